@@ -137,6 +137,19 @@ ref<EvalState> EvalCommand::getEvalState()
     return ref<EvalState>(evalState);
 }
 
+std::function<ref<EvalState>()> EvalCommand::getEvalStateFactory()
+{
+    /* Open the stores now, since getEvalStore() and getStore() are
+       not thread-safe. */
+    auto evalStore = getEvalStore();
+    auto store = getStore();
+    return [this, evalStore, store]() {
+        auto state = make_ref<EvalState>(lookupPath, evalStore, fetchSettings, evalSettings, store);
+        state->repair = repair;
+        return state;
+    };
+}
+
 MixOperateOnOptions::MixOperateOnOptions()
 {
     addFlag({
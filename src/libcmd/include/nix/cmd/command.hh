@@ -102,6 +102,14 @@ struct EvalCommand : virtual StoreCommand, MixEvalArgs
 
     ref<EvalState> getEvalState();
 
+    /**
+     * Return a function that creates fresh evaluators configured like
+     * the one returned by `getEvalState()`. This is meant for worker
+     * threads (see `parallelEval()`), so it can be called from any
+     * thread.
+     */
+    std::function<ref<EvalState>()> getEvalStateFactory();
+
 private:
     std::shared_ptr<Store> evalStore;
 
@@ -82,8 +82,17 @@ static inline FlakeRef defaultNixpkgsFlakeRef()
     return FlakeRef::fromAttrs(fetchSettings, {{"type","indirect"}, {"id", "nixpkgs"}});
 }
 
+/**
+ * Open the evaluation cache for the outputs of `lockedFlake`.
+ *
+ * @param useEvalCache If false, never use the on-disk cache, even if
+ * `eval-cache` is enabled. This is needed for evaluators running on
+ * worker threads, which must not contend for the database with the main
+ * evaluator.
+ */
 ref<eval_cache::EvalCache> openEvalCache(
     EvalState & state,
-    std::shared_ptr<flake::LockedFlake> lockedFlake);
+    std::shared_ptr<flake::LockedFlake> lockedFlake,
+    bool useEvalCache = true);
 
 }
@@ -445,9 +445,10 @@ static StorePath getDeriver(
 
 ref<eval_cache::EvalCache> openEvalCache(
     EvalState & state,
-    std::shared_ptr<flake::LockedFlake> lockedFlake)
+    std::shared_ptr<flake::LockedFlake> lockedFlake,
+    bool useEvalCache)
 {
-    auto fingerprint = evalSettings.useEvalCache && evalSettings.pureEval
+    auto fingerprint = useEvalCache && evalSettings.useEvalCache && evalSettings.pureEval
         ? lockedFlake->getFingerprint(state.store, state.fetchSettings)
         : std::nullopt;
     auto rootLoader = [&state, lockedFlake]()
@@ -0,0 +1,58 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+struct AttrSetBench
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state;
+
+    AttrSetBench()
+        : state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr)
+    { }
+
+    Expr * parse(std::string_view s)
+    {
+        return state.parseExprFromString(std::string(s), state.rootPath(CanonPath::root));
+    }
+};
+
+/**
+ * Apply a chain of overlays, each adding or overriding a few attributes
+ * of a large set, like Nixpkgs overlays and `callPackage` overrides do,
+ * and then look up every attribute of the result.
+ */
+static void BM_OpUpdateChain(benchmark::State & bstate)
+{
+    AttrSetBench bench;
+
+    auto size = bstate.range(0);
+    auto depth = bstate.range(1);
+
+    auto e = bench.parse(fmt(R"(
+        let
+          base = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) %d);
+          overlay = acc: i: acc // { "a${toString (i * 7)}" = -i; "new${toString i}" = i; };
+          result = builtins.foldl' overlay base (builtins.genList (i: i) %d);
+        in builtins.foldl' (sum: name: sum + result.${name}) 0 (builtins.attrNames result)
+    )", size, depth));
+
+    for (auto _ : bstate) {
+        Value v;
+        bench.state.eval(e, v);
+        bench.state.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v.integer());
+    }
+
+}
+
+BENCHMARK(BM_OpUpdateChain)
+    ->ArgsProduct({{1000, 20000}, {1, 10, 100}})
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,244 @@
+#include <gtest/gtest.h>
+
+#include "nix/expr/attr-set.hh"
+#include "nix/expr/tests/libexpr.hh"
+
+namespace nix {
+
+class BindingsTest : public LibExprTest
+{
+protected:
+    std::vector<Symbol> makeSymbols(size_t n)
+    {
+        std::vector<Symbol> res;
+        for (size_t i = 0; i < n; ++i)
+            res.push_back(state.symbols.create(fmt("attr%d", i)));
+        return res;
+    }
+};
+
+TEST_F(BindingsTest, smallSetsAreNotIndexed)
+{
+    ASSERT_EQ(Bindings::indexBitsFor(0), 0u);
+    ASSERT_EQ(Bindings::indexBitsFor(Bindings::minIndexedSize - 1), 0u);
+    ASSERT_GT(Bindings::indexBitsFor(Bindings::minIndexedSize), 0u);
+}
+
+TEST_F(BindingsTest, indexLoadFactor)
+{
+    for (Bindings::size_t n = Bindings::minIndexedSize; n < 100000; n += 997) {
+        auto slots = (uint64_t) 1 << Bindings::indexBitsFor(n);
+        ASSERT_LE(n * 3, slots * 2);
+        ASSERT_GT(n * 3, slots / 2);
+    }
+}
+
+TEST_F(BindingsTest, indexedLookup)
+{
+    auto symbols = makeSymbols(1000);
+    auto absent = state.symbols.create("absent");
+
+    /* Only use every other symbol, so that some lookups miss. */
+    auto builder = state.buildBindings(symbols.size() / 2);
+    for (size_t i = 0; i < symbols.size(); i += 2)
+        builder.alloc(symbols[i]).mkInt(i);
+    auto bindings = builder.finish();
+
+    auto hits = Bindings::nrIndexedHits.load();
+    auto misses = Bindings::nrIndexedMisses.load();
+
+    for (size_t i = 0; i < symbols.size(); ++i) {
+        auto a = bindings->get(symbols[i]);
+        if (i % 2) {
+            ASSERT_EQ(a, nullptr);
+            ASSERT_EQ(bindings->find(symbols[i]), bindings->end());
+        } else {
+            ASSERT_NE(a, nullptr);
+            ASSERT_EQ(a->name, symbols[i]);
+            ASSERT_EQ(a->value->integer().value, (NixInt::Inner) i);
+            ASSERT_EQ(bindings->find(symbols[i]), a);
+        }
+    }
+    ASSERT_EQ(bindings->get(absent), nullptr);
+
+    ASSERT_EQ(Bindings::nrIndexedHits - hits, 2 * symbols.size() / 2);
+    ASSERT_EQ(Bindings::nrIndexedMisses - misses, 2 * symbols.size() / 2 + 1);
+}
+
+/**
+ * Modifying a set after a lookup must invalidate its index.
+ */
+TEST_F(BindingsTest, indexIsRebuiltAfterModification)
+{
+    auto symbols = makeSymbols(200);
+
+    auto builder = state.buildBindings(symbols.size());
+    for (size_t i = 0; i < symbols.size() - 1; ++i)
+        builder.alloc(symbols[i]).mkInt(i);
+    auto bindings = builder.alreadySorted();
+    bindings->sort();
+
+    ASSERT_EQ(bindings->get(symbols.back()), nullptr);
+
+    builder.alloc(symbols.back()).mkInt(symbols.size() - 1);
+    bindings = builder.finish();
+
+    for (auto & name : symbols)
+        ASSERT_NE(bindings->get(name), nullptr);
+}
+
+TEST_F(BindingsTest, largeSetFromNix)
+{
+    auto v = eval(R"(
+        let
+          set = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 5000);
+        in builtins.foldl' (acc: i: acc + set."a${toString i}") 0 (builtins.genList (i: i) 5000)
+    )");
+    ASSERT_EQ(v.integer().value, 5000 * 4999 / 2);
+}
+
+/**
+ * A small `//` on top of a large set is represented as a layer, which
+ * must behave like the flat result.
+ */
+TEST_F(BindingsTest, layeredUpdate)
+{
+    auto v = eval(R"(
+        let base = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 100);
+        in base // { a5 = -5; a50 = -50; b = 1; }
+    )");
+    auto & bindings = *v.attrs();
+    ASSERT_EQ(bindings.nrLayers(), 2u);
+    ASSERT_EQ(bindings.size(), 101u);
+
+    ASSERT_EQ(bindings.get(createSymbol("a5"))->value->integer().value, -5);
+    ASSERT_EQ(bindings.get(createSymbol("a6"))->value->integer().value, 6);
+    ASSERT_EQ(bindings.get(createSymbol("b"))->value->integer().value, 1);
+    ASSERT_EQ(bindings.get(createSymbol("c")), nullptr);
+
+    /* Iteration yields each name once, in symbol order, with the value
+       of the highest layer. */
+    std::vector<Symbol> names;
+    for (auto & a : bindings) {
+        if (!names.empty())
+            ASSERT_LT(names.back(), a.name);
+        names.push_back(a.name);
+        if (a.name == createSymbol("a50"))
+            ASSERT_EQ(a.value->integer().value, -50);
+    }
+    ASSERT_EQ(names.size(), bindings.size());
+
+    /* An iterator returned by find() can be advanced. */
+    auto i = bindings.find(createSymbol("a5"));
+    ASSERT_EQ(i->value->integer().value, -5);
+    auto pos = std::find(names.begin(), names.end(), createSymbol("a5"));
+    for (++pos, ++i; pos != names.end(); ++pos, ++i)
+        ASSERT_EQ(i->name, *pos);
+    ASSERT_EQ(i, bindings.end());
+}
+
+TEST_F(BindingsTest, layeredUpdateIsTransparent)
+{
+    auto v = eval(R"(
+        let
+          base = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 100);
+          layered = base // { a5 = -5; b = 1; };
+          flat = builtins.listToAttrs (builtins.attrValues (builtins.mapAttrs (name: value: { inherit name value; }) layered));
+        in [
+          (layered == flat)
+          (builtins.attrNames layered == builtins.attrNames flat)
+          (builtins.attrValues layered == builtins.attrValues flat)
+          (builtins.length (builtins.attrNames layered))
+          (builtins.removeAttrs layered [ "a5" "a6" ] == builtins.removeAttrs flat [ "a5" "a6" ])
+          (builtins.intersectAttrs { a5 = null; b = null; } layered)
+        ]
+    )");
+    ASSERT_EQ(v.listSize(), 6u);
+    for (size_t n : {0, 1, 2, 4}) {
+        state.forceValue(*v.listElems()[n], noPos);
+        ASSERT_TRUE(v.listElems()[n]->boolean()) << n;
+    }
+    state.forceValue(*v.listElems()[3], noPos);
+    ASSERT_EQ(v.listElems()[3]->integer().value, 101);
+    state.forceValue(*v.listElems()[5], noPos);
+    ASSERT_EQ(v.listElems()[5]->attrs()->size(), 2u);
+}
+
+/**
+ * Long chains of `//` are flattened before they exceed `maxLayers`.
+ */
+TEST_F(BindingsTest, layerChainsAreBounded)
+{
+    auto v = eval(R"(
+        let base = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 1000);
+        in builtins.foldl' (acc: i: acc // { "b${toString i}" = i; }) base (builtins.genList (i: i) 50)
+    )");
+    auto & bindings = *v.attrs();
+    ASSERT_LE(bindings.nrLayers(), Bindings::maxLayers);
+    ASSERT_EQ(bindings.size(), 1050u);
+    size_t n = 0;
+    for (auto & a : bindings) {
+        (void) a;
+        n++;
+    }
+    ASSERT_EQ(n, 1050u);
+    ASSERT_EQ(bindings.get(createSymbol("b0"))->value->integer().value, 0);
+    ASSERT_EQ(bindings.get(createSymbol("b49"))->value->integer().value, 49);
+}
+
+/**
+ * Sets built by the same code share a lookup cache entry, and a cache
+ * entry never yields a wrong attribute for a set of another shape.
+ */
+TEST_F(BindingsTest, lookupCache)
+{
+    auto symbols = makeSymbols(8);
+
+    auto makeSet = [&](size_t first, NixInt::Inner offset) {
+        auto builder = state.buildBindings(symbols.size());
+        for (size_t i = first; i < symbols.size(); ++i)
+            builder.alloc(symbols[i]).mkInt(offset + i);
+        return builder.finish();
+    };
+
+    AttrLookupCache cache;
+    auto hits = Bindings::nrLookupCacheHits.load();
+
+    auto a = makeSet(0, 0);
+    auto b = makeSet(0, 100);
+    ASSERT_EQ(a->get(symbols[5], cache)->value->integer().value, 5);
+    ASSERT_EQ(b->get(symbols[5], cache)->value->integer().value, 105);
+    ASSERT_EQ(Bindings::nrLookupCacheHits, hits + 1);
+
+    /* In a set of another shape, the cached position holds another
+       attribute or doesn't exist. */
+    auto c = makeSet(3, 200);
+    ASSERT_EQ(c->get(symbols[5], cache)->value->integer().value, 205);
+    ASSERT_EQ(c->get(symbols[1], cache), nullptr);
+    auto d = makeSet(7, 300);
+    ASSERT_EQ(d->get(symbols[5], cache), nullptr);
+
+    /* Both shapes are now cached. */
+    hits = Bindings::nrLookupCacheHits.load();
+    ASSERT_EQ(a->get(symbols[5], cache)->value->integer().value, 5);
+    ASSERT_EQ(c->get(symbols[5], cache)->value->integer().value, 205);
+    ASSERT_EQ(Bindings::nrLookupCacheHits, hits + 2);
+}
+
+TEST_F(BindingsTest, lookupCacheInSelect)
+{
+    auto v = eval(R"(
+        let
+          mk = i: { inherit i; a = i; b.c = i * 2; };
+          base = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 100);
+          sets = builtins.genList mk 10 ++ [ { b.c = -1; } (base // { b.c = -2; }) (base // { a = 7; b = base; }) ];
+        in map (s: s.b.c or s.a) sets
+    )");
+    state.forceValueDeep(v);
+    std::vector<NixInt::Inner> expected{0, 2, 4, 6, 8, 10, 12, 14, 16, 18, -1, -2, 7};
+    ASSERT_EQ(v.listSize(), expected.size());
+    for (auto [n, elem] : enumerate(v.listItems()))
+        ASSERT_EQ(elem->integer().value, expected[n]) << n;
+}
+
+} // namespace nix
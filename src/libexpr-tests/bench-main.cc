@@ -0,0 +1,17 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval-gc.hh"
+#include "nix/store/globals.hh"
+
+int main(int argc, char ** argv)
+{
+    nix::initLibStore(false);
+    nix::initGC();
+
+    ::benchmark::Initialize(&argc, argv);
+    if (::benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    ::benchmark::RunSpecifiedBenchmarks();
+    ::benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "nix/expr/eval-arena.hh"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+namespace nix {
+
+TEST(EvalArena, zeroedAndAligned)
+{
+    EvalArena arena;
+    for (size_t n = 1; n < 100; n++) {
+        auto p = (char *) arena.alloc(EvalArena::scValue, n);
+        ASSERT_EQ((uintptr_t) p % EvalArena::alignment, 0u);
+        for (size_t i = 0; i < n; i++)
+            ASSERT_EQ(p[i], 0);
+        memset(p, 0xff, n);
+    }
+}
+
+TEST(EvalArena, sizeClassesAreSeparate)
+{
+    EvalArena arena;
+    auto v1 = (char *) arena.alloc(EvalArena::scValue, 24);
+    arena.alloc(EvalArena::scEnv, 16);
+    auto v2 = (char *) arena.alloc(EvalArena::scValue, 24);
+    ASSERT_EQ(v1 + 24, v2);
+
+    ASSERT_EQ(arena.stats(EvalArena::scValue).nrObjects, 2u);
+    ASSERT_EQ(arena.stats(EvalArena::scValue).bytesUsed, 48u);
+    ASSERT_EQ(arena.stats(EvalArena::scEnv).nrObjects, 1u);
+    ASSERT_EQ(arena.stats(EvalArena::scBindings).nrObjects, 0u);
+    ASSERT_EQ(arena.totals().nrChunks, 2u);
+}
+
+TEST(EvalArena, growsAcrossChunks)
+{
+    EvalArena arena;
+    size_t total = 0;
+    while (total < 4 * EvalArena::maxChunkSize) {
+        auto p = (char *) arena.alloc(EvalArena::scValue, 24);
+        ASSERT_EQ(p[0], 0);
+        p[0] = 1;
+        total += 24;
+    }
+    auto & stats = arena.stats(EvalArena::scValue);
+    ASSERT_GT(stats.nrChunks, 1u);
+    ASSERT_EQ(stats.bytesUsed, total);
+    ASSERT_GE(stats.bytesReserved, stats.bytesUsed);
+}
+
+TEST(EvalArena, largeObjectsGetTheirOwnChunk)
+{
+    EvalArena arena;
+    auto small1 = (char *) arena.alloc(EvalArena::scBindings, 16);
+    auto big = (char *) arena.alloc(EvalArena::scBindings, EvalArena::maxChunkSize);
+    auto small2 = (char *) arena.alloc(EvalArena::scBindings, 16);
+    ASSERT_EQ(big[EvalArena::maxChunkSize - 1], 0);
+    /* The big allocation must not have displaced the current chunk. */
+    ASSERT_EQ(small1 + 16, small2);
+    ASSERT_EQ(arena.stats(EvalArena::scBindings).nrChunks, 2u);
+}
+
+} // namespace nix
@@ -0,0 +1,122 @@
+#include "nix/expr/eval-cache.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+using namespace nix::eval_cache;
+
+/**
+ * An attribute tree with roughly the shape of Nixpkgs: 20000 top-level
+ * packages, plus a nested package set with another 5000, each with a
+ * few string attributes and a `meta` set.
+ */
+static const char * nixpkgsLike = R"(
+    let
+      pkg = i: {
+        pname = "pkg-${toString i}";
+        version = "1.${toString i}";
+        meta = {
+          description = "Package number ${toString i}";
+          broken = false;
+        };
+      };
+      pkgs = n: builtins.listToAttrs (builtins.genList (i: { name = "pkg${toString i}"; value = pkg i; }) n);
+    in pkgs 20000 // { python3Packages = pkgs 5000; }
+)";
+
+struct EvalCacheBench
+{
+    std::filesystem::path cacheDir = createTempDir();
+    AutoDelete delCacheDir{cacheDir, true};
+
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state;
+
+    uint64_t nrCaches = 0;
+
+    EvalCacheBench(bool compact)
+        : state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr)
+    {
+        setEnv("NIX_CACHE_HOME", cacheDir.c_str());
+        evalSettings.compactEvalCache = compact;
+    }
+
+    Value * load()
+    {
+        auto v = state.allocValue();
+        state.eval(state.parseExprFromString(nixpkgsLike, state.rootPath(CanonPath::root)), *v);
+        return v;
+    }
+
+    /**
+     * Visit every package like `nix search` does, and return the
+     * number of packages.
+     */
+    static size_t walk(AttrCursor & cursor)
+    {
+        size_t n = 0;
+        for (auto & name : cursor.getAttrs()) {
+            auto child = cursor.getAttr(name);
+            if (auto pname = child->maybeGetAttr("pname")) {
+                benchmark::DoNotOptimize(pname->getString());
+                benchmark::DoNotOptimize(child->getAttr("version")->getString());
+                benchmark::DoNotOptimize(child->getAttr("meta")->getAttr("description")->getString());
+                n++;
+            } else
+                n += walk(*child);
+        }
+        return n;
+    }
+
+    /**
+     * Fill a new cache by evaluating the tree, and return its
+     * fingerprint.
+     */
+    Hash populate()
+    {
+        auto fingerprint = hashString(HashAlgorithm::SHA256, fmt("eval-cache-bench-%d", nrCaches++));
+        auto cache = make_ref<EvalCache>(std::cref(fingerprint), state, [&]() { return load(); });
+        walk(*cache->getRoot());
+        return fingerprint;
+    }
+};
+
+/**
+ * Evaluate the tree and write it to a new cache.
+ */
+static void BM_EvalCacheCold(benchmark::State & bstate)
+{
+    EvalCacheBench bench(bstate.range(0));
+    bstate.SetLabel(bstate.range(0) ? "compact" : "sqlite");
+
+    for (auto _ : bstate)
+        bench.populate();
+}
+
+/**
+ * Read the whole tree back from a populated cache.
+ */
+static void BM_EvalCacheWarm(benchmark::State & bstate)
+{
+    EvalCacheBench bench(bstate.range(0));
+    bstate.SetLabel(bstate.range(0) ? "compact" : "sqlite");
+
+    auto fingerprint = bench.populate();
+
+    for (auto _ : bstate) {
+        auto cache = make_ref<EvalCache>(std::cref(fingerprint), bench.state, []() -> Value * {
+            throw Error("the evaluation cache should not need to evaluate anything");
+        });
+        bstate.counters["packages"] = EvalCacheBench::walk(*cache->getRoot());
+    }
+}
+
+BENCHMARK(BM_EvalCacheCold)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_EvalCacheWarm)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,129 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "nix/expr/eval-cache.hh"
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+using namespace eval_cache;
+
+/**
+ * Runs every test with both the SQLite and the compact backend.
+ */
+class EvalCacheTest : public LibExprTest, public ::testing::WithParamInterface<bool>
+{
+protected:
+    std::filesystem::path cacheDir;
+    std::unique_ptr<AutoDelete> delCacheDir;
+    std::optional<std::string> oldCacheHome;
+
+    Hash fingerprint = hashString(HashAlgorithm::SHA256, "eval-cache-test");
+
+    void SetUp() override
+    {
+        cacheDir = createTempDir();
+        delCacheDir = std::make_unique<AutoDelete>(cacheDir, true);
+        oldCacheHome = getEnv("NIX_CACHE_HOME");
+        setEnv("NIX_CACHE_HOME", cacheDir.c_str());
+        evalSettings.compactEvalCache = GetParam();
+    }
+
+    void TearDown() override
+    {
+        if (oldCacheHome)
+            setEnv("NIX_CACHE_HOME", oldCacheHome->c_str());
+        else
+            unsetenv("NIX_CACHE_HOME");
+    }
+
+    ref<EvalCache> makeCache(std::function<Value *()> rootLoader)
+    {
+        return make_ref<EvalCache>(std::cref(fingerprint), state, rootLoader);
+    }
+
+    std::function<Value *()> loader(std::string expr)
+    {
+        return [this, expr]() {
+            auto v = state.allocValue();
+            *v = eval(expr);
+            return v;
+        };
+    }
+
+    /**
+     * A root loader for caches that must answer everything from disk.
+     */
+    std::function<Value *()> noLoader()
+    {
+        return []() -> Value * {
+            ADD_FAILURE() << "evaluation cache unexpectedly evaluated the root";
+            throw Error("not cached");
+        };
+    }
+};
+
+TEST_P(EvalCacheTest, cachesValues)
+{
+    auto expr = R"({
+        s = "foo";
+        b = true;
+        i = 42;
+        l = [ "x" "y" ];
+        nested = { t = "bar"; };
+    })";
+
+    {
+        auto root = makeCache(loader(expr))->getRoot();
+        ASSERT_EQ(root->getAttrs().size(), 5);
+        ASSERT_EQ(root->getAttr("s")->getString(), "foo");
+        ASSERT_EQ(root->getAttr("b")->getBool(), true);
+        ASSERT_EQ(root->getAttr("i")->getInt(), NixInt{42});
+        ASSERT_EQ(root->getAttr("l")->getListOfStrings(), (std::vector<std::string>{"x", "y"}));
+        ASSERT_EQ(root->getAttr("nested")->getAttr("t")->getString(), "bar");
+        ASSERT_EQ(root->maybeGetAttr("missing"), nullptr);
+    }
+
+    {
+        auto root = makeCache(noLoader())->getRoot();
+        ASSERT_EQ(root->getAttrs().size(), 5);
+        ASSERT_EQ(root->getAttr("s")->getString(), "foo");
+        ASSERT_EQ(root->getAttr("b")->getBool(), true);
+        ASSERT_EQ(root->getAttr("i")->getInt(), NixInt{42});
+        ASSERT_EQ(root->getAttr("l")->getListOfStrings(), (std::vector<std::string>{"x", "y"}));
+        ASSERT_EQ(root->getAttr("nested")->getAttr("t")->getString(), "bar");
+        ASSERT_EQ(root->maybeGetAttr("missing"), nullptr);
+    }
+}
+
+TEST_P(EvalCacheTest, extendsExistingCache)
+{
+    auto expr = R"({ a = "1"; b = "2"; })";
+
+    {
+        auto root = makeCache(loader(expr))->getRoot();
+        ASSERT_EQ(root->getAttr("a")->getString(), "1");
+    }
+
+    {
+        /* "b" was never evaluated, so this needs the root. */
+        auto root = makeCache(loader(expr))->getRoot();
+        ASSERT_EQ(root->getAttr("b")->getString(), "2");
+    }
+
+    {
+        auto root = makeCache(noLoader())->getRoot();
+        ASSERT_EQ(root->getAttr("a")->getString(), "1");
+        ASSERT_EQ(root->getAttr("b")->getString(), "2");
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    EvalCache,
+    EvalCacheTest,
+    ::testing::Values(false, true),
+    [](const ::testing::TestParamInfo<bool> & info) { return info.param ? "compact" : "sqlite"; });
+
+} // namespace nix
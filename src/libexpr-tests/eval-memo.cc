@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include "nix/expr/eval-memo.hh"
+#include "nix/expr/tests/libexpr.hh"
+
+namespace nix {
+
+class EvalMemoTest : public LibExprTest
+{
+protected:
+    EvalMemoTest()
+    {
+        state.memoCache = std::make_unique<EvalMemoCache>(1000);
+    }
+
+    Value evalDeep(std::string input)
+    {
+        auto v = eval(input);
+        state.forceValueDeep(v);
+        return v;
+    }
+};
+
+TEST_F(EvalMemoTest, sameArgument)
+{
+    auto v = evalDeep("let f = x: x + 1; in builtins.genList (i: f 5) 10");
+    ASSERT_EQ(v.listSize(), 10u);
+    for (auto elem : v.listItems())
+        ASSERT_EQ(elem->integer().value, 6);
+    ASSERT_GE(state.memoCache->stats.hits, 9u);
+}
+
+TEST_F(EvalMemoTest, equalAttrSets)
+{
+    /* Every call gets a fresh set, but with the same attribute values. */
+    auto v = evalDeep("let f = { a, b }: a + b; x = 1; in builtins.genList (i: f { a = x; b = x; }) 10");
+    for (auto elem : v.listItems())
+        ASSERT_EQ(elem->integer().value, 2);
+    ASSERT_GE(state.memoCache->stats.hits, 9u);
+}
+
+TEST_F(EvalMemoTest, differentArguments)
+{
+    auto v = evalDeep(R"(
+        let
+          f = { a, b ? 0 }: a * 10 + b;
+          g = x: builtins.typeOf x;
+        in builtins.genList (i: f { a = i; }) 5 ++ [ (f { a = 1; b = 1; }) (g 1) (g "1") (g 1.0) ]
+    )");
+    ASSERT_EQ(v.listSize(), 9u);
+    std::vector<NixInt::Inner> expected{0, 10, 20, 30, 40, 11};
+    for (auto [n, i] : enumerate(expected))
+        ASSERT_EQ(v.listElems()[n]->integer().value, i) << n;
+    ASSERT_EQ(v.listElems()[6]->string_view(), "int");
+    ASSERT_EQ(v.listElems()[7]->string_view(), "string");
+    ASSERT_EQ(v.listElems()[8]->string_view(), "float");
+}
+
+TEST_F(EvalMemoTest, errorsAreNotCached)
+{
+    ASSERT_THROW(eval("let f = x: if x then throw \"no\" else 1; in [ (f false) (f true) ]"), ThrownError);
+    auto v = eval(R"(
+        let f = x: throw "no";
+        in [ (builtins.tryEval (f 1)).success (builtins.tryEval (f 1)).success ]
+    )");
+    state.forceValueDeep(v);
+    ASSERT_FALSE(v.listElems()[0]->boolean());
+    ASSERT_FALSE(v.listElems()[1]->boolean());
+}
+
+TEST_F(EvalMemoTest, attrNames)
+{
+    auto v = evalDeep(R"(
+        let set = builtins.listToAttrs (builtins.genList (i: { name = "a${toString i}"; value = i; }) 100);
+        in [ (builtins.attrNames set) (builtins.attrNames set) (builtins.attrValues set) ]
+    )");
+    ASSERT_EQ(v.listElems()[0]->listElems(), v.listElems()[1]->listElems());
+    ASSERT_EQ(v.listElems()[2]->listSize(), 100u);
+}
+
+TEST_F(EvalMemoTest, keyOwnsArgument)
+{
+    auto & lambda = dynamic_cast<ExprLambda &>(*state.parseExprFromString("x: x", state.rootPath(CanonPath::root)));
+    EvalMemoCache cache(10);
+
+    /* The storage of the argument gets reused after the call. */
+    Value arg, res, one;
+    arg.mkInt(1);
+    res.mkInt(1);
+    cache.insert(EvalMemoCache::lambdaKey(lambda, nullptr, arg), res);
+    arg.mkInt(3);
+
+    one.mkInt(1);
+    ASSERT_NE(cache.lookup(EvalMemoCache::lambdaKey(lambda, nullptr, one)), nullptr);
+    ASSERT_EQ(cache.lookup(EvalMemoCache::lambdaKey(lambda, nullptr, arg)), nullptr);
+}
+
+TEST_F(EvalMemoTest, bounded)
+{
+    state.memoCache = std::make_unique<EvalMemoCache>(4);
+    auto v = evalDeep("let f = x: x * 2; in builtins.genList (i: f i) 10");
+    for (auto [n, elem] : enumerate(v.listItems()))
+        ASSERT_EQ(elem->integer().value, (NixInt::Inner) n * 2);
+    ASSERT_LE(state.memoCache->size(), 4u);
+    ASSERT_GT(state.memoCache->stats.flushes, 0u);
+}
+
+} // namespace nix
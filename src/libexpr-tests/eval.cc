@@ -161,4 +161,43 @@ TEST_F(EvalStateTest, getBuiltin_fail) {
     ASSERT_THROW(state.getBuiltin("nonexistent"), EvalError);
 }
 
+TEST_F(EvalStateTest, concatStringsRope) {
+    // Large concatenations become ropes, which must behave like flat
+    // strings and keep the context of their parts.
+    NixStringContext context{NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo")}};
+    Value s;
+    s.mkString("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo", context);
+
+    auto f = eval("s: builtins.foldl' (acc: i: acc + \"${s}/bin/${toString i}\\n\") \"\" (builtins.genList (i: i) 1000)");
+    Value v;
+    state.callFunction(f, s, v, noPos);
+    state.forceValue(v, noPos);
+    ASSERT_THAT(v, IsString());
+    ASSERT_NE(v.stringRope(), nullptr);
+
+    NixStringContext vContext;
+    copyContext(v, vContext);
+    ASSERT_EQ(vContext, context);
+
+    ASSERT_TRUE(v.string_view().starts_with("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo/bin/0\n"));
+    ASSERT_TRUE(v.string_view().ends_with("-foo/bin/999\n"));
+}
+
+TEST_F(EvalStateTest, concatStringsRopeEquality) {
+    auto v = eval(R"(
+        let
+          lines = builtins.genList (i: "line ${toString i}\n") 10000;
+          folded = builtins.foldl' (acc: l: acc + l) "" lines;
+          joined = builtins.concatStringsSep "" lines;
+        in [ (builtins.stringLength folded) (folded == joined) (builtins.substring 0 14 (folded + joined)) ]
+    )");
+    ASSERT_THAT(v, IsListOfSize(3));
+    state.forceValue(*v.listElems()[0], noPos);
+    ASSERT_THAT(*v.listElems()[0], IsIntEq(98890));
+    state.forceValue(*v.listElems()[1], noPos);
+    ASSERT_THAT(*v.listElems()[1], IsTrue());
+    state.forceValue(*v.listElems()[2], noPos);
+    ASSERT_THAT(*v.listElems()[2], IsStringEq("line 0\nline 1\n"));
+}
+
 } // namespace nix
@@ -0,0 +1,98 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/json-to-value.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/resource.h>
+
+using namespace nix;
+
+/**
+ * A `flake.lock`-like document with `n` inputs.
+ */
+static std::string lockFile(size_t n)
+{
+    std::string s = R"({"nodes":{)";
+    for (size_t i = 0; i < n; ++i) {
+        s += fmt(R"("input-%1%":{"inputs":{"nixpkgs":"nixpkgs","systems":"systems_%1%"},)"
+                 R"("locked":{"lastModified":%2%,"narHash":"sha256-%3%=","owner":"owner-%1%",)"
+                 R"("repo":"repo-%1%","rev":"%4%","type":"github"},)"
+                 R"("original":{"owner":"owner-%1%","repo":"repo-%1%","type":"github"}},)",
+            i, 1700000000 + i, std::string(43, 'A' + i % 26), std::string(40, 'a' + i % 6));
+    }
+    s += R"("root":{"inputs":{}}},"root":"root","version":7})";
+    return s;
+}
+
+/**
+ * An SPDX-like software bill of materials with `n` packages, with some
+ * escapes and non-ASCII text in it.
+ */
+static std::string sbom(size_t n)
+{
+    std::string s = R"({"spdxVersion":"SPDX-2.3","packages":[)";
+    for (size_t i = 0; i < n; ++i) {
+        if (i)
+            s += ',';
+        s += fmt(R"({"SPDXID":"SPDXRef-package-%1%","name":"package-%1%","versionInfo":"%2%.%3%.%4%",)"
+                 R"("downloadLocation":"https://example.org/src/package-%1%.tar.gz",)"
+                 R"("description":"A package\nwith a \"quoted\" description é ☃ %1%",)"
+                 R"("checksums":[{"algorithm":"SHA256","checksumValue":"%5%"}],)"
+                 R"("licenseConcluded":"MIT","filesAnalyzed":false,"size":%6%,"score":%7%})",
+            i, i % 10, i % 7, i % 3, std::string(64, 'f'), i * 1024, 0.5 + i % 100);
+    }
+    s += "]}";
+    return s;
+}
+
+static long maxRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss * 1024;
+}
+
+/**
+ * Parse `json` into a fresh value on every iteration, and report the
+ * throughput, the bytes allocated by the evaluator per document and the
+ * peak resident set size of the process.
+ */
+static void parse(benchmark::State & bstate, const std::string & json)
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr);
+
+    EvalState::CountHeapBytes countHeapBytes;
+    auto bytesBefore = state.arena.totals().bytesUsed + EvalState::nrHeapBytes;
+
+    for (auto _ : bstate) {
+        Value v;
+        parseJSON(state, json, v);
+        benchmark::DoNotOptimize(v);
+    }
+
+    auto bytesAfter = state.arena.totals().bytesUsed + EvalState::nrHeapBytes;
+
+    bstate.SetBytesProcessed(bstate.iterations() * json.size());
+    bstate.counters["allocatedPerDoc"] = (double) (bytesAfter - bytesBefore) / bstate.iterations();
+    bstate.counters["documentSize"] = json.size();
+    bstate.counters["maxRSS"] = maxRSS();
+}
+
+static void BM_FromJSONLockFile(benchmark::State & bstate)
+{
+    parse(bstate, lockFile(bstate.range(0)));
+}
+
+static void BM_FromJSONSBOM(benchmark::State & bstate)
+{
+    parse(bstate, sbom(bstate.range(0)));
+}
+
+BENCHMARK(BM_FromJSONLockFile)->Arg(100)->Arg(10000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FromJSONSBOM)->Arg(100)->Arg(100000)->Unit(benchmark::kMillisecond);
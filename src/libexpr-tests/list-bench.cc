@@ -0,0 +1,65 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+/**
+ * Evaluate `expr`, which must return an integer, on every iteration,
+ * and report the bytes of list storage and strings allocated per
+ * iteration.
+ */
+static void run(benchmark::State & bstate, const std::string & expr)
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr);
+
+    auto e = state.parseExprFromString(expr, state.rootPath(CanonPath::root));
+
+    EvalState::CountHeapBytes countHeapBytes;
+    auto bytesBefore = EvalState::nrHeapBytes;
+
+    for (auto _ : bstate) {
+        Value v;
+        state.eval(e, v);
+        state.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v.integer());
+    }
+
+    bstate.counters["heapBytes"] = benchmark::Counter(EvalState::nrHeapBytes - bytesBefore, benchmark::Counter::kAvgIterations);
+}
+
+/**
+ * Sum a list of `n` integers by recursing over it with `head` and
+ * `tail`, as `foldr`-style code in nixpkgs does.
+ */
+static void BM_TailRecursion(benchmark::State & bstate)
+{
+    run(bstate, fmt(R"(
+        let
+          sum = acc: xs: if xs == [ ] then acc else sum (acc + builtins.head xs) (builtins.tail xs);
+        in sum 0 (builtins.genList (i: i) %d)
+    )", bstate.range(0)));
+}
+
+/**
+ * Drop the first and last elements of a list of `n` integers with
+ * `filter`, and count what remains after a `map`.
+ */
+static void BM_FilterMap(benchmark::State & bstate)
+{
+    run(bstate, fmt(R"(
+        let
+          n = %d;
+          xs = builtins.genList (i: i) n;
+        in builtins.length (map (x: x * 2) (builtins.filter (x: x > 0 && x < n - 1) xs))
+    )", bstate.range(0)));
+}
+
+BENCHMARK(BM_TailRecursion)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FilterMap)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
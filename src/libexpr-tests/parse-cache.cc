@@ -0,0 +1,161 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "nix/expr/parse-cache.hh"
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+class ParseCacheTest : public LibExprTest
+{
+protected:
+    AutoDelete tmpDir{createTempDir()};
+    std::shared_ptr<ParseCache> cache = std::make_shared<ParseCache>(tmpDir.path() / "cache");
+
+    ParseCacheTest()
+    {
+        state.parseCache = cache;
+    }
+
+    SourcePath writeNixFile(std::string_view contents)
+    {
+        auto path = tmpDir.path() / "default.nix";
+        writeFile(path, contents);
+        return state.rootPath(CanonPath(path.string()));
+    }
+
+    std::string show(Expr * e)
+    {
+        std::ostringstream str;
+        e->show(state.symbols, str);
+        return str.str();
+    }
+};
+
+static constexpr std::string_view testExpr = R"(
+    let
+      x = rec { inherit y; inherit (z) a b; c = a + 1; "${"d"}" = c; };
+      y = 1.5;
+      z = { a = 1; b = -2; };
+      s = ''
+        foo ${toString x.c} bar
+      '';
+    in {
+      /** Doc comment for f. */
+      f = { a, b ? 2, ... }@args: a - b;
+      g = n: if n == 0 || !(n > 1) then [ n ] ++ [ (n * 2) ] else assert n != 3; n / 2;
+      inherit s;
+      p = ./foo/bar.nix;
+      h = x ? c && x.e or true;
+      w = with z; a;
+      pos = __curPos;
+      u = x // { c = 3; } // { inherit (x) c; };
+      impl = true -> false;
+      str = "x${"y"}z";
+      v = <nixpkgs>;
+    }
+)";
+
+TEST_F(ParseCacheTest, roundTrip)
+{
+    auto path = writeNixFile(testExpr);
+
+    auto e1 = state.parseExprFromFile(path);
+    ASSERT_EQ(cache->nrMisses, 1);
+    ASSERT_EQ(cache->nrHits, 0);
+
+    auto e2 = state.parseExprFromFile(path);
+    ASSERT_EQ(cache->nrMisses, 1);
+    ASSERT_EQ(cache->nrHits, 1);
+
+    ASSERT_NE(e1, e2);
+    ASSERT_EQ(show(e1), show(e2));
+    ASSERT_EQ(state.positions[e1->getPos()], state.positions[e2->getPos()]);
+
+    auto & attrs1 = dynamic_cast<ExprLet &>(*e1);
+    auto & attrs2 = dynamic_cast<ExprLet &>(*e2);
+    auto & body1 = dynamic_cast<ExprAttrs &>(*attrs1.body);
+    auto & body2 = dynamic_cast<ExprAttrs &>(*attrs2.body);
+    for (auto & [name, def] : body1.attrs) {
+        auto & def2 = body2.attrs.at(name);
+        ASSERT_EQ(state.positions[def.pos], state.positions[def2.pos]);
+        ASSERT_EQ(state.positions[def.e->getPos()], state.positions[def2.e->getPos()]);
+    }
+
+    auto & f1 = dynamic_cast<ExprLambda &>(*body1.attrs.at(createSymbol("f")).e);
+    auto & f2 = dynamic_cast<ExprLambda &>(*body2.attrs.at(createSymbol("f")).e);
+    ASSERT_THAT(f2.docComment.getInnerText(state.positions), testing::HasSubstr("Doc comment for f."));
+    ASSERT_EQ(f1.docComment.getInnerText(state.positions), f2.docComment.getInnerText(state.positions));
+    ASSERT_EQ(state.symbols[f2.name], "f");
+
+    auto & p = dynamic_cast<ExprPath &>(*body2.attrs.at(createSymbol("p")).e);
+    ASSERT_EQ(p.s, (tmpDir.path() / "foo/bar.nix").string());
+}
+
+TEST_F(ParseCacheTest, evaluatesTheSame)
+{
+    auto path = writeNixFile("let f = { a, b ? a + 1 }: a * b; in [ (f { a = 2; }) (rec { x = 1; y = x; }).y ]");
+
+    Value v1, v2;
+    state.eval(state.parseExprFromFile(path), v1);
+    state.eval(state.parseExprFromFile(path), v2);
+    ASSERT_EQ(cache->nrHits, 1);
+
+    state.forceValueDeep(v1);
+    state.forceValueDeep(v2);
+    ASSERT_EQ(printValue(state, v1), "[ 6 1 ]");
+    ASSERT_EQ(printValue(state, v2), "[ 6 1 ]");
+}
+
+TEST_F(ParseCacheTest, changedFileMisses)
+{
+    auto path = writeNixFile("1");
+    state.parseExprFromFile(path);
+
+    writeNixFile("2");
+    auto e = state.parseExprFromFile(path);
+    ASSERT_EQ(cache->nrMisses, 2);
+    ASSERT_EQ(show(e), "2");
+}
+
+TEST_F(ParseCacheTest, ignoresCorruptEntries)
+{
+    auto path = writeNixFile("{ a = [ 1 2 3 ]; }");
+    state.parseExprFromFile(path);
+
+    for (auto & entry : std::filesystem::directory_iterator(tmpDir.path() / "cache"))
+        writeFile(entry.path(), "NIXPARSE garbage");
+
+    auto e = state.parseExprFromFile(path);
+    ASSERT_EQ(cache->nrHits, 0);
+    ASSERT_EQ(cache->nrMisses, 2);
+    ASSERT_EQ(show(e), "{ a = [ (1) (2) (3) ]; }");
+
+    /* The corrupt entry was replaced. */
+    state.parseExprFromFile(path);
+    ASSERT_EQ(cache->nrHits, 1);
+}
+
+TEST_F(ParseCacheTest, prunesUnusedEntries)
+{
+    auto path = writeNixFile("1");
+    state.parseExprFromFile(path);
+    writeNixFile("2");
+    state.parseExprFromFile(path);
+
+    std::vector<std::filesystem::path> entries;
+    for (auto & entry : std::filesystem::directory_iterator(tmpDir.path() / "cache"))
+        entries.push_back(entry.path());
+    ASSERT_EQ(entries.size(), 2);
+
+    std::filesystem::last_write_time(entries[0],
+        std::filesystem::file_time_type::clock::now() - ParseCache::maxAge - std::chrono::hours(1));
+
+    ParseCache(tmpDir.path() / "cache").prune();
+
+    ASSERT_FALSE(std::filesystem::exists(entries[0]));
+    ASSERT_TRUE(std::filesystem::exists(entries[1]));
+}
+
+} // namespace nix
@@ -0,0 +1,98 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+struct PrimOpBench
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state;
+
+    PrimOpBench()
+        : state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr)
+    { }
+
+    void run(benchmark::State & bstate, std::string_view s)
+    {
+        auto e = state.parseExprFromString(std::string(s), state.rootPath(CanonPath::root));
+        for (auto _ : bstate) {
+            Value v;
+            state.eval(e, v);
+            state.forceValue(v, noPos);
+            benchmark::DoNotOptimize(v.integer());
+        }
+    }
+};
+
+/**
+ * A dependency walk over `n` nodes with the given kind of key, where
+ * each node depends on a few others, so that most keys are seen several
+ * times, like a walk over a package closure or the NixOS module graph.
+ */
+static void genericClosure(benchmark::State & bstate, std::string_view mkKey)
+{
+    PrimOpBench bench;
+    bench.run(bstate, fmt(R"(
+        let
+          n = %d;
+          node = i: { key = %s; inherit i; };
+          deps = i: map (d: node (builtins.bitAnd (i * 7 + d * 13 + 1) (n - 1))) [ 1 2 3 4 ];
+        in builtins.length (builtins.genericClosure {
+          startSet = [ (node 0) ];
+          operator = x: deps x.i;
+        })
+    )", bstate.range(0), mkKey));
+}
+
+static void BM_GenericClosureIntKeys(benchmark::State & bstate)
+{
+    genericClosure(bstate, "i");
+}
+
+static void BM_GenericClosureStringKeys(benchmark::State & bstate)
+{
+    genericClosure(bstate, "\"/nix/store/00000000000000000000000000000000-package-${toString i}\"");
+}
+
+static void BM_GenericClosureListKeys(benchmark::State & bstate)
+{
+    genericClosure(bstate, "[ \"module\" i ]");
+}
+
+/**
+ * Call builtins `n` times, either as `builtins.<name>`, which is
+ * resolved when parsing and skips `callFunction()`, or through a
+ * variable, which isn't.
+ */
+static void primOpCalls(benchmark::State & bstate, std::string_view builtins)
+{
+    PrimOpBench bench;
+    bench.run(bstate, fmt(R"(
+        let
+          b = builtins;
+          xs = [ 1 2 3 ];
+        in builtins.foldl' (acc: i: acc + %1%.length xs + %1%.head xs) 0 (builtins.genList (i: i) %2%)
+    )", builtins, bstate.range(0)));
+}
+
+static void BM_PrimOpCallsKnown(benchmark::State & bstate)
+{
+    primOpCalls(bstate, "builtins");
+}
+
+static void BM_PrimOpCallsGeneric(benchmark::State & bstate)
+{
+    primOpCalls(bstate, "b");
+}
+
+BENCHMARK(BM_GenericClosureIntKeys)->Arg(1 << 10)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GenericClosureStringKeys)->Arg(1 << 10)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_GenericClosureListKeys)->Arg(1 << 10)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PrimOpCallsKnown)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PrimOpCallsGeneric)->Arg(1 << 17)->Unit(benchmark::kMillisecond);
@@ -1,7 +1,10 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <random>
+
 #include "nix/expr/eval-settings.hh"
+#include "nix/expr/json-to-value.hh"
 #include "nix/util/memory-source-accessor.hh"
 
 #include "nix/expr/tests/libexpr.hh"
@@ -327,6 +330,27 @@ namespace nix {
         ASSERT_THROW(eval("builtins.tail []"), Error);
     }
 
+    TEST_F(PrimOpTest, tailSharesElements) {
+        auto v = eval("let xs = [ 1 2 3 4 5 ]; in [ xs (builtins.tail (builtins.tail xs)) ]");
+        auto xs = v.listElems()[0];
+        auto ys = v.listElems()[1];
+        state.forceValue(*xs, noPos);
+        state.forceValue(*ys, noPos);
+        ASSERT_THAT(*ys, IsListOfSize(3));
+        ASSERT_EQ(ys->listElems(), xs->listElems() + 2);
+        for (const auto [n, elem] : enumerate(ys->listItems()))
+            ASSERT_THAT(*elem, IsIntEq(3 + static_cast<int>(n)));
+    }
+
+    TEST_F(PrimOpTest, tailRecursion) {
+        auto v = eval(R"(
+          let
+            sum = acc: xs: if xs == [ ] then acc else sum (acc + builtins.head xs) (builtins.tail xs);
+          in sum 0 (builtins.genList (i: i) 1000)
+        )");
+        ASSERT_THAT(v, IsIntEq(499500));
+    }
+
     TEST_F(PrimOpTest, map) {
         auto v = eval("map (x: \"foo\" + x) [ \"bar\" \"bla\" \"abc\" ]");
         ASSERT_THAT(v, IsListOfSize(3));
@@ -353,6 +377,23 @@ namespace nix {
             ASSERT_THAT(*elem, IsIntEq(2));
     }
 
+    TEST_F(PrimOpTest, filterContiguous) {
+        auto v = eval("let xs = [ 1 2 3 4 5 6 ]; in [ xs (builtins.filter (x: x > 1 && x < 6) xs) ]");
+        auto xs = v.listElems()[0];
+        auto ys = v.listElems()[1];
+        state.forceValue(*xs, noPos);
+        state.forceValue(*ys, noPos);
+        ASSERT_THAT(*ys, IsListOfSize(4));
+        ASSERT_EQ(ys->listElems(), xs->listElems() + 1);
+        for (const auto [n, elem] : enumerate(ys->listItems()))
+            ASSERT_THAT(*elem, IsIntEq(2 + static_cast<int>(n)));
+    }
+
+    TEST_F(PrimOpTest, filterNone) {
+        auto v = eval("builtins.filter (x: false) [ 1 2 3 ]");
+        ASSERT_THAT(v, IsListOfSize(0));
+    }
+
     TEST_F(PrimOpTest, elemTrue) {
         auto v = eval("builtins.elem 3 [ 1 2 3 4 5 ]");
         ASSERT_THAT(v, IsTrue());
@@ -451,6 +492,16 @@ namespace nix {
             ASSERT_THAT(*elem, IsIntEq(numbers[n]));
     }
 
+    TEST_F(PrimOpTest, concatMapSingleList) {
+        auto v = eval("let xs = [ 1 2 3 ]; in [ xs (builtins.concatMap (x: if x == 2 then xs else [ ]) [ 1 2 3 ]) ]");
+        auto xs = v.listElems()[0];
+        auto ys = v.listElems()[1];
+        state.forceValue(*xs, noPos);
+        state.forceValue(*ys, noPos);
+        ASSERT_THAT(*ys, IsListOfSize(3));
+        ASSERT_EQ(ys->listElems(), xs->listElems());
+    }
+
     TEST_F(PrimOpTest, addInt) {
         auto v = eval("builtins.add 3 5");
         ASSERT_THAT(v, IsIntEq(8));
@@ -724,11 +775,11 @@ namespace nix {
         auto v = eval(expr);
         ASSERT_THAT(v, IsAttrsOfSize(2));
 
-        auto name = v.attrs()->find(createSymbol("name"));
+        auto name = v.attrs()->get(createSymbol("name"));
         ASSERT_TRUE(name);
         ASSERT_THAT(*name->value, IsStringEq(expectedName));
 
-        auto version = v.attrs()->find(createSymbol("version"));
+        auto version = v.attrs()->get(createSymbol("version"));
         ASSERT_TRUE(version);
         ASSERT_THAT(*version->value, IsStringEq(expectedVersion));
     }
@@ -756,6 +807,22 @@ namespace nix {
         ASSERT_EQ(v.string_view(), "foo%bar%baz");
     }
 
+    TEST_F(PrimOpTest, concatStringsSepContext) {
+        // The context of the separator is kept even if it isn't used.
+        NixStringContext context{NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo")}};
+        Value sep;
+        sep.mkString("/", context);
+        for (auto list : {"[ ]", "[ \"a\" ]", "[ \"a\" \"b\" ]"}) {
+            auto f = eval(fmt("sep: builtins.concatStringsSep sep %s", list));
+            Value v;
+            state.callFunction(f, sep, v, noPos);
+            state.forceValue(v, noPos);
+            NixStringContext vContext;
+            copyContext(v, vContext);
+            ASSERT_EQ(vContext, context) << list;
+        }
+    }
+
     TEST_F(PrimOpTest, split1) {
         // v = [ "" [ "a" ] "c" ]
         auto v = eval("builtins.split \"(a)b\" \"abc\"");
@@ -826,6 +893,18 @@ namespace nix {
         ASSERT_THAT(*third, IsStringEq(" "));
     }
 
+    TEST_F(PrimOpTest, splitLongSubject) {
+        // The lazy DFA gives up on this pattern and subject, which used
+        // to make the search loop forever.
+        std::mt19937 gen(0);
+        std::string s;
+        for (size_t i = 0; i < 30000; ++i)
+            s += "ab"[gen() % 2];
+        auto v = eval("builtins.split \"(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)c\" \"" + s + "\"");
+        ASSERT_THAT(v, IsListOfSize(1));
+        ASSERT_THAT(*v.listElems()[0], IsStringEq(s));
+    }
+
     TEST_F(PrimOpTest, match1) {
         auto v = eval("builtins.match \"ab\" \"abc\"");
         ASSERT_THAT(v, IsNull());
@@ -872,4 +951,120 @@ namespace nix {
         auto v = eval("builtins.genericClosure { startSet = []; }");
         ASSERT_THAT(v, IsListOfSize(0));
     }
+
+    TEST_F(PrimOpTest, genericClosure_intKeys) {
+        auto v = eval("builtins.genericClosure { startSet = [ { key = 0; } ]; operator = x: [ { key = builtins.bitAnd (x.key + 7) 1023; } ]; }");
+        ASSERT_THAT(v, IsListOfSize(1024));
+    }
+
+    TEST_F(PrimOpTest, genericClosure_numberKeys) {
+        // Integers and floats that are equal are the same key.
+        auto v = eval("builtins.genericClosure { startSet = [ { key = 1; } { key = 1.0; } { key = 1.5; } { key = -0.0; } { key = 0; } ]; operator = x: []; }");
+        ASSERT_THAT(v, IsListOfSize(3));
+    }
+
+    TEST_F(PrimOpTest, genericClosure_stringAndListKeys) {
+        auto v = eval("builtins.genericClosure { startSet = [ { key = \"a\"; } { key = \"a\"; } { key = \"b\"; } ]; operator = x: []; }");
+        ASSERT_THAT(v, IsListOfSize(2));
+
+        v = eval("builtins.genericClosure { startSet = [ { key = [ 1 \"a\" ]; } { key = [ 1 \"a\" ]; } { key = [ 1.0 (\"a\" + \"\") ]; } { key = [ 1 \"b\" ]; } { key = [ 1 ]; } ]; operator = x: []; }");
+        ASSERT_THAT(v, IsListOfSize(3));
+    }
+
+    TEST_F(PrimOpTest, genericClosure_incomparableKeys) {
+        // Keys of types that cannot be compared are an error even if
+        // they differ.
+        ASSERT_THROW(eval("builtins.genericClosure { startSet = [ { key = true; } { key = false; } ]; operator = x: []; }"), EvalError);
+        ASSERT_THROW(eval("builtins.genericClosure { startSet = [ { key = 1; } { key = \"1\"; } ]; operator = x: []; }"), EvalError);
+        ASSERT_THROW(eval("builtins.genericClosure { startSet = [ { key = [ 1 ]; } { key = [ \"a\" ]; } ]; operator = x: []; }"), EvalError);
+        ASSERT_THAT(eval("builtins.genericClosure { startSet = [ { key = true; } ]; operator = x: []; }"), IsListOfSize(1));
+    }
+
+    TEST_F(PrimOpTest, genericClosure_listKeysAreForced) {
+        // Hashing a list key evaluates all of its elements, even if
+        // there is no other key to compare it with.
+        ASSERT_THROW(eval("builtins.genericClosure { startSet = [ { key = [ (throw \"x\") ]; } ]; operator = x: []; }"), ThrownError);
+        ASSERT_THROW(eval("builtins.genericClosure { startSet = [ { key = [ 1 ]; } { key = [ 2 (throw \"x\") ]; } ]; operator = x: []; }"), ThrownError);
+    }
+
+    TEST_F(PrimOpTest, fromJSON) {
+        auto v = eval(R"(builtins.fromJSON ''{"b": [1, -2.5e1, true, null, "xé😀\n"], "a": {}, "c": []}'')");
+        ASSERT_THAT(v, IsAttrsOfSize(3));
+        auto b = v.attrs()->get(createSymbol("b"));
+        ASSERT_NE(b, nullptr);
+        state.forceValue(*b->value, noPos);
+        ASSERT_THAT(*b->value, IsListOfSize(5));
+        ASSERT_THAT(*b->value->listElems()[1], IsFloatEq(-25.0));
+        ASSERT_THAT(*b->value->listElems()[4], IsStringEq("xé😀\n"));
+    }
+
+    TEST_F(PrimOpTest, fromJSON_duplicateKeys) {
+        // The last member with the same name wins.
+        ASSERT_THAT(eval(R"((builtins.fromJSON ''{"a": 1, "b": 2, "a": 3}'').a)"), IsIntEq(3));
+        ASSERT_THAT(eval(R"(builtins.fromJSON ''{"a": 1, "b": 2, "a": 3}'')"), IsAttrsOfSize(2));
+    }
+
+    TEST_F(PrimOpTest, fromJSON_numbers) {
+        ASSERT_THAT(eval("builtins.fromJSON \"-9223372036854775808\""), IsIntEq(std::numeric_limits<NixInt::Inner>::min()));
+        ASSERT_THAT(eval("builtins.fromJSON \"-9223372036854775809\""), IsFloatEq(-9223372036854775809.0));
+        ASSERT_THAT(eval("builtins.fromJSON \"18446744073709551616\""), IsFloatEq(18446744073709551616.0));
+        ASSERT_THAT(eval("builtins.fromJSON \"1e-400\""), IsFloatEq(0.0));
+        ASSERT_THROW(eval("builtins.fromJSON \"9223372036854775808\""), Error);
+        ASSERT_THROW(eval("builtins.fromJSON \"1e400\""), JSONParseError);
+    }
+
+    TEST_F(PrimOpTest, fromJSON_deeplyNested) {
+        // Nesting is limited by memory, not by the stack.
+        auto n = 1000000;
+        auto v = eval(fmt("builtins.fromJSON \"%s%s\"", std::string(n, '['), std::string(n, ']')));
+        ASSERT_THAT(v, IsListOfSize(1));
+    }
+
+    TEST_F(PrimOpTest, fromJSON_invalid) {
+        for (auto s : {"", "[1,]", "{\\\"a\\\"}", "01", "1.", "tru", "[1] 2", "\\\"\\\\x\\\"", "\\\"\\\\ud800\\\""})
+            ASSERT_THROW(eval(fmt("builtins.fromJSON \"%s\"", s)), JSONParseError) << s;
+    }
+
+    TEST_F(PrimOpTest, knownPrimOpCall) {
+        ASSERT_THAT(eval("builtins.length [ 1 2 3 ]"), IsIntEq(3));
+        ASSERT_THAT(eval("__length [ 1 2 ]"), IsIntEq(2));
+        ASSERT_THAT(eval("map (x: x + 1) [ 1 ]"), IsListOfSize(1));
+    }
+
+    TEST_F(PrimOpTest, knownPrimOpCallShadowed) {
+        ASSERT_THAT(eval("let builtins = { length = x: 42; }; in builtins.length [ 1 ]"), IsIntEq(42));
+        ASSERT_THAT(eval("let __length = x: 42; in __length [ 1 ]"), IsIntEq(42));
+        ASSERT_THAT(eval("(x: x.length [ 1 ]) { length = x: 42; }"), IsIntEq(42));
+    }
+
+    TEST_F(PrimOpTest, knownPrimOpCallArity) {
+        // Partial applications and calls with too many arguments take the generic path.
+        ASSERT_THAT(eval("(builtins.add 1) 2"), IsIntEq(3));
+        ASSERT_THAT(eval("builtins.elemAt [ (x: x * 2) ] 0 21"), IsIntEq(42));
+    }
+
+    TEST_F(PrimOpTest, knownPrimOpCallSameDerivation) {
+        // Calls through `b` aren't resolved when parsing, so they take the
+        // generic path through callFunction(). Both must give the same
+        // derivation.
+        auto drvPath = [&](std::string_view builtins) {
+            auto v = eval(fmt(R"(
+                let b = builtins; in (derivation {
+                  name = "known-primops";
+                  system = "x86_64-linux";
+                  builder = "/bin/sh";
+                  args = %1%.map toString (%1%.genList (x: x * 2) 5);
+                  n = %1%.length (%1%.attrNames { a = 1; b = 2; });
+                  s = %1%.concatStringsSep "-" (%1%.filter (x: x != "b") [ "a" "b" "c" ]);
+                  h = %1%.hashString "sha256" (%1%.toJSON { x = %1%.elemAt [ 1 2 ] 1; });
+                }).drvPath
+            )", builtins));
+            return std::string(v.string_view());
+        };
+        ASSERT_EQ(drvPath("builtins"), drvPath("b"));
+    }
+
+    TEST_F(PrimOpTest, knownPrimOpCallSelfReference) {
+        ASSERT_THROW(eval("let xs = builtins.tail xs; in xs"), InfiniteRecursionError);
+    }
 } /* namespace nix */
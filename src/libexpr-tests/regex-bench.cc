@@ -0,0 +1,156 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/regex.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <regex>
+
+using namespace nix;
+
+/**
+ * Regular expressions used by Nixpkgs and NixOS, together with typical
+ * subjects.
+ */
+struct Case
+{
+    const char * name;
+    const char * regex;
+    bool split;
+    std::vector<std::string> subjects;
+};
+
+static const std::vector<Case> corpus = {
+    /* lib.strings.trim */
+    {"trim", "[[:space:]]*(.*[^[:space:]])[[:space:]]*", false, {"  hello world \n", "\tfoo", "x"}},
+    /* lib.versions.majorMinor and friends */
+    {"version", "([0-9]+)\\.([0-9]+).*", false, {"1.2.3", "23.11pre-git", "2024-01-01"}},
+    /* builtins.parseDrvName-like splitting of a store path name */
+    {"drvName", "(.*)-([0-9][^-]*)", false, {"hello-2.12.1", "python3.11-requests-2.31.0", "glibc-2.38-44"}},
+    /* lib.strings.isValidPosixName */
+    {"posixName", "[a-zA-Z_][a-zA-Z0-9_]*", false, {"NIX_PATH", "foo-bar", "_x1"}},
+    /* lib.types.str with a URL check, as in fetchurl */
+    {"url", "[a-zA-Z][a-zA-Z0-9+.-]*://([^/]*)(/.*)?", false, {"https://cache.nixos.org/nix-cache-info", "mirror://gnu/hello"}},
+    /* isStorePath */
+    {"storePath", "/nix/store/([0-9a-df-np-sv-z]{32})-([^/]+)", false, {"/nix/store/0c0k4ddhbfrxvsdgk7pgpfa0a4cp5dlm-hello-2.12.1"}},
+    /* lib.strings.splitString "." */
+    {"splitDot", "\\.", true, {"services.nginx.virtualHosts.default.locations"}},
+    /* lib.strings.splitString "\n", e.g. on the contents of a file */
+    {"splitLines", "\n", true, {"line 1\nline 2\n\nline 4\n"}},
+    /* Word splitting, as in lib.strings.toSentenceCase and nix-shell
+       shebang parsing */
+    {"splitWords", "[[:space:]]+", true, {"  nix-shell -i bash -p hello  cowsay "}},
+    /* Splitting out ${...} interpolations from a template */
+    {"splitInterpolation", "\\$\\{([^}]*)}", true, {"exec ${pkgs.hello}/bin/hello --greeting ${greeting} >${out}"}},
+};
+
+static std::string repeat(const std::string & s, size_t n)
+{
+    std::string res;
+    res.reserve(s.size() * n);
+    for (size_t i = 0; i < n; ++i)
+        res += s;
+    return res;
+}
+
+/**
+ * The subjects of `Case`, repeated `n` times, so that `split` cases
+ * look at longer strings and `match` cases at the same short ones.
+ */
+static std::vector<std::string> subjects(const Case & c, size_t n)
+{
+    if (!c.split)
+        return c.subjects;
+    std::vector<std::string> res;
+    for (auto & s : c.subjects)
+        res.push_back(repeat(s, n));
+    return res;
+}
+
+static void BM_Regex(benchmark::State & bstate)
+{
+    auto & c = corpus[bstate.range(0)];
+    auto ss = subjects(c, bstate.range(1));
+    bstate.SetLabel(c.name);
+
+    regex::Regex re(c.regex);
+
+    for (auto _ : bstate) {
+        for (const auto & s : ss) {
+            if (c.split)
+                benchmark::DoNotOptimize(re.matchAll(s));
+            else {
+                regex::Captures captures;
+                benchmark::DoNotOptimize(re.match(s, captures));
+            }
+        }
+    }
+}
+
+/**
+ * The previous implementation of `builtins.match` and `builtins.split`,
+ * for comparison.
+ */
+static void BM_StdRegex(benchmark::State & bstate)
+{
+    auto & c = corpus[bstate.range(0)];
+    auto ss = subjects(c, bstate.range(1));
+    bstate.SetLabel(c.name);
+
+    std::regex re(c.regex, std::regex::extended);
+
+    for (auto _ : bstate) {
+        for (const auto & s : ss) {
+            if (c.split) {
+                auto begin = std::cregex_iterator(s.data(), s.data() + s.size(), re);
+                benchmark::DoNotOptimize(std::distance(begin, std::cregex_iterator()));
+            } else {
+                std::cmatch match;
+                benchmark::DoNotOptimize(std::regex_match(s.data(), s.data() + s.size(), match, re));
+            }
+        }
+    }
+}
+
+static void corpusArgs(benchmark::internal::Benchmark * b)
+{
+    for (size_t i = 0; i < corpus.size(); ++i)
+        for (int n : {1, 1000})
+            b->Args({(int64_t) i, n});
+}
+
+BENCHMARK(BM_Regex)->Apply(corpusArgs);
+BENCHMARK(BM_StdRegex)->Apply(corpusArgs);
+
+/**
+ * Split a large generated file into lines and match every line, like
+ * NixOS modules that parse `/etc/os-release`-style or `.env` files do.
+ */
+static void BM_PrimSplitAndMatch(benchmark::State & bstate)
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr);
+
+    auto e = state.parseExprFromString(
+        fmt(R"(
+            let
+              text = builtins.concatStringsSep "\n" (builtins.genList (i: "KEY_${toString i}=\"value ${toString i}\"") %d);
+              lines = builtins.filter builtins.isString (builtins.split "\n" text);
+            in builtins.length (builtins.filter (l: builtins.match "([A-Z_0-9]+)=\"(.*)\"" l != null) lines)
+        )",
+            bstate.range(0)),
+        state.rootPath(CanonPath::root));
+
+    for (auto _ : bstate) {
+        Value v;
+        state.eval(e, v);
+        state.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v.integer());
+    }
+}
+
+BENCHMARK(BM_PrimSplitAndMatch)->Arg(1000)->Arg(100000)->Unit(benchmark::kMillisecond);
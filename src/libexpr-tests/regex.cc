@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include "nix/expr/regex.hh"
+
+#include <random>
+
+namespace nix::regex {
+
+static std::vector<std::optional<std::string>> match(std::string_view re, std::string_view s)
+{
+    Regex regex(re);
+    Captures captures;
+    if (!regex.match(s, captures))
+        return {};
+    std::vector<std::optional<std::string>> res;
+    for (size_t i = 0; i < captures.size(); ++i)
+        res.push_back(captures.matched(i) ? std::optional(std::string(captures.get(s, i))) : std::nullopt);
+    return res;
+}
+
+static std::vector<std::string> matchAll(std::string_view re, std::string_view s)
+{
+    std::vector<std::string> res;
+    for (auto & captures : Regex(re).matchAll(s))
+        res.push_back(std::string(captures.get(s, 0)));
+    return res;
+}
+
+using M = std::vector<std::optional<std::string>>;
+using S = std::vector<std::string>;
+
+TEST(Regex, literal)
+{
+    ASSERT_EQ(match("abc", "abc"), (M{"abc"}));
+    ASSERT_EQ(match("abc", "abcd"), M{});
+    ASSERT_EQ(match("", ""), (M{""}));
+}
+
+TEST(Regex, groups)
+{
+    ASSERT_EQ(match("a(b)(c)", "abc"), (M{"abc", "b", "c"}));
+    ASSERT_EQ(match("(a)|(b)", "b"), (M{"b", std::nullopt, "b"}));
+    ASSERT_EQ(match("(.*)-([0-9].*)", "foo-bar-1.2.3"), (M{"foo-bar-1.2.3", "foo-bar", "1.2.3"}));
+}
+
+TEST(Regex, firstAlternativeWins)
+{
+    ASSERT_EQ(match("(a|ab)(c|bcd)(d*)", "abcd"), (M{"abcd", "a", "bcd", ""}));
+}
+
+TEST(Regex, emptyLoopIteration)
+{
+    /* Like libstdc++, the loop goes round once more on the empty
+       string. */
+    ASSERT_EQ(match("(a*)*", "aa"), (M{"aa", ""}));
+    ASSERT_EQ(match("(a*)+", "b"), M{});
+}
+
+TEST(Regex, intervals)
+{
+    ASSERT_EQ(match("a{2,3}", "aaa"), (M{"aaa"}));
+    ASSERT_EQ(match("a{2,3}", "aaaa"), M{});
+    ASSERT_EQ(match("a{2,}", "aaaa"), (M{"aaaa"}));
+    ASSERT_EQ(match("\\{}", "{}"), (M{"{}"}));
+}
+
+TEST(Regex, brackets)
+{
+    ASSERT_EQ(match("[]a]+", "a]"), (M{"a]"}));
+    ASSERT_EQ(match("[a-]+", "-a"), (M{"-a"}));
+    ASSERT_EQ(match("[^[:space:]]+", "abc"), (M{"abc"}));
+    ASSERT_EQ(match("[[:alpha:]_][[:alnum:]_'-]*", "foo_bar-1'"), (M{"foo_bar-1'"}));
+    ASSERT_EQ(match("[[.hyphen.]]", "-"), (M{"-"}));
+}
+
+TEST(Regex, anchors)
+{
+    ASSERT_EQ(matchAll("^a|b$", "aab"), (S{"a", "b"}));
+    ASSERT_EQ(matchAll("^", "ab"), (S{""}));
+}
+
+TEST(Regex, matchAll)
+{
+    ASSERT_EQ(matchAll("[[:space:]]+", " foo  bar "), (S{" ", "  ", " "}));
+    ASSERT_EQ(matchAll("x*", "ab"), (S{"", "", ""}));
+    ASSERT_EQ(matchAll("a*", "baaac"), (S{"", "aaa", "", ""}));
+    ASSERT_EQ(matchAll("(a|ab)", "abab"), (S{"ab", "ab"}));
+}
+
+TEST(Regex, invalid)
+{
+    for (auto re : {"(", ")", "[", "*", "\\w", "a{2,1}", "[z-a]", "[[:foo:]]", "a\\"})
+        ASSERT_THROW(Regex{re}, BadRegex) << re;
+}
+
+TEST(Regex, tooLarge)
+{
+    ASSERT_THROW(Regex("((a{1000}){1000}){1000}"), RegexTooLarge);
+}
+
+TEST(Regex, linearTime)
+{
+    /* These take exponential time or overflow the stack with a
+       backtracking matcher. */
+    std::string s(1000000, 'a');
+    ASSERT_EQ(match("(a|aa)*b", s), M{});
+    ASSERT_EQ(match("(a|aa)*", s).size(), 2);
+    ASSERT_EQ(matchAll("(a*)*b", s), S{});
+    ASSERT_EQ(matchAll("(.*)", s).size(), 2);
+}
+
+TEST(Regex, dfaGivesUp)
+{
+    /* The DFA for this needs thousands of states, so it gives up on a
+       long enough subject. */
+    std::mt19937 gen(0);
+    std::string s;
+    for (size_t i = 0; i < 30000; ++i)
+        s += "ab"[gen() % 2];
+    auto re = "(a|b)*a(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)(a|b)c";
+    ASSERT_EQ(matchAll(re, s), S{});
+    ASSERT_EQ(matchAll(re, s + "abbbbbbbbbbbc"), S{s + "abbbbbbbbbbbc"});
+}
+
+} // namespace nix::regex
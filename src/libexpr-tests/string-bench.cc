@@ -0,0 +1,83 @@
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+/**
+ * Evaluate `expr`, which must return an integer, on every iteration,
+ * and report the bytes of strings and the number of ropes per
+ * iteration.
+ */
+static void run(benchmark::State & bstate, const std::string & expr)
+{
+    bool readOnlyMode = true;
+    fetchers::Settings fetchSettings;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, openStore("dummy://"), fetchSettings, evalSettings, nullptr);
+
+    auto e = state.parseExprFromString(expr, state.rootPath(CanonPath::root));
+
+    EvalState::CountHeapBytes countHeapBytes;
+    auto bytesBefore = EvalState::nrHeapBytes;
+    auto ropesBefore = EvalState::nrStringRopes.load();
+
+    for (auto _ : bstate) {
+        Value v;
+        state.eval(e, v);
+        state.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v.integer());
+    }
+
+    bstate.counters["heapBytes"] = benchmark::Counter(EvalState::nrHeapBytes - bytesBefore, benchmark::Counter::kAvgIterations);
+    bstate.counters["ropes"] = benchmark::Counter(EvalState::nrStringRopes.load() - ropesBefore, benchmark::Counter::kAvgIterations);
+}
+
+/**
+ * Build a script of `n` lines with repeated `+`, as a fold over a list
+ * does.
+ */
+static void BM_ConcatStringsFold(benchmark::State & bstate)
+{
+    run(bstate, fmt(R"(
+        builtins.stringLength (builtins.foldl'
+          (script: i: script + "echo 'setting up service ${toString i}' >&2\n")
+          ""
+          (builtins.genList (i: i) %d))
+    )", bstate.range(0)));
+}
+
+/**
+ * Assemble a NixOS-style activation script from `n` snippets, the way
+ * `system.activationScripts` does: each snippet is rendered with
+ * `concatMapStrings`-style list concatenation, and the snippets are
+ * appended in dependency order with a header for each.
+ */
+static void BM_ActivationScript(benchmark::State & bstate)
+{
+    run(bstate, fmt(R"(
+        let
+          concatMapStrings = f: list: builtins.concatStringsSep "" (map f list);
+          names = builtins.genList (i: "snippet-${toString i}") %d;
+          snippets = builtins.listToAttrs (map (name: {
+            inherit name;
+            value.text = ''
+              # ${name}
+              mkdir -p /run/${name}
+              ${concatMapStrings (d: "install -d -m 0755 /var/lib/${name}/${d}\n") [ "cache" "state" "logs" "tmp" ]}
+              chown -R ${name}:${name} /var/lib/${name}
+            '';
+          }) names);
+          script = builtins.foldl'
+            (script: name: script + "\n#### Activation script snippet ${name}:\n" + snippets.${name}.text)
+            "#!/bin/sh\n"
+            names;
+        in builtins.stringLength script
+    )", bstate.range(0)));
+}
+
+BENCHMARK(BM_ConcatStringsFold)->Arg(1000)->Arg(20000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ActivationScript)->Arg(100)->Arg(5000)->Unit(benchmark::kMillisecond);
@@ -117,6 +117,80 @@ TEST(NixStringContextElemTest, built_built_xp) {
         NixStringContextElem::parse("!foo!bar!g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-x.drv"),        MissingExperimentalFeature);
 }
 
+class StringContextBuilderTest : public LibExprTest
+{
+protected:
+    Value mkStringWithContext(std::string_view s, NixStringContext context)
+    {
+        Value v;
+        v.mkString(s, context);
+        return v;
+    }
+
+    NixStringContext decode(const char * * encoded)
+    {
+        Value v;
+        v.mkString("", encoded);
+        NixStringContext context;
+        copyContext(v, context);
+        return context;
+    }
+};
+
+static NixStringContextElem opaque(std::string_view name)
+{
+    return NixStringContextElem::Opaque { .path = StorePath { "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-" + std::string(name) } };
+}
+
+TEST_F(StringContextBuilderTest, empty) {
+    StringContextBuilder context;
+    Value v;
+    v.mkString("foo");
+    context.add(v);
+    ASSERT_TRUE(context.empty());
+    ASSERT_EQ(context.finish(state), nullptr);
+}
+
+/**
+ * If only one part has a context, it is reused rather than copied.
+ */
+TEST_F(StringContextBuilderTest, single_shared) {
+    auto a = mkStringWithContext("a", {opaque("a")});
+    Value b;
+    b.mkString("b");
+
+    StringContextBuilder context;
+    context.add(a);
+    context.add(b);
+    ASSERT_EQ(context.finish(state), a.context());
+}
+
+/**
+ * A part whose context contains all the others is reused too.
+ */
+TEST_F(StringContextBuilderTest, superset_shared) {
+    auto a = mkStringWithContext("a", {opaque("a"), opaque("b")});
+    auto b = mkStringWithContext("b", {opaque("b")});
+
+    StringContextBuilder context;
+    context.add(b);
+    context.add(a);
+    ASSERT_EQ(context.finish(state), a.context());
+}
+
+TEST_F(StringContextBuilderTest, union) {
+    auto a = mkStringWithContext("a", {opaque("a")});
+    auto b = mkStringWithContext("b", {opaque("b"), opaque("c")});
+
+    StringContextBuilder context;
+    context.add(a);
+    context.add(b);
+    context.add(a);
+    context.context.insert(opaque("d"));
+
+    ASSERT_EQ(decode(context.finish(state)), (NixStringContext {opaque("a"), opaque("b"), opaque("c"), opaque("d")}));
+}
+
 #ifndef COVERAGE
 
 RC_GTEST_PROP(
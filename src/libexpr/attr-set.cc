@@ -19,7 +19,11 @@ Bindings * EvalState::allocBindings(size_t capacity)
         throw Error("attribute set of size %d is too big", capacity);
     nrAttrsets++;
     nrAttrsInAttrsets += capacity;
-    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity)) Bindings((Bindings::size_t) capacity);
+    size_t indexSize = 0;
+    if (auto bits = Bindings::indexBitsFor(capacity))
+        indexSize = ((size_t) 1 << bits) * sizeof(uint32_t);
+    nrAttrsetIndexBytes += indexSize;
+    return new (arena.alloc(EvalArena::scBindings, sizeof(Bindings) + sizeof(Attr) * capacity + indexSize)) Bindings((Bindings::size_t) capacity);
 }
 
 
@@ -37,9 +41,46 @@ Value & BindingsBuilder::alloc(std::string_view name, PosIdx pos)
 }
 
 
+std::atomic<uint64_t> Bindings::nrIndexes = 0;
+std::atomic<uint64_t> Bindings::nrIndexedHits = 0;
+std::atomic<uint64_t> Bindings::nrIndexedMisses = 0;
+std::atomic<uint64_t> Bindings::nrLookupCacheHits = 0;
+std::atomic<uint64_t> Bindings::nrLookupCacheMisses = 0;
+
+
 void Bindings::sort()
 {
-    if (size_) std::sort(begin(), end());
+    if (size_) std::sort(&attrs[0], &attrs[size_]);
+    indexed_ = false;
+}
+
+
+void Bindings::finishLayer()
+{
+    if (!baseLayer_) return;
+    totalSize_ = baseLayer_->size();
+    for (size_t n = 0; n < size_; ++n)
+        if (!baseLayer_->get(attrs[n].name))
+            totalSize_++;
+}
+
+
+void Bindings::buildIndex() const
+{
+    auto idx = index();
+    uint64_t mask = ((uint64_t) 1 << indexBits_) - 1;
+    std::fill_n(idx, mask + 1, 0);
+
+    /* Insert in order, so that if there are duplicate names, a lookup
+       finds the first one, just like a binary search would. */
+    for (size_t n = 0; n < size_; ++n) {
+        auto slot = indexSlot(attrs[n].name);
+        while (idx[slot]) slot = (slot + 1) & mask;
+        idx[slot] = n + 1;
+    }
+
+    indexed_ = true;
+    nrIndexes.fetch_add(1, std::memory_order_relaxed);
 }
 
 
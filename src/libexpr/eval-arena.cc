@@ -0,0 +1,71 @@
+#include "nix/expr/eval-arena.hh"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace nix {
+
+EvalArena::~EvalArena()
+{
+    for (auto & r : regions) {
+        auto chunk = r.chunks;
+        while (chunk) {
+            auto next = chunk->next;
+            std::free(chunk);
+            chunk = next;
+        }
+    }
+}
+
+
+EvalArena::Chunk * EvalArena::newChunk(Region & r, size_t size)
+{
+    /* calloc() of a large block is typically served by fresh,
+       already-zeroed pages, so this does not touch the memory. */
+    auto chunk = (Chunk *) std::calloc(sizeof(Chunk) + size, 1);
+    if (!chunk) throw std::bad_alloc();
+    chunk->next = r.chunks;
+    r.chunks = chunk;
+    r.stats.nrChunks++;
+    r.stats.bytesReserved += sizeof(Chunk) + size;
+    return chunk;
+}
+
+
+void * EvalArena::allocSlow(Region & r, size_t n)
+{
+    r.stats.bytesUsed += n;
+
+    /* Give big objects (e.g. the top-level Nixpkgs attribute set) a
+       chunk of their own, so that we don't throw away the remainder
+       of the current chunk. */
+    if (n > r.nextChunkSize / 4)
+        return newChunk(r, n) + 1;
+
+    auto size = r.nextChunkSize;
+    r.nextChunkSize = std::min(r.nextChunkSize * 2, maxChunkSize);
+
+    auto chunk = newChunk(r, size);
+    r.ptr = (char *) (chunk + 1);
+    r.end = r.ptr + size;
+
+    void * p = r.ptr;
+    r.ptr += n;
+    return p;
+}
+
+
+EvalArena::Stats EvalArena::totals() const
+{
+    Stats res;
+    for (auto & r : regions) {
+        res.nrObjects += r.stats.nrObjects;
+        res.nrChunks += r.stats.nrChunks;
+        res.bytesUsed += r.stats.bytesUsed;
+        res.bytesReserved += r.stats.bytesReserved;
+    }
+    return res;
+}
+
+}
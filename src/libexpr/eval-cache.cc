@@ -7,6 +7,8 @@
 // Need specialization involving `SymbolStr` just in this one module.
 #include "nix/util/strings-inline.hh"
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
 namespace nix::eval_cache {
 
 CachedEvalError::CachedEvalError(ref<AttrCursor> cursor, Symbol attr)
@@ -39,7 +41,37 @@ create table if not exists Attributes (
 );
 )sql";
 
+/**
+ * The storage of an evaluation cache. Every attribute is identified by
+ * an `AttrId`, and is looked up by the `AttrId` of its parent and its
+ * name. The root attribute has parent 0 and an empty name.
+ */
 struct AttrDb
+{
+    virtual ~AttrDb() = default;
+
+    virtual AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs) = 0;
+
+    virtual AttrId setString(AttrKey key, std::string_view s, const char * * context = nullptr) = 0;
+
+    virtual AttrId setBool(AttrKey key, bool b) = 0;
+
+    virtual AttrId setInt(AttrKey key, int n) = 0;
+
+    virtual AttrId setListOfStrings(AttrKey key, const std::vector<std::string> & l) = 0;
+
+    virtual AttrId setPlaceholder(AttrKey key) = 0;
+
+    virtual AttrId setMissing(AttrKey key) = 0;
+
+    virtual AttrId setMisc(AttrKey key) = 0;
+
+    virtual AttrId setFailed(AttrKey key) = 0;
+
+    virtual std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key) = 0;
+};
+
+struct SQLiteAttrDb : AttrDb
 {
     std::atomic_bool failed{false};
 
@@ -59,7 +91,7 @@ struct AttrDb
 
     SymbolTable & symbols;
 
-    AttrDb(
+    SQLiteAttrDb(
         const StoreDirConfig & cfg,
         const Hash & fingerprint,
         SymbolTable & symbols)
@@ -93,7 +125,7 @@ struct AttrDb
         state->txn = std::make_unique<SQLiteTxn>(state->db);
     }
 
-    ~AttrDb()
+    ~SQLiteAttrDb()
     {
         try {
             auto state(_state->lock());
@@ -120,7 +152,7 @@ struct AttrDb
 
     AttrId setAttrs(
         AttrKey key,
-        const std::vector<Symbol> & attrs)
+        const std::vector<Symbol> & attrs) override
     {
         return doSQLite([&]()
         {
@@ -149,7 +181,7 @@ struct AttrDb
     AttrId setString(
         AttrKey key,
         std::string_view s,
-        const char * * context = nullptr)
+        const char * * context) override
     {
         return doSQLite([&]()
         {
@@ -181,7 +213,7 @@ struct AttrDb
 
     AttrId setBool(
         AttrKey key,
-        bool b)
+        bool b) override
     {
         return doSQLite([&]()
         {
@@ -199,7 +231,7 @@ struct AttrDb
 
     AttrId setInt(
         AttrKey key,
-        int n)
+        int n) override
     {
         return doSQLite([&]()
         {
@@ -217,7 +249,7 @@ struct AttrDb
 
     AttrId setListOfStrings(
         AttrKey key,
-        const std::vector<std::string> & l)
+        const std::vector<std::string> & l) override
     {
         return doSQLite([&]()
         {
@@ -233,7 +265,7 @@ struct AttrDb
         });
     }
 
-    AttrId setPlaceholder(AttrKey key)
+    AttrId setPlaceholder(AttrKey key) override
     {
         return doSQLite([&]()
         {
@@ -249,7 +281,7 @@ struct AttrDb
         });
     }
 
-    AttrId setMissing(AttrKey key)
+    AttrId setMissing(AttrKey key) override
     {
         return doSQLite([&]()
         {
@@ -265,7 +297,7 @@ struct AttrDb
         });
     }
 
-    AttrId setMisc(AttrKey key)
+    AttrId setMisc(AttrKey key) override
     {
         return doSQLite([&]()
         {
@@ -281,7 +313,7 @@ struct AttrDb
         });
     }
 
-    AttrId setFailed(AttrKey key)
+    AttrId setFailed(AttrKey key) override
     {
         return doSQLite([&]()
         {
@@ -297,7 +329,7 @@ struct AttrDb
         });
     }
 
-    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
+    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key) override
     {
         auto state(_state->lock());
 
@@ -343,16 +375,487 @@ struct AttrDb
     }
 };
 
+/**
+ * An evaluation cache stored in a single immutable file that is mapped
+ * into memory, rather than in a SQLite database.
+ *
+ * The file contains every attribute as a fixed-size node. The children
+ * of an attribute set are consecutive nodes sorted by name, so looking
+ * up an attribute is a binary search among its siblings without any
+ * copying. The `AttrId` of an attribute in the file is the index of its
+ * node; node 0 is the parent of the root.
+ *
+ * Attributes written during a session are kept in memory, shadowing
+ * those in the file. If there are any, a new file containing both is
+ * written when the cache is closed, and atomically replaces the old
+ * one. Attributes that are no longer reachable from the root are
+ * dropped at that point.
+ */
+struct CompactAttrDb : AttrDb
+{
+    static constexpr std::string_view magic = "NIXEVC01";
+
+    static constexpr uint64_t noContext = std::numeric_limits<uint64_t>::max();
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t nrNodes;
+        uint64_t blobSize;
+    };
+
+    struct Node
+    {
+        /**
+         * Offset of the name in the blob.
+         */
+        uint64_t name;
+
+        /**
+         * The integer or boolean value, or the offset of the string
+         * value or list of strings in the blob.
+         */
+        uint64_t value;
+
+        /**
+         * Offset of the list of string context elements in the blob,
+         * or `noContext`.
+         */
+        uint64_t context;
+
+        uint64_t firstChild;
+        uint32_t nrChildren;
+        uint32_t type;
+    };
+
+    /**
+     * An attribute written during this session.
+     */
+    struct Row
+    {
+        AttrId id;
+        AttrType type;
+        int64_t n = 0;
+        std::string s;
+        std::vector<std::string> list;
+        std::optional<std::vector<std::string>> context;
+    };
+
+    /**
+     * Orders rows by parent and name, and allows looking them up
+     * without copying the name.
+     */
+    struct RowKeyLess
+    {
+        using is_transparent = void;
+
+        template<typename A, typename B>
+        bool operator () (const A & a, const B & b) const
+        {
+            return std::pair(a.first, std::string_view(a.second)) < std::pair(b.first, std::string_view(b.second));
+        }
+    };
+
+    struct State
+    {
+        boost::iostreams::mapped_file_source file;
+        const Node * nodes = nullptr;
+        uint64_t nrNodes = 0;
+        const char * blob = nullptr;
+        uint64_t blobSize = 0;
+
+        /**
+         * The attributes written during this session, by parent and
+         * name.
+         */
+        std::map<std::pair<AttrId, std::string>, Row, RowKeyLess> rows;
+
+        AttrId nextId = 1;
+    };
+
+    Sync<State> _state;
+
+    std::filesystem::path path;
+
+    SymbolTable & symbols;
+
+    CompactAttrDb(const Hash & fingerprint, SymbolTable & symbols)
+        : symbols(symbols)
+    {
+        std::filesystem::path cacheDir = getCacheDir() + "/eval-cache-v5";
+        createDirs(cacheDir);
+
+        path = cacheDir / (fingerprint.to_string(HashFormat::Base16, false) + ".attrs");
+
+        auto state(_state.lock());
+
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec)) return;
+
+        try {
+            state->file.open(path.string());
+        } catch (std::exception &) {
+        }
+        if (!state->file.is_open()) return;
+
+        try {
+            auto data = state->file.data();
+            auto size = state->file.size();
+            Header header;
+            if (size < sizeof(header)) corrupt();
+            memcpy(&header, data, sizeof(header));
+            if (std::string_view(header.magic, sizeof(header.magic)) != magic
+                || header.nrNodes == 0
+                || header.nrNodes > (size - sizeof(header)) / sizeof(Node)
+                || header.blobSize != size - sizeof(header) - header.nrNodes * sizeof(Node))
+                corrupt();
+            state->nodes = (const Node *) (data + sizeof(header));
+            state->nrNodes = header.nrNodes;
+            state->blob = data + sizeof(header) + header.nrNodes * sizeof(Node);
+            state->blobSize = header.blobSize;
+            state->nextId = header.nrNodes;
+        } catch (Error & e) {
+            debug("ignoring evaluation cache '%s': %s", path.string(), e.msg());
+            state->file.close();
+            state->nodes = nullptr;
+            state->nrNodes = 0;
+        }
+    }
+
+    ~CompactAttrDb()
+    {
+        try {
+            auto state(_state.lock());
+            if (!state->rows.empty())
+                write(*state);
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    [[noreturn]] static void corrupt()
+    {
+        throw Error("evaluation cache is corrupt");
+    }
+
+    static std::string_view getString(const State & state, uint64_t offset)
+    {
+        uint32_t len;
+        if (offset > state.blobSize || state.blobSize - offset < sizeof(len)) corrupt();
+        memcpy(&len, state.blob + offset, sizeof(len));
+        offset += sizeof(len);
+        if (state.blobSize - offset < len) corrupt();
+        return {state.blob + offset, len};
+    }
+
+    static std::vector<std::string> getStrings(const State & state, uint64_t offset)
+    {
+        uint32_t count;
+        if (offset > state.blobSize || state.blobSize - offset < sizeof(count)) corrupt();
+        memcpy(&count, state.blob + offset, sizeof(count));
+        offset += sizeof(count);
+        std::vector<std::string> res;
+        for (uint32_t i = 0; i < count; ++i) {
+            auto s = getString(state, offset);
+            res.emplace_back(s);
+            offset += sizeof(uint32_t) + s.size();
+        }
+        return res;
+    }
+
+    static const Node & getNode(const State & state, AttrId id)
+    {
+        if (id >= state.nrNodes) corrupt();
+        return state.nodes[id];
+    }
+
+    /**
+     * Find the child of node `parent` in the file with the given name.
+     */
+    static std::optional<AttrId> findChild(const State & state, AttrId parent, std::string_view name)
+    {
+        if (parent >= state.nrNodes) return std::nullopt;
+        auto & node = getNode(state, parent);
+        if (node.firstChild > state.nrNodes || state.nrNodes - node.firstChild < node.nrChildren) corrupt();
+        auto lo = node.firstChild, hi = node.firstChild + node.nrChildren;
+        while (lo < hi) {
+            auto mid = lo + (hi - lo) / 2;
+            auto cmp = getString(state, state.nodes[mid].name).compare(name);
+            if (cmp == 0) return mid;
+            if (cmp < 0) lo = mid + 1; else hi = mid;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * The names of the children of `parent`, both in the file and
+     * written in this session.
+     */
+    static std::vector<std::string_view> childNames(const State & state, AttrId parent)
+    {
+        std::vector<std::string_view> names;
+        if (parent < state.nrNodes) {
+            auto & node = getNode(state, parent);
+            if (node.firstChild > state.nrNodes || state.nrNodes - node.firstChild < node.nrChildren) corrupt();
+            for (auto i = node.firstChild; i < node.firstChild + node.nrChildren; ++i)
+                names.push_back(getString(state, state.nodes[i].name));
+        }
+        auto nrInFile = names.size();
+        for (auto i = state.rows.lower_bound(std::pair(parent, std::string_view()));
+             i != state.rows.end() && i->first.first == parent;
+             ++i)
+        {
+            if (nrInFile && std::binary_search(names.begin(), names.begin() + nrInFile, i->first.second))
+                continue;
+            names.push_back(i->first.second);
+        }
+        if (names.size() != nrInFile)
+            std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    AttrId setRow(AttrKey key, Row && row)
+    {
+        auto state(_state.lock());
+        row.id = state->nextId++;
+        auto id = row.id;
+        state->rows.insert_or_assign({key.first, std::string(symbols[key.second])}, std::move(row));
+        return id;
+    }
+
+    AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs) override
+    {
+        auto rowId = setRow(key, {.type = AttrType::FullAttrs});
+        for (auto & attr : attrs)
+            setRow({rowId, attr}, {.type = AttrType::Placeholder});
+        return rowId;
+    }
+
+    AttrId setString(AttrKey key, std::string_view s, const char * * context) override
+    {
+        Row row{.type = AttrType::String, .s = std::string(s)};
+        if (context) {
+            row.context.emplace();
+            for (const char * * p = context; *p; ++p)
+                row.context->push_back(*p);
+        }
+        return setRow(key, std::move(row));
+    }
+
+    AttrId setBool(AttrKey key, bool b) override
+    {
+        return setRow(key, {.type = AttrType::Bool, .n = b ? 1 : 0});
+    }
+
+    AttrId setInt(AttrKey key, int n) override
+    {
+        return setRow(key, {.type = AttrType::Int, .n = n});
+    }
+
+    AttrId setListOfStrings(AttrKey key, const std::vector<std::string> & l) override
+    {
+        return setRow(key, {.type = AttrType::ListOfStrings, .list = l});
+    }
+
+    AttrId setPlaceholder(AttrKey key) override
+    {
+        return setRow(key, {.type = AttrType::Placeholder});
+    }
+
+    AttrId setMissing(AttrKey key) override
+    {
+        return setRow(key, {.type = AttrType::Missing});
+    }
+
+    AttrId setMisc(AttrKey key) override
+    {
+        return setRow(key, {.type = AttrType::Misc});
+    }
+
+    AttrId setFailed(AttrKey key) override
+    {
+        return setRow(key, {.type = AttrType::Failed});
+    }
+
+    AttrValue toAttrValue(const State & state, AttrId id, AttrType type, int64_t n,
+        std::string_view s, std::vector<std::string> && list,
+        const std::optional<std::vector<std::string>> & context)
+    {
+        switch (type) {
+            case AttrType::Placeholder:
+                return placeholder_t();
+            case AttrType::FullAttrs: {
+                std::vector<Symbol> attrs;
+                for (auto & name : childNames(state, id))
+                    attrs.emplace_back(symbols.create(name));
+                return attrs;
+            }
+            case AttrType::String: {
+                NixStringContext ctx;
+                if (context)
+                    for (auto & s : *context)
+                        ctx.insert(NixStringContextElem::parse(s));
+                return string_t{std::string(s), ctx};
+            }
+            case AttrType::Bool:
+                return n != 0;
+            case AttrType::Int:
+                return int_t{NixInt{n}};
+            case AttrType::ListOfStrings:
+                return std::move(list);
+            case AttrType::Missing:
+                return missing_t();
+            case AttrType::Misc:
+                return misc_t();
+            case AttrType::Failed:
+                return failed_t();
+            default:
+                throw Error("unexpected type in evaluation cache");
+        }
+    }
+
+    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key) override
+    {
+        auto state(_state.lock());
+
+        auto name = symbols[key.second];
+
+        auto i = state->rows.find(std::pair(key.first, std::string_view(name)));
+        if (i != state->rows.end()) {
+            auto & row = i->second;
+            return {{row.id, toAttrValue(*state, row.id, row.type, row.n, row.s, std::vector(row.list), row.context)}};
+        }
+
+        try {
+            auto id = findChild(*state, key.first, name);
+            if (!id) return {};
+            auto & node = getNode(*state, *id);
+            auto type = (AttrType) node.type;
+            auto isString = type == AttrType::String;
+            std::optional<std::vector<std::string>> context;
+            if (isString && node.context != noContext)
+                context = getStrings(*state, node.context);
+            return {{*id, toAttrValue(*state, *id, type, (int64_t) node.value,
+                isString ? getString(*state, node.value) : std::string_view(),
+                type == AttrType::ListOfStrings ? getStrings(*state, node.value) : std::vector<std::string>(),
+                context)}};
+        } catch (Error & e) {
+            /* Treat a corrupt file as a cache miss. It will be
+               replaced when the cache is closed. */
+            debug("ignoring evaluation cache '%s': %s", path.string(), e.msg());
+            return {};
+        }
+    }
+
+    /**
+     * Write the attributes in the file and in `state.rows` that are
+     * reachable from the root to a new file.
+     */
+    void write(const State & state)
+    {
+        std::vector<Node> nodes;
+        std::string blob;
+        std::unordered_map<std::string, uint64_t> strings;
+
+        auto putString = [&](std::string_view s) -> uint64_t {
+            auto i = strings.find(std::string(s));
+            if (i != strings.end()) return i->second;
+            auto offset = blob.size();
+            uint32_t len = s.size();
+            blob.append((const char *) &len, sizeof(len));
+            blob.append(s);
+            strings.emplace(s, offset);
+            return offset;
+        };
+
+        auto putStrings = [&](const std::vector<std::string> & l) -> uint64_t {
+            auto offset = blob.size();
+            uint32_t count = l.size();
+            blob.append((const char *) &count, sizeof(count));
+            for (auto & s : l) {
+                uint32_t len = s.size();
+                blob.append((const char *) &len, sizeof(len));
+                blob.append(s);
+            }
+            return offset;
+        };
+
+        /* Lay out the tree breadth-first, so that the children of every
+           node are consecutive. `queue` holds the old IDs of the nodes
+           in the new file. */
+        std::vector<AttrId> queue{0};
+        nodes.push_back(Node{.name = putString(""), .value = 0, .context = noContext, .firstChild = 0, .nrChildren = 0, .type = AttrType::Placeholder});
+
+        for (size_t n = 0; n < queue.size(); ++n) {
+            auto parent = queue[n];
+            auto names = childNames(state, parent);
+            nodes[n].firstChild = nodes.size();
+            nodes[n].nrChildren = names.size();
+
+            for (auto & name : names) {
+                Node node{.name = putString(name), .value = 0, .context = noContext, .firstChild = 0, .nrChildren = 0};
+                auto i = state.rows.find(std::pair(parent, name));
+                if (i != state.rows.end()) {
+                    auto & row = i->second;
+                    node.type = row.type;
+                    if (row.type == AttrType::String) {
+                        node.value = putString(row.s);
+                        if (row.context) node.context = putStrings(*row.context);
+                    } else if (row.type == AttrType::ListOfStrings)
+                        node.value = putStrings(row.list);
+                    else
+                        node.value = row.n;
+                    queue.push_back(row.id);
+                } else {
+                    auto id = *findChild(state, parent, name);
+                    auto & old = getNode(state, id);
+                    node.type = old.type;
+                    if (old.type == AttrType::String) {
+                        node.value = putString(getString(state, old.value));
+                        if (old.context != noContext) node.context = putStrings(getStrings(state, old.context));
+                    } else if (old.type == AttrType::ListOfStrings)
+                        node.value = putStrings(getStrings(state, old.value));
+                    else
+                        node.value = old.value;
+                    queue.push_back(id);
+                }
+                nodes.push_back(node);
+            }
+        }
+
+        Header header{.nrNodes = nodes.size(), .blobSize = blob.size()};
+        memcpy(header.magic, magic.data(), sizeof(header.magic));
+
+        std::string contents;
+        contents.reserve(sizeof(header) + nodes.size() * sizeof(Node) + blob.size());
+        contents.append((const char *) &header, sizeof(header));
+        contents.append((const char *) nodes.data(), nodes.size() * sizeof(Node));
+        contents.append(blob);
+
+        auto tmp = makeTempPath(path.parent_path().string(), ".tmp-" + path.filename().string());
+        AutoDelete delTmp(tmp, false);
+        writeFile(tmp, contents);
+        std::filesystem::rename(tmp, path);
+        delTmp.cancel();
+    }
+};
+
 static std::shared_ptr<AttrDb> makeAttrDb(
     const StoreDirConfig & cfg,
     const Hash & fingerprint,
-    SymbolTable & symbols)
+    SymbolTable & symbols,
+    bool compact)
 {
     try {
-        return std::make_shared<AttrDb>(cfg, fingerprint, symbols);
+        if (compact)
+            return std::make_shared<CompactAttrDb>(fingerprint, symbols);
+        return std::make_shared<SQLiteAttrDb>(cfg, fingerprint, symbols);
     } catch (SQLiteError &) {
         ignoreExceptionExceptInterrupt();
         return nullptr;
+    } catch (Error & e) {
+        debug("cannot open evaluation cache: %s", e.msg());
+        return nullptr;
     }
 }
 
@@ -360,7 +863,7 @@ EvalCache::EvalCache(
     std::optional<std::reference_wrapper<const Hash>> useCache,
     EvalState & state,
     RootLoader rootLoader)
-    : db(useCache ? makeAttrDb(*state.store, *useCache, state.symbols) : nullptr)
+    : db(useCache ? makeAttrDb(*state.store, *useCache, state.symbols, state.settings.compactEvalCache) : nullptr)
     , state(state)
     , rootLoader(rootLoader)
 {
@@ -0,0 +1,184 @@
+#include "nix/expr/eval-memo.hh"
+#include "nix/expr/attr-set.hh"
+#include "nix/util/hash.hh"
+
+#include <boost/container_hash/hash.hpp>
+
+#include <array>
+#include <cstring>
+
+namespace nix {
+
+/**
+ * Lists, sets and strings larger than this are compared by identity,
+ * so that computing a key stays cheap.
+ */
+static constexpr size_t maxShallowSize = 16;
+static constexpr size_t maxStringSize = 256;
+
+/**
+ * The payload of `v`, which identifies what it points to for the types
+ * that are compared by identity.
+ */
+static std::array<uintptr_t, 2> payloadWords(const Value & v)
+{
+    std::array<uintptr_t, 2> words;
+    static_assert(sizeof(words) == sizeof(v.payload));
+    std::memcpy(words.data(), &v.payload, sizeof(words));
+    return words;
+}
+
+static size_t hashArg(const Value & v)
+{
+    size_t h = 0;
+    // Allow selecting a subset of enum values
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (v.type()) {
+    case nInt:
+        boost::hash_combine(h, v.integer().value);
+        break;
+    case nBool:
+        boost::hash_combine(h, v.boolean());
+        break;
+    case nNull:
+        break;
+    case nString:
+        /* Ropes are always large, and are not flattened for this. */
+        if (auto rope = v.stringRope())
+            boost::hash_combine(h, (const void *) rope);
+        else if (auto s = v.string_view(); s.size() <= maxStringSize)
+            boost::hash_combine(h, std::hash<std::string_view>{}(s));
+        else
+            boost::hash_combine(h, (const void *) v.c_str());
+        break;
+    case nAttrs:
+        if (v.attrs()->size() <= maxShallowSize)
+            for (auto & attr : *v.attrs()) {
+                boost::hash_combine(h, std::hash<Symbol>{}(attr.name));
+                boost::hash_combine(h, attr.value);
+            }
+        else
+            boost::hash_combine(h, v.attrs());
+        break;
+    case nList:
+        if (v.listSize() <= maxShallowSize)
+            for (auto elem : v.listItems())
+                boost::hash_combine(h, elem);
+        else
+            boost::hash_combine(h, v.listElems());
+        break;
+    case nFunction:
+        if (v.isLambda()) {
+            boost::hash_combine(h, v.payload.lambda.fun);
+            boost::hash_combine(h, v.payload.lambda.env);
+        } else
+            boost::hash_combine(h, payloadWords(v));
+        break;
+    default:
+        boost::hash_combine(h, payloadWords(v));
+        break;
+    }
+    #pragma GCC diagnostic pop
+    boost::hash_combine(h, (int) v.type());
+    return h;
+}
+
+static bool shallowEqual(const Value & a, const Value & b)
+{
+    if (&a == &b)
+        return true;
+    if (a.type() != b.type())
+        return false;
+
+    // Allow selecting a subset of enum values
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (a.type()) {
+    case nInt:
+        return a.integer().value == b.integer().value;
+    case nBool:
+        return a.boolean() == b.boolean();
+    case nNull:
+        return true;
+    case nString: {
+        if (a.stringRope() || b.stringRope())
+            return a.stringRope() == b.stringRope();
+        if (a.context() != b.context())
+            return false;
+        auto sa = a.string_view(), sb = b.string_view();
+        if (sa.size() > maxStringSize || sb.size() > maxStringSize)
+            return a.c_str() == b.c_str();
+        return sa == sb;
+    }
+    case nAttrs: {
+        auto & x = *a.attrs(), & y = *b.attrs();
+        if (&x == &y)
+            return true;
+        /* Positions are observable through `unsafeGetAttrPos`. */
+        if (x.size() != y.size() || x.size() > maxShallowSize || x.pos != y.pos)
+            return false;
+        for (auto i = x.begin(), j = y.begin(); i != x.end(); ++i, ++j)
+            if (i->name != j->name || i->value != j->value || i->pos != j->pos)
+                return false;
+        return true;
+    }
+    case nList: {
+        if (a.listSize() != b.listSize())
+            return false;
+        if (a.listSize() > maxShallowSize)
+            return a.listElems() == b.listElems();
+        auto xs = a.listItems(), ys = b.listItems();
+        return std::equal(xs.begin(), xs.end(), ys.begin());
+    }
+    case nFunction:
+        if (a.isLambda() || b.isLambda())
+            return a.isLambda() && b.isLambda() && a.payload.lambda.fun == b.payload.lambda.fun
+                   && a.payload.lambda.env == b.payload.lambda.env;
+        return a.isPrimOp() == b.isPrimOp() && payloadWords(a) == payloadWords(b);
+    case nThunk:
+        /* All black holes look the same. */
+        if (a.isBlackhole() || b.isBlackhole())
+            return false;
+        return a.isApp() == b.isApp() && payloadWords(a) == payloadWords(b);
+    default:
+        return payloadWords(a) == payloadWords(b);
+    }
+    #pragma GCC diagnostic pop
+}
+
+EvalMemoCache::Key EvalMemoCache::lambdaKey(const ExprLambda & lambda, const Env * env, const Value & arg)
+{
+    size_t h = hashArg(arg);
+    boost::hash_combine(h, &lambda);
+    boost::hash_combine(h, env);
+    return {.fun = &lambda, .env = env, .arg = arg, .hash = h};
+}
+
+EvalMemoCache::Key EvalMemoCache::identityKey(const void * fun, const void * obj)
+{
+    size_t h = 0;
+    boost::hash_combine(h, fun);
+    boost::hash_combine(h, obj);
+    return {.fun = fun, .env = obj, .arg = std::nullopt, .hash = h};
+}
+
+bool EvalMemoCache::KeyEq::operator()(const Key & a, const Key & b) const
+{
+    if (a.hash != b.hash || a.fun != b.fun || a.env != b.env)
+        return false;
+    if (!a.arg || !b.arg)
+        return !a.arg && !b.arg;
+    return shallowEqual(*a.arg, *b.arg);
+}
+
+void EvalMemoCache::insert(const Key & key, const Value & result)
+{
+    if (entries.size() >= maxEntries) {
+        entries.clear();
+        stats.flushes++;
+    }
+    entries.emplace(key, result);
+}
+
+}
@@ -0,0 +1,679 @@
+#include "nix/expr/eval-profiler.hh"
+#include "nix/expr/nixexpr.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/util.hh"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <signal.h>
+#  include <sys/time.h>
+#endif
+
+namespace nix {
+
+namespace {
+
+/**
+ * Minimal encoder for the protobuf wire format, sufficient for writing
+ * `perftools.profiles.Profile` messages (see `profile.proto` in
+ * https://github.com/google/pprof).
+ */
+struct ProtoWriter
+{
+    std::string buf;
+
+    void varint(uint64_t n)
+    {
+        while (n >= 0x80) {
+            buf += (char) (n | 0x80);
+            n >>= 7;
+        }
+        buf += (char) n;
+    }
+
+    void tag(uint32_t field, uint32_t wireType)
+    {
+        varint(((uint64_t) field << 3) | wireType);
+    }
+
+    void uint(uint32_t field, uint64_t n)
+    {
+        if (!n)
+            return;
+        tag(field, 0);
+        varint(n);
+    }
+
+    void bytes(uint32_t field, std::string_view s)
+    {
+        tag(field, 2);
+        varint(s.size());
+        buf += s;
+    }
+
+    void packed(uint32_t field, std::span<const uint64_t> ns)
+    {
+        ProtoWriter w;
+        for (auto n : ns)
+            w.varint(n);
+        bytes(field, w.buf);
+    }
+};
+
+/**
+ * A stack frame on the shadow stack. This has to be trivially copyable,
+ * since it is copied from a signal handler.
+ */
+struct Frame
+{
+    enum Kind : uint32_t {
+        Lambda,
+        PrimOp,
+        Functor,
+        Other,
+        /** Stands in for the frames that did not fit in a sample. */
+        Truncated,
+        /** Stands in for evaluation outside of any function call. */
+        TopLevel,
+    };
+
+    Kind kind;
+    /** Position where the function has been called. */
+    PosIdx callPos;
+    /** `ExprLambda *` or `const PrimOp *`, depending on `kind`. */
+    const void * fun;
+
+    auto operator<=>(const Frame & rhs) const = default;
+};
+
+static_assert(std::is_trivially_copyable_v<Frame>);
+
+Frame getFrame(EvalState & state, const Value & v, PosIdx pos)
+{
+    if (v.isLambda())
+        return {.kind = Frame::Lambda, .callPos = pos, .fun = v.payload.lambda.fun};
+    else if (v.isPrimOp())
+        return {.kind = Frame::PrimOp, .callPos = pos, .fun = v.primOp()};
+    else if (v.isPrimOpApp())
+        return {.kind = Frame::PrimOp, .callPos = pos, .fun = v.primOpAppPrimOp()};
+    else if (state.isFunctor(v))
+        return {.kind = Frame::Functor, .callPos = pos, .fun = nullptr};
+    else
+        return {.kind = Frame::Other, .callPos = pos, .fun = nullptr};
+}
+
+std::string describeOrigin(const Pos::Origin & origin)
+{
+    return std::visit(
+        overloaded{
+            [](const std::monostate &) -> std::string { return "«none»"; },
+            [](const Pos::Stdin &) -> std::string { return "«stdin»"; },
+            [](const Pos::String &) -> std::string { return "«string»"; },
+            [](const SourcePath & path) -> std::string { return path.to_string(); },
+        },
+        origin);
+}
+
+/**
+ * Builds a gzipped `perftools.profiles.Profile` from stacks of frames.
+ */
+class PprofBuilder
+{
+    /* Field numbers of `perftools.profiles.Profile` and its submessages. */
+    enum : uint32_t {
+        profileSampleType = 1,
+        profileSample = 2,
+        profileLocation = 4,
+        profileFunction = 5,
+        profileStringTable = 6,
+        profileTimeNanos = 9,
+        profileDurationNanos = 10,
+        profilePeriodType = 11,
+        profilePeriod = 12,
+        profileDefaultSampleType = 14,
+        valueTypeType = 1,
+        valueTypeUnit = 2,
+        sampleLocationId = 1,
+        sampleValue = 2,
+        locationId = 1,
+        locationLine = 4,
+        lineFunctionId = 1,
+        lineLine = 2,
+        lineColumn = 3,
+        functionId = 1,
+        functionName = 2,
+        functionSystemName = 3,
+        functionFilename = 4,
+        functionStartLine = 5,
+    };
+
+    EvalState & state;
+
+    ProtoWriter out;
+    ProtoWriter stringTable;
+
+    std::map<std::string, uint64_t, std::less<>> stringIds;
+
+    /* A function is identified by what was called; a location by the
+       function and the position of the call that it was executing when
+       the sample was taken. */
+    std::map<std::pair<Frame::Kind, const void *>, uint64_t> functionIds;
+    std::map<std::tuple<uint64_t, uint32_t, uint32_t>, uint64_t> locationIds;
+
+    std::vector<uint64_t> locations;
+
+    uint64_t string(std::string_view s)
+    {
+        auto i = stringIds.find(s);
+        if (i != stringIds.end())
+            return i->second;
+        auto id = stringIds.size();
+        stringIds.emplace(s, id);
+        stringTable.bytes(profileStringTable, s);
+        return id;
+    }
+
+    void valueType(uint32_t field, std::pair<std::string_view, std::string_view> typeAndUnit)
+    {
+        ProtoWriter w;
+        w.uint(valueTypeType, string(typeAndUnit.first));
+        w.uint(valueTypeUnit, string(typeAndUnit.second));
+        out.bytes(field, w.buf);
+    }
+
+    uint64_t function(const Frame & frame);
+
+    uint64_t location(const Frame & frame, PosIdx posIdx);
+
+public:
+
+    /**
+     * @param sampleTypes The type and unit of each value of a sample.
+     */
+    PprofBuilder(EvalState & state, std::initializer_list<std::pair<std::string_view, std::string_view>> sampleTypes)
+        : state(state)
+    {
+        /* The string table must start with the empty string. */
+        string("");
+
+        for (auto & type : sampleTypes)
+            valueType(profileSampleType, type);
+    }
+
+    /**
+     * Add a sample for a stack of frames, the outermost first.
+     */
+    void addSample(std::span<const Frame> frames, std::span<const uint64_t> values)
+    {
+        /* pprof wants the leaf first. The location of a frame is the
+           call that it made to the next frame, if any. */
+        locations.clear();
+        for (size_t n = frames.size(); n-- > 0;) {
+            auto & frame = frames[n];
+            PosIdx at = n + 1 < frames.size() ? frames[n + 1].callPos : noPos;
+            if (!at && frame.kind == Frame::Lambda)
+                at = static_cast<const ExprLambda *>(frame.fun)->getPos();
+            locations.push_back(location(frame, at));
+        }
+
+        ProtoWriter w;
+        w.packed(sampleLocationId, locations);
+        w.packed(sampleValue, values);
+        out.bytes(profileSample, w.buf);
+    }
+
+    /**
+     * @return The compressed profile.
+     */
+    std::string finish(
+        std::chrono::system_clock::time_point startTime,
+        std::pair<std::string_view, std::string_view> periodType,
+        uint64_t period,
+        std::string_view defaultSampleType = "")
+    {
+        auto now = std::chrono::system_clock::now();
+        out.uint(profileTimeNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(startTime.time_since_epoch()).count());
+        out.uint(profileDurationNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count());
+        valueType(profilePeriodType, periodType);
+        out.uint(profilePeriod, period);
+        if (!defaultSampleType.empty())
+            out.uint(profileDefaultSampleType, string(defaultSampleType));
+
+        out.buf += stringTable.buf;
+
+        return compress("gzip", out.buf);
+    }
+};
+
+uint64_t PprofBuilder::function(const Frame & frame)
+{
+    auto key = std::pair{frame.kind, frame.fun};
+    if (frame.kind == Frame::Functor || frame.kind == Frame::Other)
+        /* Nothing is known about these functions except where they
+           were called, so name them after that. */
+        key.second = reinterpret_cast<const void *>(uintptr_t(frame.callPos.hash()));
+    auto i = functionIds.find(key);
+    if (i != functionIds.end())
+        return i->second;
+
+    /* Where the function is defined, or for functions that we know
+       nothing about, where they were called. */
+    auto pos = state.positions
+        [frame.kind == Frame::Lambda ? static_cast<const ExprLambda *>(frame.fun)->getPos()
+         : frame.kind == Frame::Functor || frame.kind == Frame::Other ? frame.callPos
+                                                                      : noPos];
+    auto where = fmt("%s:%d:%d", describeOrigin(pos.origin), pos.line, pos.column);
+
+    std::string name;
+    switch (frame.kind) {
+    case Frame::Lambda:
+        if (auto lambdaName = static_cast<const ExprLambda *>(frame.fun)->name)
+            name = state.symbols[lambdaName];
+        else
+            name = fmt("«lambda @ %s»", where);
+        break;
+    case Frame::PrimOp:
+        name = fmt("primop %s", static_cast<const PrimOp *>(frame.fun)->name);
+        break;
+    case Frame::Functor:
+        name = fmt("«functor @ %s»", where);
+        break;
+    case Frame::Other:
+        name = fmt("«call @ %s»", where);
+        break;
+    case Frame::Truncated:
+        name = "«truncated»";
+        break;
+    case Frame::TopLevel:
+        name = "«top level»";
+        break;
+    }
+
+    auto id = functionIds.size() + 1;
+    functionIds.emplace(key, id);
+
+    ProtoWriter w;
+    w.uint(functionId, id);
+    w.uint(functionName, string(name));
+    w.uint(functionSystemName, string(name));
+    if (pos) {
+        w.uint(functionFilename, string(describeOrigin(pos.origin)));
+        w.uint(functionStartLine, pos.line);
+    }
+    out.bytes(profileFunction, w.buf);
+    return id;
+}
+
+uint64_t PprofBuilder::location(const Frame & frame, PosIdx posIdx)
+{
+    auto fun = function(frame);
+    auto pos = state.positions[posIdx];
+    auto key = std::tuple{fun, pos.line, pos.column};
+    auto i = locationIds.find(key);
+    if (i != locationIds.end())
+        return i->second;
+
+    auto id = locationIds.size() + 1;
+    locationIds.emplace(key, id);
+
+    ProtoWriter line;
+    line.uint(lineFunctionId, fun);
+    line.uint(lineLine, pos.line);
+    line.uint(lineColumn, pos.column);
+
+    ProtoWriter w;
+    w.uint(locationId, id);
+    w.bytes(locationLine, line.buf);
+    out.bytes(profileLocation, w.buf);
+    return id;
+}
+
+#ifndef _WIN32
+
+class SignalSampler;
+
+/** The profiler that `SIGPROF` is delivered to. */
+std::atomic<SignalSampler *> activeSampler{nullptr};
+
+/**
+ * Sampling profiler driven by `SIGPROF`.
+ *
+ * The function call hooks maintain a shadow stack of the Nix functions
+ * being called, which is a fixed-size array that is only ever modified
+ * by the evaluating thread. On each tick of `ITIMER_PROF` the signal
+ * handler copies the innermost frames of that stack into a ring buffer
+ * of samples, without allocating or taking locks. The hooks drain the
+ * ring buffer into a map of stacks to sample counts, which is written
+ * as a pprof profile when the profiler is destroyed.
+ *
+ * Unlike `SampleStack`, the hooks never read the clock or allocate, so
+ * they are cheap enough for profiling production evaluations.
+ */
+class SignalSampler : public EvalProfiler
+{
+    /** Maximum number of frames recorded per sample. Deeper stacks are truncated at the root. */
+    static constexpr uint32_t maxSampleDepth = 512;
+
+    /** Number of samples that can be taken before the hooks drain them. */
+    static constexpr uint32_t ringSize = 32;
+
+    struct Sample
+    {
+        uint32_t depth;
+        bool truncated;
+        Frame frames[maxSampleDepth];
+    };
+
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    EvalState & state;
+    std::filesystem::path profileFile;
+    std::chrono::microseconds interval;
+
+    /** The evaluating thread. Calls from other threads are not recorded. */
+    pthread_t thread;
+
+    std::unique_ptr<Frame[]> stack;
+    uint32_t stackSize;
+    std::atomic<uint32_t> depth{0};
+
+    std::unique_ptr<Sample[]> ring;
+    std::atomic<uint32_t> ringHead{0}, ringTail{0};
+    std::atomic<uint64_t> nrDropped{0};
+
+    std::map<std::vector<Frame>, uint64_t> samples;
+
+    std::chrono::system_clock::time_point startTime = std::chrono::system_clock::now();
+
+    struct sigaction oldAction;
+    struct itimerval oldTimer;
+
+    static void onSignal(int)
+    {
+        auto savedErrno = errno;
+        if (auto sampler = activeSampler.load(std::memory_order_relaxed))
+            sampler->takeSample();
+        errno = savedErrno;
+    }
+
+    /** Called from the signal handler. Must be async-signal-safe. */
+    void takeSample()
+    {
+        if (!pthread_equal(pthread_self(), thread)) {
+            nrDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto head = ringHead.load(std::memory_order_relaxed);
+        if (head - ringTail.load(std::memory_order_relaxed) >= ringSize) {
+            nrDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto & sample = ring[head % ringSize];
+        auto d = std::min(depth.load(std::memory_order_relaxed), stackSize);
+        std::atomic_signal_fence(std::memory_order_acquire);
+        auto start = d > maxSampleDepth ? d - maxSampleDepth : 0;
+        sample.depth = d - start;
+        sample.truncated = start > 0;
+        std::copy(&stack[start], &stack[d], sample.frames);
+
+        std::atomic_signal_fence(std::memory_order_release);
+        ringHead.store(head + 1, std::memory_order_relaxed);
+    }
+
+    void drain()
+    {
+        auto head = ringHead.load(std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_acquire);
+        for (auto tail = ringTail.load(std::memory_order_relaxed); tail != head; ++tail) {
+            auto & sample = ring[tail % ringSize];
+            std::vector<Frame> frames;
+            frames.reserve(sample.depth + 1);
+            if (sample.truncated)
+                frames.push_back(Frame{.kind = Frame::Truncated, .callPos = noPos, .fun = nullptr});
+            frames.insert(frames.end(), sample.frames, sample.frames + sample.depth);
+            samples[std::move(frames)]++;
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        ringTail.store(head, std::memory_order_relaxed);
+    }
+
+    void saveProfile();
+
+public:
+
+    SignalSampler(EvalState & state, std::filesystem::path profileFile, uint32_t frequency)
+        : state(state)
+        , profileFile(std::move(profileFile))
+        , interval(std::max<int64_t>(1, 1000000 / frequency))
+        , thread(pthread_self())
+        , stack(std::make_unique<Frame[]>(state.settings.maxCallDepth + 1))
+        , stackSize(state.settings.maxCallDepth + 1)
+        , ring(std::make_unique<Sample[]>(ringSize))
+    {
+        SignalSampler * expected = nullptr;
+        if (!activeSampler.compare_exchange_strong(expected, this))
+            throw Error("only one evaluation can be profiled with 'eval-profiler = pprof' at a time");
+
+        struct sigaction act;
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = onSignal;
+        sigemptyset(&act.sa_mask);
+        act.sa_flags = SA_RESTART;
+        if (sigaction(SIGPROF, &act, &oldAction)) {
+            activeSampler = nullptr;
+            throw SysError("installing handler for SIGPROF");
+        }
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = interval.count() / 1000000;
+        timer.it_interval.tv_usec = interval.count() % 1000000;
+        timer.it_value = timer.it_interval;
+        if (setitimer(ITIMER_PROF, &timer, &oldTimer)) {
+            sigaction(SIGPROF, &oldAction, nullptr);
+            activeSampler = nullptr;
+            throw SysError("starting the profiling timer");
+        }
+    }
+
+    ~SignalSampler()
+    {
+        setitimer(ITIMER_PROF, &oldTimer, nullptr);
+        sigaction(SIGPROF, &oldAction, nullptr);
+        activeSampler = nullptr;
+
+        try {
+            drain();
+            saveProfile();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        if (!pthread_equal(pthread_self(), thread)) [[unlikely]]
+            return;
+
+        if (ringHead.load(std::memory_order_relaxed) != ringTail.load(std::memory_order_relaxed)) [[unlikely]]
+            drain();
+
+        auto d = depth.load(std::memory_order_relaxed);
+        if (d < stackSize) [[likely]]
+            stack[d] = getFrame(state, v, pos);
+        /* Make sure the frame is complete before the signal handler can see it. */
+        std::atomic_signal_fence(std::memory_order_release);
+        depth.store(d + 1, std::memory_order_relaxed);
+    }
+
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        if (!pthread_equal(pthread_self(), thread)) [[unlikely]]
+            return;
+
+        if (auto d = depth.load(std::memory_order_relaxed))
+            depth.store(d - 1, std::memory_order_relaxed);
+    }
+};
+
+void SignalSampler::saveProfile()
+{
+    PprofBuilder profile(state, {{"samples", "count"}, {"cpu", "nanoseconds"}});
+
+    auto periodNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+
+    for (auto & [frames, count] : samples) {
+        std::array<uint64_t, 2> values{count, count * periodNanos};
+        profile.addSample(frames, values);
+    }
+
+    if (auto dropped = nrDropped.load())
+        debug("eval profiler dropped %d samples", dropped);
+
+    writeFile(profileFile, profile.finish(startTime, {"cpu", "nanoseconds"}, periodNanos));
+}
+
+#endif
+
+/**
+ * Profiler that attributes the memory allocated by the evaluator to the
+ * Nix call stack.
+ *
+ * The hooks maintain a tree of the call stacks seen so far. Whenever a
+ * function is entered or left, the growth of the arena and of the
+ * other evaluator allocations since the previous call is added to the
+ * node of the function that was running, so the allocations themselves
+ * are not slowed down. Since the evaluator never frees memory, the
+ * profile shows both allocated and retained memory.
+ */
+class HeapProfiler : public EvalProfiler
+{
+    struct Node
+    {
+        Node * parent;
+        Frame frame;
+        uint64_t objects = 0;
+        uint64_t bytes = 0;
+        std::map<Frame, std::unique_ptr<Node>> children;
+    };
+
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    EvalState & state;
+    std::filesystem::path profileFile;
+
+    Node root{.parent = nullptr, .frame = {.kind = Frame::TopLevel, .callPos = noPos, .fun = nullptr}};
+    Node * current = &root;
+
+    EvalState::CountHeapBytes countHeapBytes;
+
+    uint64_t lastObjects, lastBytes;
+
+    std::chrono::system_clock::time_point startTime = std::chrono::system_clock::now();
+
+    void account()
+    {
+        auto arena = state.arena.totals();
+        auto bytes = arena.bytesUsed + EvalState::nrHeapBytes;
+        current->objects += arena.nrObjects - lastObjects;
+        current->bytes += bytes - lastBytes;
+        lastObjects = arena.nrObjects;
+        lastBytes = bytes;
+    }
+
+    void saveProfile()
+    {
+        PprofBuilder profile(state, {{"alloc_objects", "count"}, {"alloc_space", "bytes"}});
+
+        std::vector<Frame> frames;
+        std::function<void(const Node &)> visit = [&](const Node & node) {
+            frames.push_back(node.frame);
+            if (node.objects || node.bytes) {
+                std::array<uint64_t, 2> values{node.objects, node.bytes};
+                profile.addSample(frames, values);
+            }
+            for (auto & [_, child] : node.children)
+                visit(*child);
+            frames.pop_back();
+        };
+        visit(root);
+
+        writeFile(profileFile, profile.finish(startTime, {"space", "bytes"}, 1, "alloc_space"));
+    }
+
+public:
+
+    HeapProfiler(EvalState & state, std::filesystem::path profileFile)
+        : state(state)
+        , profileFile(std::move(profileFile))
+    {
+        auto arena = state.arena.totals();
+        lastObjects = arena.nrObjects;
+        lastBytes = arena.bytesUsed + EvalState::nrHeapBytes;
+    }
+
+    ~HeapProfiler()
+    {
+        try {
+            account();
+            saveProfile();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        account();
+        auto frame = getFrame(state, v, pos);
+        auto & child = current->children[frame];
+        if (!child)
+            child = std::make_unique<Node>(Node{.parent = current, .frame = frame});
+        current = child.get();
+    }
+
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        account();
+        if (current->parent)
+            current = current->parent;
+    }
+};
+
+} // namespace
+
+ref<EvalProfiler> makeSignalSampleProfiler(EvalState & state, std::filesystem::path profileFile, uint32_t frequency)
+{
+#ifndef _WIN32
+    if (frequency == 0)
+        throw UsageError("'eval-profiler-frequency' must not be 0 with 'eval-profiler = pprof'");
+    return make_ref<SignalSampler>(state, std::move(profileFile), frequency);
+#else
+    throw UnimplementedError("'eval-profiler = pprof' is not supported on this platform");
+#endif
+}
+
+ref<EvalProfiler> makeHeapProfiler(EvalState & state, std::filesystem::path profileFile)
+{
+    return make_ref<HeapProfiler>(state, std::move(profileFile));
+}
+
+}
@@ -11,6 +11,8 @@
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/expr/function-trace.hh"
+#include "nix/expr/parse-cache.hh"
+#include "nix/util/users.hh"
 #include "nix/store/profiles.hh"
 #include "nix/expr/print.hh"
 #include "nix/fetchers/filtering-source-accessor.hh"
@@ -49,6 +51,7 @@ static char * allocString(size_t size)
     char * t;
     t = (char *) GC_MALLOC_ATOMIC(size);
     if (!t) throw std::bad_alloc();
+    EvalState::countHeapBytes(size);
     return t;
 }
 
@@ -128,6 +131,7 @@ std::string showType(const Value & v)
     #pragma GCC diagnostic ignored "-Wswitch-enum"
     switch (v.internalType) {
         case tString: return v.payload.string.context ? "a string with context" : "a string";
+        case tStringRope: return v.payload.rope->hasContext ? "a string with context" : "a string";
         case tPrimOp:
             return fmt("the built-in function '%s'", std::string(v.payload.primOp->name));
         case tPrimOpApp:
@@ -336,6 +340,12 @@ EvalState::EvalState(
     vStringSymlink.mkString("symlink");
     vStringUnknown.mkString("unknown");
 
+    if (settings.useParseCache)
+        parseCache = std::make_shared<ParseCache>(std::filesystem::path(getCacheDir()) / "parse-cache-v1");
+
+    if (settings.evalMemoize)
+        memoCache = std::make_unique<EvalMemoCache>(settings.evalMemoizeSize);
+
     /* Construct the Nix expression search path. */
     assert(lookupPath.elements.empty());
     if (!settings.pureEval) {
@@ -374,6 +384,13 @@ EvalState::EvalState(
         profiler.addProfiler(makeSampleStackProfiler(
             *this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
         break;
+    case EvalProfilerMode::pprof:
+        profiler.addProfiler(makeSignalSampleProfiler(
+            *this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
+        break;
+    case EvalProfilerMode::heap:
+        profiler.addProfiler(makeHeapProfiler(*this, settings.evalProfileFile.get()));
+        break;
     case EvalProfilerMode::disabled:
         break;
     }
@@ -885,9 +902,19 @@ void Value::mkString(std::string_view s)
 }
 
 
+std::atomic<uint64_t> EvalState::nrStringContexts = 0;
+std::atomic<uint64_t> EvalState::nrStringContextElems = 0;
+std::atomic<uint64_t> EvalState::nrStringContextsShared = 0;
+std::atomic<uint64_t> EvalState::nrStringRopes = 0;
+std::atomic<uint64_t> EvalState::nrStringRopesFlattened = 0;
+thread_local uint64_t EvalState::nrHeapBytes = 0;
+std::atomic<uint32_t> EvalState::nrHeapByteCounters = 0;
+
 static const char * * encodeContext(const NixStringContext & context)
 {
     if (!context.empty()) {
+        EvalState::nrStringContexts.fetch_add(1, std::memory_order_relaxed);
+        EvalState::nrStringContextElems.fetch_add(context.size(), std::memory_order_relaxed);
         size_t n = 0;
         auto ctx = (const char * *)
             allocBytes((context.size() + 1) * sizeof(char *));
@@ -905,6 +932,11 @@ void Value::mkString(std::string_view s, const NixStringContext & context)
     mkString(makeImmutableString(s), encodeContext(context));
 }
 
+void Value::mkString(std::string_view s, const char * * context)
+{
+    mkString(makeImmutableString(s), context);
+}
+
 void Value::mkStringMove(const char * s, const NixStringContext & context)
 {
     mkString(s, encodeContext(context));
@@ -1435,21 +1467,26 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
                 showAttrPath(state, env, attrPath))
             : nullptr;
 
-        for (auto & i : attrPath) {
+        for (auto [n, i] : enumerate(attrPath)) {
             state.nrLookups++;
             const Attr * j;
             auto name = getName(i, state, env);
+            auto lookup = [&]() {
+                return n < lookupCaches.size()
+                    ? vAttrs->attrs()->get(name, lookupCaches[n])
+                    : vAttrs->attrs()->get(name);
+            };
             if (def) {
                 state.forceValue(*vAttrs, pos);
                 if (vAttrs->type() != nAttrs ||
-                    !(j = vAttrs->attrs()->get(name)))
+                    !(j = lookup()))
                 {
                     def->eval(state, env, v);
                     return;
                 }
             } else {
                 state.forceAttrs(*vAttrs, pos, "while selecting an attribute");
-                if (!(j = vAttrs->attrs()->get(name))) {
+                if (!(j = lookup())) {
                     StringSet allAttrNames;
                     for (auto & attr : *vAttrs->attrs())
                         allAttrNames.insert(std::string(state.symbols[attr.name]));
@@ -1526,18 +1563,53 @@ void ExprLambda::eval(EvalState & state, Env & env, Value & v)
     v.mkLambda(&env, this);
 }
 
-void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes, const PosIdx pos)
+class EvalState::FunctionCallScope
+{
+    EvalState & state;
+    CallDepth level;
+    Value & fun;
+    std::span<Value *> args;
+    PosIdx pos;
+
+public:
+
+    FunctionCallScope(EvalState & state, Value & fun, std::span<Value *> args, const PosIdx pos)
+        : state(state)
+        , level(state.addCallDepth(pos))
+        , fun(fun)
+        , args(args)
+        , pos(pos)
+    {
+        if (state.profiler.getNeededHooks().test(EvalProfiler::preFunctionCall)) [[unlikely]]
+            state.profiler.preFunctionCallHook(state, fun, args, pos);
+    }
+
+    ~FunctionCallScope()
+    {
+        if (state.profiler.getNeededHooks().test(EvalProfiler::postFunctionCall)) [[unlikely]]
+            state.profiler.postFunctionCallHook(state, fun, args, pos);
+    }
+};
+
+
+void EvalState::invokePrimOp(const PrimOp & fn, const PosIdx primOpPos, Value * * args, Value & vRes, const PosIdx pos)
 {
-    auto _level = addCallDepth(pos);
+    nrPrimOpCalls++;
+    if (countCalls) primOpCalls[fn.name]++;
+
+    try {
+        fn.fun(*this, primOpPos, args, vRes);
+    } catch (Error & e) {
+        if (fn.addTrace)
+            addErrorTrace(e, pos, "while calling the '%1%' builtin", fn.name);
+        throw;
+    }
+}
 
-    auto neededHooks = profiler.getNeededHooks();
-    if (neededHooks.test(EvalProfiler::preFunctionCall)) [[unlikely]]
-        profiler.preFunctionCallHook(*this, fun, args, pos);
 
-    Finally traceExit_{[&](){
-        if (profiler.getNeededHooks().test(EvalProfiler::postFunctionCall)) [[unlikely]]
-            profiler.postFunctionCallHook(*this, fun, args, pos);
-    }};
+void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes, const PosIdx pos)
+{
+    FunctionCallScope scope(*this, fun, args, pos);
 
     forceValue(fun, pos);
 
@@ -1629,6 +1701,19 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 }
             }
 
+            /* Look up the result only now, so that the argument of a
+               lambda with formals has been forced and can be compared
+               by its attributes. */
+            std::optional<EvalMemoCache::Key> memoKey;
+            if (memoCache) [[unlikely]] {
+                memoKey = EvalMemoCache::lambdaKey(lambda, vCur.payload.lambda.env, *args[0]);
+                if (auto res = memoCache->lookup(*memoKey)) {
+                    vCur = *res;
+                    args = args.subspan(1);
+                    continue;
+                }
+            }
+
             nrFunctionCalls++;
             if (countCalls) incrFunctionCall(&lambda);
 
@@ -1644,6 +1729,9 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                     : nullptr;
 
                 lambda.body->eval(*this, env2, vCur);
+
+                if (memoKey) [[unlikely]]
+                    memoCache->insert(*memoKey, vCur);
             } catch (Error & e) {
                 if (loggerSettings.showTrace.get()) {
                     addErrorTrace(
@@ -1671,18 +1759,7 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 return;
             } else {
                 /* We have all the arguments, so call the primop. */
-                auto * fn = vCur.primOp();
-
-                nrPrimOpCalls++;
-                if (countCalls) primOpCalls[fn->name]++;
-
-                try {
-                    fn->fun(*this, vCur.determinePos(noPos), args.data(), vCur);
-                } catch (Error & e) {
-                    if (fn->addTrace)
-                        addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
-                    throw;
-                }
+                invokePrimOp(*vCur.primOp(), vCur.determinePos(noPos), args.data(), vCur, pos);
 
                 args = args.subspan(argsLeft);
             }
@@ -1716,21 +1793,9 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                 for (size_t i = 0; i < argsLeft; ++i)
                     vArgs[argsDone + i] = args[i];
 
-                auto fn = primOp->primOp();
-                nrPrimOpCalls++;
-                if (countCalls) primOpCalls[fn->name]++;
-
-                try {
-                    // TODO:
-                    // 1. Unify this and above code. Heavily redundant.
-                    // 2. Create a fake env (arg1, arg2, etc.) and a fake expr (arg1: arg2: etc: builtins.name arg1 arg2 etc)
-                    //    so the debugger allows to inspect the wrong parameters passed to the builtin.
-                    fn->fun(*this, vCur.determinePos(noPos), vArgs, vCur);
-                } catch (Error & e) {
-                    if (fn->addTrace)
-                        addErrorTrace(e, pos, "while calling the '%1%' builtin", fn->name);
-                    throw;
-                }
+                // TODO: Create a fake env (arg1, arg2, etc.) and a fake expr (arg1: arg2: etc: builtins.name arg1 arg2 etc)
+                // so the debugger allows to inspect the wrong parameters passed to the builtin.
+                invokePrimOp(*primOp->primOp(), vCur.determinePos(noPos), vArgs, vCur, pos);
 
                 args = args.subspan(argsLeft);
             }
@@ -1776,6 +1841,14 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
         )
         : nullptr;
 
+    if (knownPrimOp) {
+        Value * vArgs[maxPrimOpArity];
+        for (size_t i = 0; i < args.size(); ++i)
+            vArgs[i] = args[i]->maybeThunk(state, env);
+        state.callPrimOp(*knownPrimOp, {vArgs, args.size()}, v, pos);
+        return;
+    }
+
     Value vFun;
     fun->eval(state, env, vFun);
 
@@ -1793,6 +1866,24 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
 }
 
 
+void EvalState::callPrimOp(Value & fun, std::span<Value *> args, Value & vRes, const PosIdx pos)
+{
+    FunctionCallScope scope(*this, fun, args, pos);
+
+    auto * fn = fun.primOp();
+    assert(args.size() == fn->arity);
+
+    nrKnownPrimOpCalls++;
+
+    /* As in callFunction(), don't let the primop write to `vRes`
+       directly, since `vRes` may be a blackholed thunk that its
+       arguments refer to. */
+    Value vCur;
+    invokePrimOp(*fn, fun.determinePos(noPos), args.data(), vCur, pos);
+    vRes = vCur;
+}
+
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -1940,17 +2031,40 @@ void ExprOpUpdate::eval(EvalState & state, Env & env, Value & v)
 
     state.nrOpUpdates++;
 
-    if (v1.attrs()->size() == 0) { v = v2; return; }
-    if (v2.attrs()->size() == 0) { v = v1; return; }
+    auto & bindings1 = *v1.attrs();
+    auto & bindings2 = *v2.attrs();
+
+    if (bindings1.size() == 0) { v = v2; return; }
+    if (bindings2.size() == 0) { v = v1; return; }
+
+    /* If the second set is small compared to the first (as in
+       `drv // { passthru = ...; }` or a chain of overrides), don't copy
+       the first set but put the second one on top of it as a new
+       layer. When the chain gets too long, we fall through to copying,
+       which flattens it again. Small sets are always copied, since
+       that is cheap and keeps lookups and iteration fast. */
+    if (bindings1.nrLayers() < Bindings::maxLayers
+        && bindings1.size() >= 32
+        && bindings2.size() * 4 <= bindings1.size())
+    {
+        auto attrs = state.buildBindings(bindings2.size());
+        attrs.layerOnTopOf(bindings1);
+        for (auto & a : bindings2)
+            attrs.insert(a);
+        v.mkAttrs(attrs.alreadySorted());
+        state.nrOpUpdateLayers++;
+        state.nrOpUpdateValuesCopied += bindings2.size();
+        return;
+    }
 
-    auto attrs = state.buildBindings(v1.attrs()->size() + v2.attrs()->size());
+    auto attrs = state.buildBindings(bindings1.size() + bindings2.size());
 
     /* Merge the sets, preferring values from the second set.  Make
        sure to keep the resulting vector in sorted order. */
-    auto i = v1.attrs()->begin();
-    auto j = v2.attrs()->begin();
+    auto i = bindings1.begin(), iEnd = bindings1.end();
+    auto j = bindings2.begin(), jEnd = bindings2.end();
 
-    while (i != v1.attrs()->end() && j != v2.attrs()->end()) {
+    while (i != iEnd && j != jEnd) {
         if (i->name == j->name) {
             attrs.insert(*j);
             ++i; ++j;
@@ -1961,8 +2075,8 @@ void ExprOpUpdate::eval(EvalState & state, Env & env, Value & v)
             attrs.insert(*j++);
     }
 
-    while (i != v1.attrs()->end()) attrs.insert(*i++);
-    while (j != v2.attrs()->end()) attrs.insert(*j++);
+    while (i != iEnd) attrs.insert(*i++);
+    while (j != jEnd) attrs.insert(*j++);
 
     v.mkAttrs(attrs.alreadySorted());
 
@@ -1993,6 +2107,7 @@ void EvalState::concatLists(Value & v, size_t nrLists, Value * const * lists, co
     }
 
     if (nonEmpty && len == nonEmpty->listSize()) {
+        nrListElemsShared += len;
         v = *nonEmpty;
         return;
     }
@@ -2009,11 +2124,210 @@ void EvalState::concatLists(Value & v, size_t nrLists, Value * const * lists, co
 }
 
 
+void EvalState::mkListSlice(Value & v, const Value & list, size_t start, size_t len)
+{
+    assert(start + len <= list.listSize());
+
+    nrListSlices++;
+    nrListElemsShared += len;
+
+    if (len == list.listSize())
+        v = list;
+    else
+        v.mkListSlice(len, list.listElems() + start);
+}
+
+
+const char * * StringContextBuilder::finish()
+{
+    if (context.empty()) {
+        if (encoded.empty()) return nullptr;
+        if (encoded.size() == 1) {
+            EvalState::nrStringContextsShared.fetch_add(1, std::memory_order_relaxed);
+            return encoded[0];
+        }
+    }
+
+    /* Encoded elements are canonical, so equal elements are equal
+       strings. */
+    SmallVector<const char *, 16> elems;
+    for (auto ctx : encoded)
+        for (auto p = ctx; *p; ++p)
+            elems.push_back(*p);
+    for (auto & i : context)
+        elems.push_back(makeImmutableString(i.to_string()));
+
+    auto less = [](const char * a, const char * b) { return strcmp(a, b) < 0; };
+    auto equal = [](const char * a, const char * b) { return a == b || strcmp(a, b) == 0; };
+    std::sort(elems.begin(), elems.end(), less);
+    elems.erase(std::unique(elems.begin(), elems.end(), equal), elems.end());
+
+    /* Reuse an input that already has all the elements, as in
+       "${x}/${x}". */
+    if (context.empty())
+        for (auto ctx : encoded) {
+            size_t n = 0;
+            while (ctx[n]) n++;
+            if (n == elems.size()) {
+                EvalState::nrStringContextsShared.fetch_add(1, std::memory_order_relaxed);
+                return ctx;
+            }
+        }
+
+    EvalState::nrStringContexts.fetch_add(1, std::memory_order_relaxed);
+    EvalState::nrStringContextElems.fetch_add(elems.size(), std::memory_order_relaxed);
+
+    auto res = (const char * *) allocBytes((elems.size() + 1) * sizeof(char *));
+    std::copy(elems.begin(), elems.end(), res);
+    res[elems.size()] = nullptr;
+    return res;
+}
+
+
+/**
+ * Call `f` on the parts of `rope` in order, descending into the parts
+ * that are ropes themselves unless `stop` returns true for them. This
+ * uses an explicit stack, because ropes built by folds over long lists
+ * are very deep.
+ */
+template<typename Stop, typename F>
+static void forEachPart(const StringRope & rope, Stop && stop, F && f)
+{
+    std::vector<std::pair<const StringRope *, size_t>> stack{{&rope, 0}};
+    while (!stack.empty()) {
+        auto & [r, i] = stack.back();
+        if (i == r->nrParts) {
+            stack.pop_back();
+            continue;
+        }
+        auto & part = r->parts[i++];
+        if (part.rope && !stop(*part.rope))
+            stack.push_back({part.rope, 0});
+        else
+            f(part);
+    }
+}
+
+void StringRope::flatten() const
+{
+    EvalState::nrStringRopesFlattened.fetch_add(1, std::memory_order_relaxed);
+
+    auto res = allocString(size + 1);
+    auto p = res;
+    forEachPart(*this,
+        [](const StringRope & r) { return r.flat != nullptr; },
+        [&](const Part & part) {
+            memcpy(p, part.rope ? part.rope->flat : part.s, part.size);
+            p += part.size;
+        });
+    assert(p == res + size);
+    *p = 0;
+
+    /* Merge the context now, so that the parts can be released to
+       the garbage collector. The rope was allocated as non-const by
+       `StringRopeBuilder`. */
+    context();
+    flat = res;
+    auto self = const_cast<StringRope *>(this);
+    std::fill_n(self->parts, nrParts, Part{});
+    self->nrParts = 0;
+}
+
+void StringRope::mergeContext() const
+{
+    StringContextBuilder res;
+    forEachPart(*this,
+        [](const StringRope & r) { return !r.hasContext || r.flatContext; },
+        [&](const Part & part) {
+            if (auto ctx = part.rope ? part.rope->flatContext : part.context)
+                res.encoded.push_back(ctx);
+        });
+    flatContext = res.finish();
+}
+
+void StringRopeBuilder::add(const Value & v)
+{
+    if (auto rope = v.stringRope()) {
+        if (rope->size)
+            parts.push_back({.s = nullptr, .rope = rope, .size = rope->size, .context = nullptr});
+        size += rope->size;
+        hasContext |= rope->hasContext;
+    } else {
+        auto s = v.string_view();
+        if (!s.empty() || v.context())
+            parts.push_back({.s = s.data(), .rope = nullptr, .size = s.size(), .context = v.context()});
+        size += s.size();
+        hasContext |= v.context() != nullptr;
+    }
+}
+
+void StringRopeBuilder::add(std::string_view s, const NixStringContext & context)
+{
+    auto ctx = encodeContext(context);
+    if (!s.empty() || ctx)
+        parts.push_back({.s = makeImmutableString(s), .rope = nullptr, .size = s.size(), .context = ctx});
+    size += s.size();
+    hasContext |= ctx != nullptr;
+}
+
+void StringRopeBuilder::addContext(const Value & v)
+{
+    if (auto ctx = v.context()) {
+        parts.push_back({.s = "", .rope = nullptr, .size = 0, .context = ctx});
+        hasContext = true;
+    }
+}
+
+void StringRopeBuilder::finish(Value & v)
+{
+    if (parts.empty()) {
+        v.mkString("", nullptr);
+        return;
+    }
+
+    /* A single part is reused as is, as in "${x}". */
+    if (parts.size() == 1) {
+        auto & part = parts[0];
+        if (part.rope)
+            v.mkString(part.rope);
+        else
+            v.mkString(part.s, part.context);
+        return;
+    }
+
+    if (size < minRopeSize) {
+        StringContextBuilder context;
+        auto res = allocString(size + 1);
+        auto p = res;
+        for (auto & part : parts) {
+            auto s = part.rope ? part.rope->c_str() : part.s;
+            memcpy(p, s, part.size);
+            p += part.size;
+            if (auto ctx = part.rope ? part.rope->context() : part.context)
+                context.encoded.push_back(ctx);
+        }
+        *p = 0;
+        v.mkString(res, context.finish());
+        return;
+    }
+
+    EvalState::nrStringRopes.fetch_add(1, std::memory_order_relaxed);
+
+    auto rope = new (allocBytes(sizeof(StringRope) + parts.size() * sizeof(StringRope::Part))) StringRope;
+    rope->size = size;
+    rope->hasContext = hasContext;
+    rope->nrParts = parts.size();
+    std::copy(parts.begin(), parts.end(), rope->parts);
+    v.mkString(rope);
+}
+
+
 void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
 {
-    NixStringContext context;
+    StringContextBuilder context;
     std::vector<BackedStringView> s;
     size_t sSize = 0;
+    StringRopeBuilder res;
     NixInt n{0};
     NixFloat nf = 0;
 
@@ -2026,19 +2340,6 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
         for (const auto & part : s) result += *part;
         return result;
     };
-    /* c_str() is not str().c_str() because we want to create a string
-       Value. allocating a GC'd string directly and moving it into a
-       Value lets us avoid an allocation and copy. */
-    const auto c_str = [&] {
-        char * result = allocString(sSize + 1);
-        char * tmp = result;
-        for (const auto & part : s) {
-            memcpy(tmp, part->data(), part->size());
-            tmp += part->size();
-        }
-        *tmp = 0;
-        return result;
-    };
 
     // List of returned strings. References to these Values must NOT be persisted.
     SmallTemporaryValueVector<conservativeStackReservation> values(es->size());
@@ -2078,6 +2379,18 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
                 nf += vTmp.fpoint();
             } else
                 state.error<EvalError>("cannot add %1% to a float", showType(vTmp)).atPos(i_pos).withFrame(env, *this).debugThrow();
+        } else if (firstType != nPath) {
+            /* Strings are shared rather than copied, so that a large
+               result can become a rope. */
+            if (vTmp.type() == nString)
+                res.add(vTmp);
+            else {
+                NixStringContext partContext;
+                auto part = state.coerceToString(i_pos, vTmp, partContext,
+                                                 "while evaluating a path segment",
+                                                 false, firstType == nString, !first);
+                res.add(*part, partContext);
+            }
         } else {
             if (s.empty()) s.reserve(es->size());
             /* skip canonization of first path, which would only be not
@@ -2085,7 +2398,7 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             path */
             auto part = state.coerceToString(i_pos, vTmp, context,
                                              "while evaluating a path segment",
-                                             false, firstType == nString, !first);
+                                             false, false, !first);
             sSize += part->size();
             s.emplace_back(std::move(part));
         }
@@ -2102,7 +2415,7 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             state.error<EvalError>("a string that refers to a store path cannot be appended to a path").atPos(pos).withFrame(env, *this).debugThrow();
         v.mkPath(state.rootPath(CanonPath(str())));
     } else
-        v.mkStringMove(c_str(), context);
+        res.finish(v);
 }
 
 
@@ -2289,8 +2602,8 @@ std::string_view EvalState::forceString(Value & v, const PosIdx pos, std::string
 
 void copyContext(const Value & v, NixStringContext & context, const ExperimentalFeatureSettings & xpSettings)
 {
-    if (v.payload.string.context)
-        for (const char * * p = v.payload.string.context; *p; ++p)
+    if (auto ctx = v.context())
+        for (const char * * p = ctx; *p; ++p)
             context.insert(NixStringContextElem::parse(*p, xpSettings));
 }
 
@@ -2339,6 +2652,26 @@ std::optional<std::string> EvalState::tryAttrsToString(const PosIdx pos, Value &
     return {};
 }
 
+BackedStringView EvalState::coerceToString(
+    const PosIdx pos,
+    Value & v,
+    StringContextBuilder & context,
+    std::string_view errorCtx,
+    bool coerceMore,
+    bool copyToStore,
+    bool canonicalizePath)
+{
+    forceValue(v, pos);
+
+    if (v.type() == nString) {
+        context.add(v);
+        return v.string_view();
+    }
+
+    return coerceToString(pos, v, context.context, errorCtx, coerceMore, copyToStore, canonicalizePath);
+}
+
+
 BackedStringView EvalState::coerceToString(
     const PosIdx pos,
     Value & v,
@@ -2876,7 +3209,7 @@ void EvalState::printStatistics()
     uint64_t bEnvs = nrEnvs * sizeof(Env) + nrValuesInEnvs * sizeof(Value *);
     uint64_t bLists = nrListElems * sizeof(Value *);
     uint64_t bValues = nrValues * sizeof(Value);
-    uint64_t bAttrsets = nrAttrsets * sizeof(Bindings) + nrAttrsInAttrsets * sizeof(Attr);
+    uint64_t bAttrsets = nrAttrsets * sizeof(Bindings) + nrAttrsInAttrsets * sizeof(Attr) + nrAttrsetIndexBytes;
 
     auto outPath = getEnv("NIX_SHOW_STATS_PATH").value_or("-");
     std::fstream fs;
@@ -2897,6 +3230,25 @@ void EvalState::printStatistics()
         {"elements", nrListElems},
         {"bytes", bLists},
         {"concats", nrListConcats},
+        {"slices", nrListSlices},
+        {"shared", nrListElemsShared},
+        {"bytesSaved", nrListElemsShared * sizeof(Value *)},
+    };
+    uint64_t bStringContexts = (nrStringContexts.load() + nrStringContextElems.load()) * sizeof(char *);
+    topObj["stringContexts"] = {
+        {"number", nrStringContexts.load()},
+        {"elements", nrStringContextElems.load()},
+        {"bytes", bStringContexts},
+        {"shared", nrStringContextsShared.load()},
+    };
+    topObj["stringRopes"] = {
+        {"number", nrStringRopes.load()},
+        {"flattened", nrStringRopesFlattened.load()},
+    };
+    topObj["derivations"] = {
+        {"number", nrDerivations},
+        {"stringContextBytesPerDerivation", nrDerivations ? bStringContexts / nrDerivations : 0},
+        {"stringContextsPerDerivation", nrDerivations ? (double) nrStringContexts.load() / nrDerivations : 0},
     };
     topObj["values"] = {
         {"number", nrValues},
@@ -2910,19 +3262,55 @@ void EvalState::printStatistics()
         {"number", nrAttrsets},
         {"bytes", bAttrsets},
         {"elements", nrAttrsInAttrsets},
+        {"index", {
+            {"bytes", nrAttrsetIndexBytes},
+            {"number", Bindings::nrIndexes.load()},
+            {"hits", Bindings::nrIndexedHits.load()},
+            {"misses", Bindings::nrIndexedMisses.load()},
+        }},
+        {"lookupCache", {
+            {"hits", Bindings::nrLookupCacheHits.load()},
+            {"misses", Bindings::nrLookupCacheMisses.load()},
+        }},
     };
+    if (memoCache)
+        topObj["memo"] = {
+            {"hits", memoCache->stats.hits},
+            {"misses", memoCache->stats.misses},
+            {"flushes", memoCache->stats.flushes},
+            {"entries", memoCache->size()},
+        };
     topObj["sizes"] = {
         {"Env", sizeof(Env)},
         {"Value", sizeof(Value)},
         {"Bindings", sizeof(Bindings)},
         {"Attr", sizeof(Attr)},
     };
+    auto arenaStats = [](const EvalArena::Stats & s) -> json {
+        return {
+            {"objects", s.nrObjects},
+            {"chunks", s.nrChunks},
+            {"bytesUsed", s.bytesUsed},
+            {"bytesReserved", s.bytesReserved},
+        };
+    };
+    topObj["arena"] = arenaStats(arena.totals());
+    topObj["arena"]["values"] = arenaStats(arena.stats(EvalArena::scValue));
+    topObj["arena"]["envs"] = arenaStats(arena.stats(EvalArena::scEnv));
+    topObj["arena"]["sets"] = arenaStats(arena.stats(EvalArena::scBindings));
+    if (parseCache)
+        topObj["parseCache"] = {
+            {"hits", parseCache->nrHits},
+            {"misses", parseCache->nrMisses},
+        };
     topObj["nrOpUpdates"] = nrOpUpdates;
     topObj["nrOpUpdateValuesCopied"] = nrOpUpdateValuesCopied;
+    topObj["nrOpUpdateLayers"] = nrOpUpdateLayers;
     topObj["nrThunks"] = nrThunks;
     topObj["nrAvoided"] = nrAvoided;
     topObj["nrLookups"] = nrLookups;
     topObj["nrPrimOpCalls"] = nrPrimOpCalls;
+    topObj["nrKnownPrimOpCalls"] = nrKnownPrimOpCalls;
     topObj["nrFunctionCalls"] = nrFunctionCalls;
 
     if (countCalls) {
@@ -3011,7 +3399,25 @@ Expr * EvalState::parseExprFromFile(const SourcePath & path, std::shared_ptr<Sta
     auto buffer = path.resolveSymlinks().readFile();
     // readFile hopefully have left some extra space for terminators
     buffer.append("\0\0", 2);
-    return parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv);
+
+    if (!parseCache)
+        return parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv);
+
+    /* The parser modifies the buffer, so compute the key first. */
+    auto basePath = path.parent();
+    auto key = parseCache->key(*this, buffer, basePath);
+    auto origin = positions.addOrigin(path, buffer.size());
+    auto & docComments = positionToDocComment[path];
+
+    auto result = parseCache->lookup(*this, key, origin, basePath, docComments);
+    if (!result) {
+        result = parseExprFromBuf(buffer.data(), buffer.size(), origin, basePath, symbols, settings, positions, docComments, rootFS, exprSymbols);
+        parseCache->insert(*this, key, result, origin, basePath, docComments);
+    }
+
+    result->bindVars(*this, staticEnv);
+
+    return result;
 }
 
 
@@ -3161,7 +3567,7 @@ Expr * EvalState::parse(
         docComments = &it->second;
     }
 
-    auto result = parseExprFromBuf(text, length, origin, basePath, symbols, settings, positions, *docComments, rootFS, exprSymbols);
+    auto result = parseExprFromBuf(text, length, positions.addOrigin(origin, length), basePath, symbols, settings, positions, *docComments, rootFS, exprSymbols);
 
     result->bindVars(*this, staticEnv);
 
@@ -5,6 +5,10 @@
 #include "nix/expr/symbol-table.hh"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <iterator>
 
 namespace nix {
 
@@ -43,6 +47,21 @@ static_assert(sizeof(Attr) == 2 * sizeof(uint32_t) + sizeof(Value *),
  * by its size and its capacity, the capacity being the number of Attr
  * elements allocated after this structure, while the size corresponds to
  * the number of elements already inserted in this structure.
+ *
+ * Large sets (at least `minIndexedSize` elements of capacity) also have
+ * space for a hash index after the attributes: an open-addressing table
+ * of positions in `attrs`, keyed by symbol. It is built on the first
+ * lookup after the set was last modified, so that sets that are never
+ * looked up don't pay for it, and turns a lookup into (typically) a
+ * single probe instead of a binary search with a cache miss per step.
+ *
+ * A set can also be a layer on top of a base set, which is how `a // b`
+ * is represented when `b` is small compared to `a`: the layer only
+ * contains the attributes of `b`, and attributes of the base that have
+ * the same name are shadowed. Lookups try each layer in turn, and
+ * iteration merges the layers, so this is invisible to users of
+ * Bindings. The number of layers is bounded by `maxLayers`; `//` copies
+ * the attributes into a flat set when it would be exceeded.
  */
 class Bindings
 {
@@ -50,50 +69,295 @@ public:
     typedef uint32_t size_t;
     PosIdx pos;
 
+    /**
+     * Sets with a capacity below this are searched by binary search
+     * only.
+     */
+    static constexpr size_t minIndexedSize = 64;
+
+    /**
+     * The maximum length of a chain of layers, including the bottom
+     * one.
+     */
+    static constexpr unsigned int maxLayers = 8;
+
+    /**
+     * Statistics about lookups in the hash index, for
+     * `EvalState::printStatistics()`. Atomic because several
+     * evaluators can run in parallel.
+     */
+    static std::atomic<uint64_t> nrIndexes, nrIndexedHits, nrIndexedMisses;
+
+    /**
+     * Statistics about `get(Symbol, AttrLookupCache &)`.
+     */
+    static std::atomic<uint64_t> nrLookupCacheHits, nrLookupCacheMisses;
+
+    /**
+     * The log2 of the number of slots of the hash index of a set with
+     * the given capacity, or 0 if it doesn't get one.
+     */
+    static unsigned int indexBitsFor(size_t capacity)
+    {
+        if (capacity < minIndexedSize) return 0;
+        /* Keep the load factor at most 2/3. */
+        return std::bit_width(((uint64_t) capacity * 3 / 2) - 1);
+    }
+
 private:
-    size_t size_, capacity_;
+    /**
+     * The number of attributes in this layer.
+     */
+    size_t size_;
+
+    size_t capacity_;
+
+    /**
+     * The number of distinct attributes in this layer and the layers
+     * below it. Only meaningful if `baseLayer_` is set.
+     */
+    size_t totalSize_ = 0;
+
+    uint8_t indexBits_;
+    mutable bool indexed_ = false;
+
+    /**
+     * The number of layers in the chain starting at this one.
+     */
+    uint8_t nrLayers_ = 1;
+
+    const Bindings * baseLayer_ = nullptr;
+
     Attr attrs[0];
 
-    Bindings(size_t capacity) : size_(0), capacity_(capacity) { }
+    Bindings(size_t capacity)
+        : size_(0), capacity_(capacity), indexBits_(indexBitsFor(capacity)) { }
     Bindings(const Bindings & bindings) = delete;
 
+    /**
+     * The hash index, which starts right after the `capacity_`
+     * attributes. A slot contains 1 + the position of an attribute, or
+     * 0 if it is empty.
+     */
+    uint32_t * index() const
+    {
+        return (uint32_t *) &attrs[capacity_];
+    }
+
+    uint64_t indexSlot(Symbol name) const
+    {
+        /* Fibonacci hashing: symbol ids are dense, so take the high
+           bits of the product. */
+        return (std::hash<Symbol>{}(name) * 0x9e3779b97f4a7c15ULL) >> (64 - indexBits_);
+    }
+
+    void buildIndex() const;
+
+    const Attr * lookupIndexed(Symbol name) const
+    {
+        if (!indexed_) buildIndex();
+        auto idx = index();
+        uint64_t mask = ((uint64_t) 1 << indexBits_) - 1;
+        for (auto slot = indexSlot(name); ; slot = (slot + 1) & mask) {
+            auto n = idx[slot];
+            if (!n) {
+                nrIndexedMisses.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            if (attrs[n - 1].name == name) {
+                nrIndexedHits.fetch_add(1, std::memory_order_relaxed);
+                return &attrs[n - 1];
+            }
+        }
+    }
+
+    /**
+     * Look up `name` in this layer only.
+     */
+    const Attr * getInLayer(Symbol name) const
+    {
+        if (indexBits_)
+            return lookupIndexed(name);
+        Attr key(name, 0);
+        auto i = std::lower_bound(&attrs[0], &attrs[size_], key);
+        if (i != &attrs[size_] && i->name == name) return i;
+        return nullptr;
+    }
+
 public:
-    size_t size() const { return size_; }
 
-    bool empty() const { return !size_; }
+    /**
+     * An iterator over the attributes of a set in symbol order. For a
+     * set that has no base layer, this just walks the array. Otherwise
+     * it merges the layers, skipping attributes that are shadowed by a
+     * higher layer.
+     */
+    class const_iterator
+    {
+        struct Layer
+        {
+            const Attr * cur, * end;
+        };
+
+        /**
+         * The current attribute, or `nullptr` at the end of a layered
+         * set.
+         */
+        const Attr * cur = nullptr;
+
+        /**
+         * The positions in each layer, top layer first. Unused (and
+         * `nrLayers` is 0) if the set has a single layer.
+         */
+        std::array<Layer, maxLayers> layers;
+        uint8_t nrLayers = 0;
+
+        /**
+         * Point `cur` to the smallest attribute at the front of any
+         * layer, preferring higher layers.
+         */
+        void pick()
+        {
+            cur = nullptr;
+            for (unsigned int n = 0; n < nrLayers; ++n) {
+                auto & l = layers[n];
+                if (l.cur != l.end && (!cur || l.cur->name < cur->name))
+                    cur = l.cur;
+            }
+        }
+
+        friend class Bindings;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Attr;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Attr *;
+        using reference = const Attr &;
+
+        const_iterator() { }
+
+        const_iterator(const Attr * cur) : cur(cur) { }
+
+        reference operator *() const { return *cur; }
+        pointer operator ->() const { return cur; }
+
+        const_iterator & operator ++()
+        {
+            if (!nrLayers)
+                ++cur;
+            else {
+                auto name = cur->name;
+                for (unsigned int n = 0; n < nrLayers; ++n) {
+                    auto & l = layers[n];
+                    while (l.cur != l.end && l.cur->name == name) ++l.cur;
+                }
+                pick();
+            }
+            return *this;
+        }
+
+        const_iterator operator ++(int)
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        bool operator ==(const const_iterator & other) const
+        {
+            return cur == other.cur;
+        }
+
+        /**
+         * Allow the result of `get()` to be compared with an iterator.
+         */
+        bool operator ==(const Attr * other) const
+        {
+            return cur == other;
+        }
+    };
+
+    typedef const_iterator iterator;
 
-    typedef Attr * iterator;
+    /**
+     * The number of (distinct) attributes in the set.
+     */
+    size_t size() const { return baseLayer_ ? totalSize_ : size_; }
 
-    typedef const Attr * const_iterator;
+    bool empty() const { return !size(); }
 
     void push_back(const Attr & attr)
     {
         assert(size_ < capacity_);
         attrs[size_++] = attr;
+        indexed_ = false;
     }
 
     const_iterator find(Symbol name) const
     {
-        Attr key(name, 0);
-        const_iterator i = std::lower_bound(begin(), end(), key);
-        if (i != end() && i->name == name) return i;
-        return end();
+        auto i = get(name);
+        if (!i) return end();
+        if (!baseLayer_) return i;
+        /* Position every layer after `name`, so that the iterator can
+           be advanced. */
+        auto it = iteratorAt([&](const Attr * b, const Attr * e) {
+            return std::upper_bound(b, e, Attr(name, 0));
+        });
+        it.cur = i;
+        return it;
     }
 
     const Attr * get(Symbol name) const
     {
-        Attr key(name, 0);
-        const_iterator i = std::lower_bound(begin(), end(), key);
-        if (i != end() && i->name == name) return &*i;
+        auto layer = this;
+        do {
+            if (auto i = layer->getInLayer(name))
+                return i;
+            layer = layer->baseLayer_;
+        } while (layer);
         return nullptr;
     }
 
-    iterator begin() { return &attrs[0]; }
-    iterator end() { return &attrs[size_]; }
+    /**
+     * Like `get(name)`, but try the positions remembered in `cache`
+     * first, and remember where `name` was found. Only the top layer is
+     * cached, since an attribute there shadows the layers below it.
+     */
+    const Attr * get(Symbol name, AttrLookupCache & cache) const
+    {
+        for (auto p : cache.positions)
+            if (p < size_ && attrs[p].name == name) {
+                nrLookupCacheHits.fetch_add(1, std::memory_order_relaxed);
+                return &attrs[p];
+            }
+
+        nrLookupCacheMisses.fetch_add(1, std::memory_order_relaxed);
+        auto i = get(name);
+        if (i >= &attrs[0] && i < &attrs[size_]) {
+            cache.positions[cache.next] = i - &attrs[0];
+            cache.next = (cache.next + 1) % AttrLookupCache::nrEntries;
+        }
+        return i;
+    }
 
-    const_iterator begin() const { return &attrs[0]; }
-    const_iterator end() const { return &attrs[size_]; }
+    const_iterator begin() const
+    {
+        if (!baseLayer_) return &attrs[0];
+        auto it = iteratorAt([](const Attr * b, const Attr * e) { return b; });
+        it.pick();
+        return it;
+    }
 
+    const_iterator end() const
+    {
+        if (!baseLayer_) return &attrs[size_];
+        return const_iterator();
+    }
+
+    /**
+     * Access the attributes of this layer, e.g. while building it.
+     */
     Attr & operator[](size_t pos)
     {
         return attrs[pos];
@@ -108,15 +372,19 @@ public:
 
     size_t capacity() const { return capacity_; }
 
+    unsigned int nrLayers() const { return nrLayers_; }
+
+    const Bindings * baseLayer() const { return baseLayer_; }
+
     /**
      * Returns the attributes in lexicographically sorted order.
      */
     std::vector<const Attr *> lexicographicOrder(const SymbolTable & symbols) const
     {
         std::vector<const Attr *> res;
-        res.reserve(size_);
-        for (size_t n = 0; n < size_; n++)
-            res.emplace_back(&attrs[n]);
+        res.reserve(size());
+        for (auto & a : *this)
+            res.emplace_back(&a);
         std::sort(res.begin(), res.end(), [&](const Attr * a, const Attr * b) {
             std::string_view sa = symbols[a->name], sb = symbols[b->name];
             return sa < sb;
@@ -124,7 +392,39 @@ public:
         return res;
     }
 
+private:
+
+    /**
+     * Make this layer a layer on top of `base`.
+     */
+    void setBaseLayer(const Bindings & base)
+    {
+        assert(base.nrLayers_ < maxLayers);
+        baseLayer_ = &base;
+        nrLayers_ = base.nrLayers_ + 1;
+    }
+
+    /**
+     * Compute `totalSize_` once the top layer is complete.
+     */
+    void finishLayer();
+
+    /**
+     * Return an iterator over a layered set where each layer starts at
+     * `start(begin, end)` of that layer.
+     */
+    const_iterator iteratorAt(auto start) const
+    {
+        const_iterator it;
+        for (auto layer = this; layer; layer = layer->baseLayer_) {
+            auto b = &layer->attrs[0], e = &layer->attrs[layer->size_];
+            it.layers[it.nrLayers++] = {start(b, e), e};
+        }
+        return it;
+    }
+
     friend class EvalState;
+    friend class BindingsBuilder;
 };
 
 /**
@@ -165,14 +465,26 @@ public:
 
     Value & alloc(std::string_view name, PosIdx pos = noPos);
 
+    /**
+     * Make the set a layer on top of `base`, so that it only needs to
+     * contain the attributes that are added to or override those of
+     * `base`. `base` must have fewer than `Bindings::maxLayers` layers.
+     */
+    void layerOnTopOf(const Bindings & base)
+    {
+        bindings->setBaseLayer(base);
+    }
+
     Bindings * finish()
     {
         bindings->sort();
+        bindings->finishLayer();
         return bindings;
     }
 
     Bindings * alreadySorted()
     {
+        bindings->finishLayer();
         return bindings;
     }
 
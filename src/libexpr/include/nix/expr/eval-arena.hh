@@ -0,0 +1,125 @@
+#pragma once
+///@file
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nix {
+
+/**
+ * A region allocator for the objects the evaluator creates in bulk and
+ * never frees individually: `Value`, `Env` and `Bindings`.
+ *
+ * Memory is handed out from large, zero-initialised chunks with a bump
+ * pointer. Every size class has its own list of chunks, so objects of
+ * the same kind are laid out next to each other. Nothing is released
+ * until the arena itself is destroyed, at which point all chunks are
+ * freed at once.
+ *
+ * The arena is not thread-safe; it belongs to a single `EvalState`.
+ */
+class EvalArena
+{
+public:
+
+    enum SizeClass : uint8_t {
+        scValue,
+        scEnv,
+        scBindings,
+        nrSizeClasses,
+    };
+
+    struct Stats
+    {
+        /**
+         * Number of objects allocated.
+         */
+        uint64_t nrObjects = 0;
+
+        /**
+         * Number of chunks obtained from the system allocator.
+         */
+        uint64_t nrChunks = 0;
+
+        /**
+         * Bytes handed out to callers, including alignment padding.
+         */
+        uint64_t bytesUsed = 0;
+
+        /**
+         * Bytes obtained from the system allocator.
+         */
+        uint64_t bytesReserved = 0;
+    };
+
+    /**
+     * All allocations are aligned to this many bytes.
+     */
+    static constexpr size_t alignment = 8;
+
+    /**
+     * Size of the first chunk of each size class. Subsequent chunks
+     * double in size up to `maxChunkSize`.
+     */
+    static constexpr size_t minChunkSize = 64 * 1024;
+
+    static constexpr size_t maxChunkSize = 8 * 1024 * 1024;
+
+    EvalArena() = default;
+    EvalArena(const EvalArena &) = delete;
+    EvalArena & operator = (const EvalArena &) = delete;
+    ~EvalArena();
+
+    /**
+     * Allocate `n` zeroed bytes in size class `sc`.
+     */
+    [[gnu::always_inline]]
+    inline void * alloc(SizeClass sc, size_t n)
+    {
+        auto & r = regions[sc];
+        n = (n + alignment - 1) & ~(alignment - 1);
+        r.stats.nrObjects++;
+        if (n <= (size_t) (r.end - r.ptr)) [[likely]] {
+            void * p = r.ptr;
+            r.ptr += n;
+            r.stats.bytesUsed += n;
+            return p;
+        }
+        return allocSlow(r, n);
+    }
+
+    const Stats & stats(SizeClass sc) const
+    {
+        return regions[sc].stats;
+    }
+
+    Stats totals() const;
+
+private:
+
+    struct Chunk
+    {
+        Chunk * next;
+    };
+
+    struct Region
+    {
+        char * ptr = nullptr;
+        char * end = nullptr;
+        Chunk * chunks = nullptr;
+        size_t nextChunkSize = minChunkSize;
+        Stats stats;
+    };
+
+    Region regions[nrSizeClasses];
+
+    /**
+     * Keep this out of the `alloc()` hot path.
+     */
+    [[gnu::noinline]]
+    void * allocSlow(Region & r, size_t n);
+
+    static Chunk * newChunk(Region & r, size_t size);
+};
+
+}
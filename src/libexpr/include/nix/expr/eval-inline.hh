@@ -17,6 +17,7 @@ inline void * allocBytes(size_t n)
     void * p;
     p = calloc(n, 1);
     if (!p) throw std::bad_alloc();
+    EvalState::countHeapBytes(n);
     return p;
 }
 
@@ -24,7 +25,7 @@ inline void * allocBytes(size_t n)
 [[gnu::always_inline]]
 Value * EvalState::allocValue()
 {
-    void * p = allocBytes(sizeof(Value));
+    void * p = arena.alloc(EvalArena::scValue, sizeof(Value));
     nrValues++;
     return (Value *) p;
 }
@@ -37,7 +38,7 @@ Env & EvalState::allocEnv(size_t size)
     nrValuesInEnvs += size;
 
     Env * env;
-    env = (Env *) allocBytes(sizeof(Env) + size * sizeof(Value *));
+    env = (Env *) arena.alloc(EvalArena::scEnv, sizeof(Env) + size * sizeof(Value *));
 
     /* We assume that env->values has been cleared by the allocator; maybeThunk() and lookupVar fromWith expect this. */
 
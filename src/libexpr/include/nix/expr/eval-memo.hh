@@ -0,0 +1,110 @@
+#pragma once
+///@file
+
+#include "nix/expr/value.hh"
+
+#include <optional>
+#include <unordered_map>
+
+namespace nix {
+
+struct Env;
+struct ExprLambda;
+
+/**
+ * A cache of the results of function applications, used when the
+ * `eval-memoize` setting is enabled.
+ *
+ * Entries are keyed by the function (a lambda together with its
+ * closure, or a primop) and by its argument. Arguments are never forced
+ * to compute a key. An argument that has been evaluated already is
+ * compared shallowly: integers, booleans, null and short strings by
+ * value, and small lists and attribute sets by the identity of their
+ * elements. Anything else is compared by what its `Value` points to,
+ * e.g. the expression and environment of a thunk.
+ * Since evaluation is pure, a cached result is indistinguishable from a
+ * recomputed one, except that side effects like `builtins.trace` are not
+ * repeated.
+ *
+ * The cache holds at most `maxEntries` results; it is emptied when it
+ * is full.
+ */
+class EvalMemoCache
+{
+public:
+
+    struct Key
+    {
+        const void * fun;
+        const void * env;
+        /**
+         * A copy of the argument, since the argument itself may be a
+         * temporary that is gone by the time the key is compared.
+         */
+        std::optional<Value> arg;
+        size_t hash;
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t flushes = 0;
+    };
+
+    Stats stats;
+
+    EvalMemoCache(size_t maxEntries)
+        : maxEntries(maxEntries)
+    { }
+
+    /**
+     * The key of applying `lambda` with closure `env` to `arg`.
+     */
+    static Key lambdaKey(const ExprLambda & lambda, const Env * env, const Value & arg);
+
+    /**
+     * The key of a primop `fun` that only depends on the identity of
+     * `obj`, e.g. a `Bindings`.
+     */
+    static Key identityKey(const void * fun, const void * obj);
+
+    const Value * lookup(const Key & key)
+    {
+        auto i = entries.find(key);
+        if (i == entries.end()) {
+            stats.misses++;
+            return nullptr;
+        }
+        stats.hits++;
+        return &i->second;
+    }
+
+    void insert(const Key & key, const Value & result);
+
+    size_t size() const
+    {
+        return entries.size();
+    }
+
+private:
+
+    struct KeyHash
+    {
+        size_t operator()(const Key & key) const
+        {
+            return key.hash;
+        }
+    };
+
+    struct KeyEq
+    {
+        bool operator()(const Key & a, const Key & b) const;
+    };
+
+    std::unordered_map<Key, Value, KeyHash, KeyEq, traceable_allocator<std::pair<const Key, Value>>> entries;
+
+    size_t maxEntries;
+};
+
+}
@@ -111,4 +111,18 @@ public:
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
 
+/**
+ * Create a profiler that samples the Nix call stack `frequency` times
+ * per second of CPU time using `SIGPROF`, and writes a gzipped pprof
+ * profile to `profileFile` when it is destroyed.
+ */
+ref<EvalProfiler> makeSignalSampleProfiler(EvalState & state, std::filesystem::path profileFile, uint32_t frequency);
+
+/**
+ * Create a profiler that attributes the memory allocated by the
+ * evaluator to the Nix call stack, and writes a gzipped pprof heap
+ * profile to `profileFile` when it is destroyed.
+ */
+ref<EvalProfiler> makeHeapProfiler(EvalState & state, std::filesystem::path profileFile);
+
 }
@@ -209,8 +209,19 @@ struct EvalSettings : Config
           Enables evaluation profiling. The following modes are supported:
 
           * `flamegraph` stack sampling profiler. Outputs folded format, one line per stack (suitable for `flamegraph.pl` and compatible tools).
+            It records the stack on function calls, which makes evaluation considerably slower.
+
+          * `pprof` stack sampling profiler driven by a CPU timer (`SIGPROF`), with little overhead.
+            Outputs a gzipped [pprof](https://github.com/google/pprof) profile, whose locations are Nix source positions.
+            Not available on Windows.
+
+          * `heap` attributes the memory allocated by the evaluator (values, environments, attribute sets, lists and strings) to the Nix function that was running when it was allocated.
+            Outputs a gzipped pprof heap profile with `alloc_objects` and `alloc_space` sample types.
+            Since the evaluator never frees memory, this is also the memory it retains.
 
           Use [`eval-profile-file`](#conf-eval-profile-file) to specify where the profile is saved.
+
+          Profiling only works with a single evaluator, so commands refuse to run with [`eval-cores`](#conf-eval-cores) other than 1.
         )"};
 
     Setting<Path> evalProfileFile{this, "nix.profile", "eval-profile-file",
@@ -221,7 +232,7 @@ struct EvalSettings : Config
     Setting<uint32_t> evalProfilerFrequency{this, 99, "eval-profiler-frequency",
         R"(
           Specifies the sampling rate in hertz for sampling evaluation profilers.
-          Use `0` to sample the stack after each function call.
+          Use `0` to sample the stack after each function call (`flamegraph` only).
           See [`eval-profiler`](#conf-eval-profiler).
         )"};
 
@@ -232,6 +243,62 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<bool> compactEvalCache{this, false, "compact-eval-cache",
+        R"(
+          Whether to store the [evaluation cache](#conf-eval-cache) in a
+          compact file that is mapped into memory, instead of in a SQLite
+          database. Reading from it is much faster, but every change to
+          it rewrites the whole file when Nix exits.
+        )"};
+
+    Setting<bool> useParseCache{this, true, "parse-cache",
+        R"(
+          Whether to cache the parse trees of Nix files on disk, in
+          `$XDG_CACHE_HOME/nix/parse-cache-v1`. A file that was parsed
+          before, with the same contents and in the same directory, is
+          loaded from the cache instead of being parsed again. Entries
+          that haven't been used for 30 days are deleted.
+        )"};
+
+    Setting<bool> evalMemoize{this, false, "eval-memoize",
+        R"(
+          Whether to remember the results of function calls, and reuse
+          them when the same function is called again with the same
+          argument. Arguments are compared without evaluating them:
+          numbers, booleans and short strings by value, and small lists
+          and attribute sets by the identity of their elements. This
+          speeds up evaluations that repeatedly apply the same functions
+          to the same values, as the NixOS module system does, at the
+          cost of memory.
+
+          Since evaluation is pure, this doesn't change the result, but
+          side effects such as the messages of `builtins.trace` are only
+          produced once.
+        )"};
+
+    Setting<unsigned int> evalMemoizeSize{this, 1000000, "eval-memoize-size",
+        R"(
+          The maximum number of results kept by
+          [`eval-memoize`](#conf-eval-memoize). When it is reached, the
+          cache is emptied.
+        )"};
+
+    Setting<unsigned int> evalCores{this, 1, "eval-cores",
+        R"(
+          The number of threads used to evaluate independent attributes in
+          [`nix search`](@docroot@/command-ref/new-cli/nix3-search.md) and
+          [`nix flake show`](@docroot@/command-ref/new-cli/nix3-flake-show.md).
+          The special value `0` means to use all available CPU cores.
+
+          Every thread uses its own evaluator, so memory usage grows with
+          the number of threads. Attributes evaluated by worker threads are
+          not recorded in the [evaluation cache](#conf-eval-cache). The
+          output is the same regardless of this setting.
+
+          Parallel evaluation is only available for flake installables,
+          and cannot be combined with [`eval-profiler`](#conf-eval-profiler).
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{this, false, "ignore-try",
         R"(
           If set to true, ignore exceptions inside 'tryEval' calls when evaluating nix expressions in
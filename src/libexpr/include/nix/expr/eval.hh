@@ -2,8 +2,11 @@
 ///@file
 
 #include "nix/expr/attr-set.hh"
+#include "nix/expr/eval-arena.hh"
+#include "nix/expr/eval-memo.hh"
 #include "nix/expr/eval-error.hh"
 #include "nix/expr/eval-profiler.hh"
+#include "nix/expr/gc-small-vector.hh"
 #include "nix/util/types.hh"
 #include "nix/expr/value.hh"
 #include "nix/expr/nixexpr.hh"
@@ -17,6 +20,7 @@
 #include "nix/expr/repl-exit-status.hh"
 #include "nix/util/ref.hh"
 
+#include <atomic>
 #include <map>
 #include <optional>
 #include <functional>
@@ -165,6 +169,84 @@ std::unique_ptr<ValMap> mapStaticEnvBindings(const SymbolTable & st, const Stati
 
 void copyContext(const Value & v, NixStringContext & context, const ExperimentalFeatureSettings & xpSettings = experimentalFeatureSettings);
 
+/**
+ * The context of a string that is being built from several parts.
+ *
+ * The contexts of parts that are strings are kept in their encoded form
+ * and merged without decoding them. Their element strings are shared
+ * with the result, and if only one part has a context, its array is
+ * reused as is. Only elements from other sources, such as paths that
+ * are copied to the store, are decoded and encoded again.
+ */
+struct StringContextBuilder
+{
+    /**
+     * Decoded elements, e.g. from coercing paths and derivations.
+     */
+    NixStringContext context;
+
+    /**
+     * The encoded contexts of string parts.
+     */
+    SmallVector<const char * *, 4> encoded;
+
+    /**
+     * Add the context of the string `v`.
+     */
+    void add(const Value & v)
+    {
+        if (auto ctx = v.context())
+            encoded.push_back(ctx);
+    }
+
+    bool empty() const
+    {
+        return context.empty() && encoded.empty();
+    }
+
+    /**
+     * Return the encoded context of the result, which is `nullptr` if
+     * it is empty.
+     */
+    const char * * finish();
+};
+
+/**
+ * The result of concatenating strings, as in `a + b` or
+ * `builtins.concatStringsSep`. Small results are copied into a flat
+ * string. Large ones become a `StringRope` that refers to the parts
+ * without copying them, and is only flattened when the bytes are
+ * needed.
+ */
+struct StringRopeBuilder
+{
+    /**
+     * Results of at least this many bytes become ropes.
+     */
+    static constexpr size_t minRopeSize = 1024;
+
+    SmallVector<StringRope::Part, 8> parts;
+    size_t size = 0;
+    bool hasContext = false;
+
+    /**
+     * Add the string `v`, sharing its contents and its context.
+     */
+    void add(const Value & v);
+
+    /**
+     * Add a copy of `s`, with the given context.
+     */
+    void add(std::string_view s, const NixStringContext & context);
+
+    /**
+     * Add only the context of the string `v`.
+     */
+    void addContext(const Value & v);
+
+    void finish(Value & v);
+};
+
 
 std::string printValue(EvalState & state, Value & v);
 std::ostream & operator << (std::ostream & os, const ValueType t);
@@ -174,6 +256,8 @@ struct RegexCache;
 
 std::shared_ptr<RegexCache> makeRegexCache();
 
+class ParseCache;
+
 struct DebugTrace {
     /* WARNING: Converting PosIdx -> Pos should be done with extra care. This is
        due to the fact that operator[] of PosTable is incredibly expensive. */
@@ -207,6 +291,14 @@ public:
     SymbolTable symbols;
     PosTable positions;
 
+    /**
+     * Backing storage for values, environments and attribute sets.
+     * This must be declared before any member that allocates from it
+     * (such as `baseEnv`), so that it is constructed first and
+     * destroyed last.
+     */
+    EvalArena arena;
+
     const Symbol sWith, sOutPath, sDrvPath, sType, sMeta, sName, sValue,
         sSystem, sOverrides, sOutputs, sOutputName, sIgnoreNulls,
         sFile, sLine, sColumn, sFunctor, sToString,
@@ -347,6 +439,16 @@ public:
      */
     std::map<const Hash, ref<eval_cache::EvalCache>> evalCaches;
 
+    /**
+     * The on-disk cache of parse trees, if `parse-cache` is enabled.
+     */
+    std::shared_ptr<ParseCache> parseCache;
+
+    /**
+     * The cache of function results, if `eval-memoize` is enabled.
+     */
+    std::unique_ptr<EvalMemoCache> memoCache;
+
 private:
 
     /* Cache for calls to addToStore(); maps source paths to the store
@@ -562,6 +664,16 @@ public:
         bool coerceMore = false, bool copyToStore = true,
         bool canonicalizePath = true);
 
+    /**
+     * Like the above, but collects the context in a
+     * `StringContextBuilder`, which avoids decoding the context of
+     * strings.
+     */
+    BackedStringView coerceToString(const PosIdx pos, Value & v, StringContextBuilder & context,
+        std::string_view errorCtx,
+        bool coerceMore = false, bool copyToStore = true,
+        bool canonicalizePath = true);
+
     StorePath copyPathToStore(NixStringContext & context, const SourcePath & path);
 
     /**
@@ -726,6 +838,12 @@ public:
         callFunction(fun, args, vRes, pos);
     }
 
+    /**
+     * Like `callFunction()`, but for a primop `fun` that is called with
+     * exactly as many arguments as it takes.
+     */
+    void callPrimOp(Value & fun, std::span<Value *> args, Value & vRes, const PosIdx pos);
+
     /**
      * Automatically call a function for which each argument has a
      * default value or has a binding in the `args` map.
@@ -803,6 +921,13 @@ public:
 
     void concatLists(Value & v, size_t nrLists, Value * const * lists, const PosIdx pos, std::string_view errorCtx);
 
+    /**
+     * Make `v` the sublist of the forced list `list` consisting of `len`
+     * elements starting at `start`. The result shares its elements with
+     * `list` rather than copying them, so this takes O(1) time.
+     */
+    void mkListSlice(Value & v, const Value & list, size_t start, size_t len);
+
     /**
      * Print statistics, if enabled.
      *
@@ -849,6 +974,56 @@ public:
 
     DocComment getDocCommentForPos(PosIdx pos);
 
+    unsigned long nrDerivations = 0;
+
+    /**
+     * The number of encoded string contexts that were allocated, and
+     * their total number of elements, and the number of times that
+     * the context of a part was reused for a concatenation. These are
+     * global because `Value::mkString()` doesn't know the `EvalState`,
+     * and atomic because several evaluators can run in parallel.
+     */
+    static std::atomic<uint64_t> nrStringContexts;
+    static std::atomic<uint64_t> nrStringContextElems;
+    static std::atomic<uint64_t> nrStringContextsShared;
+
+    /**
+     * The number of string ropes that were created, and the number
+     * that had to be flattened.
+     */
+    static std::atomic<uint64_t> nrStringRopes;
+    static std::atomic<uint64_t> nrStringRopesFlattened;
+
+    /**
+     * The number of bytes of strings, list elements and string contexts
+     * that the current thread has allocated outside of the arena. This
+     * is used to attribute memory in the heap profiler. It is only
+     * maintained while a `CountHeapBytes` object exists, so that
+     * allocations don't pay for the thread-local access otherwise.
+     */
+    static thread_local uint64_t nrHeapBytes;
+
+    static std::atomic<uint32_t> nrHeapByteCounters;
+
+    struct CountHeapBytes
+    {
+        CountHeapBytes()
+        {
+            nrHeapByteCounters.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        ~CountHeapBytes()
+        {
+            nrHeapByteCounters.fetch_sub(1, std::memory_order_relaxed);
+        }
+    };
+
+    static void countHeapBytes(size_t n)
+    {
+        if (nrHeapByteCounters.load(std::memory_order_relaxed)) [[unlikely]]
+            nrHeapBytes += n;
+    }
+
 private:
 
     /**
@@ -874,11 +1049,16 @@ private:
     unsigned long nrLookups = 0;
     unsigned long nrAttrsets = 0;
     unsigned long nrAttrsInAttrsets = 0;
+    unsigned long nrAttrsetIndexBytes = 0;
     unsigned long nrAvoided = 0;
     unsigned long nrOpUpdates = 0;
     unsigned long nrOpUpdateValuesCopied = 0;
+    unsigned long nrOpUpdateLayers = 0;
     unsigned long nrListConcats = 0;
+    unsigned long nrListSlices = 0;
+    unsigned long nrListElemsShared = 0;
     unsigned long nrPrimOpCalls = 0;
+    unsigned long nrKnownPrimOpCalls = 0;
     unsigned long nrFunctionCalls = 0;
 
     bool countCalls;
@@ -894,10 +1074,24 @@ private:
 
     void incrFunctionCall(ExprLambda * fun);
 
+    /**
+     * Counts a call of `fun` towards the call depth and reports it to
+     * the profiler for as long as it exists. Used by `callFunction()`
+     * and `callPrimOp()`.
+     */
+    class FunctionCallScope;
+
+    /**
+     * Call the primop `fn` with all its arguments, counting the call
+     * and adding an error trace for the call site `pos`.
+     */
+    void invokePrimOp(const PrimOp & fn, const PosIdx primOpPos, Value * * args, Value & vRes, const PosIdx pos);
+
     typedef std::map<PosIdx, size_t> AttrSelects;
     AttrSelects attrSelects;
 
     friend struct ExprOpUpdate;
+    friend struct ExprCall;
     friend struct ExprOpConcatLists;
     friend struct ExprVar;
     friend struct ExprString;
@@ -72,6 +72,27 @@ struct AttrName
 
 typedef std::vector<AttrName> AttrPath;
 
+/**
+ * An inline cache for the attribute lookups done by one element of an
+ * attribute path, used by `Bindings::get(Symbol, AttrLookupCache &)`.
+ *
+ * It remembers the positions in the attribute array where the attribute
+ * was recently found. Sets created by the same code have the same
+ * attribute names in the same order, so a selection site usually finds
+ * its attribute at one of these positions without searching.
+ */
+struct AttrLookupCache
+{
+    static constexpr unsigned int nrEntries = 2;
+
+    uint32_t positions[nrEntries] = {};
+
+    /**
+     * The entry to replace on the next miss.
+     */
+    uint8_t next = 0;
+};
+
 std::string showAttrPath(const SymbolTable & symbols, const AttrPath & attrPath);
 
 
@@ -199,6 +220,10 @@ struct ExprSelect : Expr
     PosIdx pos;
     Expr * e, * def;
     AttrPath attrPath;
+    /**
+     * One cache per element of `attrPath`. Set up by `bindVars()`.
+     */
+    std::vector<AttrLookupCache> lookupCaches;
     ExprSelect(const PosIdx & pos, Expr * e, AttrPath attrPath, Expr * def) : pos(pos), e(e), def(def), attrPath(std::move(attrPath)) { };
     ExprSelect(const PosIdx & pos, Expr * e, Symbol name) : pos(pos), e(e), def(0) { attrPath.push_back(AttrName(name)); };
     PosIdx getPos() const override { return pos; }
@@ -362,6 +387,12 @@ struct ExprCall : Expr
     std::vector<Expr *> args;
     PosIdx pos;
     std::optional<PosIdx> cursedOrEndPos; // used during parsing to warn about https://github.com/NixOS/nix/issues/11118
+    /**
+     * If `fun` is statically known to be a builtin that takes exactly
+     * `args.size()` arguments (e.g. `builtins.length xs`), the value of
+     * that builtin. Set by `bindVars()`.
+     */
+    Value * knownPrimOp = nullptr;
     ExprCall(const PosIdx & pos, Expr * fun, std::vector<Expr *> && args)
         : fun(fun), args(args), pos(pos), cursedOrEndPos({})
     { }
@@ -0,0 +1,52 @@
+#pragma once
+///@file
+
+#include "nix/util/ref.hh"
+
+#include <functional>
+
+namespace nix {
+
+class EvalState;
+struct EvalSettings;
+
+/**
+ * Throw an error if `settings` enable something that doesn't work with
+ * several evaluators in one process, so that commands can refuse
+ * `eval-cores` other than 1 before they start evaluating.
+ */
+void checkParallelEval(const EvalSettings & settings);
+
+/**
+ * Run `nrJobs` independent evaluation jobs on up to `nrThreads`
+ * threads. `nrThreads == 0` means one thread per CPU core.
+ *
+ * `EvalState` is not thread-safe, so every thread evaluates with its
+ * own evaluator, created on first use by `makeState`. Jobs are handed
+ * out one at a time, so threads that finish early pick up the remaining
+ * work. Values must not be passed between jobs or back to the caller;
+ * jobs should return their results in plain C++ data structures,
+ * indexed by job number, so that the output does not depend on the
+ * scheduling.
+ *
+ * If any job throws, no jobs with a higher number are started, and the
+ * exception of the lowest-numbered failing job is rethrown after all
+ * threads have finished. This makes the reported error deterministic
+ * as well.
+ *
+ * Worker threads get a stack as big as the one `nix` requests for its
+ * main thread, since evaluation is deeply recursive.
+ *
+ * `releaseState`, if set, is called on the worker thread just before
+ * its evaluator is destroyed. Jobs that keep per-evaluator data across
+ * jobs (such as eval cache cursors) must drop it there, since it may
+ * refer to memory owned by the evaluator.
+ */
+void parallelEval(
+    size_t nrJobs,
+    size_t nrThreads,
+    std::function<ref<EvalState>()> makeState,
+    std::function<void(EvalState & state, size_t job)> job,
+    std::function<void(EvalState & state)> releaseState = {});
+
+}
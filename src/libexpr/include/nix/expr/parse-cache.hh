@@ -0,0 +1,98 @@
+#pragma once
+///@file
+
+#include "nix/expr/nixexpr.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/pos-table.hh"
+#include "nix/util/source-path.hh"
+
+#include <chrono>
+#include <filesystem>
+
+namespace nix {
+
+class EvalState;
+
+typedef std::unordered_map<PosIdx, DocComment> DocCommentMap;
+
+/**
+ * A persistent cache of the parse trees of Nix files.
+ *
+ * Every entry is a binary encoding of the `Expr` tree of one file, from
+ * before `bindVars()`, together with the symbols it uses and the doc
+ * comments of the file. Positions are stored as offsets into the file,
+ * so a loaded tree gets a fresh origin in the `PosTable` like a parsed
+ * one does.
+ *
+ * Entries are keyed by the contents of the file and by everything else
+ * the parser looks at: the directory that relative path literals are
+ * resolved against, the home directory and the experimental features
+ * that change the syntax. They are never invalidated; a changed file
+ * simply gets a new entry. Entries that haven't been used for
+ * `maxAge` are deleted, see `prune()`.
+ *
+ * Entries are written atomically and are checked while loading, so a
+ * corrupt or truncated entry is treated as a miss.
+ */
+class ParseCache
+{
+    std::filesystem::path dir;
+
+public:
+
+    uint64_t nrHits = 0;
+    uint64_t nrMisses = 0;
+
+    /**
+     * Entries that haven't been used for this long are deleted.
+     */
+    static constexpr std::chrono::hours maxAge{24 * 30};
+
+    /**
+     * Open the cache in `dir`, and prune it if that hasn't been done
+     * for a day.
+     */
+    ParseCache(std::filesystem::path dir);
+
+    /**
+     * Delete the entries that haven't been used for `maxAge`. The
+     * modification time of an entry is updated when it is loaded, at
+     * most once a day. Errors are not fatal.
+     */
+    void prune();
+
+    /**
+     * Compute the key of the file with the given contents, which is to
+     * be parsed relative to `basePath`.
+     */
+    Hash key(EvalState & state, std::string_view contents, const SourcePath & basePath);
+
+    /**
+     * Load the parse tree of the file with key `key` if it is in the
+     * cache. Its positions are added to `origin`, and its doc comments
+     * to `docComments`.
+     *
+     * @return The tree, or `nullptr` on a cache miss.
+     */
+    Expr * lookup(
+        EvalState & state,
+        const Hash & key,
+        const PosTable::Origin & origin,
+        const SourcePath & basePath,
+        DocCommentMap & docComments);
+
+    /**
+     * Store the parse tree `e` of a file that was just parsed into
+     * `origin`. Errors are not fatal, since the cache is only an
+     * optimisation.
+     */
+    void insert(
+        EvalState & state,
+        const Hash & key,
+        Expr * e,
+        const PosTable::Origin & origin,
+        const SourcePath & basePath,
+        const DocCommentMap & docComments);
+};
+
+}
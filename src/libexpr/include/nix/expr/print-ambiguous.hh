@@ -12,13 +12,16 @@ namespace nix {
  * but it produces ambiguous output; unevaluated thunks and lambdas (and a few
  * other types) are printed as Nix path syntax like `<CODE>`.
  *
+ * `seen` holds the attribute sets and lists printed so far, with their
+ * sizes, since a slice of a list shares the elements of the list.
+ *
  * See: https://github.com/NixOS/nix/issues/9730
  */
 void printAmbiguous(
     Value &v,
     const SymbolTable &symbols,
     std::ostream &str,
-    std::set<const void *> *seen,
+    std::set<std::pair<const void *, size_t>> *seen,
     int depth);
 
 }
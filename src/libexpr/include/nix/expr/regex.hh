@@ -0,0 +1,166 @@
+#pragma once
+///@file
+
+#include "nix/util/error.hh"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace nix::regex {
+
+MakeError(BadRegex, Error);
+
+/**
+ * The pattern is syntactically valid, but its automaton exceeds
+ * `Regex::maxProgramSize`.
+ */
+MakeError(RegexTooLarge, BadRegex);
+
+struct Program;
+struct Dfa;
+class MatchOracle;
+class PikeVM;
+
+/**
+ * The submatches of a successful match, as offsets into the subject.
+ * Submatch 0 is the whole match.
+ */
+class Captures
+{
+    std::vector<size_t> offsets;
+
+    friend class Regex;
+
+public:
+
+    static constexpr size_t npos = std::string_view::npos;
+
+    size_t size() const
+    {
+        return offsets.size() / 2;
+    }
+
+    bool matched(size_t i) const
+    {
+        return offsets[2 * i] != npos;
+    }
+
+    size_t start(size_t i) const
+    {
+        return offsets[2 * i];
+    }
+
+    size_t end(size_t i) const
+    {
+        return offsets[2 * i + 1];
+    }
+
+    std::string_view get(std::string_view subject, size_t i) const
+    {
+        return subject.substr(start(i), end(i) - start(i));
+    }
+};
+
+/**
+ * A POSIX extended regular expression, as used by `builtins.match` and
+ * `builtins.split`.
+ *
+ * The pattern is compiled to a Thompson NFA and matched in time linear
+ * in the length of the subject: a lazily built DFA decides whether
+ * there is a match at all, and a Pike VM computes the submatches.
+ * Neither backtracks nor recurses on the subject.
+ *
+ * The syntax and the choice of submatches are those of libstdc++'s
+ * `std::regex` with `std::regex::extended`, which this replaces: escapes
+ * of ordinary characters are errors, repetition is greedy, `^` and `$`
+ * only match at the ends of the subject, and bracket expressions use
+ * the "C" locale.
+ */
+class Regex
+{
+public:
+
+    /**
+     * libstdc++'s `_GLIBCXX_REGEX_STATE_LIMIT`.
+     */
+    static constexpr size_t maxProgramSize = 100000;
+
+    /**
+     * @throws BadRegex if `pattern` is not a valid regular expression.
+     */
+    explicit Regex(std::string_view pattern);
+
+    ~Regex();
+
+    /**
+     * The number of parenthesised subexpressions.
+     */
+    size_t groupCount() const;
+
+    /**
+     * Whether the regular expression matches all of `subject`.
+     */
+    bool match(std::string_view subject, Captures & captures) const;
+
+    struct SearchFlags
+    {
+        /**
+         * Ignore empty matches.
+         */
+        bool notNull = false;
+
+        /**
+         * Only consider matches starting at `from`.
+         */
+        bool continuous = false;
+    };
+
+    /**
+     * Find the leftmost match in `subject` that starts at or after
+     * `from`.
+     */
+    bool search(std::string_view subject, size_t from, Captures & captures, SearchFlags flags) const;
+
+    /**
+     * All non-overlapping matches in `subject`, in the order in which
+     * `std::regex_iterator` would visit them.
+     */
+    std::vector<Captures> matchAll(std::string_view subject) const;
+
+private:
+
+    std::unique_ptr<Program> prog;
+
+    /**
+     * Lazily built unanchored and anchored DFAs, shared by all threads.
+     * A thread that finds them locked does without, or builds a private
+     * one for the duration of a search.
+     */
+    mutable std::mutex dfaLock;
+    mutable std::unique_ptr<Dfa> dfas[2];
+
+    /**
+     * The caller must hold `dfaLock`.
+     */
+    Dfa & dfa(bool anchored) const;
+
+    /**
+     * Whether there is a match that ends anywhere in `subject` (when not
+     * `anchored`), or that spans all of it (when `anchored`). Returns
+     * `std::nullopt` if the DFA is busy or grows too large.
+     */
+    std::optional<bool> dfaMatch(std::string_view subject, size_t from, bool anchored) const;
+
+    bool search(
+        std::string_view subject,
+        size_t from,
+        Captures & captures,
+        SearchFlags flags,
+        MatchOracle & oracle,
+        PikeVM & vm) const;
+};
+
+}
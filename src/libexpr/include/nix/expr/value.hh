@@ -36,7 +36,8 @@ typedef enum {
     tPrimOp,
     tPrimOpApp,
     tExternal,
-    tFloat
+    tFloat,
+    tStringRope
 } InternalType;
 
 /**
@@ -133,6 +134,79 @@ class ExternalValueBase
 std::ostream & operator << (std::ostream & str, const ExternalValueBase & v);
 
 
+/**
+ * A string that is the concatenation of other strings. The parts are
+ * only copied into one contiguous string when the bytes are first
+ * needed, so that building a large string with repeated `+` takes
+ * linear rather than quadratic time.
+ *
+ * Each part keeps its own context. The context of the whole rope is
+ * only merged when it is asked for.
+ */
+struct StringRope
+{
+    struct Part
+    {
+        /**
+         * The part, if it is a flat string, and otherwise `nullptr`.
+         */
+        const char * s;
+
+        /**
+         * The part, if it is itself a rope.
+         */
+        const StringRope * rope;
+
+        size_t size;
+
+        /**
+         * The context of `s`.
+         */
+        const char * * context;
+    };
+
+    size_t size;
+
+    /**
+     * Whether any part has a context.
+     */
+    bool hasContext;
+
+    /**
+     * Caches of the contiguous string and of the merged context.
+     */
+    mutable const char * flat = nullptr;
+    mutable const char * * flatContext = nullptr;
+
+    /**
+     * The parts, which are released once the rope has been flattened.
+     */
+    size_t nrParts;
+    Part parts[0];
+
+    const char * c_str() const
+    {
+        if (!flat)
+            flatten();
+        return flat;
+    }
+
+    const char * * context() const
+    {
+        if (!hasContext)
+            return nullptr;
+        if (!flatContext)
+            mergeContext();
+        return flatContext;
+    }
+
+private:
+
+    void flatten() const;
+    void mergeContext() const;
+};
+
+
 class ListBuilder
 {
     const size_t size;
@@ -240,6 +314,7 @@ public:
         bool boolean;
 
         StringWithContext string;
+        const StringRope * rope;
 
         Path path;
 
@@ -273,7 +348,7 @@ public:
             case tUninitialized: break;
             case tInt: return nInt;
             case tBool: return nBool;
-            case tString: return nString;
+            case tString: case tStringRope: return nString;
             case tPath: return nPath;
             case tNull: return nNull;
             case tAttrs: return nAttrs;
@@ -329,6 +404,8 @@ public:
 
     void mkString(std::string_view s, const NixStringContext & context);
 
+    void mkString(std::string_view s, const char * * context);
+
     void mkStringMove(const char * s, const NixStringContext & context);
 
     inline void mkString(const SymbolStr & s)
@@ -336,6 +413,11 @@ public:
         mkString(s.c_str());
     }
 
+    inline void mkString(const StringRope * rope)
+    {
+        finishValue(tStringRope, { .rope = rope });
+    }
+
     void mkPath(const SourcePath & path);
     void mkPath(std::string_view path);
 
@@ -366,6 +448,22 @@ public:
             finishValue(tListN, { .bigList = { .size = builder.size, .elems = builder.elems } });
     }
 
+    /**
+     * Make this value a list of the `size` elements starting at
+     * `elems`, without copying them if there are more than two. The
+     * storage is shared, so it must belong to a `tListN` list, whose
+     * elements are never freed or modified.
+     */
+    void mkListSlice(size_t size, Value * const * elems)
+    {
+        if (size == 1)
+            finishValue(tList1, { .smallList = { elems[0] } });
+        else if (size == 2)
+            finishValue(tList2, { .smallList = { elems[0], elems[1] } });
+        else
+            finishValue(tListN, { .bigList = { .size = size, .elems = elems } });
+    }
+
     inline void mkThunk(Env * e, Expr * ex)
     {
         finishValue(tThunk, { .thunk = { .env = e, .expr = ex } });
@@ -448,23 +546,40 @@ public:
             CanonPath(CanonPath::unchecked_t(), payload.path.path));
     }
 
+    /**
+     * The contents of a string. If it is a rope, this flattens it.
+     */
     std::string_view string_view() const
     {
+        if (internalType == tStringRope)
+            return std::string_view(payload.rope->c_str(), payload.rope->size);
         assert(internalType == tString);
         return std::string_view(payload.string.c_str);
     }
 
     const char * c_str() const
     {
+        if (internalType == tStringRope)
+            return payload.rope->c_str();
         assert(internalType == tString);
         return payload.string.c_str;
     }
 
     const char * * context() const
     {
+        if (internalType == tStringRope)
+            return payload.rope->context();
         return payload.string.context;
     }
 
+    /**
+     * The string as a rope, or `nullptr` if it is a flat string.
+     */
+    const StringRope * stringRope() const
+    {
+        return internalType == tStringRope ? payload.rope : nullptr;
+    }
+
     ExternalValueBase * external() const
     { return payload.external; }
 
@@ -2,181 +2,508 @@
 #include "nix/expr/value.hh"
 #include "nix/expr/eval.hh"
 
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <limits>
-#include <variant>
-#include <nlohmann/json.hpp>
-
-using json = nlohmann::json;
 
 namespace nix {
 
-// for more information, refer to
-// https://github.com/nlohmann/json/blob/master/include/nlohmann/detail/input/json_sax.hpp
-class JSONSax : nlohmann::json_sax<json> {
-    class JSONState {
-    protected:
-        std::unique_ptr<JSONState> parent;
-        RootValue v;
-    public:
-        virtual std::unique_ptr<JSONState> resolve(EvalState &)
-        {
-            throw std::logic_error("tried to close toplevel json parser state");
-        }
-        explicit JSONState(std::unique_ptr<JSONState> && p) : parent(std::move(p)) {}
-        explicit JSONState(Value * v) : v(allocRootValue(v)) {}
-        JSONState(JSONState & p) = delete;
-        Value & value(EvalState & state)
-        {
-            if (!v)
-                v = allocRootValue(state.allocValue());
-            return **v;
-        }
-        virtual ~JSONState() {}
-        virtual void add() {}
-    };
+namespace {
 
-    class JSONObjectState : public JSONState {
-        using JSONState::JSONState;
-        ValueMap attrs;
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto attrs2 = state.buildBindings(attrs.size());
-            for (auto & i : attrs)
-                attrs2.insert(i.first, i.second);
-            parent->value(state).mkAttrs(attrs2);
-            return std::move(parent);
-        }
-        void add() override { v = nullptr; }
-    public:
-        void key(string_t & name, EvalState & state)
-        {
-            forceNoNullByte(name);
-            attrs.insert_or_assign(state.symbols.create(name), &value(state));
-        }
-    };
+/**
+ * A parser for JSON (RFC 8259) that builds Nix values directly, without
+ * a document tree or intermediate copies.
+ *
+ * Strings without escapes are scanned eight bytes at a time and copied
+ * straight from the input into the Nix string or symbol; strings with
+ * escapes are decoded into a scratch buffer that is reused. The
+ * elements of all open arrays and the members of all open objects are
+ * kept on two stacks, so every list and attribute set is allocated once
+ * with its exact size when it is closed. Nesting is handled with an
+ * explicit stack of frames rather than recursion.
+ *
+ * It accepts exactly what nlohmann::json accepted before: a single
+ * value, optionally preceded by a byte order mark, with valid UTF-8 in
+ * strings. Integers that don't fit an int64 or uint64 are parsed as
+ * floats, and the last of several members with the same name wins.
+ */
+class JSONParser
+{
+    EvalState & state;
 
-    class JSONListState : public JSONState {
-        ValueVector values;
-        std::unique_ptr<JSONState> resolve(EvalState & state) override
-        {
-            auto list = state.buildList(values.size());
-            for (const auto & [n, v2] : enumerate(list))
-                v2 = values[n];
-            parent->value(state).mkList(list);
-            return std::move(parent);
-        }
-        void add() override {
-            values.push_back(*v);
-            v = nullptr;
-        }
-    public:
-        JSONListState(std::unique_ptr<JSONState> && p, std::size_t reserve) : JSONState(std::move(p))
-        {
-            values.reserve(reserve);
-        }
+    const char * const begin;
+    const char * p;
+    const char * const end;
+
+    std::string scratch;
+
+    struct Frame
+    {
+        bool object;
+
+        /**
+         * The index of the first element in `elems` or member in
+         * `members`.
+         */
+        size_t start;
     };
 
-    EvalState & state;
-    std::unique_ptr<JSONState> rs;
+    std::vector<Frame> frames;
+
+    ValueVector elems;
+
+    using Member = std::pair<Symbol, Value *>;
+    std::vector<Member, traceable_allocator<Member>> members;
 
 public:
-    JSONSax(EvalState & state, Value & v) : state(state), rs(new JSONState(&v)) {};
 
-    bool null() override
+    JSONParser(EvalState & state, std::string_view s)
+        : state(state)
+        , begin(s.data())
+        , p(s.data())
+        , end(s.data() + s.size())
     {
-        rs->value(state).mkNull();
-        rs->add();
-        return true;
     }
 
-    bool boolean(bool val) override
+    void parse(Value & v)
     {
-        rs->value(state).mkBool(val);
-        rs->add();
-        return true;
+        if (end - p >= 3 && !memcmp(p, "\xef\xbb\xbf", 3))
+            p += 3;
+
+        while (true) {
+            skipWhitespace();
+
+            /* Parse a value, or open a container and go parse its
+               first element. */
+            Value * value;
+            switch (peek()) {
+            case '{':
+                p++;
+                skipWhitespace();
+                if (peek() == '}') {
+                    p++;
+                    value = state.allocValue();
+                    value->mkAttrs(&state.emptyBindings);
+                    break;
+                }
+                frames.push_back({.object = true, .start = members.size()});
+                parseMemberName();
+                continue;
+            case '[':
+                p++;
+                skipWhitespace();
+                if (peek() == ']') {
+                    p++;
+                    value = &state.vEmptyList;
+                    break;
+                }
+                frames.push_back({.object = false, .start = elems.size()});
+                continue;
+            case '"':
+                value = state.allocValue();
+                value->mkString(parseString());
+                break;
+            case 't':
+                expectLiteral("true");
+                value = state.getBool(true);
+                break;
+            case 'f':
+                expectLiteral("false");
+                value = state.getBool(false);
+                break;
+            case 'n':
+                expectLiteral("null");
+                value = &state.vNull;
+                break;
+            default:
+                value = state.allocValue();
+                parseNumber(*value);
+                break;
+            }
+
+            /* Add the value to its container, and close the containers
+               that end after it. */
+            while (true) {
+                if (frames.empty()) {
+                    skipWhitespace();
+                    if (p != end)
+                        fail("unexpected content after the end of the JSON value");
+                    v = *value;
+                    return;
+                }
+
+                auto & frame = frames.back();
+                if (frame.object)
+                    members.back().second = value;
+                else
+                    elems.push_back(value);
+
+                skipWhitespace();
+                auto c = peek();
+                if (c == ',') {
+                    p++;
+                    if (frame.object) {
+                        skipWhitespace();
+                        parseMemberName();
+                    }
+                    break;
+                }
+                if (frame.object && c == '}')
+                    value = finishObject(frame.start);
+                else if (!frame.object && c == ']')
+                    value = finishArray(frame.start);
+                else
+                    fail(frame.object ? "expected ',' or '}'" : "expected ',' or ']'");
+                p++;
+                frames.pop_back();
+            }
+        }
     }
 
-    bool number_integer(number_integer_t val) override
+private:
+
+    [[noreturn]] void fail(std::string_view msg)
     {
-        rs->value(state).mkInt(val);
-        rs->add();
-        return true;
+        size_t line = 1;
+        auto lineStart = begin;
+        for (auto i = begin; i < p && i < end; ++i)
+            if (*i == '\n') {
+                line++;
+                lineStart = i + 1;
+            }
+        throw JSONParseError("syntax error while parsing JSON at line %d, column %d: %s", line, p - lineStart + 1, msg);
     }
 
-    bool number_unsigned(number_unsigned_t val_) override
+    char peek()
     {
-        if (val_ > std::numeric_limits<NixInt::Inner>::max()) {
-            throw Error("unsigned json number %1% outside of Nix integer range", val_);
-        }
-        NixInt::Inner val = val_;
-        rs->value(state).mkInt(val);
-        rs->add();
-        return true;
+        if (p == end)
+            fail("unexpected end of input");
+        return *p;
     }
 
-    bool number_float(number_float_t val, const string_t & s) override
+    void skipWhitespace()
     {
-        rs->value(state).mkFloat(val);
-        rs->add();
-        return true;
+        while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            p++;
     }
 
-    bool string(string_t & val) override
+    void expectLiteral(std::string_view literal)
     {
-        forceNoNullByte(val);
-        rs->value(state).mkString(val);
-        rs->add();
-        return true;
+        if ((size_t) (end - p) < literal.size() || memcmp(p, literal.data(), literal.size()))
+            fail("invalid literal");
+        p += literal.size();
     }
 
-#if NLOHMANN_JSON_VERSION_MAJOR >= 3 && NLOHMANN_JSON_VERSION_MINOR >= 8
-    bool binary(binary_t&) override
+    void parseMemberName()
     {
-        // This function ought to be unreachable
-        assert(false);
-        return true;
+        if (peek() != '"')
+            fail("expected a member name");
+        auto name = state.symbols.create(parseString());
+        skipWhitespace();
+        if (peek() != ':')
+            fail("expected ':'");
+        p++;
+        members.push_back({name, nullptr});
     }
-#endif
 
-    bool start_object(std::size_t len) override
+    Value * finishObject(size_t start)
     {
-        rs = std::make_unique<JSONObjectState>(std::move(rs));
-        return true;
+        auto first = members.begin() + start;
+        auto last = members.end();
+
+        std::stable_sort(first, last, [](const Member & a, const Member & b) { return a.first < b.first; });
+
+        /* Of members with the same name, keep the last one. */
+        size_t size = 0;
+        for (auto i = first; i != last; ++i)
+            if (i + 1 == last || i[1].first != i->first)
+                size++;
+
+        auto attrs = state.buildBindings(size);
+        for (auto i = first; i != last; ++i)
+            if (i + 1 == last || i[1].first != i->first)
+                attrs.insert(i->first, i->second);
+
+        members.erase(first, last);
+
+        auto v = state.allocValue();
+        v->mkAttrs(attrs.alreadySorted());
+        return v;
     }
 
-    bool key(string_t & name) override
+    Value * finishArray(size_t start)
     {
-        dynamic_cast<JSONObjectState*>(rs.get())->key(name, state);
-        return true;
+        auto list = state.buildList(elems.size() - start);
+        std::copy(elems.begin() + start, elems.end(), list.begin());
+        elems.resize(start);
+
+        auto v = state.allocValue();
+        v->mkList(list);
+        return v;
     }
 
-    bool end_object() override {
-        rs = rs->resolve(state);
-        rs->add();
-        return true;
+    /**
+     * Whether any of the 8 bytes of `x` needs a closer look in a string:
+     * a quote, a backslash, a control character or a non-ASCII byte.
+     */
+    static bool hasSpecialByte(uint64_t x)
+    {
+        constexpr uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+        auto hasZero = [&](uint64_t y) { return (y - ones) & ~y & highs; };
+        return hasZero(x ^ (ones * '"')) | hasZero(x ^ (ones * '\\')) | ((x - ones * 0x20) & ~x & highs) | (x & highs);
     }
 
-    bool end_array() override {
-        return end_object();
+    /**
+     * Parse a string starting at the opening quote. The result points
+     * into the input if there are no escapes, and into `scratch`
+     * otherwise.
+     */
+    std::string_view parseString()
+    {
+        auto start = ++p;
+
+        /* The start of the characters that haven't been copied to
+           `scratch` yet, or null if there were no escapes so far. */
+        const char * run = nullptr;
+
+        while (true) {
+            while (end - p >= 8) {
+                uint64_t x;
+                memcpy(&x, p, 8);
+                if (hasSpecialByte(x))
+                    break;
+                p += 8;
+            }
+
+            if (p == end)
+                fail("unterminated string");
+
+            auto c = (unsigned char) *p;
+            if (c == '"')
+                break;
+            else if (c == '\\') {
+                if (!run)
+                    scratch.clear();
+                scratch.append(run ? run : start, p);
+                p++;
+                parseEscape();
+                run = p;
+            } else if (c < 0x20)
+                fail("control character in string must be escaped");
+            else if (c >= 0x80)
+                skipUTF8();
+            else
+                p++;
+        }
+
+        std::string_view s;
+        if (run) {
+            scratch.append(run, p);
+            forceNoNullByte(scratch);
+            s = scratch;
+        } else
+            s = {start, (size_t) (p - start)};
+
+        p++;
+        return s;
+    }
+
+    unsigned parseHex4()
+    {
+        if (end - p < 4)
+            fail("incomplete \\u escape");
+        unsigned n = 0;
+        for (int i = 0; i < 4; ++i, ++p) {
+            char c = *p;
+            n <<= 4;
+            if (c >= '0' && c <= '9')
+                n |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                n |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                n |= c - 'A' + 10;
+            else
+                fail("invalid \\u escape");
+        }
+        return n;
+    }
+
+    /**
+     * Decode the escape sequence after a backslash and append it to
+     * `scratch`.
+     */
+    void parseEscape()
+    {
+        switch (peek()) {
+        case '"':
+        case '\\':
+        case '/':
+            scratch += *p++;
+            return;
+        case 'b':
+            p++;
+            scratch += '\b';
+            return;
+        case 'f':
+            p++;
+            scratch += '\f';
+            return;
+        case 'n':
+            p++;
+            scratch += '\n';
+            return;
+        case 'r':
+            p++;
+            scratch += '\r';
+            return;
+        case 't':
+            p++;
+            scratch += '\t';
+            return;
+        case 'u':
+            break;
+        default:
+            fail("invalid escape sequence");
+        }
+
+        p++;
+        auto cp = parseHex4();
+        if (cp >= 0xdc00 && cp <= 0xdfff)
+            fail("unpaired low surrogate in \\u escape");
+        if (cp >= 0xd800 && cp <= 0xdbff) {
+            if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                fail("unpaired high surrogate in \\u escape");
+            p += 2;
+            auto low = parseHex4();
+            if (low < 0xdc00 || low > 0xdfff)
+                fail("unpaired high surrogate in \\u escape");
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        }
+
+        if (cp < 0x80)
+            scratch += (char) cp;
+        else if (cp < 0x800) {
+            scratch += (char) (0xc0 | (cp >> 6));
+            scratch += (char) (0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            scratch += (char) (0xe0 | (cp >> 12));
+            scratch += (char) (0x80 | ((cp >> 6) & 0x3f));
+            scratch += (char) (0x80 | (cp & 0x3f));
+        } else {
+            scratch += (char) (0xf0 | (cp >> 18));
+            scratch += (char) (0x80 | ((cp >> 12) & 0x3f));
+            scratch += (char) (0x80 | ((cp >> 6) & 0x3f));
+            scratch += (char) (0x80 | (cp & 0x3f));
+        }
     }
 
-    bool start_array(size_t len) override {
-        rs = std::make_unique<JSONListState>(std::move(rs),
-            len != std::numeric_limits<size_t>::max() ? len : 128);
-        return true;
+    void skipUTF8()
+    {
+        auto b = [&](ptrdiff_t i) -> unsigned char { return p + i < end ? p[i] : 0; };
+        auto cont = [&](ptrdiff_t i, unsigned char lo = 0x80, unsigned char hi = 0xbf) {
+            return b(i) >= lo && b(i) <= hi;
+        };
+
+        auto c = b(0);
+        size_t n;
+        if (c >= 0xc2 && c <= 0xdf && cont(1))
+            n = 2;
+        else if (c == 0xe0 && cont(1, 0xa0) && cont(2))
+            n = 3;
+        else if (((c >= 0xe1 && c <= 0xec) || c == 0xee || c == 0xef) && cont(1) && cont(2))
+            n = 3;
+        else if (c == 0xed && cont(1, 0x80, 0x9f) && cont(2))
+            n = 3;
+        else if (c == 0xf0 && cont(1, 0x90) && cont(2) && cont(3))
+            n = 4;
+        else if (c >= 0xf1 && c <= 0xf3 && cont(1) && cont(2) && cont(3))
+            n = 4;
+        else if (c == 0xf4 && cont(1, 0x80, 0x8f) && cont(2) && cont(3))
+            n = 4;
+        else
+            fail("invalid UTF-8 in string");
+        p += n;
     }
 
-    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) override {
-        throw JSONParseError("%s", ex.what());
+    void parseNumber(Value & v)
+    {
+        auto start = p;
+
+        bool negative = p != end && *p == '-';
+        if (negative)
+            p++;
+
+        auto isDigit = [&]() { return p != end && *p >= '0' && *p <= '9'; };
+
+        if (!isDigit())
+            fail("invalid value");
+
+        /* Accumulate the integer part, noting if it overflows. */
+        uint64_t n = 0;
+        bool overflow = false;
+        if (*p == '0')
+            p++;
+        else
+            for (; isDigit(); ++p) {
+                unsigned digit = *p - '0';
+                if (n > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+                    overflow = true;
+                n = n * 10 + digit;
+            }
+
+        bool isFloat = false;
+        if (p != end && *p == '.') {
+            isFloat = true;
+            p++;
+            if (!isDigit())
+                fail("expected a digit after the decimal point");
+            while (isDigit())
+                p++;
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            isFloat = true;
+            p++;
+            if (p != end && (*p == '+' || *p == '-'))
+                p++;
+            if (!isDigit())
+                fail("expected a digit in the exponent");
+            while (isDigit())
+                p++;
+        }
+
+        if (!isFloat && !overflow) {
+            if (!negative) {
+                if (n > (uint64_t) std::numeric_limits<NixInt::Inner>::max())
+                    throw Error("unsigned json number %1% outside of Nix integer range", n);
+                v.mkInt((NixInt::Inner) n);
+                return;
+            }
+            if (n <= (uint64_t) std::numeric_limits<NixInt::Inner>::max() + 1) {
+                v.mkInt((NixInt::Inner) (0 - n));
+                return;
+            }
+        }
+
+        double d;
+        auto [ptr, ec] = std::from_chars(start, p, d);
+        if (ec == std::errc::result_out_of_range) {
+            /* Numbers that are too small round to zero, but numbers
+               that are too large are an error. */
+            d = std::strtod(std::string(start, p).c_str(), nullptr);
+            if (std::isinf(d))
+                fail("number overflow");
+        } else if (ec != std::errc() || ptr != p)
+            fail("invalid number");
+        v.mkFloat(d);
     }
 };
 
-void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
+}
+
+void parseJSON(EvalState & state, const std::string_view & s, Value & v)
 {
-    JSONSax parser(state, v);
-    bool res = json::sax_parse(s_, &parser);
-    if (!res)
-        throw JSONParseError("Invalid JSON Value");
+    JSONParser(state, s).parse(v);
 }
 
 }
@@ -352,6 +352,8 @@ void ExprSelect::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
     for (auto & i : attrPath)
         if (!i.symbol)
             i.expr->bindVars(es, env);
+
+    lookupCaches.assign(attrPath.size(), {});
 }
 
 void ExprOpHasAttr::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
@@ -461,6 +463,49 @@ void ExprLambda::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
     body->bindVars(es, newEnv);
 }
 
+/**
+ * If `e` is a variable bound in the base environment, return its value,
+ * provided that it has been initialised already.
+ */
+static Value * lookupBaseEnvVar(EvalState & es, const std::shared_ptr<const StaticEnv> & env, Expr * e)
+{
+    auto var = dynamic_cast<ExprVar *>(e);
+    if (!var || var->fromWith)
+        return nullptr;
+
+    auto curEnv = env.get();
+    for (auto level = var->level; level && curEnv; --level)
+        curEnv = curEnv->up.get();
+    if (curEnv != es.staticBaseEnv.get())
+        return nullptr;
+
+    return es.baseEnv.values[var->displ];
+}
+
+/**
+ * Return the primop that `fun` always evaluates to, i.e. `foo` or
+ * `builtins.foo` where `builtins` and `foo` are not shadowed.
+ */
+static Value * resolveKnownPrimOp(EvalState & es, const std::shared_ptr<const StaticEnv> & env, Expr * fun)
+{
+    Value * v = nullptr;
+
+    if (auto select = dynamic_cast<ExprSelect *>(fun)) {
+        if (select->def || select->attrPath.size() != 1 || !select->attrPath[0].symbol)
+            return nullptr;
+        auto vBuiltins = lookupBaseEnvVar(es, env, select->e);
+        if (!vBuiltins || vBuiltins->type() != nAttrs)
+            return nullptr;
+        auto attr = vBuiltins->attrs()->get(select->attrPath[0].symbol);
+        if (!attr)
+            return nullptr;
+        v = attr->value;
+    } else
+        v = lookupBaseEnvVar(es, env, fun);
+
+    return v && v->isPrimOp() ? v : nullptr;
+}
+
 void ExprCall::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
 {
     if (es.debugRepl)
@@ -469,6 +514,14 @@ void ExprCall::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> &
     fun->bindVars(es, env);
     for (auto e : args)
         e->bindVars(es, env);
+
+    /* Calls to builtins can skip evaluating `fun` and the generic
+       dispatch in callFunction(). Don't do this when debugging or
+       counting calls, since those observe the evaluation of `fun`. */
+    knownPrimOp = nullptr;
+    if (!es.debugRepl && !es.countCalls)
+        if (auto v = resolveKnownPrimOp(es, env, fun); v && v->primOp()->arity == args.size())
+            knownPrimOp = v;
 }
 
 void ExprLet::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
@@ -0,0 +1,106 @@
+#include "nix/expr/parallel-eval.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/finally.hh"
+
+#include <atomic>
+#include <thread>
+
+#include <pthread.h>
+
+namespace nix {
+
+static constexpr size_t workerStackSize = 64 * 1024 * 1024;
+
+void checkParallelEval(const EvalSettings & settings)
+{
+    /* Every evaluator would write its own profile to the same file, and
+       the 'pprof' profiler can only sample one thread. */
+    if (settings.evalProfilerMode != EvalProfilerMode::disabled)
+        throw UsageError("'eval-profiler' cannot be used with 'eval-cores' other than 1");
+}
+
+void parallelEval(
+    size_t nrJobs,
+    size_t nrThreads,
+    std::function<ref<EvalState>()> makeState,
+    std::function<void(EvalState & state, size_t job)> job,
+    std::function<void(EvalState & state)> releaseState)
+{
+    if (!nrThreads) {
+        nrThreads = std::thread::hardware_concurrency();
+        if (!nrThreads) nrThreads = 1;
+    }
+    nrThreads = std::min(nrThreads, nrJobs);
+    if (!nrThreads) return;
+
+    struct Failure
+    {
+        size_t job;
+        std::exception_ptr exception;
+    };
+
+    std::atomic<size_t> nextJob{0};
+    Sync<std::optional<Failure>> failure_;
+
+    std::function<void()> worker = [&]() {
+        std::shared_ptr<EvalState> state;
+        Finally release([&]() {
+            if (state && releaseState)
+                releaseState(*state);
+        });
+        while (true) {
+            auto i = nextJob++;
+            if (i >= nrJobs) break;
+            {
+                auto failure(failure_.lock());
+                if (*failure && (*failure)->job < i) break;
+            }
+            try {
+                if (!state) state = makeState();
+                job(*state, i);
+            } catch (...) {
+                auto failure(failure_.lock());
+                if (!*failure || i < (*failure)->job)
+                    *failure = Failure{i, std::current_exception()};
+            }
+        }
+    };
+
+    auto run = [](void * arg) -> void * {
+        (*(std::function<void()> *) arg)();
+        return nullptr;
+    };
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr))
+        throw SysError("initialising thread attributes");
+    Finally destroyAttr([&]() { pthread_attr_destroy(&attr); });
+    pthread_attr_setstacksize(&attr, workerStackSize);
+
+    std::vector<pthread_t> threads;
+    Finally joinThreads([&]() {
+        for (auto & thread : threads)
+            pthread_join(thread, nullptr);
+    });
+
+    for (size_t n = 0; n < nrThreads; ++n) {
+        pthread_t thread;
+        if (auto err = pthread_create(&thread, &attr, run, &worker)) {
+            /* Make the running threads stop before we bail out. */
+            nextJob = nrJobs;
+            throw SysError(err, "creating evaluation thread");
+        }
+        threads.push_back(thread);
+    }
+
+    for (auto & thread : threads)
+        pthread_join(thread, nullptr);
+    threads.clear();
+
+    if (auto failure = *failure_.lock())
+        std::rethrow_exception(failure->exception);
+}
+
+}
@@ -0,0 +1,771 @@
+#include "nix/expr/parse-cache.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/users.hh"
+
+#include <cstring>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+namespace nix {
+
+/**
+ * Bump this whenever the encoding below or the `Expr` classes change.
+ */
+static constexpr uint32_t formatVersion = 1;
+
+static constexpr std::string_view magic = "NIXPARSE";
+
+enum class ExprTag : uint8_t {
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpUpdate,
+    OpConcatLists,
+    ConcatStrings,
+    Pos,
+};
+
+/* The encoding is a list of symbols followed by a list of nodes, in
+   which every node comes after its children. Symbols and nodes are
+   referred to by their index plus one, so that 0 can stand for
+   "none". Positions are stored as their offset in the file plus one.
+   Integers are in host byte order; the header doesn't match on a host
+   with the other byte order. */
+
+template<typename T>
+static void put(std::string & s, T x)
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    s.append((const char *) &x, sizeof(x));
+}
+
+static void putString(std::string & s, std::string_view x)
+{
+    put<uint32_t>(s, x.size());
+    s.append(x);
+}
+
+namespace {
+
+struct Writer
+{
+    EvalState & state;
+    const PosTable::Origin & origin;
+    const SourcePath & basePath;
+
+    std::string nodes;
+    uint32_t nrNodes = 0;
+    std::unordered_map<const Expr *, uint32_t> nodeIds;
+
+    std::vector<Symbol> symbols;
+    std::unordered_map<Symbol, uint32_t> symbolIds;
+
+    uint32_t sym(Symbol s)
+    {
+        if (!s) return 0;
+        auto [i, inserted] = symbolIds.try_emplace(s, symbols.size() + 1);
+        if (inserted) symbols.push_back(s);
+        return i->second;
+    }
+
+    uint32_t pos(PosIdx p)
+    {
+        if (!p) return 0;
+        auto offset = origin.offsetOf(p);
+        if (offset > origin.size)
+            throw Error("position does not belong to the file being cached");
+        return offset + 1;
+    }
+
+    void attrPath(std::string & r, const AttrPath & attrPath)
+    {
+        put<uint32_t>(r, attrPath.size());
+        for (auto & i : attrPath) {
+            put<uint32_t>(r, sym(i.symbol));
+            if (!i.symbol) put<uint32_t>(r, expr(i.expr));
+        }
+    }
+
+    template<typename Op>
+    bool binOp(std::string & r, Expr * e, ExprTag tag)
+    {
+        auto op = dynamic_cast<Op *>(e);
+        if (!op) return false;
+        put(r, tag);
+        put<uint32_t>(r, pos(op->pos));
+        put<uint32_t>(r, expr(op->e1));
+        put<uint32_t>(r, expr(op->e2));
+        return true;
+    }
+
+    /**
+     * Write `e` and its children, unless they have been written
+     * already, and return its reference.
+     */
+    uint32_t expr(Expr * e)
+    {
+        if (!e) return 0;
+        if (auto i = nodeIds.find(e); i != nodeIds.end()) return i->second;
+
+        /* Children are written to `nodes` while the record of `e`
+           is assembled. */
+        std::string r;
+
+        if (auto e2 = dynamic_cast<ExprInt *>(e)) {
+            put(r, ExprTag::Int);
+            put<int64_t>(r, e2->v.integer().value);
+        }
+        else if (auto e2 = dynamic_cast<ExprFloat *>(e)) {
+            put(r, ExprTag::Float);
+            put<double>(r, e2->v.fpoint());
+        }
+        else if (auto e2 = dynamic_cast<ExprString *>(e)) {
+            put(r, ExprTag::String);
+            putString(r, e2->s);
+        }
+        else if (auto e2 = dynamic_cast<ExprPath *>(e)) {
+            put(r, ExprTag::Path);
+            if (e2->accessor == basePath.accessor)
+                put<uint8_t>(r, 1);
+            else if (e2->accessor == state.rootFS)
+                put<uint8_t>(r, 0);
+            else
+                throw Error("path literal with an unknown accessor");
+            putString(r, e2->s);
+        }
+        else if (auto e2 = dynamic_cast<ExprInheritFrom *>(e)) {
+            put(r, ExprTag::InheritFrom);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, e2->displ);
+        }
+        else if (auto e2 = dynamic_cast<ExprVar *>(e)) {
+            put(r, ExprTag::Var);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, sym(e2->name));
+        }
+        else if (auto e2 = dynamic_cast<ExprSelect *>(e)) {
+            put(r, ExprTag::Select);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, expr(e2->e));
+            put<uint32_t>(r, expr(e2->def));
+            attrPath(r, e2->attrPath);
+        }
+        else if (auto e2 = dynamic_cast<ExprOpHasAttr *>(e)) {
+            put(r, ExprTag::OpHasAttr);
+            put<uint32_t>(r, expr(e2->e));
+            attrPath(r, e2->attrPath);
+        }
+        else if (auto e2 = dynamic_cast<ExprAttrs *>(e)) {
+            put(r, ExprTag::Attrs);
+            put<uint8_t>(r, e2->recursive);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, e2->attrs.size());
+            for (auto & [name, def] : e2->attrs) {
+                put<uint32_t>(r, sym(name));
+                put(r, def.kind);
+                put<uint32_t>(r, expr(def.e));
+                put<uint32_t>(r, pos(def.pos));
+                put<uint32_t>(r, def.displ);
+            }
+            put<uint32_t>(r, e2->inheritFromExprs ? e2->inheritFromExprs->size() : 0);
+            if (e2->inheritFromExprs)
+                for (auto from : *e2->inheritFromExprs)
+                    put<uint32_t>(r, expr(from));
+            put<uint32_t>(r, e2->dynamicAttrs.size());
+            for (auto & def : e2->dynamicAttrs) {
+                put<uint32_t>(r, expr(def.nameExpr));
+                put<uint32_t>(r, expr(def.valueExpr));
+                put<uint32_t>(r, pos(def.pos));
+            }
+        }
+        else if (auto e2 = dynamic_cast<ExprList *>(e)) {
+            put(r, ExprTag::List);
+            put<uint32_t>(r, e2->elems.size());
+            for (auto elem : e2->elems)
+                put<uint32_t>(r, expr(elem));
+        }
+        else if (auto e2 = dynamic_cast<ExprLambda *>(e)) {
+            put(r, ExprTag::Lambda);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, sym(e2->name));
+            put<uint32_t>(r, sym(e2->arg));
+            put<uint8_t>(r, e2->hasFormals());
+            if (e2->hasFormals()) {
+                put<uint8_t>(r, e2->formals->ellipsis);
+                put<uint32_t>(r, e2->formals->formals.size());
+                for (auto & formal : e2->formals->formals) {
+                    put<uint32_t>(r, pos(formal.pos));
+                    put<uint32_t>(r, sym(formal.name));
+                    put<uint32_t>(r, expr(formal.def));
+                }
+            }
+            put<uint32_t>(r, expr(e2->body));
+            put<uint32_t>(r, pos(e2->docComment.begin));
+            put<uint32_t>(r, pos(e2->docComment.end));
+        }
+        else if (auto e2 = dynamic_cast<ExprCall *>(e)) {
+            put(r, ExprTag::Call);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, expr(e2->fun));
+            put<uint32_t>(r, e2->args.size());
+            for (auto arg : e2->args)
+                put<uint32_t>(r, expr(arg));
+            put<uint32_t>(r, e2->cursedOrEndPos ? pos(*e2->cursedOrEndPos) : 0);
+        }
+        else if (auto e2 = dynamic_cast<ExprLet *>(e)) {
+            put(r, ExprTag::Let);
+            put<uint32_t>(r, expr(e2->attrs));
+            put<uint32_t>(r, expr(e2->body));
+        }
+        else if (auto e2 = dynamic_cast<ExprWith *>(e)) {
+            put(r, ExprTag::With);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, expr(e2->attrs));
+            put<uint32_t>(r, expr(e2->body));
+        }
+        else if (auto e2 = dynamic_cast<ExprIf *>(e)) {
+            put(r, ExprTag::If);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, expr(e2->cond));
+            put<uint32_t>(r, expr(e2->then));
+            put<uint32_t>(r, expr(e2->else_));
+        }
+        else if (auto e2 = dynamic_cast<ExprAssert *>(e)) {
+            put(r, ExprTag::Assert);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint32_t>(r, expr(e2->cond));
+            put<uint32_t>(r, expr(e2->body));
+        }
+        else if (auto e2 = dynamic_cast<ExprOpNot *>(e)) {
+            put(r, ExprTag::OpNot);
+            put<uint32_t>(r, expr(e2->e));
+        }
+        else if (binOp<ExprOpEq>(r, e, ExprTag::OpEq)
+            || binOp<ExprOpNEq>(r, e, ExprTag::OpNEq)
+            || binOp<ExprOpAnd>(r, e, ExprTag::OpAnd)
+            || binOp<ExprOpOr>(r, e, ExprTag::OpOr)
+            || binOp<ExprOpImpl>(r, e, ExprTag::OpImpl)
+            || binOp<ExprOpUpdate>(r, e, ExprTag::OpUpdate)
+            || binOp<ExprOpConcatLists>(r, e, ExprTag::OpConcatLists))
+            ;
+        else if (auto e2 = dynamic_cast<ExprConcatStrings *>(e)) {
+            put(r, ExprTag::ConcatStrings);
+            put<uint32_t>(r, pos(e2->pos));
+            put<uint8_t>(r, e2->forceString);
+            put<uint32_t>(r, e2->es->size());
+            for (auto & [p, part] : *e2->es) {
+                put<uint32_t>(r, pos(p));
+                put<uint32_t>(r, expr(part));
+            }
+        }
+        else if (auto e2 = dynamic_cast<ExprPos *>(e)) {
+            put(r, ExprTag::Pos);
+            put<uint32_t>(r, pos(e2->pos));
+        }
+        else
+            throw Error("cannot cache expression of type '%s'", typeid(*e).name());
+
+        nodes += r;
+        auto id = ++nrNodes;
+        nodeIds.emplace(e, id);
+        return id;
+    }
+};
+
+struct Reader
+{
+    EvalState & state;
+    const PosTable::Origin & origin;
+    const SourcePath & basePath;
+
+    const char * cur;
+    const char * end;
+
+    std::vector<Symbol> symbols;
+    std::vector<Expr *> nodes;
+
+    [[noreturn]] void corrupt()
+    {
+        throw Error("parse cache entry is corrupt");
+    }
+
+    template<typename T>
+    T get()
+    {
+        if ((size_t) (end - cur) < sizeof(T)) corrupt();
+        T x;
+        std::memcpy(&x, cur, sizeof(T));
+        cur += sizeof(T);
+        return x;
+    }
+
+    std::string_view getString()
+    {
+        auto n = get<uint32_t>();
+        if ((size_t) (end - cur) < n) corrupt();
+        std::string_view s(cur, n);
+        cur += n;
+        return s;
+    }
+
+    Symbol sym()
+    {
+        auto i = get<uint32_t>();
+        if (i > symbols.size()) corrupt();
+        return i ? symbols[i - 1] : Symbol();
+    }
+
+    Symbol nonEmptySym()
+    {
+        auto s = sym();
+        if (!s) corrupt();
+        return s;
+    }
+
+    PosIdx pos()
+    {
+        auto i = get<uint32_t>();
+        return i ? state.positions.add(origin, i - 1) : noPos;
+    }
+
+    Expr * maybeExpr()
+    {
+        auto i = get<uint32_t>();
+        if (i > nodes.size()) corrupt();
+        return i ? nodes[i - 1] : nullptr;
+    }
+
+    Expr * expr()
+    {
+        auto e = maybeExpr();
+        if (!e) corrupt();
+        return e;
+    }
+
+    AttrPath attrPath()
+    {
+        AttrPath res;
+        auto n = get<uint32_t>();
+        for (uint32_t i = 0; i < n; ++i) {
+            auto s = sym();
+            if (s)
+                res.emplace_back(s);
+            else
+                res.emplace_back(expr());
+        }
+        return res;
+    }
+
+    template<typename Op>
+    Expr * binOp()
+    {
+        auto p = pos();
+        auto e1 = expr();
+        return new Op(p, e1, expr());
+    }
+
+    Expr * node()
+    {
+        switch (get<ExprTag>()) {
+
+        case ExprTag::Int:
+            return new ExprInt(get<int64_t>());
+
+        case ExprTag::Float:
+            return new ExprFloat(get<double>());
+
+        case ExprTag::String:
+            return new ExprString(std::string(getString()));
+
+        case ExprTag::Path: {
+            auto accessor = get<uint8_t>() ? basePath.accessor : state.rootFS;
+            return new ExprPath(accessor, std::string(getString()));
+        }
+
+        case ExprTag::Var: {
+            auto p = pos();
+            return new ExprVar(p, nonEmptySym());
+        }
+
+        case ExprTag::InheritFrom: {
+            auto p = pos();
+            return new ExprInheritFrom(p, get<uint32_t>());
+        }
+
+        case ExprTag::Select: {
+            auto p = pos();
+            auto e = expr();
+            auto def = maybeExpr();
+            return new ExprSelect(p, e, attrPath(), def);
+        }
+
+        case ExprTag::OpHasAttr: {
+            auto e = expr();
+            return new ExprOpHasAttr(e, attrPath());
+        }
+
+        case ExprTag::Attrs: {
+            auto recursive = get<uint8_t>();
+            auto res = new ExprAttrs(pos());
+            res->recursive = recursive;
+            auto nrAttrs = get<uint32_t>();
+            for (uint32_t i = 0; i < nrAttrs; ++i) {
+                auto name = nonEmptySym();
+                auto kind = get<ExprAttrs::AttrDef::Kind>();
+                if ((unsigned) kind > (unsigned) ExprAttrs::AttrDef::Kind::InheritedFrom) corrupt();
+                auto e = expr();
+                ExprAttrs::AttrDef def(e, pos(), kind);
+                def.displ = get<uint32_t>();
+                res->attrs.insert_or_assign(name, def);
+            }
+            if (auto nrFroms = get<uint32_t>()) {
+                res->inheritFromExprs = std::make_unique<std::vector<Expr *>>();
+                for (uint32_t i = 0; i < nrFroms; ++i)
+                    res->inheritFromExprs->push_back(expr());
+            }
+            auto nrDynamic = get<uint32_t>();
+            for (uint32_t i = 0; i < nrDynamic; ++i) {
+                auto nameExpr = expr();
+                auto valueExpr = expr();
+                res->dynamicAttrs.emplace_back(nameExpr, valueExpr, pos());
+            }
+            return res;
+        }
+
+        case ExprTag::List: {
+            auto res = new ExprList;
+            auto n = get<uint32_t>();
+            for (uint32_t i = 0; i < n; ++i)
+                res->elems.push_back(expr());
+            return res;
+        }
+
+        case ExprTag::Lambda: {
+            auto p = pos();
+            auto name = sym();
+            auto arg = sym();
+            Formals * formals = nullptr;
+            if (get<uint8_t>()) {
+                formals = new Formals;
+                formals->ellipsis = get<uint8_t>();
+                auto n = get<uint32_t>();
+                for (uint32_t i = 0; i < n; ++i) {
+                    auto fp = pos();
+                    auto fname = nonEmptySym();
+                    formals->formals.push_back({fp, fname, maybeExpr()});
+                }
+                /* Symbols are ordered by creation, so this is not
+                   necessarily the order they were parsed in. */
+                std::sort(formals->formals.begin(), formals->formals.end(),
+                    [] (const auto & a, const auto & b) {
+                        return std::tie(a.name, a.pos) < std::tie(b.name, b.pos);
+                    });
+            }
+            auto res = new ExprLambda(p, arg, formals, expr());
+            res->name = name;
+            res->docComment.begin = pos();
+            res->docComment.end = pos();
+            return res;
+        }
+
+        case ExprTag::Call: {
+            auto p = pos();
+            auto fun = expr();
+            std::vector<Expr *> args;
+            auto n = get<uint32_t>();
+            for (uint32_t i = 0; i < n; ++i)
+                args.push_back(expr());
+            auto res = new ExprCall(p, fun, std::move(args));
+            /* The parser has warned about these; do so again. */
+            if (auto cursedOrEndPos = pos()) {
+                res->cursedOrEndPos = cursedOrEndPos;
+                res->warnIfCursedOr(state.symbols, state.positions);
+            }
+            return res;
+        }
+
+        case ExprTag::Let: {
+            auto attrs = dynamic_cast<ExprAttrs *>(expr());
+            if (!attrs) corrupt();
+            return new ExprLet(attrs, expr());
+        }
+
+        case ExprTag::With: {
+            auto p = pos();
+            auto attrs = expr();
+            return new ExprWith(p, attrs, expr());
+        }
+
+        case ExprTag::If: {
+            auto p = pos();
+            auto cond = expr();
+            auto then = expr();
+            return new ExprIf(p, cond, then, expr());
+        }
+
+        case ExprTag::Assert: {
+            auto p = pos();
+            auto cond = expr();
+            return new ExprAssert(p, cond, expr());
+        }
+
+        case ExprTag::OpNot:
+            return new ExprOpNot(expr());
+
+        case ExprTag::OpEq: return binOp<ExprOpEq>();
+        case ExprTag::OpNEq: return binOp<ExprOpNEq>();
+        case ExprTag::OpAnd: return binOp<ExprOpAnd>();
+        case ExprTag::OpOr: return binOp<ExprOpOr>();
+        case ExprTag::OpImpl: return binOp<ExprOpImpl>();
+        case ExprTag::OpUpdate: return binOp<ExprOpUpdate>();
+        case ExprTag::OpConcatLists: return binOp<ExprOpConcatLists>();
+
+        case ExprTag::ConcatStrings: {
+            auto p = pos();
+            auto forceString = get<uint8_t>();
+            auto es = new std::vector<std::pair<PosIdx, Expr *>>;
+            auto n = get<uint32_t>();
+            for (uint32_t i = 0; i < n; ++i) {
+                auto partPos = pos();
+                es->emplace_back(partPos, expr());
+            }
+            return new ExprConcatStrings(p, forceString, es);
+        }
+
+        case ExprTag::Pos:
+            return new ExprPos(pos());
+
+        default:
+            corrupt();
+        }
+    }
+};
+
+}
+
+static constexpr std::chrono::hours day{24};
+
+static constexpr std::string_view prunedStamp = "last-pruned";
+
+ParseCache::ParseCache(std::filesystem::path dir)
+    : dir(std::move(dir))
+{
+    std::error_code ec;
+    if (!std::filesystem::is_directory(this->dir, ec))
+        return;
+
+    auto stamp = this->dir / prunedStamp;
+    auto lastPruned = std::filesystem::last_write_time(stamp, ec);
+    if (!ec && std::filesystem::file_time_type::clock::now() - lastPruned < day)
+        return;
+
+    prune();
+
+    try {
+        writeFile(stamp.string(), "");
+    } catch (Error & e) {
+        debug("cannot write '%s': %s", stamp.string(), e.msg());
+    }
+}
+
+
+void ParseCache::prune()
+{
+    auto now = std::filesystem::file_time_type::clock::now();
+    std::error_code ec;
+
+    for (auto & entry : std::filesystem::directory_iterator(dir, ec)) {
+        if (entry.path().filename() == prunedStamp) continue;
+        auto mtime = entry.last_write_time(ec);
+        if (ec || now - mtime < maxAge) continue;
+        debug("deleting unused parse cache entry '%s'", entry.path().string());
+        std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+
+Hash ParseCache::key(EvalState & state, std::string_view contents, const SourcePath & basePath)
+{
+    /* Path literals are made absolute while parsing, so the result
+       depends on the directory of the file. */
+    std::string header;
+    for (auto & field : {
+        std::to_string(formatVersion),
+        nixVersion,
+        basePath.path.abs(),
+        std::string(basePath.accessor == state.rootFS ? "root" : ""),
+        state.settings.pureEval ? std::string() : getHome(),
+        std::string(experimentalFeatureSettings.isEnabled(Xp::PipeOperators) ? "pipe-operators" : ""),
+        std::string(experimentalFeatureSettings.isEnabled(Xp::NoUrlLiterals) ? "no-url-literals" : ""),
+    }) {
+        header += field;
+        header += '\0';
+    }
+
+    HashSink sink(HashAlgorithm::SHA256);
+    sink(header);
+    sink(contents);
+    return sink.finish().first;
+}
+
+
+Expr * ParseCache::lookup(
+    EvalState & state,
+    const Hash & key,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    DocCommentMap & docComments)
+{
+    auto path = dir / key.to_string(HashFormat::Base16, false);
+
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(path, ec)) {
+        nrMisses++;
+        return nullptr;
+    }
+
+    boost::iostreams::mapped_file_source file;
+    try {
+        file.open(path.string());
+    } catch (std::exception &) {
+    }
+    if (!file.is_open()) {
+        nrMisses++;
+        return nullptr;
+    }
+
+    Reader reader{
+        .state = state,
+        .origin = origin,
+        .basePath = basePath,
+        .cur = file.data(),
+        .end = file.data() + file.size(),
+    };
+
+    try {
+        if (file.size() < magic.size() || std::string_view(reader.cur, magic.size()) != magic)
+            reader.corrupt();
+        reader.cur += magic.size();
+        if (reader.get<uint32_t>() != formatVersion)
+            reader.corrupt();
+
+        auto nrSymbols = reader.get<uint32_t>();
+        reader.symbols.reserve(nrSymbols);
+        for (uint32_t i = 0; i < nrSymbols; ++i)
+            reader.symbols.push_back(state.symbols.create(reader.getString()));
+
+        auto nrNodes = reader.get<uint32_t>();
+        reader.nodes.reserve(nrNodes);
+        for (uint32_t i = 0; i < nrNodes; ++i)
+            reader.nodes.push_back(reader.node());
+
+        auto root = reader.expr();
+
+        DocCommentMap docs;
+        auto nrDocs = reader.get<uint32_t>();
+        for (uint32_t i = 0; i < nrDocs; ++i) {
+            auto p = reader.pos();
+            auto begin = reader.pos();
+            docs.insert_or_assign(p, DocComment{begin, reader.pos()});
+        }
+
+        if (reader.cur != reader.end)
+            reader.corrupt();
+
+        docComments.merge(docs);
+
+        /* Record that the entry is still in use, see `prune()`. */
+        auto now = std::filesystem::file_time_type::clock::now();
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (!ec && now - mtime > day)
+            std::filesystem::last_write_time(path, now, ec);
+
+        nrHits++;
+        return root;
+    } catch (Error & e) {
+        debug("ignoring parse cache entry '%s': %s", path.string(), e.msg());
+        nrMisses++;
+        return nullptr;
+    }
+}
+
+
+void ParseCache::insert(
+    EvalState & state,
+    const Hash & key,
+    Expr * e,
+    const PosTable::Origin & origin,
+    const SourcePath & basePath,
+    const DocCommentMap & docComments)
+{
+    auto path = dir / key.to_string(HashFormat::Base16, false);
+    std::error_code ec;
+
+    try {
+        Writer writer{
+            .state = state,
+            .origin = origin,
+            .basePath = basePath,
+        };
+
+        auto root = writer.expr(e);
+
+        std::string docs;
+        uint32_t nrDocs = 0;
+        for (auto & [p, doc] : docComments) {
+            /* The map is shared by all parses of the same file. */
+            if (!p || origin.offsetOf(p) > origin.size) continue;
+            put<uint32_t>(docs, writer.pos(p));
+            put<uint32_t>(docs, writer.pos(doc.begin));
+            put<uint32_t>(docs, writer.pos(doc.end));
+            nrDocs++;
+        }
+
+        std::string s(magic);
+        put<uint32_t>(s, formatVersion);
+        put<uint32_t>(s, writer.symbols.size());
+        for (auto sym : writer.symbols)
+            putString(s, state.symbols[sym]);
+        put<uint32_t>(s, writer.nrNodes);
+        s += writer.nodes;
+        put<uint32_t>(s, root);
+        put<uint32_t>(s, nrDocs);
+        s += docs;
+
+        createDirs(dir);
+        auto tmp = makeTempPath(path.string());
+        try {
+            writeFile(tmp, s);
+            std::filesystem::rename(tmp, path);
+        } catch (...) {
+            std::filesystem::remove(tmp, ec);
+            throw;
+        }
+    } catch (std::exception & e) {
+        debug("cannot write parse cache entry '%s': %s", path.string(), e.what());
+    }
+}
+
+}
@@ -62,7 +62,7 @@ typedef std::unordered_map<PosIdx, DocComment> DocCommentMap;
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     SymbolTable & symbols,
     const EvalSettings & settings,
@@ -527,7 +527,7 @@ namespace nix {
 Expr * parseExprFromBuf(
     char * text,
     size_t length,
-    Pos::Origin origin,
+    const PosTable::Origin & origin,
     const SourcePath & basePath,
     SymbolTable & symbols,
     const EvalSettings & settings,
@@ -540,7 +540,7 @@ Expr * parseExprFromBuf(
     LexerState lexerState {
         .positionToDocComment = docComments,
         .positions = positions,
-        .origin = positions.addOrigin(origin, length),
+        .origin = origin,
     };
     ParserState state {
         .lexerState = lexerState,
@@ -5,6 +5,7 @@
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/gc-small-vector.hh"
 #include "nix/expr/json-to-value.hh"
+#include "nix/expr/regex.hh"
 #include "nix/store/names.hh"
 #include "nix/store/path-references.hh"
 #include "nix/store/store-api.hh"
@@ -25,7 +26,6 @@
 #include <algorithm>
 #include <cstring>
 #include <sstream>
-#include <regex>
 
 #include <dlfcn.h>
 
@@ -38,10 +38,10 @@ namespace nix {
  * Miscellaneous
  *************************************************************/
 
-static inline Value * mkString(EvalState & state, const std::csub_match & match)
+static inline Value * mkString(EvalState & state, std::string_view s)
 {
     Value * v = state.allocValue();
-    v->mkString({match.first, match.second});
+    v->mkString(s);
     return v;
 }
 
@@ -671,7 +671,116 @@ struct CompareValues
 };
 
 
-typedef std::list<Value *, gc_allocator<Value *>> ValueList;
+/**
+ * A hash of a `genericClosure` key that is the same for keys that
+ * `CompareValues` considers equivalent: integers and floats that are
+ * equal as numbers hash alike, and strings and paths are hashed by
+ * their contents only. Forces all elements of lists, including those
+ * that comparing keys would never have looked at.
+ */
+static size_t hashKey(EvalState & state, Value & v)
+{
+    auto hashNumber = [](double d) {
+        /* Integers are compared with floats after conversion to
+           double, so hash them that way too. */
+        if (d >= -0x1p63 && d < 0x1p63 && d == (int64_t) d)
+            return std::hash<int64_t>{}((int64_t) d);
+        return std::hash<double>{}(d);
+    };
+
+    // Allow selecting a subset of enum values
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (v.type()) {
+    case nInt:
+        return hashNumber(v.integer().value);
+    case nFloat:
+        return hashNumber(v.fpoint());
+    case nString:
+        return std::hash<std::string_view>{}(v.c_str());
+    case nPath:
+        return std::hash<std::string_view>{}(v.payload.path.path);
+    case nBool:
+        return v.boolean();
+    case nList: {
+        size_t h = v.listSize();
+        for (auto elem : v.listItems()) {
+            state.forceValue(*elem, noPos);
+            h = h * 31 + hashKey(state, *elem);
+        }
+        return h;
+    }
+    default:
+        return v.type();
+    }
+    #pragma GCC diagnostic pop
+}
+
+/**
+ * The keys seen by `genericClosure`, in an open-addressing hash table
+ * with linear probing. Keys are only compared when their hashes are
+ * equal.
+ */
+class ClosureKeys
+{
+    struct Slot
+    {
+        size_t hash;
+        Value * key = nullptr;
+    };
+
+    /* The number of slots is `2^bits`. */
+    unsigned int bits = 4;
+    std::vector<Slot> slots = std::vector<Slot>(size_t(1) << bits);
+    size_t size = 0;
+
+    /* `CompareValues` orders keys, so keys are equal if neither is
+       less than the other. */
+    CompareValues & cmp;
+
+    /* Hashes of consecutive integers are consecutive, so spread them
+       over the table. Only the high bits of the product depend on all
+       bits of the hash. */
+    size_t slotOf(size_t hash) const
+    {
+        return (uint64_t(hash) * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old(slots.size() * 2);
+        std::swap(old, slots);
+        bits++;
+        auto mask = slots.size() - 1;
+        for (auto & slot : old)
+            if (slot.key) {
+                auto i = slotOf(slot.hash);
+                while (slots[i].key) i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+    }
+
+public:
+
+    ClosureKeys(CompareValues & cmp) : cmp(cmp) { }
+
+    /**
+     * @return Whether `key` was not present yet.
+     */
+    bool insert(Value * key, size_t hash)
+    {
+        auto mask = slots.size() - 1;
+        auto i = slotOf(hash);
+        for (; slots[i].key; i = (i + 1) & mask)
+            if (slots[i].hash == hash && !cmp(key, slots[i].key) && !cmp(slots[i].key, key))
+                return false;
+        slots[i] = {hash, key};
+        /* Keep the load factor at most 2/3. */
+        if (++size * 3 > slots.size() * 2)
+            grow();
+        return true;
+    }
+};
 
 static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
@@ -682,7 +791,7 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * a
 
     state.forceList(*startSet->value, noPos, "while evaluating the 'startSet' attribute passed as argument to builtins.genericClosure");
 
-    ValueList workSet;
+    ValueVector workSet;
     for (auto elem : startSet->value->listItems())
         workSet.push_back(elem);
 
@@ -698,21 +807,34 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value * * a
     /* Construct the closure by applying the operator to elements of
        `workSet', adding the result to `workSet', continuing until
        no new elements are found. */
-    ValueList res;
+    ValueVector res;
     // `doneKeys' doesn't need to be a GC root, because its values are
     // reachable from res.
     auto cmp = CompareValues(state, noPos, "while comparing the `key` attributes of two genericClosure elements");
-    std::set<Value *, decltype(cmp)> doneKeys(cmp);
-    while (!workSet.empty()) {
-        Value * e = *(workSet.begin());
-        workSet.pop_front();
+    ClosureKeys doneKeys(cmp);
+    Value * firstKey = nullptr;
+    for (size_t next = 0; next < workSet.size(); ++next) {
+        Value * e = workSet[next];
 
         state.forceAttrs(*e, noPos, "while evaluating one of the elements generated by (or initially passed to) builtins.genericClosure");
 
         auto key = state.getAttr(state.sKey, e->attrs(), "in one of the attrsets generated by (or initially passed to) builtins.genericClosure");
         state.forceValue(*key->value, noPos);
 
-        if (!doneKeys.insert(key->value).second) continue;
+        /* Keys that are not comparable with the others are an error,
+           even if they hash differently. Comparing them with the first
+           key reports it. Lists are compared up to their first
+           difference, so that `[ 1 ]` and `[ "a" ]` are rejected too. */
+        if (!firstKey)
+            firstKey = key->value;
+        else {
+            auto t1 = key->value->type(), t2 = firstKey->type();
+            bool numbers = (t1 == nInt || t1 == nFloat) && (t2 == nInt || t2 == nFloat);
+            if ((t1 != t2 && !numbers) || t1 == nList || !(t1 == nInt || t1 == nFloat || t1 == nString || t1 == nPath))
+                cmp(key->value, firstKey);
+        }
+
+        if (!doneKeys.insert(key->value, hashKey(state, *key->value))) continue;
         res.push_back(e);
 
         /* Call the `operator' function with `e' as argument. */
@@ -762,6 +884,7 @@ static RegisterPrimOp primop_genericClosure(PrimOp {
 
       The result is produced by calling the `operator` on each `item` that has not been called yet, including newly added items, until no new items are added.
       Items are compared by their `key` attribute.
+      All elements of a list `key` are evaluated.
 
       Common usages are:
 
@@ -1259,6 +1382,8 @@ static void derivationStrictInternal(
 {
     checkDerivationName(state, drvName);
 
+    state.nrDerivations++;
+
     /* Check whether attributes should be passed as a JSON file. */
     using nlohmann::json;
     std::optional<json> jsonObject;
@@ -1591,11 +1716,9 @@ static void derivationStrictInternal(
 
     /* Optimisation, but required in read-only mode! because in that
        case we don't actually write store derivations, so we can't
-       read them later. */
-    {
-        auto h = hashDerivationModulo(*state.store, drv, false);
-        drvHashes.lock()->insert_or_assign(drvPath, h);
-    }
+       read them later. This also records the hash in the store, so
+       that other processes don't need to compute it. */
+    rememberDerivationHashModulo(*state.store, drvPath, hashDerivationModulo(*state.store, drv, false));
 
     auto result = state.buildBindings(1 + drv.outputs.size());
     result.alloc(state.sDrvPath).mkString(drvPathS, {
@@ -2706,12 +2829,32 @@ static RegisterPrimOp primop_path({
  *************************************************************/
 
 
+/**
+ * The memoization key of a primop `tag` that only depends on the
+ * identity of `attrs`, if memoization is enabled and `attrs` is large
+ * enough for it to pay off.
+ */
+static std::optional<EvalMemoCache::Key> memoizeAttrsPrimOp(EvalState & state, const void * tag, const Bindings & attrs)
+{
+    if (!state.memoCache || attrs.size() < 16)
+        return std::nullopt;
+    return EvalMemoCache::identityKey(tag, &attrs);
+}
+
 /* Return the names of the attributes in a set as a sorted list of
    strings. */
 static void prim_attrNames(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     state.forceAttrs(*args[0], pos, "while evaluating the argument passed to builtins.attrNames");
 
+    static char memoTag;
+    auto memoKey = memoizeAttrsPrimOp(state, &memoTag, *args[0]->attrs());
+    if (memoKey)
+        if (auto res = state.memoCache->lookup(*memoKey)) {
+            v = *res;
+            return;
+        }
+
     auto list = state.buildList(args[0]->attrs()->size());
 
     for (const auto & [n, i] : enumerate(*args[0]->attrs()))
@@ -2721,6 +2864,9 @@ static void prim_attrNames(EvalState & state, const PosIdx pos, Value * * args,
               [](Value * v1, Value * v2) { return strcmp(v1->c_str(), v2->c_str()) < 0; });
 
     v.mkList(list);
+
+    if (memoKey)
+        state.memoCache->insert(*memoKey, v);
 }
 
 static RegisterPrimOp primop_attrNames({
@@ -2740,6 +2886,14 @@ static void prim_attrValues(EvalState & state, const PosIdx pos, Value * * args,
 {
     state.forceAttrs(*args[0], pos, "while evaluating the argument passed to builtins.attrValues");
 
+    static char memoTag;
+    auto memoKey = memoizeAttrsPrimOp(state, &memoTag, *args[0]->attrs());
+    if (memoKey)
+        if (auto res = state.memoCache->lookup(*memoKey)) {
+            v = *res;
+            return;
+        }
+
     auto list = state.buildList(args[0]->attrs()->size());
 
     for (const auto & [n, i] : enumerate(*args[0]->attrs()))
@@ -2756,6 +2910,9 @@ static void prim_attrValues(EvalState & state, const PosIdx pos, Value * * args,
         v = ((Attr *) v)->value;
 
     v.mkList(list);
+
+    if (memoKey)
+        state.memoCache->insert(*memoKey, v);
 }
 
 static RegisterPrimOp primop_attrValues({
@@ -3358,18 +3515,15 @@ static RegisterPrimOp primop_head({
 });
 
 /* Return a list consisting of everything but the first element of
-   a list.  Warning: this function takes O(n) time, so you probably
-   don't want to use it!  */
+   a list.  The result shares its elements with the argument, so this
+   takes O(1) time. */
 static void prim_tail(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
     state.forceList(*args[0], pos, "while evaluating the first argument passed to 'builtins.tail'");
     if (args[0]->listSize() == 0)
         state.error<EvalError>("'builtins.tail' called on an empty list").atPos(pos).debugThrow();
 
-    auto list = state.buildList(args[0]->listSize() - 1);
-    for (const auto & [n, v] : enumerate(list))
-        v = args[0]->listElems()[n + 1];
-    v.mkList(list);
+    state.mkListSlice(v, *args[0], 1, args[0]->listSize() - 1);
 }
 
 static RegisterPrimOp primop_tail({
@@ -3379,11 +3533,8 @@ static RegisterPrimOp primop_tail({
       Return the list without its first item; abort evaluation if
       the argument isn’t a list or is an empty list.
 
-      > **Warning**
-      >
-      > This function should generally be avoided since it's inefficient:
-      > unlike Haskell's `tail`, it takes O(n) time, so recursing over a
-      > list by repeatedly calling `tail` takes O(n^2) time.
+      The result shares its items with *list* rather than copying
+      them, so like Haskell's `tail`, this takes O(1) time.
     )",
     .fun = prim_tail,
 });
@@ -3440,18 +3591,22 @@ static void prim_filter(EvalState & state, const PosIdx pos, Value * * args, Val
     SmallValueVector<nonRecursiveStackReservation> vs(args[1]->listSize());
     size_t k = 0;
 
-    bool same = true;
+    /* The range of indices of the kept elements. If they are
+       contiguous, the result is a slice of the argument. */
+    size_t first = 0, last = 0;
+
     for (unsigned int n = 0; n < args[1]->listSize(); ++n) {
         Value res;
         state.callFunction(*args[0], *args[1]->listElems()[n], res, noPos);
-        if (state.forceBool(res, pos, "while evaluating the return value of the filtering function passed to builtins.filter"))
+        if (state.forceBool(res, pos, "while evaluating the return value of the filtering function passed to builtins.filter")) {
+            if (!k) first = n;
+            last = n;
             vs[k++] = args[1]->listElems()[n];
-        else
-            same = false;
+        }
     }
 
-    if (same)
-        v = *args[1];
+    if (!k || last - first + 1 == k)
+        state.mkListSlice(v, *args[1], first, k);
     else {
         auto list = state.buildList(k);
         for (const auto & [n, v] : enumerate(list)) v = vs[n];
@@ -3841,12 +3996,21 @@ static void prim_concatMap(EvalState & state, const PosIdx pos, Value * * args,
     // List of returned lists before concatenation. References to these Values must NOT be persisted.
     SmallTemporaryValueVector<conservativeStackReservation> lists(nrLists);
     size_t len = 0;
+    Value * nonEmpty = nullptr;
 
     for (unsigned int n = 0; n < nrLists; ++n) {
         Value * vElem = args[1]->listElems()[n];
         state.callFunction(*args[0], *vElem, lists[n], pos);
         state.forceList(lists[n], lists[n].determinePos(args[0]->determinePos(pos)), "while evaluating the return value of the function passed to builtins.concatMap");
         len += lists[n].listSize();
+        if (lists[n].listSize()) nonEmpty = &lists[n];
+    }
+
+    /* If only one of the returned lists is non-empty, the result is
+       that list; there is nothing to concatenate. */
+    if (nonEmpty && len == nonEmpty->listSize()) {
+        state.mkListSlice(v, *nonEmpty, 0, len);
+        return;
     }
 
     auto list = state.buildList(len);
@@ -4308,24 +4472,22 @@ struct RegexCache
 {
     struct State
     {
-        std::unordered_map<std::string, std::regex, StringViewHash, std::equal_to<>> cache;
+        std::unordered_map<std::string, regex::Regex, StringViewHash, std::equal_to<>> cache;
     };
 
     Sync<State> state_;
 
-    std::regex get(std::string_view re)
+    /**
+     * The returned reference stays valid, since entries are never
+     * removed.
+     */
+    const regex::Regex & get(std::string_view re)
     {
         auto state(state_.lock());
         auto it = state->cache.find(re);
         if (it != state->cache.end())
             return it->second;
-        /* No std::regex constructor overload from std::string_view, but can be constructed
-           from a pointer + size or an iterator range. */
-        return state->cache
-            .emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(re),
-                std::forward_as_tuple(/*s=*/re.data(), /*count=*/re.size(), std::regex::extended))
+        return state->cache.emplace(std::piecewise_construct, std::forward_as_tuple(re), std::forward_as_tuple(re))
             .first->second;
     }
 };
@@ -4341,13 +4503,13 @@ void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 
     try {
 
-        auto regex = state.regexCache->get(re);
+        auto & regex = state.regexCache->get(re);
 
         NixStringContext context;
         const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
 
-        std::cmatch match;
-        if (!std::regex_match(str.begin(), str.end(), match, regex)) {
+        regex::Captures match;
+        if (!regex.match(str, match)) {
             v.mkNull();
             return;
         }
@@ -4355,22 +4517,20 @@ void prim_match(EvalState & state, const PosIdx pos, Value * * args, Value & v)
         // the first match is the whole string
         auto list = state.buildList(match.size() - 1);
         for (const auto & [i, v2] : enumerate(list))
-            if (!match[i + 1].matched)
+            if (!match.matched(i + 1))
                 v2 = &state.vNull;
             else
-                v2 = mkString(state, match[i + 1]);
+                v2 = mkString(state, match.get(str, i + 1));
         v.mkList(list);
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
+    } catch (regex::RegexTooLarge & e) {
+        state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+    } catch (regex::BadRegex & e) {
+        state.error<EvalError>("invalid regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
     }
 }
 
@@ -4418,16 +4578,15 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 
     try {
 
-        auto regex = state.regexCache->get(re);
+        auto & regex = state.regexCache->get(re);
 
         NixStringContext context;
         const auto str = state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
 
-        auto begin = std::cregex_iterator(str.begin(), str.end(), regex);
-        auto end = std::cregex_iterator();
+        auto matches = regex.matchAll(str);
 
         // Any matches results are surrounded by non-matching results.
-        const size_t len = std::distance(begin, end);
+        const size_t len = matches.size();
         auto list = state.buildList(2 * len + 1);
         size_t idx = 0;
 
@@ -4437,12 +4596,13 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
             return;
         }
 
-        for (auto i = begin; i != end; ++i) {
+        size_t prefixStart = 0;
+        for (const auto & match : matches) {
             assert(idx <= 2 * len + 1 - 3);
-            const auto & match = *i;
 
             // Add a string for non-matched characters.
-            list[idx++] = mkString(state, match.prefix());
+            list[idx++] = mkString(state, str.substr(prefixStart, match.start(0) - prefixStart));
+            prefixStart = match.end(0);
 
             // Add a list for matched substrings.
             const size_t slen = match.size() - 1;
@@ -4450,33 +4610,31 @@ void prim_split(EvalState & state, const PosIdx pos, Value * * args, Value & v)
             // Start at 1, because the first match is the whole string.
             auto list2 = state.buildList(slen);
             for (const auto & [si, v2] : enumerate(list2)) {
-                if (!match[si + 1].matched)
+                if (!match.matched(si + 1))
                     v2 = &state.vNull;
                 else
-                    v2 = mkString(state, match[si + 1]);
+                    v2 = mkString(state, match.get(str, si + 1));
             }
 
             (list[idx++] = state.allocValue())->mkList(list2);
 
             // Add a string for non-matched suffix characters.
             if (idx == 2 * len)
-                list[idx++] = mkString(state, match.suffix());
+                list[idx++] = mkString(state, str.substr(prefixStart));
         }
 
         assert(idx == 2 * len + 1);
 
         v.mkList(list);
 
-    } catch (std::regex_error & e) {
-        if (e.code() == std::regex_constants::error_space) {
-            // limit is _GLIBCXX_REGEX_STATE_LIMIT for libstdc++
-            state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
-        } else
-            state.error<EvalError>("invalid regular expression '%s'", re)
-                .atPos(pos)
-                .debugThrow();
+    } catch (regex::RegexTooLarge & e) {
+        state.error<EvalError>("memory limit exceeded by regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
+    } catch (regex::BadRegex & e) {
+        state.error<EvalError>("invalid regular expression '%s'", re)
+            .atPos(pos)
+            .debugThrow();
     }
 }
 
@@ -4519,21 +4677,31 @@ static RegisterPrimOp primop_split({
 
 static void prim_concatStringsSep(EvalState & state, const PosIdx pos, Value * * args, Value & v)
 {
-    NixStringContext context;
+    StringRopeBuilder res;
 
-    auto sep = state.forceString(*args[0], context, pos, "while evaluating the first argument (the separator string) passed to builtins.concatStringsSep");
+    state.forceString(*args[0], pos, "while evaluating the first argument (the separator string) passed to builtins.concatStringsSep");
     state.forceList(*args[1], pos, "while evaluating the second argument (the list of strings to concat) passed to builtins.concatStringsSep");
 
-    std::string res;
-    res.reserve((args[1]->listSize() + 32) * sep.size());
+    /* The context of the separator is kept even if the list has fewer
+       than two elements. */
+    if (args[1]->listSize() < 2)
+        res.addContext(*args[0]);
+
     bool first = true;
 
     for (auto elem : args[1]->listItems()) {
-        if (first) first = false; else res += sep;
-        res += *state.coerceToString(pos, *elem, context, "while evaluating one element of the list of strings to concat passed to builtins.concatStringsSep");
+        if (first) first = false; else res.add(*args[0]);
+        state.forceValue(*elem, pos);
+        if (elem->type() == nString)
+            res.add(*elem);
+        else {
+            NixStringContext context;
+            auto s = state.coerceToString(pos, *elem, context, "while evaluating one element of the list of strings to concat passed to builtins.concatStringsSep");
+            res.add(*s, context);
+        }
     }
 
-    v.mkString(res, context);
+    res.finish(v);
 }
 
 static RegisterPrimOp primop_concatStringsSep({
@@ -10,7 +10,7 @@ void printAmbiguous(
     Value &v,
     const SymbolTable &symbols,
     std::ostream &str,
-    std::set<const void *> *seen,
+    std::set<std::pair<const void *, size_t>> *seen,
     int depth)
 {
     checkInterrupt();
@@ -36,7 +36,7 @@ void printAmbiguous(
         str << "null";
         break;
     case nAttrs: {
-        if (seen && !v.attrs()->empty() && !seen->insert(v.attrs()).second)
+        if (seen && !v.attrs()->empty() && !seen->insert({v.attrs(), v.attrs()->size()}).second)
             str << "«repeated»";
         else {
             str << "{ ";
@@ -50,7 +50,7 @@ void printAmbiguous(
         break;
     }
     case nList:
-        if (seen && v.listSize() && !seen->insert(v.listElems()).second)
+        if (seen && v.listSize() && !seen->insert({v.listElems(), v.listSize()}).second)
             str << "«repeated»";
         else {
             str << "[ ";
@@ -0,0 +1,1824 @@
+#include "nix/expr/regex.hh"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <unordered_map>
+
+namespace nix::regex {
+
+using ByteSet = std::bitset<256>;
+
+enum class Op : uint8_t {
+    Byte,
+    Set,
+    Any,
+    Split,
+    Jmp,
+    Save,
+    Mark,
+    Progress,
+    Bol,
+    Eol,
+    Match,
+};
+
+/**
+ * Where a `Split` comes from. This matters for searches: like
+ * libstdc++, we try both alternatives of `|` and keep the longer match,
+ * but stop trying fewer repetitions as soon as more repetitions lead to
+ * any match at all.
+ */
+enum class Fork : uint8_t { Alt, Rep };
+
+struct Inst
+{
+    Op op;
+    Fork fork = Fork::Alt;
+    uint8_t byte = 0;
+
+    /**
+     * The jump target of `Jmp`, the preferred branch of `Split`, the
+     * index of a `Set`, or the slot of `Save`, `Mark` and `Progress`.
+     */
+    uint32_t x = 0;
+
+    /**
+     * The other branch of `Split`, or where `Progress` goes if the
+     * subject has been consumed since the `Mark`.
+     */
+    uint32_t y = 0;
+};
+
+struct Program
+{
+    std::vector<Inst> insts;
+    std::vector<ByteSet> sets;
+    size_t nGroups = 0;
+    size_t nMarks = 0;
+
+    /**
+     * Whether there are any `Split`s for `|`.
+     */
+    bool hasAlt = false;
+
+    /**
+     * The bytes that a match can start with, unless there are matches
+     * that consume nothing.
+     */
+    std::optional<ByteSet> firstBytes;
+
+    /**
+     * Per thread: the start and end of every group, followed by the
+     * positions of the `Mark`s.
+     */
+    size_t nSlots() const
+    {
+        return 2 * (nGroups + 1) + nMarks;
+    }
+
+    bool matches(const Inst & inst, char c) const
+    {
+        // Allow selecting a subset of enum values
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wswitch-enum"
+        switch (inst.op) {
+        case Op::Byte:
+            return (uint8_t) c == inst.byte;
+        case Op::Set:
+            return sets[inst.x].test((uint8_t) c);
+        case Op::Any:
+            return c != '\0';
+        default:
+            return false;
+        }
+        #pragma GCC diagnostic pop
+    }
+};
+
+/* Parsing. */
+
+static constexpr size_t unbounded = SIZE_MAX;
+
+struct Node
+{
+    enum class Type { Empty, Byte, Set, Any, Bol, Eol, Group, Concat, Alt, Repeat } type;
+    uint8_t byte = 0;
+    ByteSet set;
+    size_t group = 0;
+    size_t min = 0, max = 0;
+    std::vector<Node> children;
+};
+
+/**
+ * The collating symbols known to libstdc++, indexed by character.
+ */
+static constexpr const char * collatingNames[] = {
+    "NUL",
+    "SOH",
+    "STX",
+    "ETX",
+    "EOT",
+    "ENQ",
+    "ACK",
+    "alert",
+    "backspace",
+    "tab",
+    "newline",
+    "vertical-tab",
+    "form-feed",
+    "carriage-return",
+    "SO",
+    "SI",
+    "DLE",
+    "DC1",
+    "DC2",
+    "DC3",
+    "DC4",
+    "NAK",
+    "SYN",
+    "ETB",
+    "CAN",
+    "EM",
+    "SUB",
+    "ESC",
+    "IS4",
+    "IS3",
+    "IS2",
+    "IS1",
+    "space",
+    "exclamation-mark",
+    "quotation-mark",
+    "number-sign",
+    "dollar-sign",
+    "percent-sign",
+    "ampersand",
+    "apostrophe",
+    "left-parenthesis",
+    "right-parenthesis",
+    "asterisk",
+    "plus-sign",
+    "comma",
+    "hyphen",
+    "period",
+    "slash",
+    "zero",
+    "one",
+    "two",
+    "three",
+    "four",
+    "five",
+    "six",
+    "seven",
+    "eight",
+    "nine",
+    "colon",
+    "semicolon",
+    "less-than-sign",
+    "equals-sign",
+    "greater-than-sign",
+    "question-mark",
+    "commercial-at",
+    "A",
+    "B",
+    "C",
+    "D",
+    "E",
+    "F",
+    "G",
+    "H",
+    "I",
+    "J",
+    "K",
+    "L",
+    "M",
+    "N",
+    "O",
+    "P",
+    "Q",
+    "R",
+    "S",
+    "T",
+    "U",
+    "V",
+    "W",
+    "X",
+    "Y",
+    "Z",
+    "left-square-bracket",
+    "backslash",
+    "right-square-bracket",
+    "circumflex",
+    "underscore",
+    "grave-accent",
+    "a",
+    "b",
+    "c",
+    "d",
+    "e",
+    "f",
+    "g",
+    "h",
+    "i",
+    "j",
+    "k",
+    "l",
+    "m",
+    "n",
+    "o",
+    "p",
+    "q",
+    "r",
+    "s",
+    "t",
+    "u",
+    "v",
+    "w",
+    "x",
+    "y",
+    "z",
+    "left-curly-bracket",
+    "vertical-line",
+    "right-curly-bracket",
+    "tilde",
+    "DEL",
+};
+
+/**
+ * Character classes in the "C" locale.
+ */
+static std::optional<ByteSet> characterClass(std::string_view name)
+{
+    std::string lower;
+    for (auto c : name)
+        lower += c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+
+    std::function<bool(int)> pred;
+    auto isUpper = [](int c) { return c >= 'A' && c <= 'Z'; };
+    auto isLower = [](int c) { return c >= 'a' && c <= 'z'; };
+    auto isDigit = [](int c) { return c >= '0' && c <= '9'; };
+    auto isSpace = [](int c) { return c == ' ' || (c >= '\t' && c <= '\r'); };
+    auto isGraph = [](int c) { return c > ' ' && c < 127; };
+    auto isAlnum = [&](int c) { return isUpper(c) || isLower(c) || isDigit(c); };
+
+    if (lower == "d" || lower == "digit")
+        pred = isDigit;
+    else if (lower == "w")
+        pred = [&](int c) { return isAlnum(c) || c == '_'; };
+    else if (lower == "s" || lower == "space")
+        pred = isSpace;
+    else if (lower == "alnum")
+        pred = isAlnum;
+    else if (lower == "alpha")
+        pred = [&](int c) { return isUpper(c) || isLower(c); };
+    else if (lower == "blank")
+        pred = [](int c) { return c == ' ' || c == '\t'; };
+    else if (lower == "cntrl")
+        pred = [](int c) { return c < ' ' || c == 127; };
+    else if (lower == "graph")
+        pred = isGraph;
+    else if (lower == "lower")
+        pred = isLower;
+    else if (lower == "print")
+        pred = [&](int c) { return isGraph(c) || c == ' '; };
+    else if (lower == "punct")
+        pred = [&](int c) { return isGraph(c) && !isAlnum(c); };
+    else if (lower == "upper")
+        pred = isUpper;
+    else if (lower == "xdigit")
+        pred = [&](int c) { return isDigit(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'); };
+    else
+        return std::nullopt;
+
+    ByteSet set;
+    for (int c = 0; c < 128; ++c)
+        if (pred(c))
+            set.set(c);
+    return set;
+}
+
+class Parser
+{
+    std::string_view s;
+    size_t pos = 0;
+    size_t depth = 0;
+
+    static constexpr size_t maxDepth = 1000;
+
+public:
+
+    size_t nGroups = 0;
+
+    Parser(std::string_view s)
+        : s(s)
+    {
+    }
+
+    Node parse()
+    {
+        auto node = parseAlternatives();
+        if (pos != s.size())
+            fail("unmatched ')'");
+        return node;
+    }
+
+private:
+
+    [[noreturn]] void fail(std::string_view msg)
+    {
+        throw BadRegex("%s at offset %d of regular expression", msg, pos);
+    }
+
+    bool atEnd() const
+    {
+        return pos == s.size();
+    }
+
+    Node parseAlternatives()
+    {
+        if (++depth > maxDepth)
+            throw RegexTooLarge("regular expression is nested too deeply");
+        Node node{.type = Node::Type::Alt};
+        node.children.push_back(parseConcat());
+        while (!atEnd() && s[pos] == '|') {
+            pos++;
+            node.children.push_back(parseConcat());
+        }
+        depth--;
+        if (node.children.size() == 1)
+            return std::move(node.children[0]);
+        return node;
+    }
+
+    Node parseConcat()
+    {
+        Node node{.type = Node::Type::Concat};
+        while (!atEnd() && s[pos] != '|' && s[pos] != ')')
+            node.children.push_back(parseTerm());
+        if (node.children.empty())
+            return Node{.type = Node::Type::Empty};
+        if (node.children.size() == 1)
+            return std::move(node.children[0]);
+        return node;
+    }
+
+    Node parseTerm()
+    {
+        Node atom;
+
+        switch (char c = s[pos++]) {
+        /* Assertions cannot be repeated. */
+        case '^':
+            return Node{.type = Node::Type::Bol};
+        case '$':
+            return Node{.type = Node::Type::Eol};
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            pos--;
+            fail("nothing to repeat");
+        case '(': {
+            auto group = ++nGroups;
+            auto inner = parseAlternatives();
+            if (atEnd())
+                fail("unmatched '('");
+            pos++;
+            atom = Node{.type = Node::Type::Group, .group = group};
+            atom.children.push_back(std::move(inner));
+            break;
+        }
+        case '.':
+            atom = Node{.type = Node::Type::Any};
+            break;
+        case '[':
+            atom = parseBracket();
+            break;
+        case '\\':
+            if (atEnd())
+                fail("trailing backslash");
+            c = s[pos++];
+            /* POSIX leaves escapes of ordinary characters undefined, and
+               libstdc++ rejects them. */
+            if (c == '\0' || !std::strchr(".[\\()*+?{|^$", c))
+                fail("invalid escape");
+            atom = Node{.type = Node::Type::Byte, .byte = (uint8_t) c};
+            break;
+        case '\0':
+            fail("NUL character");
+        default:
+            atom = Node{.type = Node::Type::Byte, .byte = (uint8_t) c};
+            break;
+        }
+
+        while (!atEnd()) {
+            size_t min, max;
+            switch (s[pos]) {
+            case '*':
+                min = 0, max = unbounded;
+                pos++;
+                break;
+            case '+':
+                min = 1, max = unbounded;
+                pos++;
+                break;
+            case '?':
+                min = 0, max = 1;
+                pos++;
+                break;
+            case '{': {
+                pos++;
+                auto n = parseCount();
+                if (!n)
+                    fail("invalid interval");
+                min = max = *n;
+                if (!atEnd() && s[pos] == ',') {
+                    pos++;
+                    max = parseCount().value_or(unbounded);
+                }
+                if (atEnd() || s[pos] != '}')
+                    fail("invalid interval");
+                pos++;
+                if (max < min)
+                    fail("invalid interval");
+                break;
+            }
+            default:
+                return atom;
+            }
+            Node repeat{.type = Node::Type::Repeat, .min = min, .max = max};
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+
+        return atom;
+    }
+
+    std::optional<size_t> parseCount()
+    {
+        if (atEnd() || s[pos] < '0' || s[pos] > '9')
+            return std::nullopt;
+        size_t n = 0;
+        for (; !atEnd() && s[pos] >= '0' && s[pos] <= '9'; ++pos) {
+            n = n * 10 + (s[pos] - '0');
+            if (n > LONG_MAX / 10)
+                fail("interval bound too large");
+        }
+        return n;
+    }
+
+    char collatingElement(std::string_view name)
+    {
+        for (size_t i = 0; i < std::size(collatingNames); ++i)
+            if (name == collatingNames[i])
+                return i;
+        fail("invalid collating element");
+    }
+
+    enum class Token { Char, Dash, Collating, Class, Equivalence, End };
+
+    /**
+     * Parse a bracket expression following the rules of libstdc++,
+     * including which uses of '-' it rejects. The opening '[' has
+     * already been consumed.
+     */
+    Node parseBracket()
+    {
+        bool negate = !atEnd() && s[pos] == '^';
+        if (negate)
+            pos++;
+
+        bool atStart = true;
+        char c = 0;
+        std::string name;
+
+        auto next = [&]() {
+            if (atEnd())
+                fail("unmatched '['");
+            bool start = atStart;
+            atStart = false;
+            c = s[pos++];
+            if (c == '-')
+                return Token::Dash;
+            if (c == '[' && !atEnd() && (s[pos] == '.' || s[pos] == ':' || s[pos] == '=')) {
+                char delim = s[pos++];
+                auto end = s.find(delim, pos);
+                if (end == s.npos || end + 1 >= s.size() || s[end + 1] != ']')
+                    fail("invalid bracket expression");
+                name = s.substr(pos, end - pos);
+                pos = end + 2;
+                return delim == '.' ? Token::Collating : delim == ':' ? Token::Class : Token::Equivalence;
+            }
+            if (c == '[' && atEnd())
+                fail("unmatched '['");
+            if (c == ']' && !start)
+                return Token::End;
+            return Token::Char;
+        };
+
+        Node node{.type = Node::Type::Set};
+        auto & set = node.set;
+
+        enum class Last { None, Char, Class } last = Last::None;
+        char lastChar = 0;
+
+        auto pushChar = [&](char ch) {
+            if (last == Last::Char)
+                set.set((uint8_t) lastChar);
+            last = Last::Char;
+            lastChar = ch;
+        };
+
+        auto pushClass = [&]() {
+            if (last == Last::Char)
+                set.set((uint8_t) lastChar);
+            last = Last::Class;
+        };
+
+        /* Ranges compare `char`s, which are signed. */
+        auto addRange = [&](char from, char to) {
+            if ((signed char) from > (signed char) to)
+                fail("invalid range in bracket expression");
+            for (int b = 0; b < 256; ++b)
+                if ((signed char) b >= (signed char) from && (signed char) b <= (signed char) to)
+                    set.set(b);
+            last = Last::None;
+        };
+
+        auto token = next();
+        if (token == Token::Char || token == Token::Dash) {
+            pushChar(c);
+            token = next();
+        }
+
+        while (token != Token::End) {
+            switch (token) {
+            case Token::Char:
+                pushChar(c);
+                break;
+            case Token::Collating:
+                pushChar(collatingElement(name));
+                break;
+            case Token::Equivalence: {
+                /* In the "C" locale, characters are only equivalent to
+                   themselves, but libstdc++ ignores case. */
+                auto lower = [](int b) { return b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b; };
+                auto ch = lower((uint8_t) collatingElement(name));
+                pushClass();
+                for (int b = 0; b < 256; ++b)
+                    if (lower(b) == ch)
+                        set.set(b);
+                break;
+            }
+            case Token::Class: {
+                auto cls = characterClass(name);
+                if (!cls)
+                    fail("invalid character class");
+                pushClass();
+                set |= *cls;
+                break;
+            }
+            case Token::Dash:
+                token = next();
+                if (token == Token::End) {
+                    pushChar('-');
+                    continue;
+                }
+                if (last != Last::Char)
+                    fail("invalid range in bracket expression");
+                if (token == Token::Char || token == Token::Dash)
+                    addRange(lastChar, c);
+                else
+                    fail("invalid range in bracket expression");
+                break;
+            case Token::End:
+                break;
+            }
+            token = next();
+        }
+
+        if (last == Last::Char)
+            set.set((uint8_t) lastChar);
+
+        if (negate)
+            set.flip();
+
+        return node;
+    }
+};
+
+/* Compilation. */
+
+static bool nullable(const Node & node)
+{
+    // Allow selecting a subset of enum values
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node.type) {
+    case Node::Type::Byte:
+    case Node::Type::Set:
+    case Node::Type::Any:
+        return false;
+    case Node::Type::Concat:
+        return std::all_of(node.children.begin(), node.children.end(), nullable);
+    case Node::Type::Alt:
+        return std::any_of(node.children.begin(), node.children.end(), nullable);
+    case Node::Type::Group:
+        return nullable(node.children[0]);
+    case Node::Type::Repeat:
+        return node.min == 0 || nullable(node.children[0]);
+    default:
+        return true;
+    }
+    #pragma GCC diagnostic pop
+}
+
+static size_t add(size_t a, size_t b)
+{
+    return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t mul(size_t a, size_t b)
+{
+    return b && a > SIZE_MAX / b ? SIZE_MAX : a * b;
+}
+
+/**
+ * The number of instructions `Compiler::compile()` emits for `node`.
+ */
+static size_t programSize(const Node & node)
+{
+    // Allow selecting a subset of enum values
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wswitch-enum"
+    switch (node.type) {
+    case Node::Type::Empty:
+        return 0;
+    case Node::Type::Group:
+        return add(programSize(node.children[0]), 2);
+    case Node::Type::Concat:
+    case Node::Type::Alt: {
+        size_t n = node.type == Node::Type::Alt ? 2 * (node.children.size() - 1) : 0;
+        for (auto & child : node.children)
+            n = add(n, programSize(child));
+        return n;
+    }
+    case Node::Type::Repeat: {
+        auto & child = node.children[0];
+        auto n = programSize(child);
+        auto size = mul(node.min, n);
+        if (node.max == unbounded)
+            return add(size, nullable(child) ? add(mul(4, n), 10) : add(n, 2));
+        return add(size, mul(node.max - node.min, add(n, 1)));
+    }
+    default:
+        return 1;
+    }
+    #pragma GCC diagnostic pop
+}
+
+class Compiler
+{
+    Program & prog;
+
+public:
+
+    Compiler(Program & prog)
+        : prog(prog)
+    {
+    }
+
+    uint32_t pc() const
+    {
+        return prog.insts.size();
+    }
+
+    uint32_t emit(Inst inst)
+    {
+        prog.insts.push_back(inst);
+        return pc() - 1;
+    }
+
+    void compile(const Node & node)
+    {
+        switch (node.type) {
+        case Node::Type::Empty:
+            break;
+        case Node::Type::Byte:
+            emit({.op = Op::Byte, .byte = node.byte});
+            break;
+        case Node::Type::Set:
+            if (node.set.count() == 1) {
+                for (int b = 0; b < 256; ++b)
+                    if (node.set.test(b))
+                        emit({.op = Op::Byte, .byte = (uint8_t) b});
+            } else {
+                prog.sets.push_back(node.set);
+                emit({.op = Op::Set, .x = (uint32_t) prog.sets.size() - 1});
+            }
+            break;
+        case Node::Type::Any:
+            emit({.op = Op::Any});
+            break;
+        case Node::Type::Bol:
+            emit({.op = Op::Bol});
+            break;
+        case Node::Type::Eol:
+            emit({.op = Op::Eol});
+            break;
+        case Node::Type::Group:
+            emit({.op = Op::Save, .x = (uint32_t) (2 * node.group)});
+            compile(node.children[0]);
+            emit({.op = Op::Save, .x = (uint32_t) (2 * node.group + 1)});
+            break;
+        case Node::Type::Concat:
+            for (auto & child : node.children)
+                compile(child);
+            break;
+        case Node::Type::Alt: {
+            std::vector<uint32_t> jumps;
+            for (auto & child : node.children) {
+                if (&child == &node.children.back()) {
+                    compile(child);
+                    break;
+                }
+                auto split = emit({.op = Op::Split, .fork = Fork::Alt, .x = pc() + 1});
+                prog.hasAlt = true;
+                compile(child);
+                jumps.push_back(emit({.op = Op::Jmp}));
+                prog.insts[split].y = pc();
+            }
+            for (auto jump : jumps)
+                prog.insts[jump].x = pc();
+            break;
+        }
+        case Node::Type::Repeat:
+            compileRepeat(node);
+            break;
+        }
+    }
+
+private:
+
+    void compileRepeat(const Node & node)
+    {
+        auto & child = node.children[0];
+
+        for (size_t i = 0; i < node.min; ++i)
+            compile(child);
+
+        if (node.max != unbounded) {
+            std::vector<uint32_t> splits;
+            for (size_t i = node.min; i < node.max; ++i) {
+                splits.push_back(emit({.op = Op::Split, .fork = Fork::Rep, .x = pc() + 1}));
+                compile(child);
+            }
+            for (auto split : splits)
+                prog.insts[split].y = pc();
+        }
+
+        else if (!nullable(child)) {
+            auto split = emit({.op = Op::Split, .fork = Fork::Rep, .x = pc() + 1});
+            compile(child);
+            emit({.op = Op::Jmp, .x = split});
+            prog.insts[split].y = pc();
+        }
+
+        else {
+            /* libstdc++ lets a loop whose body matched the empty string
+               go round once more before giving up, which is observable in
+               the submatches (e.g. `(a*)*` matches "aa" with an empty
+               group). Unroll the loop to get the same result: if the
+               first copy of the body consumes nothing, fall through to the
+               second copy, and after that leave the loop. The next
+               iteration after one that did consume something uses another
+               two copies, because the tail of the previous iteration may
+               already have visited instructions of the body at the
+               current position. */
+            auto slot = (uint32_t) (2 * (prog.nGroups + 1) + prog.nMarks++);
+            std::vector<uint32_t> exits, progress;
+            uint32_t marks[2];
+            for (auto & mark : marks) {
+                mark = emit({.op = Op::Mark, .x = slot});
+                for (int i = 0; i < 2; ++i) {
+                    exits.push_back(emit({.op = Op::Split, .fork = Fork::Rep, .x = pc() + 1}));
+                    compile(child);
+                    progress.push_back(emit({.op = Op::Progress, .x = slot}));
+                }
+                exits.push_back(emit({.op = Op::Jmp}));
+            }
+            for (size_t i = 0; i < progress.size(); ++i)
+                prog.insts[progress[i]].y = marks[i < 2 ? 1 : 0];
+            for (auto i : exits)
+                (prog.insts[i].op == Op::Jmp ? prog.insts[i].x : prog.insts[i].y) = pc();
+        }
+    }
+};
+
+/* The lazy DFA. */
+
+struct Dfa
+{
+    static constexpr uint32_t unknown = UINT32_MAX;
+
+    /**
+     * Flush the states when there are more than this many. If that
+     * happens too often, give up on the DFA and let the Pike VM do all
+     * the work.
+     */
+    static constexpr size_t maxStates = 1024;
+    static constexpr size_t maxFlushes = 16;
+
+    struct State
+    {
+        /**
+         * The consuming, `Eol` and `Match` instructions the NFA may be in.
+         */
+        std::vector<uint32_t> insts;
+        bool match = false;
+        int8_t acceptsAtEnd = -1;
+        std::array<uint32_t, 256> next;
+    };
+
+    const Program & prog;
+    bool anchored;
+
+    std::vector<std::unique_ptr<State>> states;
+    std::map<std::vector<uint32_t>, uint32_t> index;
+    /**
+     * The start state for every instruction, at the start of the
+     * subject and elsewhere.
+     */
+    std::vector<uint32_t> starts;
+    size_t flushes = 0;
+
+    std::vector<uint32_t> visited;
+    uint32_t generation = 0;
+    std::vector<uint32_t> stack;
+
+    Dfa(const Program & prog, bool anchored)
+        : prog(prog)
+        , anchored(anchored)
+        , starts(2 * prog.insts.size(), unknown)
+        , visited(prog.insts.size(), 0)
+    {
+    }
+
+    void closure(uint32_t pc, bool bol, bool eol, std::vector<uint32_t> & out)
+    {
+        stack.push_back(pc);
+        while (!stack.empty()) {
+            pc = stack.back();
+            stack.pop_back();
+            if (visited[pc] == generation)
+                continue;
+            visited[pc] = generation;
+            auto & inst = prog.insts[pc];
+            // Allow selecting a subset of enum values
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wswitch-enum"
+            switch (inst.op) {
+            case Op::Jmp:
+                stack.push_back(inst.x);
+                break;
+            case Op::Split:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            case Op::Progress:
+                stack.push_back(inst.y);
+                stack.push_back(pc + 1);
+                break;
+            case Op::Save:
+            case Op::Mark:
+                stack.push_back(pc + 1);
+                break;
+            case Op::Bol:
+                if (bol)
+                    stack.push_back(pc + 1);
+                break;
+            case Op::Eol:
+                if (eol)
+                    stack.push_back(pc + 1);
+                else
+                    out.push_back(pc);
+                break;
+            default:
+                out.push_back(pc);
+                break;
+            }
+            #pragma GCC diagnostic pop
+        }
+    }
+
+    std::optional<uint32_t> intern(std::vector<uint32_t> && insts)
+    {
+        std::sort(insts.begin(), insts.end());
+        auto i = index.find(insts);
+        if (i != index.end())
+            return i->second;
+
+        if (states.size() >= maxStates) {
+            if (++flushes > maxFlushes)
+                return std::nullopt;
+            states.clear();
+            index.clear();
+            std::fill(starts.begin(), starts.end(), unknown);
+        }
+
+        auto state = std::make_unique<State>();
+        state->match = std::any_of(insts.begin(), insts.end(), [&](auto pc) { return prog.insts[pc].op == Op::Match; });
+        state->next.fill(unknown);
+        state->insts = insts;
+        states.push_back(std::move(state));
+        return index.emplace(std::move(insts), states.size() - 1).first->second;
+    }
+
+    void reset()
+    {
+        states.clear();
+        index.clear();
+        std::fill(starts.begin(), starts.end(), unknown);
+        flushes = 0;
+    }
+
+    /**
+     * The state of the NFA after following the empty transitions from
+     * `pc`.
+     */
+    std::optional<uint32_t> startState(uint32_t pc, bool bol)
+    {
+        auto & start = starts[2 * pc + bol];
+        if (start == unknown) {
+            std::vector<uint32_t> insts;
+            ++generation;
+            closure(pc, bol, false, insts);
+            auto oldFlushes = flushes;
+            auto s = intern(std::move(insts));
+            if (!s || flushes != oldFlushes)
+                return s;
+            start = *s;
+        }
+        return start;
+    }
+
+    std::optional<uint32_t> next(uint32_t s, char c)
+    {
+        auto t = states[s]->next[(uint8_t) c];
+        if (t != unknown)
+            return t;
+        return step(s, c);
+    }
+
+    std::optional<uint32_t> step(uint32_t s, char c)
+    {
+        std::vector<uint32_t> insts;
+        ++generation;
+        for (auto pc : states[s]->insts)
+            if (prog.matches(prog.insts[pc], c))
+                closure(pc + 1, false, false, insts);
+        if (!anchored)
+            closure(0, false, false, insts);
+        auto oldFlushes = flushes;
+        auto t = intern(std::move(insts));
+        /* Don't record the transition if the cache has been flushed. */
+        if (t && flushes == oldFlushes)
+            states[s]->next[(uint8_t) c] = *t;
+        return t;
+    }
+
+    bool acceptsAtEnd(State & state, bool bol)
+    {
+        if (!bol && state.acceptsAtEnd != -1)
+            return state.acceptsAtEnd;
+        std::vector<uint32_t> insts;
+        ++generation;
+        for (auto pc : state.insts)
+            closure(pc, bol, true, insts);
+        bool res = std::any_of(insts.begin(), insts.end(), [&](auto pc) { return prog.insts[pc].op == Op::Match; });
+        if (!bol)
+            state.acceptsAtEnd = res;
+        return res;
+    }
+
+    std::optional<bool> run(std::string_view subject, size_t from)
+    {
+        auto s = startState(0, from == 0);
+        if (!s)
+            return std::nullopt;
+        for (size_t pos = from; pos < subject.size(); ++pos) {
+            auto & state = *states[*s];
+            if (!anchored && state.match)
+                return true;
+            if (state.insts.empty())
+                return false;
+            s = next(*s, subject[pos]);
+            if (!s)
+                return std::nullopt;
+        }
+        auto & state = *states[*s];
+        return (!anchored && state.match) || acceptsAtEnd(state, subject.empty());
+    }
+};
+
+/**
+ * Decides whether the NFA can reach `Match` from an instruction at a
+ * position in the subject, using an anchored DFA. Answers are
+ * memoised for every DFA state and position passed through, so all
+ * the queries of a search take time linear in the length of the
+ * subject.
+ *
+ * If the DFA gives up, the oracle instead works out for every
+ * instruction and position whether `Match` is reachable, going
+ * backwards from the end of the subject. That is also linear in the
+ * length of the subject, but needs a bit per instruction and position.
+ */
+class MatchOracle
+{
+    const Program & prog;
+    std::unique_ptr<Dfa> ownDfa;
+    Dfa & dfa;
+    std::string_view subject;
+    size_t flushes;
+
+    static constexpr uint32_t empty = UINT32_MAX;
+
+    /**
+     * The memo holds `ways` answers per position inline, tagged with
+     * their DFA states, which is almost always enough for the states
+     * asked about there. Further answers go to `overflow`.
+     */
+    static constexpr size_t ways = 2;
+    std::vector<uint32_t> memo;
+    std::unordered_map<uint64_t, bool> overflow;
+
+    std::vector<size_t> path;
+
+    /**
+     * Whether `Match` is reachable from each instruction at each
+     * position, once the DFA has given up.
+     */
+    std::vector<uint64_t> live;
+    std::vector<std::vector<uint32_t>> preds;
+    std::vector<uint32_t> stack;
+
+public:
+
+    /**
+     * Use `dfa` if given, or else a private DFA.
+     */
+    MatchOracle(const Program & prog, std::string_view subject, Dfa * dfa)
+        : prog(prog)
+        , ownDfa(dfa ? nullptr : std::make_unique<Dfa>(prog, true))
+        , dfa(dfa ? *dfa : *ownDfa)
+        , subject(subject)
+        , flushes(this->dfa.flushes)
+        , memo(ways * (subject.size() + 1), empty)
+    {
+    }
+
+    /**
+     * If `nonEmpty`, only matches that consume part of the subject
+     * count.
+     */
+    bool reachesMatch(uint32_t pc, size_t pos, bool nonEmpty)
+    {
+        if (live.empty()) {
+            if (auto res = query(pc, pos, nonEmpty))
+                return *res;
+            /* The DFA gave up. Retrying would give up again at the same
+               place, so answer from the NFA from now on, and leave a
+               fresh DFA for the next subject. */
+            dfa.reset();
+            computeLive();
+        }
+        return liveQuery(pc, pos, nonEmpty);
+    }
+
+private:
+
+    bool isLive(uint32_t pc, size_t pos) const
+    {
+        auto bit = pos * prog.insts.size() + pc;
+        return live[bit / 64] & (uint64_t) 1 << bit % 64;
+    }
+
+    /**
+     * Mark `pc` as live at `pos`, along with the instructions that
+     * reach it by empty transitions.
+     */
+    void setLive(uint32_t pc, size_t pos)
+    {
+        stack.push_back(pc);
+        while (!stack.empty()) {
+            pc = stack.back();
+            stack.pop_back();
+            auto bit = pos * prog.insts.size() + pc;
+            if (live[bit / 64] & (uint64_t) 1 << bit % 64)
+                continue;
+            auto op = prog.insts[pc].op;
+            if ((op == Op::Bol && pos != 0) || (op == Op::Eol && pos != subject.size()))
+                continue;
+            live[bit / 64] |= (uint64_t) 1 << bit % 64;
+            for (auto p : preds[pc])
+                stack.push_back(p);
+        }
+    }
+
+    void computeLive()
+    {
+        auto n = prog.insts.size();
+
+        /* The empty transitions, backwards. Like the DFA, follow both
+           branches of `Progress`. */
+        preds.assign(n, {});
+        for (uint32_t pc = 0; pc < n; ++pc) {
+            auto & inst = prog.insts[pc];
+            // Allow selecting a subset of enum values
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wswitch-enum"
+            switch (inst.op) {
+            case Op::Jmp:
+                preds[inst.x].push_back(pc);
+                break;
+            case Op::Split:
+                preds[inst.x].push_back(pc);
+                preds[inst.y].push_back(pc);
+                break;
+            case Op::Progress:
+                preds[inst.y].push_back(pc);
+                preds[pc + 1].push_back(pc);
+                break;
+            case Op::Save:
+            case Op::Mark:
+            case Op::Bol:
+            case Op::Eol:
+                preds[pc + 1].push_back(pc);
+                break;
+            default:
+                break;
+            }
+            #pragma GCC diagnostic pop
+        }
+
+        live.assign((n * (subject.size() + 1) + 63) / 64, 0);
+        for (size_t pos = subject.size() + 1; pos-- > 0;)
+            for (uint32_t pc = 0; pc < n; ++pc) {
+                auto & inst = prog.insts[pc];
+                if (inst.op == Op::Match
+                    || (pos < subject.size() && prog.matches(inst, subject[pos]) && isLive(pc + 1, pos + 1)))
+                    setLive(pc, pos);
+            }
+    }
+
+    bool liveQuery(uint32_t pc, size_t pos, bool nonEmpty)
+    {
+        if (!nonEmpty)
+            return isLive(pc, pos);
+        if (pos == subject.size())
+            return false;
+
+        /* Look for a consuming instruction that gets there. */
+        std::vector<bool> visited(prog.insts.size());
+        stack.push_back(pc);
+        bool res = false;
+        while (!stack.empty()) {
+            pc = stack.back();
+            stack.pop_back();
+            if (visited[pc])
+                continue;
+            visited[pc] = true;
+            auto & inst = prog.insts[pc];
+            // Allow selecting a subset of enum values
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wswitch-enum"
+            switch (inst.op) {
+            case Op::Jmp:
+                stack.push_back(inst.x);
+                break;
+            case Op::Split:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            case Op::Progress:
+                stack.push_back(inst.y);
+                stack.push_back(pc + 1);
+                break;
+            case Op::Save:
+            case Op::Mark:
+                stack.push_back(pc + 1);
+                break;
+            case Op::Bol:
+                if (pos == 0)
+                    stack.push_back(pc + 1);
+                break;
+            case Op::Eol:
+            case Op::Match:
+                break;
+            default:
+                if (prog.matches(inst, subject[pos]) && isLive(pc + 1, pos + 1))
+                    res = true;
+                break;
+            }
+            #pragma GCC diagnostic pop
+        }
+        return res;
+    }
+
+    void clear()
+    {
+        std::fill(memo.begin(), memo.end(), empty);
+        overflow.clear();
+        path.clear();
+        flushes = dfa.flushes;
+    }
+
+    std::optional<bool> lookup(size_t pos, uint32_t s)
+    {
+        for (size_t i = 0; i < ways; ++i) {
+            auto entry = memo[ways * pos + i];
+            if (entry == empty)
+                return std::nullopt;
+            if (entry >> 1 == s)
+                return entry & 1;
+        }
+        if (auto i = overflow.find((uint64_t) pos * Dfa::maxStates + s); i != overflow.end())
+            return i->second;
+        return std::nullopt;
+    }
+
+    void remember(size_t pos, uint32_t s, bool res)
+    {
+        for (size_t i = 0; i < ways; ++i) {
+            auto & entry = memo[ways * pos + i];
+            if (entry == empty) {
+                entry = s << 1 | res;
+                return;
+            }
+            if (entry >> 1 == s)
+                return;
+        }
+        overflow.emplace((uint64_t) pos * Dfa::maxStates + s, res);
+    }
+
+    std::optional<bool> query(uint32_t pc, size_t pos, bool nonEmpty)
+    {
+        auto s = dfa.startState(pc, pos == 0);
+        if (!s)
+            return std::nullopt;
+        if (dfa.flushes != flushes)
+            clear();
+
+        /* `path` holds the DFA state at each position from `pathStart`
+           on. */
+        path.clear();
+        size_t pathStart = pos;
+
+        bool res;
+        for (size_t p = pos;; ++p) {
+            auto & state = *dfa.states[*s];
+            bool counts = p > pos || !nonEmpty;
+            if (counts) {
+                if (state.match) {
+                    res = true;
+                    break;
+                }
+                if (auto r = lookup(p, *s)) {
+                    res = *r;
+                    break;
+                }
+                path.push_back(*s);
+            } else
+                pathStart = p + 1;
+            if (p == subject.size()) {
+                res = counts && dfa.acceptsAtEnd(state, p == 0);
+                break;
+            }
+            if (state.insts.empty()) {
+                res = false;
+                break;
+            }
+            s = dfa.next(*s, subject[p]);
+            if (!s)
+                return std::nullopt;
+            /* State numbers change when the DFA is flushed. */
+            if (dfa.flushes != flushes) {
+                clear();
+                pathStart = p + 1;
+            }
+        }
+
+        for (size_t i = 0; i < path.size(); ++i)
+            remember(pathStart + i, path[i], res);
+        return res;
+    }
+};
+
+/* The Pike VM. */
+
+struct ThreadList
+{
+    std::vector<uint32_t> pcs;
+    std::vector<size_t> slots;
+
+    size_t size() const
+    {
+        return pcs.size();
+    }
+
+    void clear()
+    {
+        pcs.clear();
+        slots.clear();
+    }
+};
+
+/**
+ * Runs all paths through the NFA in lockstep, in the order in which
+ * libstdc++'s depth-first matcher would try them, to find the match
+ * that it would find.
+ *
+ * When matching the whole subject, the first path that does so wins,
+ * so we stop at the first thread that reaches `Match` at the end.
+ *
+ * When searching, libstdc++ keeps looking for a longer match after
+ * finding one, but only in the untried alternatives of enclosing `|`s:
+ * once more repetitions have led to a match, it does not try fewer. So
+ * we only follow the branch for fewer repetitions if the `oracle` says
+ * that the branch for more cannot reach `Match`, and keep the first
+ * match among the longest ones. Without any `|`, that is simply the
+ * first match, which needs no oracle.
+ */
+class PikeVM
+{
+    const Program & prog;
+    std::string_view subject;
+    size_t nSlots;
+
+    MatchOracle * oracle;
+    size_t start = 0;
+    bool notNull = false;
+
+    std::vector<uint32_t> visited;
+    uint32_t generation = 1;
+
+    struct Job
+    {
+        enum : uint8_t { Visit, Restore } type;
+        uint32_t pc;
+        size_t value = 0;
+    };
+
+    std::vector<Job> stack;
+    std::vector<size_t> scratch;
+    ThreadList clist, nlist;
+
+public:
+
+    PikeVM(const Program & prog, std::string_view subject, MatchOracle * oracle = nullptr)
+        : prog(prog)
+        , subject(subject)
+        , nSlots(prog.nSlots())
+        , oracle(oracle)
+        , visited(prog.insts.size(), 0)
+    {
+    }
+
+    /**
+     * Add the thread at `pc` with slots `scratch` to `list`, following
+     * empty transitions in priority order.
+     */
+    void add(ThreadList & list, uint32_t pc, size_t pos)
+    {
+        stack.push_back({.type = Job::Visit, .pc = pc});
+        while (!stack.empty()) {
+            auto job = stack.back();
+            stack.pop_back();
+
+            if (job.type == Job::Restore) {
+                scratch[job.pc] = job.value;
+                continue;
+            }
+
+            pc = job.pc;
+            if (visited[pc] == generation)
+                continue;
+            visited[pc] = generation;
+
+            auto & inst = prog.insts[pc];
+            // Allow selecting a subset of enum values
+            #pragma GCC diagnostic push
+            #pragma GCC diagnostic ignored "-Wswitch-enum"
+            switch (inst.op) {
+            case Op::Jmp:
+                stack.push_back({.type = Job::Visit, .pc = inst.x});
+                break;
+            case Op::Split:
+                if (inst.fork == Fork::Alt || !oracle || !prog.hasAlt
+                    || !oracle->reachesMatch(inst.x, pos, notNull && pos == start))
+                    stack.push_back({.type = Job::Visit, .pc = inst.y});
+                stack.push_back({.type = Job::Visit, .pc = inst.x});
+                break;
+            case Op::Save:
+            case Op::Mark:
+                stack.push_back({.type = Job::Restore, .pc = inst.x, .value = scratch[inst.x]});
+                scratch[inst.x] = pos;
+                stack.push_back({.type = Job::Visit, .pc = pc + 1});
+                break;
+            case Op::Progress:
+                stack.push_back({.type = Job::Visit, .pc = scratch[inst.x] != pos ? inst.y : pc + 1});
+                break;
+            case Op::Bol:
+                if (pos == 0)
+                    stack.push_back({.type = Job::Visit, .pc = pc + 1});
+                break;
+            case Op::Eol:
+                if (pos == subject.size())
+                    stack.push_back({.type = Job::Visit, .pc = pc + 1});
+                break;
+            default:
+                list.pcs.push_back(pc);
+                list.slots.insert(list.slots.end(), scratch.begin(), scratch.end());
+                break;
+            }
+            #pragma GCC diagnostic pop
+        }
+    }
+
+    /**
+     * Find a match starting at `start`. It must span the rest of the
+     * subject if there is no oracle.
+     */
+    bool run(size_t start, bool notNull, std::vector<size_t> & result)
+    {
+        this->start = start;
+        this->notNull = notNull;
+
+        clist.clear();
+        bool found = false;
+
+        scratch.assign(nSlots, Captures::npos);
+        ++generation;
+        add(clist, 0, start);
+
+        for (size_t pos = start; clist.size(); ++pos) {
+            ++generation;
+            nlist.clear();
+            bool foundHere = false;
+
+            for (size_t i = 0; i < clist.size(); ++i) {
+                auto & inst = prog.insts[clist.pcs[i]];
+                auto slots = clist.slots.begin() + i * nSlots;
+
+                if (inst.op == Op::Match) {
+                    if (!oracle) {
+                        if (pos != subject.size())
+                            continue;
+                        result.assign(slots, slots + nSlots);
+                        return true;
+                    }
+                    if (notNull && pos == start)
+                        continue;
+                    if (!prog.hasAlt) {
+                        /* The first match wins over the rest of `clist`,
+                           but not over threads of higher priority that
+                           are still running. */
+                        result.assign(slots, slots + nSlots);
+                        found = true;
+                        break;
+                    }
+                    if (!foundHere)
+                        result.assign(slots, slots + nSlots);
+                    found = foundHere = true;
+                    continue;
+                }
+
+                if (pos < subject.size() && prog.matches(inst, subject[pos])) {
+                    scratch.assign(slots, slots + nSlots);
+                    add(nlist, clist.pcs[i] + 1, pos + 1);
+                }
+            }
+
+            if (pos == subject.size())
+                break;
+
+            std::swap(clist, nlist);
+        }
+
+        return found;
+    }
+};
+
+/**
+ * Finds the same match as `PikeVM` without an oracle, by trying the
+ * paths through the NFA depth-first like libstdc++ does. It never
+ * visits an instruction twice at the same position, since that failed
+ * the first time, so it takes time linear in the length of the subject
+ * too. It needs a bit for every instruction and position, but does
+ * much less work per step than the Pike VM, so it is used for short
+ * subjects.
+ */
+class Backtracker
+{
+    const Program & prog;
+    std::string_view subject;
+
+    std::vector<uint64_t> visited;
+
+    struct Job
+    {
+        enum : uint8_t { Visit, Restore } type;
+        uint32_t pc;
+        size_t value;
+    };
+
+    std::vector<Job> stack;
+
+public:
+
+    /**
+     * The largest number of instructions times positions to use the
+     * backtracker for.
+     */
+    static constexpr size_t maxVisited = 256 * 1024;
+
+    Backtracker(const Program & prog, std::string_view subject)
+        : prog(prog)
+        , subject(subject)
+        , visited((prog.insts.size() * (subject.size() + 1) + 63) / 64)
+    {
+    }
+
+    bool run(std::vector<size_t> & slots)
+    {
+        slots.assign(prog.nSlots(), Captures::npos);
+        stack.push_back({.type = Job::Visit, .pc = 0, .value = 0});
+
+        while (!stack.empty()) {
+            auto job = stack.back();
+            stack.pop_back();
+
+            if (job.type == Job::Restore) {
+                slots[job.pc] = job.value;
+                continue;
+            }
+
+            /* Follow the preferred path, leaving the alternatives on
+               the stack. */
+            auto pc = job.pc;
+            auto pos = job.value;
+            while (true) {
+                auto bit = pos * prog.insts.size() + pc;
+                if (visited[bit / 64] & (uint64_t) 1 << bit % 64)
+                    break;
+                visited[bit / 64] |= (uint64_t) 1 << bit % 64;
+
+                auto & inst = prog.insts[pc];
+                // Allow selecting a subset of enum values
+                #pragma GCC diagnostic push
+                #pragma GCC diagnostic ignored "-Wswitch-enum"
+                switch (inst.op) {
+                case Op::Match:
+                    if (pos == subject.size())
+                        return true;
+                    break;
+                case Op::Jmp:
+                    pc = inst.x;
+                    continue;
+                case Op::Split:
+                    stack.push_back({.type = Job::Visit, .pc = inst.y, .value = pos});
+                    pc = inst.x;
+                    continue;
+                case Op::Save:
+                case Op::Mark:
+                    stack.push_back({.type = Job::Restore, .pc = inst.x, .value = slots[inst.x]});
+                    slots[inst.x] = pos;
+                    pc++;
+                    continue;
+                case Op::Progress:
+                    pc = slots[inst.x] != pos ? inst.y : pc + 1;
+                    continue;
+                case Op::Bol:
+                    if (pos != 0)
+                        break;
+                    pc++;
+                    continue;
+                case Op::Eol:
+                    if (pos != subject.size())
+                        break;
+                    pc++;
+                    continue;
+                default:
+                    if (pos == subject.size() || !prog.matches(inst, subject[pos]))
+                        break;
+                    pc++;
+                    pos++;
+                    continue;
+                }
+                #pragma GCC diagnostic pop
+                break;
+            }
+        }
+
+        return false;
+    }
+};
+
+static std::optional<ByteSet> firstBytes(const Program & prog)
+{
+    ByteSet set;
+    std::vector<bool> visited(prog.insts.size());
+    std::vector<uint32_t> stack{0};
+    while (!stack.empty()) {
+        auto pc = stack.back();
+        stack.pop_back();
+        if (visited[pc])
+            continue;
+        visited[pc] = true;
+        auto & inst = prog.insts[pc];
+        // Allow selecting a subset of enum values
+        #pragma GCC diagnostic push
+        #pragma GCC diagnostic ignored "-Wswitch-enum"
+        switch (inst.op) {
+        case Op::Byte:
+            set.set(inst.byte);
+            break;
+        case Op::Set:
+            set |= prog.sets[inst.x];
+            break;
+        case Op::Any:
+            set.set().reset(0);
+            break;
+        case Op::Jmp:
+            stack.push_back(inst.x);
+            break;
+        case Op::Split:
+            stack.push_back(inst.x);
+            stack.push_back(inst.y);
+            break;
+        case Op::Progress:
+            stack.push_back(inst.y);
+            stack.push_back(pc + 1);
+            break;
+        case Op::Eol:
+        case Op::Match:
+            return std::nullopt;
+        default:
+            stack.push_back(pc + 1);
+            break;
+        }
+        #pragma GCC diagnostic pop
+    }
+    return set;
+}
+
+Regex::Regex(std::string_view pattern)
+    : prog(std::make_unique<Program>())
+{
+    Parser parser(pattern);
+    auto root = parser.parse();
+
+    prog->nGroups = parser.nGroups;
+
+    if (add(programSize(root), 3) > maxProgramSize)
+        throw RegexTooLarge("regular expression is too large");
+
+    Compiler compiler(*prog);
+    compiler.emit({.op = Op::Save, .x = 0});
+    compiler.compile(root);
+    compiler.emit({.op = Op::Save, .x = 1});
+    compiler.emit({.op = Op::Match});
+
+    prog->firstBytes = firstBytes(*prog);
+}
+
+Regex::~Regex() = default;
+
+size_t Regex::groupCount() const
+{
+    return prog->nGroups;
+}
+
+Dfa & Regex::dfa(bool anchored) const
+{
+    auto & dfa = dfas[anchored];
+    if (!dfa)
+        dfa = std::make_unique<Dfa>(*prog, anchored);
+    return *dfa;
+}
+
+std::optional<bool> Regex::dfaMatch(std::string_view subject, size_t from, bool anchored) const
+{
+    std::unique_lock lock(dfaLock, std::try_to_lock);
+    if (!lock)
+        return std::nullopt;
+    return dfa(anchored).run(subject, from);
+}
+
+bool Regex::match(std::string_view subject, Captures & captures) const
+{
+    auto res = dfaMatch(subject, 0, true);
+    if (res && !*res)
+        return false;
+    if (res && prog->nGroups == 0) {
+        captures.offsets = {0, subject.size()};
+        return true;
+    }
+    std::vector<size_t> slots;
+    bool found = prog->insts.size() * (subject.size() + 1) <= Backtracker::maxVisited
+                     ? Backtracker(*prog, subject).run(slots)
+                     : PikeVM(*prog, subject).run(0, false, slots);
+    if (!found)
+        return false;
+    slots.resize(2 * (prog->nGroups + 1));
+    captures.offsets = std::move(slots);
+    return true;
+}
+
+bool Regex::search(std::string_view subject, size_t from, Captures & captures, SearchFlags flags) const
+{
+    std::unique_lock lock(dfaLock, std::try_to_lock);
+    if (lock && !flags.continuous) {
+        auto res = dfa(false).run(subject, from);
+        if (res && !*res)
+            return false;
+    }
+    MatchOracle oracle(*prog, subject, lock ? &dfa(true) : nullptr);
+    PikeVM vm(*prog, subject, &oracle);
+    return search(subject, from, captures, flags, oracle, vm);
+}
+
+bool Regex::search(
+    std::string_view subject,
+    size_t from,
+    Captures & captures,
+    SearchFlags flags,
+    MatchOracle & oracle,
+    PikeVM & vm) const
+{
+    auto & firstBytes = prog->firstBytes;
+    for (auto start = from; start <= subject.size(); ++start) {
+        if (firstBytes && (start == subject.size() || !firstBytes->test((uint8_t) subject[start]))) {
+            if (flags.continuous)
+                break;
+            continue;
+        }
+        if (oracle.reachesMatch(0, start, flags.notNull)) {
+            std::vector<size_t> slots;
+            vm.run(start, flags.notNull, slots);
+            slots.resize(2 * (prog->nGroups + 1));
+            captures.offsets = std::move(slots);
+            return true;
+        }
+        if (flags.continuous)
+            break;
+    }
+    return false;
+}
+
+std::vector<Captures> Regex::matchAll(std::string_view subject) const
+{
+    std::vector<Captures> matches;
+    Captures captures;
+
+    std::unique_lock lock(dfaLock, std::try_to_lock);
+    if (lock) {
+        auto res = dfa(false).run(subject, 0);
+        if (res && !*res)
+            return matches;
+    }
+
+    /* The searches share what the oracle learns about the subject. */
+    MatchOracle oracle(*prog, subject, lock ? &dfa(true) : nullptr);
+    PikeVM vm(*prog, subject, &oracle);
+
+    if (!search(subject, 0, captures, {}, oracle, vm))
+        return matches;
+
+    while (true) {
+        auto start = captures.end(0);
+        bool empty = captures.start(0) == start;
+        matches.push_back(std::move(captures));
+
+        /* After an empty match, first look for a non-empty one at the same
+           position, then for any match after it. */
+        if (empty) {
+            if (start == subject.size())
+                break;
+            if (search(subject, start, captures, {.notNull = true, .continuous = true}, oracle, vm))
+                continue;
+            start++;
+        }
+
+        if (!search(subject, start, captures, {}, oracle, vm))
+            break;
+    }
+
+    return matches;
+}
+
+}
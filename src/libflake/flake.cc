@@ -915,6 +915,10 @@ void callFlake(EvalState & state,
 
         auto [storePath, subdir] = state.store->toStorePath(sourcePath.path.abs());
 
+        /* The inputs have been made accessible in the evaluator that
+           locked the flake, but `state` may be a different one. */
+        state.allowPath(storePath);
+
         emitTreeAttrs(
             state,
             storePath,
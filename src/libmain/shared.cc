@@ -370,7 +370,16 @@ RunPager::~RunPager()
 
 PrintFreed::~PrintFreed()
 {
-    if (show)
+    if (!show) return;
+    auto pathsPerSecond = results.pathsPerSecond();
+    auto bytesPerSecond = results.bytesPerSecond();
+    if (pathsPerSecond && bytesPerSecond)
+        std::cout << fmt("%d store paths deleted, %s freed (%.0f paths/s, %s/s)\n",
+            results.paths.size(),
+            showBytes(results.bytesFreed),
+            *pathsPerSecond,
+            showBytes((uint64_t) *bytesPerSecond));
+    else
         std::cout << fmt("%d store paths deleted, %s freed\n",
             results.paths.size(),
             showBytes(results.bytesFreed));
@@ -0,0 +1,131 @@
+#include "nix/store/derivations.hh"
+#include "nix/store/store-api.hh"
+#include "nix/store/store-open.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/file-system.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace nix;
+
+/**
+ * A local store in a temporary directory, containing `n` synthetic
+ * derivations with roughly the shape of the derivations in the closure
+ * of Nixpkgs' stdenv: each depends on up to five earlier derivations
+ * and has a few dozen environment variables, one of them a large
+ * build script.
+ */
+struct DerivationClosure
+{
+    AutoDelete dir{createTempDir()};
+    std::string storeUri = fmt("local?root=%s", dir.path().string());
+    std::vector<StorePath> drvPaths;
+    std::vector<std::string> aterms;
+
+    DerivationClosure(size_t n)
+    {
+        initLibStore(false);
+
+        auto store = openStore(storeUri);
+        std::mt19937_64 rng(42);
+
+        std::string script;
+        for (size_t i = 0; i < 100; ++i)
+            script += fmt("echo \"building phase %d of $name\" && make -j$NIX_BUILD_CORES install-%d\n", i, i);
+
+        for (size_t i = 0; i < n; ++i) {
+            Derivation drv;
+            drv.name = fmt("pkg-%d", i);
+            drv.platform = "x86_64-linux";
+            drv.builder = "/bin/sh";
+            drv.args = {"-e", "/build/builder.sh"};
+
+            auto outPath = store->makeStorePath("output:out", hashString(HashAlgorithm::SHA256, drv.name), drv.name);
+            drv.outputs.insert_or_assign("out", DerivationOutput::InputAddressed { .path = outPath });
+            drv.env.insert_or_assign("out", store->printStorePath(outPath));
+            drv.env.insert_or_assign("name", drv.name);
+            drv.env.insert_or_assign("buildCommand", script);
+            for (size_t j = 0; j < 30; ++j)
+                drv.env.insert_or_assign(fmt("var%d", j), fmt("value \"%d\" of\t%s", j, drv.name));
+
+            std::string inputs;
+            for (size_t j = 0; j < 5 && i > 0; ++j) {
+                auto & input = drvPaths[rng() % i];
+                drv.inputDrvs.map[input].value.insert("out");
+                inputs += store->printStorePath(input) + " ";
+            }
+            drv.env.insert_or_assign("buildInputs", inputs);
+
+            drvPaths.push_back(writeDerivation(*store, drv));
+            aterms.push_back(drv.unparse(*store, false));
+        }
+    }
+};
+
+static DerivationClosure & getClosure()
+{
+    static DerivationClosure closure(300);
+    return closure;
+}
+
+/**
+ * Parse the ATerms of all derivations, which are already in memory.
+ */
+static void BM_ParseDerivations(benchmark::State & state)
+{
+    auto & closure = getClosure();
+    auto store = openStore(closure.storeUri);
+
+    for (auto _ : state)
+        for (size_t i = 0; i < closure.aterms.size(); ++i)
+            benchmark::DoNotOptimize(parseDerivation(*store, closure.aterms[i], closure.drvPaths[i].name()));
+
+    state.SetItemsProcessed(state.iterations() * closure.aterms.size());
+}
+
+/**
+ * Read all derivations from a store with an empty derivation cache,
+ * as a new process would.
+ */
+static void BM_ReadDerivationsUncached(benchmark::State & state)
+{
+    auto & closure = getClosure();
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto store = openStore(closure.storeUri);
+        for (auto & drvPath : closure.drvPaths)
+            store->isValidPath(drvPath);
+        state.ResumeTiming();
+
+        for (auto & drvPath : closure.drvPaths)
+            benchmark::DoNotOptimize(store->readDerivation(drvPath));
+    }
+
+    state.SetItemsProcessed(state.iterations() * closure.drvPaths.size());
+}
+
+/**
+ * Read all derivations again, as the build scheduler and
+ * `queryMissing()` do.
+ */
+static void BM_ReadDerivationsCached(benchmark::State & state)
+{
+    auto & closure = getClosure();
+    auto store = openStore(closure.storeUri);
+
+    for (auto & drvPath : closure.drvPaths)
+        store->readDerivationShared(drvPath);
+
+    for (auto _ : state)
+        for (auto & drvPath : closure.drvPaths)
+            benchmark::DoNotOptimize(store->readDerivationShared(drvPath));
+
+    state.SetItemsProcessed(state.iterations() * closure.drvPaths.size());
+}
+
+BENCHMARK(BM_ParseDerivations)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ReadDerivationsUncached)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ReadDerivationsCached)->Unit(benchmark::kMillisecond);
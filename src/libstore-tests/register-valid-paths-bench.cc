@@ -0,0 +1,63 @@
+#include "nix/store/local-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/file-system.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace nix;
+
+/**
+ * Make `n` synthetic path infos. Every path refers to itself and to up
+ * to three earlier paths, which roughly matches the shape of a
+ * Nixpkgs closure.
+ */
+static ValidPathInfos makeInfos(const Store & store, size_t n)
+{
+    std::mt19937_64 rng(42);
+    std::vector<StorePath> paths;
+    ValidPathInfos infos;
+    for (size_t i = 0; i < n; ++i) {
+        auto name = fmt("pkg-%d", i);
+        auto path = store.makeStorePath("output:out", hashString(HashAlgorithm::SHA256, name), name);
+        ValidPathInfo info{path, UnkeyedValidPathInfo(hashString(HashAlgorithm::SHA256, name + "-nar"))};
+        info.narSize = 4096 + rng() % (1 << 20);
+        info.references.insert(path);
+        for (size_t j = 0; j < 3 && i > 0; ++j)
+            info.references.insert(paths[rng() % i]);
+        paths.push_back(path);
+        infos.emplace(path, std::move(info));
+    }
+    return infos;
+}
+
+/**
+ * Register `state.range(0)` paths in a fresh local store, the way
+ * `nix copy` or substitution of a large closure does.
+ */
+static void BM_RegisterValidPaths(benchmark::State & state)
+{
+    initLibStore(false);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        {
+            AutoDelete dir(createTempDir());
+            auto store = openStore(fmt("local?root=%s", dir.path().string()));
+            auto infos = makeInfos(*store, state.range(0));
+            state.ResumeTiming();
+
+            dynamic_cast<LocalStore &>(*store).registerValidPaths(infos);
+
+            /* Don't count closing and deleting the store. */
+            state.PauseTiming();
+        }
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_RegisterValidPaths)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
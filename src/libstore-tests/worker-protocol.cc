@@ -706,6 +706,61 @@ TEST_F(WorkerProtoTest, handshake_features)
     EXPECT_EQ(std::get<1>(clientResult), WorkerProto::FeatureSet({"bar", "xyzzy"}));
 }
 
+TEST_F(WorkerProtoTest, queryPathInfos)
+{
+    Pipe toClient, toServer;
+    toClient.create();
+    toServer.create();
+
+    struct TestClientConnection : WorkerProto::BasicClientConnection
+    {
+        void closeWrite() override { }
+    };
+
+    StorePath foo { "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo" };
+    StorePath bar { "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-bar" };
+
+    UnkeyedValidPathInfo info {
+        Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="),
+    };
+    info.deriver = StorePath { "g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo.drv" };
+    info.references = { bar };
+    info.registrationTime = 23423;
+    info.narSize = 34878;
+
+    std::map<StorePath, UnkeyedValidPathInfo> clientResult;
+
+    auto clientThread = std::thread([&]() {
+        TestClientConnection conn;
+        conn.to.fd = toServer.writeSide.get();
+        conn.from.fd = toClient.readSide.get();
+        conn.protoVersion = PROTOCOL_VERSION;
+        conn.features = {WorkerProto::featureQueryPathInfos};
+        bool daemonException = false;
+        clientResult = conn.queryPathInfos(*store, &daemonException, {foo, bar});
+    });
+
+    /* Answer like the daemon does: `bar` is valid, `foo` is not. */
+    {
+        FdSink out { toClient.writeSide.get() };
+        FdSource in { toServer.readSide.get() };
+        WorkerProto::ReadConn rconn { .from = in, .version = PROTOCOL_VERSION };
+        WorkerProto::WriteConn wconn { .to = out, .version = PROTOCOL_VERSION };
+
+        EXPECT_EQ((WorkerProto::Op) readInt(in), WorkerProto::Op::QueryPathInfos);
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        EXPECT_EQ(paths, StorePathSet({foo, bar}));
+
+        out << STDERR_LAST;
+        WorkerProto::write(*store, wconn, std::map<StorePath, UnkeyedValidPathInfo> {{bar, info}});
+        out.flush();
+    }
+
+    clientThread.join();
+
+    EXPECT_EQ(clientResult, (std::map<StorePath, UnkeyedValidPathInfo> {{bar, info}}));
+}
+
 /// Has to be a `BufferedSink` for handshake.
 struct NullBufferedSink : BufferedSink {
     void writeUnbuffered(std::string_view data) override { }
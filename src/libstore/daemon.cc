@@ -854,6 +854,18 @@ static void performOp(TunnelLogger * logger, ref<Store> store,
         break;
     }
 
+    case WorkerProto::Op::QueryPathInfos: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        auto infos = store->queryPathInfos(paths);
+        logger->stopWork();
+        std::map<StorePath, UnkeyedValidPathInfo> res;
+        for (auto & [path, info] : infos)
+            res.insert_or_assign(path, static_cast<const UnkeyedValidPathInfo &>(*info));
+        WorkerProto::write(*store, wconn, res);
+        break;
+    }
+
     case WorkerProto::Op::OptimiseStore:
         logger->startWork();
         store->optimiseStore();
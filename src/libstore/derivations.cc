@@ -265,7 +265,7 @@ static StringSet parseStrings(StringViewStream & str, bool arePaths)
     StringSet res;
     expect(str, "[");
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(res.end(), (arePaths ? parsePath(str) : parseString(str)).toOwned());
     return res;
 }
 
@@ -394,7 +394,7 @@ static DerivedPathMap<StringSet>::ChildNode parseDerivedPathMapNode(
 
 
 Derivation parseDerivation(
-    const StoreDirConfig & store, std::string && s, std::string_view name,
+    const StoreDirConfig & store, std::string_view s, std::string_view name,
     const ExperimentalFeatureSettings & xpSettings)
 {
     Derivation drv;
@@ -425,12 +425,16 @@ Derivation parseDerivation(
         throw Error("derivation does not start with 'Derive' or 'DrvWithVersion'");
     }
 
+    /* The lists below are written in sorted order, so we insert with
+       a hint at the end of each map, which makes that constant time
+       for well-formed derivations. */
+
     /* Parse the list of outputs. */
     expect(str, "[");
     while (!endOfList(str)) {
         expect(str, "("); std::string id = parseString(str).toOwned();
         auto output = parseDerivationOutput(store, str, xpSettings);
-        drv.outputs.emplace(std::move(id), std::move(output));
+        drv.outputs.emplace_hint(drv.outputs.end(), std::move(id), std::move(output));
     }
 
     /* Parse the list of input derivations. */
@@ -439,11 +443,14 @@ Derivation parseDerivation(
         expect(str, "(");
         auto drvPath = parsePath(str);
         expect(str, ",");
-        drv.inputDrvs.map.insert_or_assign(store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
+        drv.inputDrvs.map.insert_or_assign(drv.inputDrvs.map.end(), store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
         expect(str, ")");
     }
 
-    expect(str, ","); drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    /* Parse the input sources directly into store paths. */
+    expect(str, ",[");
+    while (!endOfList(str))
+        drv.inputSrcs.insert(drv.inputSrcs.end(), store.parseStorePath(*parsePath(str)));
     expect(str, ","); drv.platform = parseString(str).toOwned();
     expect(str, ","); drv.builder = parseString(str).toOwned();
 
@@ -458,7 +465,7 @@ Derivation parseDerivation(
         expect(str, "("); auto name = parseString(str).toOwned();
         expect(str, ","); auto value = parseString(str).toOwned();
         expect(str, ")");
-        drv.env.insert_or_assign(std::move(name), std::move(value));
+        drv.env.insert_or_assign(drv.env.end(), std::move(name), std::move(value));
     }
 
     expect(str, ")");
@@ -781,11 +788,21 @@ DerivationType BasicDerivation::type() const
 
 Sync<DrvHashes> drvHashes;
 
+void rememberDerivationHashModulo(Store & store, const StorePath & drvPath, const DrvHash & h)
+{
+    drvHashes.lock()->insert_or_assign(drvPath, h);
+    try {
+        store.registerDerivationHashModulo(drvPath, h);
+    } catch (Error & e) {
+        debug("cannot record the hash modulo of '%s': %s", store.printStorePath(drvPath), e.msg());
+    }
+}
+
 /* pathDerivationModulo and hashDerivationModulo are mutually recursive
  */
 
 /* Look up the derivation by value and memoize the
-   `hashDerivationModulo` call.
+   `hashDerivationModulo` call, both in memory and in the store.
  */
 static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPath)
 {
@@ -796,12 +813,16 @@ static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPa
             return h->second;
         }
     }
+    if (auto h = store.queryDerivationHashModulo(drvPath)) {
+        drvHashes.lock()->insert_or_assign(drvPath, *h);
+        return *h;
+    }
     auto h = hashDerivationModulo(
         store,
         store.readInvalidDerivation(drvPath),
         false);
     // Cache it
-    drvHashes.lock()->insert_or_assign(drvPath, h);
+    rememberDerivationHashModulo(store, drvPath, h);
     return h;
 }
 
@@ -2,6 +2,7 @@
 #include "nix/store/globals.hh"
 #include "nix/store/local-store.hh"
 #include "nix/util/finally.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/util/unix-domain-socket.hh"
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
@@ -448,6 +449,94 @@ void LocalStore::findRuntimeRoots(Roots & roots, bool censor)
 struct GCLimitReached { };
 
 
+/**
+ * Deletes paths that the garbage collector has moved into the trash
+ * directory, using a pool of threads.
+ */
+class GCDeleter
+{
+    struct State
+    {
+        /**
+         * Number of paths enqueued but not yet deleted.
+         */
+        size_t queued = 0;
+
+        uint64_t bytesFreed = 0;
+
+        std::exception_ptr exception;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    /**
+     * How many paths may be waiting at once. This bounds how far the
+     * amount of freed space can lag behind what `bytesFreed()`
+     * reports, and thus how much `maxFreed` may be overshot.
+     */
+    size_t maxQueued;
+
+    /* Declared last so that the workers stop before the members above
+       are destroyed. */
+    ThreadPool pool;
+
+public:
+
+    GCDeleter(size_t nrThreads)
+        : maxQueued(nrThreads * 4)
+          /* process() counts as one of the threads, but isn't called
+             until the end. */
+        , pool(nrThreads + 1)
+    { }
+
+    void enqueue(const Path & path)
+    {
+        {
+            auto state(state_.lock());
+            while (state->queued >= maxQueued && !state->exception)
+                state.wait(wakeup);
+            if (state->exception)
+                std::rethrow_exception(state->exception);
+            state->queued++;
+        }
+
+        pool.enqueue([this, path]() {
+            uint64_t bytesFreed = 0;
+            std::exception_ptr exception;
+            try {
+                deletePath(path, bytesFreed);
+            } catch (...) {
+                exception = std::current_exception();
+            }
+            auto state(state_.lock());
+            state->queued--;
+            state->bytesFreed += bytesFreed;
+            if (exception && !state->exception)
+                state->exception = exception;
+            wakeup.notify_one();
+        });
+    }
+
+    uint64_t bytesFreed()
+    {
+        return state_.lock()->bytesFreed;
+    }
+
+    /**
+     * Wait for all enqueued paths to be deleted.
+     */
+    void finish()
+    {
+        pool.process();
+        auto state(state_.lock());
+        if (state->exception)
+            std::rethrow_exception(state->exception);
+    }
+};
+
+
 void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 {
     bool shouldDelete = options.action == GCOptions::gcDeleteDead || options.action == GCOptions::gcDeleteSpecific;
@@ -462,9 +551,16 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         // ignore suffixes like '.lock', '.chroot' and '.check'.
         std::unordered_set<std::string> tempRoots;
 
-        // Hash part of the store path currently being deleted, if
-        // any.
-        std::optional<std::string> pending;
+        // Hash parts of the store paths that are being considered
+        // for deletion or that are waiting to be deleted. A client
+        // that registers one of these as a temporary root has to wait
+        // until it has been removed from the store.
+        std::unordered_set<std::string> pending;
+
+        // Number of clients waiting for a path in `pending`. While
+        // this is non-zero, dead paths are deleted without waiting
+        // for a full batch.
+        size_t waiting = 0;
     };
 
     Sync<Shared> _shared;
@@ -575,9 +671,13 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                                    done. FIXME: ideally we would use a
                                    FD for this so we don't block the
                                    poll loop. */
-                                while (shared->pending == hashPart) {
-                                    debug("synchronising with deletion of path '%s'", path);
-                                    shared.wait(wakeup);
+                                if (shared->pending.count(hashPart)) {
+                                    shared->waiting++;
+                                    Finally stopWaiting([&]() { shared->waiting--; });
+                                    while (shared->pending.count(hashPart)) {
+                                        debug("synchronising with deletion of path '%s'", path);
+                                        shared.wait(wakeup);
+                                    }
                                 }
                             } else
                                 printError("received garbage instead of a root from client");
@@ -600,6 +700,21 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         if (serverThread.joinable()) serverThread.join();
     });
 
+    /* Paths that haven't been deleted when we bail out (e.g. because
+       of `maxFreed`) stay in the store, so don't make any client wait
+       for them. This has to run before `stopServer`. */
+    Finally releaseAllPending([&]() {
+        auto shared(_shared.lock());
+        shared->pending.clear();
+        wakeup.notify_all();
+    });
+
+    auto releasePending = [&](const StorePath & path) {
+        auto shared(_shared.lock());
+        shared->pending.erase(std::string(path.hashPart()));
+        wakeup.notify_all();
+    };
+
 
     /* Find the roots.  Since we've grabbed the GC lock, the set of
        permanent roots cannot increase now. */
@@ -623,6 +738,54 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
     if (auto p = getEnv("_NIX_TEST_GC_SYNC_2"))
         readFile(*p);
 
+    /* If enabled, dead paths are moved into the trash directory and
+       deleted from there by `deleter` in the background. Leftovers
+       from an interrupted garbage collection are deleted first. */
+    std::optional<GCDeleter> deleter;
+    if (shouldDelete && settings.gcDeleteThreads > 0 && canDeleteViaTrash()) {
+        deleter.emplace(settings.gcDeleteThreads);
+        createDirs(trashDir);
+        for (auto & entry : DirectoryIterator{trashDir}) {
+            checkInterrupt();
+            deleter->enqueue(entry.path().string());
+        }
+    }
+
+    /* Bytes freed by deleting paths in place, i.e. not by `deleter`. */
+    uint64_t bytesFreedInPlace = 0;
+
+    std::optional<std::chrono::steady_clock::time_point> deletionStarted;
+
+    auto bytesFreed = [&]() {
+        return bytesFreedInPlace + (deleter ? deleter->bytesFreed() : 0);
+    };
+
+    /* Move a path into the trash directory. Returns false if that's
+       not possible, in which case it has to be deleted in place. */
+    auto moveToTrash = [&](const Path & realPath, const Path & trashPath) {
+        if (rename(realPath.c_str(), trashPath.c_str()) == 0)
+            return true;
+        /* Moving a directory to another parent requires write
+           permission on it, since its '..' entry changes. Store paths
+           are read-only, and unlike root, a single-user install
+           doesn't get to override that. */
+        struct stat st;
+        if (errno == EACCES
+            && lstat(realPath.c_str(), &st) == 0
+            && S_ISDIR(st.st_mode)
+            && chmod(realPath.c_str(), st.st_mode | S_IWUSR) == 0)
+        {
+            if (rename(realPath.c_str(), trashPath.c_str()) == 0)
+                return true;
+            /* Don't leave a writable directory in the store. */
+            auto savedErrno = errno;
+            chmod(realPath.c_str(), st.st_mode);
+            errno = savedErrno;
+        }
+        debug("cannot move '%s' to the trash, deleting it in place: %s", realPath, strerror(errno));
+        return false;
+    };
+
     /* Helper function that deletes a path from the store and throws
        GCLimitReached if we've deleted enough garbage. */
     auto deleteFromStore = [&](std::string_view baseName)
@@ -645,12 +808,19 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
         results.paths.insert(path);
 
-        uint64_t bytesFreed;
-        deleteStorePath(realPath, bytesFreed);
+        if (!deletionStarted)
+            deletionStarted = std::chrono::steady_clock::now();
 
-        results.bytesFreed += bytesFreed;
+        Path trashPath = trashDir + "/" + std::string(baseName);
+        if (deleter && moveToTrash(realPath, trashPath))
+            deleter->enqueue(trashPath);
+        else {
+            uint64_t bytesFreed;
+            deleteStorePath(realPath, bytesFreed);
+            bytesFreedInPlace += bytesFreed;
+        }
 
-        if (results.bytesFreed > options.maxFreed) {
+        if (bytesFreed() > options.maxFreed) {
             printInfo("deleted more than %d bytes; stopping", options.maxFreed);
             throw GCLimitReached();
         }
@@ -658,6 +828,56 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
 
     std::unordered_map<StorePath, StorePathSet> referrersCache;
 
+    /* Dead paths, in the order in which they can be deleted, that
+       haven't been invalidated and deleted yet. Their hash parts are
+       in `pending`. Invalidating them in batches saves a SQLite
+       transaction per path. The batch is flushed early if a client
+       is waiting for one of the pending paths. */
+    std::vector<StorePath> deleteBatch;
+
+    constexpr size_t maxBatchSize = 1000;
+
+    auto flushDeleteBatch = [&]() {
+        if (deleteBatch.empty()) return;
+
+        auto batch = std::move(deleteBatch);
+        deleteBatch.clear();
+
+        /* The registrations of the paths that have been invalidated
+           but not deleted. If we stop early (because of `maxFreed` or
+           an error), these paths are still in the store, so they have
+           to be made valid again. */
+        ValidPathInfos invalidated;
+        auto inUse = invalidatePathsChecked(batch, &invalidated);
+
+        try {
+            for (auto & path : batch) {
+                checkInterrupt();
+                Finally release([&]() { releasePending(path); });
+                if (auto referrers = get(inUse, path)) {
+                    // If we end up here, it's likely a new occurrence
+                    // of https://github.com/NixOS/nix/issues/11923
+                    printError("BUG: cannot delete path '%s' because it is in use by %s",
+                        printStorePath(path), showPaths(*referrers));
+                    continue;
+                }
+                invalidated.erase(path);
+                deleteFromStore(path.to_string());
+                referrersCache.erase(path);
+            }
+        } catch (...) {
+            if (!invalidated.empty()) {
+                debug("re-registering %d paths that were not deleted", invalidated.size());
+                try {
+                    registerValidPaths(invalidated);
+                } catch (...) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
+            throw;
+        }
+    };
+
     /* Helper function that visits all paths reachable from `start`
        via the referrers edges and optionally derivers and derivation
        output edges. If none of those paths are roots, then all
@@ -666,12 +886,12 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         StorePathSet visited;
         std::queue<StorePath> todo;
 
-        /* Wake up any GC client waiting for deletion of the paths in
-           'visited' to finish. */
-        Finally releasePending([&]() {
-            auto shared(_shared.lock());
-            shared->pending.reset();
-            wakeup.notify_all();
+        /* Wake up any GC client waiting for the paths in 'visited' that
+           turned out not to be garbage. */
+        Finally releaseVisited([&]() {
+            for (auto & path : visited)
+                if (!dead.count(path))
+                    releasePending(path);
         });
 
         auto enqueue = [&](const StorePath & path) {
@@ -725,7 +945,7 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                     debug("cannot delete '%s' because it's a temporary root", printStorePath(*path));
                     return markAlive();
                 }
-                shared->pending = hashPart;
+                shared->pending.insert(hashPart);
             }
 
             if (isValidPath(*path)) {
@@ -761,18 +981,14 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         }
         for (auto & path : topoSortPaths(visited)) {
             if (!dead.insert(path).second) continue;
-            if (shouldDelete) {
-                try {
-                    invalidatePathChecked(path);
-                    deleteFromStore(path.to_string());
-                    referrersCache.erase(path);
-                } catch (PathInUse &e) {
-                    // If we end up here, it's likely a new occurrence
-                    // of https://github.com/NixOS/nix/issues/11923
-                    printError("BUG: %s", e.what());
-                }
-            }
+            if (shouldDelete)
+                deleteBatch.push_back(path);
+            else
+                releasePending(path);
         }
+
+        if (deleteBatch.size() >= maxBatchSize || _shared.lock()->waiting)
+            flushDeleteBatch();
     };
 
     /* Either delete all garbage paths, or just the specified
@@ -789,6 +1005,8 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                     printStorePath(i));
         }
 
+        flushDeleteBatch();
+
     } else if (options.maxFreed > 0) {
 
         if (shouldDelete)
@@ -804,12 +1022,13 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                unreachable. We don't use readDirectory() here so that
                GCing can start faster. */
             auto linksName = baseNameOf(linksDir);
+            auto trashName = baseNameOf(trashDir);
             Paths entries;
             struct dirent * dirent;
             while (errno = 0, dirent = readdir(dir.get())) {
                 checkInterrupt();
                 std::string name = dirent->d_name;
-                if (name == "." || name == ".." || name == linksName) continue;
+                if (name == "." || name == ".." || name == linksName || name == trashName) continue;
 
                 if (auto storePath = maybeParseStorePath(storeDir + "/" + name))
                     deleteReferrersClosure(*storePath);
@@ -817,10 +1036,24 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                     deleteFromStore(name);
 
             }
+
+            flushDeleteBatch();
         } catch (GCLimitReached & e) {
         }
     }
 
+    if (deleter) {
+        deleter->finish();
+        /* Only remove the trash directory if it's empty. */
+        rmdir(trashDir.c_str());
+    }
+
+    results.bytesFreed = bytesFreed();
+
+    if (deletionStarted)
+        results.secondsDeleting = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - *deletionStarted).count();
+
     if (options.action == GCOptions::gcReturnLive) {
         for (auto & i : alive)
             results.paths.insert(printStorePath(i));
@@ -408,11 +408,13 @@ StorePath writeDerivation(Store & store,
     bool readOnly = false);
 
 /**
- * Read a derivation from a file.
+ * Parse a derivation in ATerm format. Only strings with escapes are
+ * copied before they are added to the result, so `s` can be e.g. a
+ * memory-mapped file.
  */
 Derivation parseDerivation(
     const StoreDirConfig & store,
-    std::string && s,
+    std::string_view s,
     std::string_view name,
     const ExperimentalFeatureSettings & xpSettings = experimentalFeatureSettings);
 
@@ -510,6 +512,13 @@ typedef std::map<StorePath, DrvHash> DrvHashes;
 // FIXME: global, though at least thread-safe.
 extern Sync<DrvHashes> drvHashes;
 
+/**
+ * Remember the hash modulo `h` of the derivation `drvPath`, with output
+ * paths not masked, in `drvHashes` and in the persistent cache of the
+ * store (see `Store::registerDerivationHashModulo()`).
+ */
+void rememberDerivationHashModulo(Store & store, const StorePath & drvPath, const DrvHash & h);
+
 struct Source;
 struct Sink;
 
@@ -69,6 +69,29 @@ struct GCResults
      * number of bytes that would be or was freed.
      */
     uint64_t bytesFreed = 0;
+
+    /**
+     * For `gcDeleteDead` and `gcDeleteSpecific`, the wall-clock time
+     * in seconds from deleting the first path until all deletions
+     * had finished. Only local stores report this; it's 0 otherwise.
+     */
+    double secondsDeleting = 0;
+
+    /**
+     * Deletion throughput derived from the above, or `std::nullopt`
+     * if nothing was timed.
+     */
+    std::optional<double> pathsPerSecond() const
+    {
+        if (secondsDeleting <= 0) return std::nullopt;
+        return paths.size() / secondsDeleting;
+    }
+
+    std::optional<double> bytesPerSecond() const
+    {
+        if (secondsDeleting <= 0) return std::nullopt;
+        return bytesFreed / secondsDeleting;
+    }
 };
 
 
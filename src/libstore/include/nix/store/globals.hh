@@ -561,6 +561,23 @@ public:
         )",
         {"gc-keep-derivations"}};
 
+    Setting<unsigned int> gcDeleteThreads{
+        this, 4, "gc-delete-threads",
+        R"(
+          The number of threads the garbage collector uses to delete dead
+          store paths.
+
+          Dead paths are first moved into a trash directory inside the
+          store (`.trash`), which is fast and makes the store path name
+          available again immediately. The actual deletion then happens
+          in the background while the garbage collector looks for more
+          garbage. This mostly helps on large stores where deletion is
+          bound by the latency of `unlink()`.
+
+          If set to `0`, paths are deleted one at a time by the garbage
+          collector itself.
+        )"};
+
     Setting<bool> autoOptimiseStore{
         this, false, "auto-optimise-store",
         R"(
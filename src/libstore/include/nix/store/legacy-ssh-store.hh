@@ -69,6 +69,9 @@ struct LegacySSHStore : public virtual Store
     void queryPathInfoUncached(const StorePath & path,
         Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosBatchUncached(const StorePathSet & paths) override;
+
     std::map<StorePath, UnkeyedValidPathInfo> queryPathInfosUncached(
         const StorePathSet & paths);
 
@@ -173,6 +173,15 @@ private:
      */
     void deleteStorePath(const Path & path, uint64_t & bytesFreed) override;
 
+    /**
+     * Moving a path out of the merged directory would copy it up, so
+     * always go through `deleteStorePath`.
+     */
+    bool canDeleteViaTrash() override
+    {
+        return false;
+    }
+
     /**
      * Deduplicate by removing store objects from the upper layer that
      * are now in the lower layer.
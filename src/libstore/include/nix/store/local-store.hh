@@ -32,8 +32,28 @@ struct OptimiseStats
 {
     unsigned long filesLinked = 0;
     uint64_t bytesFreed = 0;
+
+    /**
+     * Files whose contents had to be hashed, and their total size.
+     */
+    unsigned long filesHashed = 0;
+    uint64_t bytesHashed = 0;
+
+    /**
+     * Files whose hash was taken from the persistent hash index.
+     */
+    unsigned long hashIndexHits = 0;
+
+    /**
+     * Wall-clock time spent by `LocalStore::optimiseStore()`.
+     */
+    std::chrono::duration<double> elapsed{0};
+
+    OptimiseStats & operator += (const OptimiseStats & other);
 };
 
+struct OptimiseHashIndex;
+
 struct LocalStoreConfig : std::enable_shared_from_this<LocalStoreConfig>, virtual LocalFSStoreConfig
 {
     using LocalFSStoreConfig::LocalFSStoreConfig;
@@ -124,6 +144,18 @@ private:
         uint64_t availAfterGC = std::numeric_limits<uint64_t>::max();
 
         std::unique_ptr<PublicKeys> publicKeys;
+
+        /**
+         * Rows of the `DerivationHashesModulo` table that
+         * `registerDerivationHashModulo()` hasn't written yet.
+         */
+        struct PendingDrvHash
+        {
+            std::string drvPath, outputName, hash;
+            bool deferred;
+        };
+
+        std::vector<PendingDrvHash> pendingDrvHashes;
     };
 
     Sync<State> _state;
@@ -132,6 +164,7 @@ public:
 
     const Path dbDir;
     const Path linksDir;
+    const Path trashDir;
     const Path reservedPath;
     const Path schemaPath;
     const Path tempRootsDir;
@@ -172,6 +205,9 @@ public:
     void queryPathInfoUncached(const StorePath & path,
         Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosBatchUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
@@ -188,6 +224,21 @@ public:
     void addToStore(const ValidPathInfo & info, Source & source,
         RepairFlag repair, CheckSigsFlag checkSigs) override;
 
+    /**
+     * Like the base implementation, but registers the new paths in
+     * large SQLite transactions rather than one per path.
+     */
+    void addMultipleToStore(
+        Source & source,
+        RepairFlag repair,
+        CheckSigsFlag checkSigs) override;
+
+    void addMultipleToStore(
+        PathsSource && pathsToCopy,
+        Activity & act,
+        RepairFlag repair,
+        CheckSigsFlag checkSigs) override;
+
     StorePath addToStoreFromDump(
         Source & dump,
         std::string_view name,
@@ -259,6 +310,16 @@ public:
      */
     virtual void deleteStorePath(const Path & path, uint64_t & bytesFreed);
 
+    /**
+     * Whether `collectGarbage` may move dead paths into `trashDir` and
+     * delete them there on background threads, instead of calling
+     * `deleteStorePath` on them in place.
+     */
+    virtual bool canDeleteViaTrash()
+    {
+        return true;
+    }
+
     /**
      * Optimise the disk space usage of the Nix store by hard-linking
      * files with the same contents.
@@ -326,6 +387,23 @@ public:
      */
     void autoGC(bool sync = true);
 
+    /**
+     * Look up the hash modulo of `drvPath` in the
+     * `DerivationHashesModulo` table. Hashes that are still pending
+     * aren't found, but this process has them in `drvHashes` anyway.
+     */
+    std::optional<DrvHash> queryDerivationHashModulo(const StorePath & drvPath) override;
+
+    /**
+     * Queue the hash modulo of `drvPath` for the
+     * `DerivationHashesModulo` table. Evaluation records one for every
+     * derivation, so they are written in batches of
+     * `maxPendingDrvHashes` rows, and when the store is closed.
+     */
+    void registerDerivationHashModulo(const StorePath & drvPath, const DrvHash & hash) override;
+
+    static constexpr size_t maxPendingDrvHashes = 256;
+
     /**
      * Register the store path 'output' as the output named 'outputName' of
      * derivation 'deriver'.
@@ -362,18 +440,60 @@ private:
 
     void upgradeDBSchema(State & state);
 
+    /**
+     * Write the pending hashes modulo to the database, in a single
+     * transaction.
+     */
+    void flushDerivationHashesModulo(State & state);
+
     void makeStoreWritable();
 
     uint64_t queryValidPathId(State & state, const StorePath & path);
 
-    uint64_t addValidPath(State & state, const ValidPathInfo & info, bool checkOutputs = true);
+    /**
+     * Look up the ids of those of `paths` that are valid, using a
+     * statement per hundred paths.
+     */
+    std::map<StorePath, uint64_t> queryValidPathIds(State & state, const StorePathSet & paths);
+
+    /**
+     * Insert the given paths, none of which may be valid yet, using
+     * multi-row `insert` statements. Their references aren't
+     * registered.
+     */
+    void addValidPaths(State & state, const std::vector<const ValidPathInfo *> & infos);
+
+    /**
+     * The part of `addToStore()` that restores the path from the NAR,
+     * with `outputLock` held. Returns whether the path was added, in
+     * which case the caller must register it while still holding the
+     * lock.
+     *
+     * If `beforeWaiting` is set, the lock is not waited for while
+     * holding other locks: as long as another process holds it,
+     * `beforeWaiting` is called, which must release the caller's other
+     * locks, and the lock is tried again a little later.
+     */
+    bool addToStoreUnregistered(const ValidPathInfo & info, Source & source,
+        RepairFlag repair, CheckSigsFlag checkSigs, PathLocks & outputLock,
+        std::function<void()> beforeWaiting = {});
+
+    class RegistrationBatch;
 
     void invalidatePath(State & state, const StorePath & path);
 
     /**
-     * Delete a path from the Nix store.
+     * Remove `paths` from the database, in order, in a single
+     * transaction. Paths that still have referrers are skipped; they
+     * are returned together with those referrers.
+     *
+     * If `invalidated` is set, the registrations of the removed paths
+     * are stored in it, so that they can be restored with
+     * `registerValidPaths()`.
      */
-    void invalidatePathChecked(const StorePath & path);
+    std::map<StorePath, StorePathSet> invalidatePathsChecked(
+        const std::vector<StorePath> & paths,
+        ValidPathInfos * invalidated = nullptr);
 
     std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State & state, const StorePath & path);
 
@@ -393,8 +513,9 @@ private:
     typedef std::unordered_set<ino_t> InodeHash;
 
     InodeHash loadInodeHash();
-    Strings readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash);
-    void optimisePath_(Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair);
+    Strings readDirectoryIgnoringInodes(const Path & path, Sync<InodeHash> & inodeHash);
+    void optimisePath_(Activity * act, OptimiseStats & stats, const Path & path,
+        Sync<InodeHash> & inodeHash, OptimiseHashIndex * hashIndex, RepairFlag repair);
 
     // Internal versions that are not wrapped in retry_sqlite.
     bool isValidPath_(State & state, const StorePath & path);
@@ -58,6 +58,9 @@ struct RemoteStore :
     void queryPathInfoUncached(const StorePath & path,
         Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosBatchUncached(const StorePathSet & paths) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
@@ -44,6 +44,7 @@ struct DrvOutput;
 
 struct BasicDerivation;
 struct Derivation;
+struct DrvHash;
 
 struct SourceAccessor;
 class NarInfoDiskCache;
@@ -129,6 +130,9 @@ struct StoreConfig : public StoreDirConfig
     Setting<int> pathInfoCacheSize{this, 65536, "path-info-cache-size",
         "Size of the in-memory store path metadata cache."};
 
+    Setting<int> derivationCacheSize{this, 1024, "derivation-cache-size",
+        "Size of the in-memory cache of parsed derivations."};
+
     Setting<bool> isTrusted{this, false, "trusted",
         R"(
           Whether paths from this store can be used as substitutes
@@ -222,6 +226,12 @@ protected:
     struct State
     {
         LRUCache<std::string, PathInfoCacheValue> pathInfoCache;
+
+        /**
+         * Parsed derivations. Since a derivation is immutable, these
+         * never need to be invalidated.
+         */
+        LRUCache<StorePath, ref<const Derivation>> drvCache;
     };
 
     SharedSync<State> state;
@@ -306,6 +316,15 @@ public:
     void queryPathInfo(const StorePath & path,
         Callback<ref<const ValidPathInfo>> callback) noexcept;
 
+    /**
+     * Query information about several valid paths at once. Paths that
+     * are not valid are omitted from the result.
+     *
+     * Unlike calling queryPathInfo() for every path, this doesn't
+     * need a round trip per path on remote stores.
+     */
+    std::map<StorePath, ref<const ValidPathInfo>> queryPathInfos(const StorePathSet & paths);
+
     /**
      * Version of queryPathInfo() that only queries the local narinfo cache and not
      * the actual store.
@@ -353,6 +372,18 @@ protected:
 
     virtual void queryPathInfoUncached(const StorePath & path,
         Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept = 0;
+
+    /**
+     * Bulk version of queryPathInfoUncached(). Paths that are not
+     * valid map to `nullptr`.
+     *
+     * The default implementation starts all queries before waiting
+     * for any of them, so they run concurrently on stores with an
+     * asynchronous queryPathInfoUncached().
+     */
+    virtual std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryPathInfosBatchUncached(const StorePathSet & paths);
+
     virtual void queryRealisationUncached(const DrvOutput &,
         Callback<std::shared_ptr<const Realisation>> callback) noexcept = 0;
 
@@ -453,6 +484,20 @@ public:
         RepairFlag repair = NoRepair,
         CheckSigsFlag checkSigs = CheckSigs);
 
+protected:
+
+    /**
+     * Implementation of `addMultipleToStore()` that adds each path
+     * that isn't valid yet by calling `addPath`, in parallel, but only
+     * after the paths it references have been added.
+     */
+    void addMultipleToStoreWith(
+        PathsSource && pathsToCopy,
+        Activity & act,
+        std::function<void(ValidPathInfo & info, Source & source)> addPath);
+
+public:
+
     /**
      * Copy the contents of a path to the store and register the
      * validity the resulting path.
@@ -523,11 +568,35 @@ public:
     virtual void registerDrvOutput(const Realisation & output, CheckSigsFlag checkSigs)
     { return registerDrvOutput(output); }
 
+    /**
+     * Look up the hash modulo (see `hashDerivationModulo()`) of the
+     * derivation `drvPath` in the persistent cache of these hashes, if
+     * the store has one.
+     */
+    virtual std::optional<DrvHash> queryDerivationHashModulo(const StorePath & drvPath);
+
+    /**
+     * Record the hash modulo of the derivation `drvPath`, so that it
+     * doesn't have to be computed again by later processes. Stores
+     * without a persistent cache ignore this.
+     */
+    virtual void registerDerivationHashModulo(const StorePath & drvPath, const DrvHash & hash)
+    { }
+
     /**
      * Write a NAR dump of a store path.
      */
     virtual void narFromPath(const StorePath & path, Sink & sink) = 0;
 
+    /**
+     * If the NAR of `path` is stored uncompressed in a local file,
+     * return a source that reads it from that file, so that copying
+     * the path can use `Source::copyIntoFile()`. Otherwise return
+     * `nullptr`, and `narFromPath()` has to be used.
+     */
+    virtual std::unique_ptr<Source> openNarFile(const StorePath & path)
+    { return nullptr; }
+
     /**
      * For each path, if it's a derivation, build it.  Building a
      * derivation means ensuring that the output paths are valid.  If
@@ -671,6 +740,12 @@ public:
      */
     Derivation readInvalidDerivation(const StorePath & drvPath);
 
+    /**
+     * Like readDerivation(), but returns the parsed derivation from
+     * the store's in-memory cache of derivations without copying it.
+     */
+    ref<const Derivation> readDerivationShared(const StorePath & drvPath);
+
     /**
      * @param [out] out Place in here the set of all store paths in the
      * file system closure of `storePath`; that is, all paths than can
@@ -726,6 +801,8 @@ public:
         std::atomic<uint64_t> narInfoMissing{0};
         std::atomic<uint64_t> narInfoWrite{0};
         std::atomic<uint64_t> pathInfoCacheSize{0};
+        std::atomic<uint64_t> drvRead{0};
+        std::atomic<uint64_t> drvReadAverted{0};
         std::atomic<uint64_t> narRead{0};
         std::atomic<uint64_t> narReadBytes{0};
         std::atomic<uint64_t> narReadCompressedBytes{0};
@@ -819,6 +896,19 @@ protected:
         throw Unsupported("operation '%s' is not supported by store '%s'", op, getUri());
     }
 
+private:
+
+    /**
+     * The `references` direction of `computeFSClosure()`.
+     */
+    void computeFSClosureForward(const StorePathSet & startPaths,
+        StorePathSet & paths_, bool includeOutputs, bool includeDerivers);
+
+    /**
+     * Look up a derivation in `State::drvCache`, or read and parse it.
+     */
+    ref<const Derivation> readDerivationCached(const StorePath & drvPath, bool requireValidPath);
+
 };
 
 
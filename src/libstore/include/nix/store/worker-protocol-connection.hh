@@ -111,6 +111,14 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
 
     UnkeyedValidPathInfo queryPathInfo(const StoreDirConfig & store, bool * daemonException, const StorePath & path);
 
+    /**
+     * Query the info of several paths in one round trip. Invalid paths
+     * are omitted from the result. Requires
+     * `WorkerProto::featureQueryPathInfos`.
+     */
+    std::map<StorePath, UnkeyedValidPathInfo>
+    queryPathInfos(const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths);
+
     void putBuildDerivationRequest(
         const StoreDirConfig & store,
         bool * daemonException,
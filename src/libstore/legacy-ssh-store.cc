@@ -144,6 +144,22 @@ void LegacySSHStore::queryPathInfoUncached(const StorePath & path,
     } catch (...) { callback.rethrow(); }
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LegacySSHStore::queryPathInfosBatchUncached(const StorePathSet & paths)
+{
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    for (auto & path : paths)
+        res.insert_or_assign(path, nullptr);
+
+    for (auto & [path, info] : queryPathInfosUncached(paths)) {
+        if (!paths.count(path))
+            throw Error("remote host returned info for path '%s' that was not queried", printStorePath(path));
+        res.insert_or_assign(path, std::make_shared<ValidPathInfo>(StorePath{path}, std::move(info)));
+    }
+
+    return res;
+}
+
 
 void LegacySSHStore::addToStore(const ValidPathInfo & info, Source & source,
     RepairFlag repair, CheckSigsFlag checkSigs)
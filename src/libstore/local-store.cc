@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <span>
 #include <cstring>
 
 #include <memory>
@@ -75,11 +76,71 @@ ref<Store> LocalStore::Config::openStore() const
     return make_ref<LocalStore>(ref{shared_from_this()});
 }
 
+/**
+ * Maximum number of rows inserted or looked up by a single statement
+ * when registering paths in bulk. With 8 parameters per `ValidPaths`
+ * row, this stays below the limit of 999 parameters of SQLite versions
+ * before 3.32.
+ */
+static constexpr size_t bulkRows = 100;
+
+static std::string repeatSQL(std::string_view row, size_t rows)
+{
+    std::string res;
+    for (size_t i = 0; i < rows; ++i) {
+        if (i) res += ", ";
+        res += row;
+    }
+    return res;
+}
+
+static std::string registerValidPathsSQL(size_t rows)
+{
+    return "insert into ValidPaths (path, hash, registrationTime, deriver, narSize, ultimate, sigs, ca) values "
+        + repeatSQL("(?, ?, ?, ?, ?, ?, ?, ?)", rows) + ";";
+}
+
+static std::string addReferencesSQL(size_t rows)
+{
+    return "insert or replace into Refs (referrer, reference) values " + repeatSQL("(?, ?)", rows) + ";";
+}
+
+static std::string queryPathIdsSQL(size_t rows)
+{
+    return "select id, path from ValidPaths where path in (" + repeatSQL("?", rows) + ");";
+}
+
+/**
+ * Call `f` on consecutive chunks of at most `bulkRows` elements of
+ * `items`, together with a statement for that many rows: `full` for
+ * full chunks, and one prepared from `makeSQL` for the remainder.
+ */
+template<typename T, typename F>
+static void forEachBulkChunk(
+    sqlite3 * db,
+    SQLiteStmt & full,
+    std::string (* makeSQL)(size_t),
+    const std::vector<T> & items,
+    F && f)
+{
+    for (size_t start = 0; start < items.size(); start += bulkRows) {
+        auto n = std::min(bulkRows, items.size() - start);
+        std::span<const T> chunk(items.data() + start, n);
+        if (n == bulkRows)
+            f(full, chunk);
+        else {
+            SQLiteStmt stmt(db, makeSQL(n));
+            f(stmt, chunk);
+        }
+    }
+}
+
 struct LocalStore::State::Stmts {
     /* Some precompiled SQLite statements. */
-    SQLiteStmt RegisterValidPath;
+    SQLiteStmt RegisterValidPaths;
     SQLiteStmt UpdatePathInfo;
-    SQLiteStmt AddReference;
+    SQLiteStmt AddReferences;
+    SQLiteStmt QueryPathIds;
     SQLiteStmt QueryPathInfo;
     SQLiteStmt QueryReferences;
     SQLiteStmt QueryReferrers;
@@ -89,6 +150,11 @@ struct LocalStore::State::Stmts {
     SQLiteStmt UpdateRealisedOutput;
     SQLiteStmt QueryValidDerivers;
     SQLiteStmt QueryDerivationOutputs;
+    /* These are only prepared if the DerivationHashesModulo table
+       exists, which it may not in a read-only store. */
+    bool haveDerivationHashesModulo = false;
+    SQLiteStmt QueryDerivationHashModulo;
+    SQLiteStmt RegisterDerivationHashModulo;
     SQLiteStmt QueryRealisedOutput;
     SQLiteStmt QueryAllRealisedOutputs;
     SQLiteStmt QueryPathFromHashPart;
@@ -103,6 +169,7 @@ LocalStore::LocalStore(ref<const Config> config)
     , config{config}
     , dbDir(config->stateDir + "/db")
     , linksDir(config->realStoreDir + "/.links")
+    , trashDir(config->realStoreDir + "/.trash")
     , reservedPath(dbDir + "/reserved")
     , schemaPath(dbDir + "/schema")
     , tempRootsDir(config->stateDir + "/temproots")
@@ -293,12 +360,11 @@ LocalStore::LocalStore(ref<const Config> config)
     upgradeDBSchema(*state);
 
     /* Prepare SQL statements. */
-    state->stmts->RegisterValidPath.create(state->db,
-        "insert into ValidPaths (path, hash, registrationTime, deriver, narSize, ultimate, sigs, ca) values (?, ?, ?, ?, ?, ?, ?, ?);");
+    state->stmts->RegisterValidPaths.create(state->db, registerValidPathsSQL(bulkRows));
     state->stmts->UpdatePathInfo.create(state->db,
         "update ValidPaths set narSize = ?, hash = ?, ultimate = ?, sigs = ?, ca = ? where path = ?;");
-    state->stmts->AddReference.create(state->db,
-        "insert or replace into Refs (referrer, reference) values (?, ?);");
+    state->stmts->AddReferences.create(state->db, addReferencesSQL(bulkRows));
+    state->stmts->QueryPathIds.create(state->db, queryPathIdsSQL(bulkRows));
     state->stmts->QueryPathInfo.create(state->db,
         "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca from ValidPaths where path = ?;");
     state->stmts->QueryReferences.create(state->db,
@@ -313,6 +379,16 @@ LocalStore::LocalStore(ref<const Config> config)
         "select v.id, v.path from DerivationOutputs d join ValidPaths v on d.drv = v.id where d.path = ?;");
     state->stmts->QueryDerivationOutputs.create(state->db,
         "select id, path from DerivationOutputs where drv = ?;");
+    if (SQLiteStmt(state->db,
+            "select 1 from sqlite_master where type = 'table' and name = 'DerivationHashesModulo';").use().next())
+    {
+        state->stmts->haveDerivationHashesModulo = true;
+        state->stmts->QueryDerivationHashModulo.create(state->db,
+            "select id, hash, deferred from DerivationHashesModulo where drv = (select id from ValidPaths where path = ?);");
+        /* This inserts nothing if the derivation is not valid. */
+        state->stmts->RegisterDerivationHashModulo.create(state->db,
+            "insert or ignore into DerivationHashesModulo (drv, id, hash, deferred) select id, ?, ?, ? from ValidPaths where path = ?;");
+    }
     // Use "path >= ?" with limit 1 rather than "path like '?%'" to
     // ensure efficient lookup.
     state->stmts->QueryPathFromHashPart.create(state->db,
@@ -398,6 +474,12 @@ LocalStore::~LocalStore()
         future.get();
     }
 
+    try {
+        flushDerivationHashesModulo(*_state.lock());
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+
     try {
         auto fdTempRoots(_fdTempRoots.lock());
         if (*fdTempRoots) {
@@ -538,6 +620,22 @@ void LocalStore::upgradeDBSchema(State & state)
         schemaMigrations.insert(migrationName);
     };
 
+    /* This table is only a cache, so a read-only store can do without
+       it. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261016-derivation-hashes-modulo",
+            R"(
+                create table if not exists DerivationHashesModulo (
+                    drv      integer not null,
+                    id       text not null,
+                    hash     text not null,
+                    deferred integer not null,
+                    primary key (drv, id),
+                    foreign key (drv) references ValidPaths(id) on delete cascade
+                );
+            )");
+
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations))
         doUpgrade(
             "20220326-ca-derivations",
@@ -574,6 +672,61 @@ void LocalStore::registerDrvOutput(const Realisation & info, CheckSigsFlag check
         throw Error("cannot register realisation '%s' because it lacks a signature by a trusted key", info.outPath.to_string());
 }
 
+std::optional<DrvHash> LocalStore::queryDerivationHashModulo(const StorePath & drvPath)
+{
+    return retrySQLite<std::optional<DrvHash>>([&]() -> std::optional<DrvHash> {
+        auto state(_state.lock());
+        if (!state->stmts->haveDerivationHashesModulo) return std::nullopt;
+        auto use(state->stmts->QueryDerivationHashModulo.use()(printStorePath(drvPath)));
+        DrvHash res { .kind = DrvHash::Kind::Regular };
+        while (use.next()) {
+            res.hashes.insert_or_assign(use.getStr(0), Hash::parseAnyPrefixed(use.getStr(1)));
+            if (use.getInt(2))
+                res.kind = DrvHash::Kind::Deferred;
+        }
+        if (res.hashes.empty()) return std::nullopt;
+        return res;
+    });
+}
+
+
+void LocalStore::registerDerivationHashModulo(const StorePath & drvPath, const DrvHash & hash)
+{
+    if (config->readOnly || settings.readOnlyMode) return;
+    auto state(_state.lock());
+    if (!state->stmts->haveDerivationHashesModulo) return;
+    for (auto & [outputName, h] : hash.hashes)
+        state->pendingDrvHashes.push_back({
+            .drvPath = printStorePath(drvPath),
+            .outputName = outputName,
+            .hash = h.to_string(HashFormat::Base16, true),
+            .deferred = hash.kind == DrvHash::Kind::Deferred,
+        });
+    if (state->pendingDrvHashes.size() >= maxPendingDrvHashes)
+        flushDerivationHashesModulo(*state);
+}
+
+
+void LocalStore::flushDerivationHashesModulo(State & state)
+{
+    if (state.pendingDrvHashes.empty()) return;
+    /* This is only a cache, so don't try again with the same rows if
+       writing them fails. */
+    Finally clear([&]() { state.pendingDrvHashes.clear(); });
+    retrySQLite<void>([&]() {
+        SQLiteTxn txn(state.db);
+        for (auto & row : state.pendingDrvHashes)
+            state.stmts->RegisterDerivationHashModulo.use()
+                (row.outputName)
+                (row.hash)
+                (row.deferred ? 1 : 0)
+                (row.drvPath)
+                .exec();
+        txn.commit();
+    });
+}
+
+
 void LocalStore::registerDrvOutput(const Realisation & info)
 {
     experimentalFeatureSettings.require(Xp::CaDerivations);
@@ -644,54 +797,59 @@ void LocalStore::cacheDrvOutputMapping(
 }
 
 
-uint64_t LocalStore::addValidPath(State & state,
-    const ValidPathInfo & info, bool checkOutputs)
+void LocalStore::addValidPaths(State & state, const std::vector<const ValidPathInfo *> & infos)
 {
-    if (info.ca.has_value() && !info.isContentAddressed(*this))
-        throw Error("cannot add path '%s' to the Nix store because it claims to be content-addressed but isn't",
-            printStorePath(info.path));
-
-    state.stmts->RegisterValidPath.use()
-        (printStorePath(info.path))
-        (info.narHash.to_string(HashFormat::Base16, true))
-        (info.registrationTime == 0 ? time(0) : info.registrationTime)
-        (info.deriver ? printStorePath(*info.deriver) : "", (bool) info.deriver)
-        (info.narSize, info.narSize != 0)
-        (info.ultimate ? 1 : 0, info.ultimate)
-        (concatStringsSep(" ", info.sigs), !info.sigs.empty())
-        (renderContentAddress(info.ca), (bool) info.ca)
-        .exec();
-    uint64_t id = state.db.getLastInsertedRowId();
+    for (auto info : infos)
+        if (info->ca.has_value() && !info->isContentAddressed(*this))
+            throw Error("cannot add path '%s' to the Nix store because it claims to be content-addressed but isn't",
+                printStorePath(info->path));
+
+    auto now = time(0);
+
+    forEachBulkChunk(state.db, state.stmts->RegisterValidPaths, registerValidPathsSQL, infos,
+        [&](SQLiteStmt & stmt, std::span<const ValidPathInfo * const> chunk) {
+            auto use(stmt.use());
+            for (auto info : chunk)
+                use
+                    (printStorePath(info->path))
+                    (info->narHash.to_string(HashFormat::Base16, true))
+                    (info->registrationTime == 0 ? now : info->registrationTime)
+                    (info->deriver ? printStorePath(*info->deriver) : "", (bool) info->deriver)
+                    (info->narSize, info->narSize != 0)
+                    (info->ultimate ? 1 : 0, info->ultimate)
+                    (concatStringsSep(" ", info->sigs), !info->sigs.empty())
+                    (renderContentAddress(info->ca), (bool) info->ca);
+            use.exec();
+        });
 
     /* If this is a derivation, then store the derivation outputs in
        the database.  This is useful for the garbage collector: it can
        efficiently query whether a path is an output of some
        derivation. */
-    if (info.path.isDerivation()) {
-        auto drv = readInvalidDerivation(info.path);
-
-        /* Verify that the output paths in the derivation are correct
-           (i.e., follow the scheme for computing output paths from
-           derivations).  Note that if this throws an error, then the
-           DB transaction is rolled back, so the path validity
-           registration above is undone. */
-        if (checkOutputs) drv.checkInvariants(*this, info.path);
-
-        for (auto & i : drv.outputsAndOptPaths(*this)) {
-            /* Floating CA derivations have indeterminate output paths until
-               they are built, so don't register anything in that case */
-            if (i.second.second)
-                cacheDrvOutputMapping(state, id, i.first, *i.second.second);
+    StorePathSet drvPaths;
+    for (auto info : infos)
+        if (info->path.isDerivation())
+            drvPaths.insert(info->path);
+
+    if (!drvPaths.empty()) {
+        auto ids = queryValidPathIds(state, drvPaths);
+        for (auto & drvPath : drvPaths) {
+            auto drv = readInvalidDerivation(drvPath);
+            for (auto & i : drv.outputsAndOptPaths(*this)) {
+                /* Floating CA derivations have indeterminate output paths until
+                   they are built, so don't register anything in that case */
+                if (i.second.second)
+                    cacheDrvOutputMapping(state, ids.at(drvPath), i.first, *i.second.second);
+            }
         }
     }
 
     {
         auto state_(Store::state.lock());
-        state_->pathInfoCache.upsert(std::string(info.path.to_string()),
-            PathInfoCacheValue{ .value = std::make_shared<const ValidPathInfo>(info) });
+        for (auto info : infos)
+            state_->pathInfoCache.upsert(std::string(info->path.to_string()),
+                PathInfoCacheValue{ .value = std::make_shared<const ValidPathInfo>(*info) });
     }
-
-    return id;
 }
 
 
@@ -708,6 +866,21 @@ void LocalStore::queryPathInfoUncached(const StorePath & path,
 }
 
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LocalStore::queryPathInfosBatchUncached(const StorePathSet & paths)
+{
+    return retrySQLite<std::map<StorePath, std::shared_ptr<const ValidPathInfo>>>([&]() {
+        auto state(_state.lock());
+        SQLiteTxn txn(state->db);
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+        for (auto & path : paths)
+            res.insert_or_assign(path, queryPathInfoInternal(*state, path));
+        txn.commit();
+        return res;
+    });
+}
+
+
 std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
 {
     /* Get the path info. */
@@ -778,6 +951,28 @@ uint64_t LocalStore::queryValidPathId(State & state, const StorePath & path)
 }
 
 
+std::map<StorePath, uint64_t> LocalStore::queryValidPathIds(State & state, const StorePathSet & paths)
+{
+    std::vector<std::string> printed;
+    printed.reserve(paths.size());
+    for (auto & path : paths)
+        printed.push_back(printStorePath(path));
+
+    std::map<StorePath, uint64_t> ids;
+
+    forEachBulkChunk(state.db, state.stmts->QueryPathIds, queryPathIdsSQL, printed,
+        [&](SQLiteStmt & stmt, std::span<const std::string> chunk) {
+            auto use(stmt.use());
+            for (auto & path : chunk)
+                use(path);
+            while (use.next())
+                ids.emplace(parseStorePath(use.getStr(1)), use.getInt(0));
+        });
+
+    return ids;
+}
+
+
 bool LocalStore::isValidPath_(State & state, const StorePath & path)
 {
     return state.stmts->QueryPathInfo.use()(printStorePath(path)).next();
@@ -937,27 +1132,59 @@ void LocalStore::registerValidPaths(const ValidPathInfos & infos)
         SQLiteTxn txn(state->db);
         StorePathSet paths;
 
+        for (auto & [_, i] : infos)
+            paths.insert(i.path);
+
+        /* Paths that are already valid only get their metadata
+           updated. The others are inserted in bulk. */
+        auto existing = queryValidPathIds(*state, paths);
+
+        std::vector<const ValidPathInfo *> newInfos;
         for (auto & [_, i] : infos) {
             assert(i.narHash.algo == HashAlgorithm::SHA256);
-            if (isValidPath_(*state, i.path))
+            if (existing.count(i.path))
                 updatePathInfo(*state, i);
             else
-                addValidPath(*state, i, false);
-            paths.insert(i.path);
+                newInfos.push_back(&i);
         }
 
+        addValidPaths(*state, newInfos);
+
+        /* Look up the ids of the referrers and all their references
+           at once. */
+        StorePathSet pathsAndRefs = paths;
+        for (auto & [_, i] : infos)
+            pathsAndRefs.insert(i.references.begin(), i.references.end());
+        auto ids = queryValidPathIds(*state, pathsAndRefs);
+
+        auto getId = [&](const StorePath & path) {
+            auto id = get(ids, path);
+            if (!id)
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+            return *id;
+        };
+
+        std::vector<std::pair<uint64_t, uint64_t>> refs;
         for (auto & [_, i] : infos) {
-            auto referrer = queryValidPathId(*state, i.path);
+            auto referrer = getId(i.path);
             for (auto & j : i.references)
-                state->stmts->AddReference.use()(referrer)(queryValidPathId(*state, j)).exec();
+                refs.emplace_back(referrer, getId(j));
         }
 
+        forEachBulkChunk(state->db, state->stmts->AddReferences, addReferencesSQL, refs,
+            [&](SQLiteStmt & stmt, std::span<const std::pair<uint64_t, uint64_t>> chunk) {
+                auto use(stmt.use());
+                for (auto & [referrer, reference] : chunk)
+                    use(referrer)(reference);
+                use.exec();
+            });
+
         /* Check that the derivation outputs are correct.  We can't do
-           this in addValidPath() above, because the references might
+           this in addValidPaths() above, because the references might
            not be valid yet. */
         for (auto & [_, i] : infos)
             if (i.path.isDerivation()) {
-                // FIXME: inefficient; we already loaded the derivation in addValidPath().
+                // FIXME: inefficient; we already loaded the derivation in addValidPaths().
                 readInvalidDerivation(i.path).checkInvariants(*this, i.path);
             }
 
@@ -1020,6 +1247,19 @@ bool LocalStore::realisationIsUntrusted(const Realisation & realisation)
 void LocalStore::addToStore(const ValidPathInfo & info, Source & source,
     RepairFlag repair, CheckSigsFlag checkSigs)
 {
+    PathLocks outputLock;
+    if (addToStoreUnregistered(info, source, repair, checkSigs, outputLock))
+        registerValidPath(info);
+    outputLock.setDeletion(true);
+}
+
+
+bool LocalStore::addToStoreUnregistered(const ValidPathInfo & info, Source & source,
+    RepairFlag repair, CheckSigsFlag checkSigs, PathLocks & outputLock,
+    std::function<void()> beforeWaiting)
+{
+    bool added = false;
+
     if (checkSigs && pathInfoIsUntrusted(info))
         throw Error("cannot add path '%s' because it lacks a signature by a trusted key", printStorePath(info.path));
 
@@ -1042,15 +1282,20 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source,
 
         if (repair || !isValidPath(info.path)) {
 
-            PathLocks outputLock;
-
             auto realPath = Store::toRealPath(info.path);
 
             /* Lock the output path.  But don't lock if we're being called
             from a build hook (whose parent process already acquired a
             lock on this path). */
-            if (!locksHeld.count(printStorePath(info.path)))
-                outputLock.lockPaths({realPath});
+            if (!locksHeld.count(printStorePath(info.path))) {
+                if (!beforeWaiting)
+                    outputLock.lockPaths({realPath});
+                else
+                    while (!outputLock.lockPaths({realPath}, "", false)) {
+                        beforeWaiting();
+                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    }
+            }
 
             if (repair || !isValidPath(info.path)) {
 
@@ -1122,15 +1367,136 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source,
                     syncParent(realPath);
                 }
 
-                registerValidPath(info);
+                added = true;
             }
-
-            outputLock.setDeletion(true);
         }
     }
 
     // In case `cleanup` ignored an `Interrupted` exception
     checkInterrupt();
+
+    return added;
+}
+
+
+/**
+ * Paths that have been added to the store but not yet registered as
+ * valid, together with the locks on them. They are registered in
+ * batches, so that a large closure doesn't need a SQLite transaction
+ * per path.
+ *
+ * To avoid deadlocks with other processes adding overlapping sets of
+ * paths, the batch is flushed (and its locks released) whenever the
+ * lock on the next path is held by someone else. Paths that have
+ * been restored are also registered if a later one fails.
+ */
+class LocalStore::RegistrationBatch
+{
+    LocalStore & store;
+
+    struct State
+    {
+        ValidPathInfos infos;
+        std::vector<std::unique_ptr<PathLocks>> locks;
+    };
+
+    Sync<State> state_;
+
+    /**
+     * Also bounds the number of lock files held open.
+     */
+    static constexpr size_t maxSize = 256;
+
+    void flush(State & state)
+    {
+        if (state.infos.empty()) return;
+        store.registerValidPaths(state.infos);
+        for (auto & lock : state.locks)
+            lock->setDeletion(true);
+        state.infos.clear();
+        state.locks.clear();
+    }
+
+public:
+
+    RegistrationBatch(LocalStore & store)
+        : store(store)
+    { }
+
+    ~RegistrationBatch()
+    {
+        try {
+            flush();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    /**
+     * Add a path to the store, and register it in this batch or an
+     * earlier one.
+     *
+     * Since a batch contains every path added before it was flushed,
+     * a path is never registered before the paths it references, as
+     * long as they were added first.
+     */
+    void add(ValidPathInfo info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
+    {
+        auto lock = std::make_unique<PathLocks>();
+        if (!store.addToStoreUnregistered(info, source, repair, checkSigs, *lock,
+                [&]() { flush(); })) {
+            lock->setDeletion(true);
+            return;
+        }
+        auto state(state_.lock());
+        auto path = info.path;
+        state->infos.insert_or_assign(path, std::move(info));
+        state->locks.push_back(std::move(lock));
+        if (state->infos.size() >= maxSize)
+            flush(*state);
+    }
+
+    void flush()
+    {
+        flush(*state_.lock());
+    }
+};
+
+
+void LocalStore::addMultipleToStore(
+    PathsSource && pathsToCopy,
+    Activity & act,
+    RepairFlag repair,
+    CheckSigsFlag checkSigs)
+{
+    RegistrationBatch batch(*this);
+    addMultipleToStoreWith(std::move(pathsToCopy), act,
+        [&](ValidPathInfo & info, Source & source) {
+            batch.add(info, source, repair, checkSigs);
+        });
+    batch.flush();
+}
+
+
+void LocalStore::addMultipleToStore(
+    Source & source,
+    RepairFlag repair,
+    CheckSigsFlag checkSigs)
+{
+    RegistrationBatch batch(*this);
+    auto expected = readNum<uint64_t>(source);
+    for (uint64_t i = 0; i < expected; ++i) {
+        // FIXME we should not be using the worker protocol here, let
+        // alone the worker protocol with a hard-coded version!
+        auto info = WorkerProto::Serialise<ValidPathInfo>::read(*this,
+            WorkerProto::ReadConn {
+                .from = source,
+                .version = 16,
+            });
+        info.ultimate = false;
+        batch.add(std::move(info), source, repair, checkSigs);
+    }
+    batch.flush();
 }
 
 
@@ -1322,23 +1688,35 @@ std::pair<std::filesystem::path, AutoCloseFD> LocalStore::createTempDirInStore()
 }
 
 
-void LocalStore::invalidatePathChecked(const StorePath & path)
+std::map<StorePath, StorePathSet> LocalStore::invalidatePathsChecked(
+    const std::vector<StorePath> & paths,
+    ValidPathInfos * invalidated)
 {
-    retrySQLite<void>([&]() {
+    return retrySQLite<std::map<StorePath, StorePathSet>>([&]() {
+        std::map<StorePath, StorePathSet> inUse;
+        if (invalidated) invalidated->clear();
+
         auto state(_state.lock());
 
         SQLiteTxn txn(state->db);
 
-        if (isValidPath_(*state, path)) {
+        for (auto & path : paths) {
+            if (!isValidPath_(*state, path)) continue;
             StorePathSet referrers; queryReferrers(*state, path, referrers);
             referrers.erase(path); /* ignore self-references */
-            if (!referrers.empty())
-                throw PathInUse("cannot delete path '%s' because it is in use by %s",
-                    printStorePath(path), showPaths(referrers));
+            if (!referrers.empty()) {
+                inUse.emplace(path, std::move(referrers));
+                continue;
+            }
+            if (invalidated)
+                if (auto info = queryPathInfoInternal(*state, path))
+                    invalidated->insert_or_assign(path, *info);
             invalidatePath(*state, path);
         }
 
         txn.commit();
+
+        return inUse;
     });
 }
 
@@ -12,51 +12,36 @@
 #include "nix/util/closure.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/util/strings.hh"
+#include "nix/util/signals.hh"
 
 namespace nix {
 
 void Store::computeFSClosure(const StorePathSet & startPaths,
     StorePathSet & paths_, bool flipDirection, bool includeOutputs, bool includeDerivers)
 {
-    std::function<std::set<StorePath>(const StorePath & path, std::future<ref<const ValidPathInfo>> &)> queryDeps;
-    if (flipDirection)
-        queryDeps = [&](const StorePath& path,
-                        std::future<ref<const ValidPathInfo>> & fut) {
-            StorePathSet res;
-            StorePathSet referrers;
-            queryReferrers(path, referrers);
-            for (auto& ref : referrers)
-                if (ref != path)
-                    res.insert(ref);
-
-            if (includeOutputs)
-                for (auto& i : queryValidDerivers(path))
-                    res.insert(i);
-
-            if (includeDerivers && path.isDerivation())
-                for (auto& [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
-                    if (maybeOutPath && isValidPath(*maybeOutPath))
-                        res.insert(*maybeOutPath);
-            return res;
-        };
-    else
-        queryDeps = [&](const StorePath& path,
-                        std::future<ref<const ValidPathInfo>> & fut) {
-            StorePathSet res;
-            auto info = fut.get();
-            for (auto& ref : info->references)
-                if (ref != path)
-                    res.insert(ref);
-
-            if (includeOutputs && path.isDerivation())
-                for (auto& [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
-                    if (maybeOutPath && isValidPath(*maybeOutPath))
-                        res.insert(*maybeOutPath);
+    if (!flipDirection) {
+        computeFSClosureForward(startPaths, paths_, includeOutputs, includeDerivers);
+        return;
+    }
 
-            if (includeDerivers && info->deriver && isValidPath(*info->deriver))
-                res.insert(*info->deriver);
-            return res;
-        };
+    auto queryDeps = [&](const StorePath & path) {
+        StorePathSet res;
+        StorePathSet referrers;
+        queryReferrers(path, referrers);
+        for (auto& ref : referrers)
+            if (ref != path)
+                res.insert(ref);
+
+        if (includeOutputs)
+            for (auto& i : queryValidDerivers(path))
+                res.insert(i);
+
+        if (includeDerivers && path.isDerivation())
+            for (auto& [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
+                if (maybeOutPath && isValidPath(*maybeOutPath))
+                    res.insert(*maybeOutPath);
+        return res;
+    };
 
     computeClosure<StorePath>(
         startPaths, paths_,
@@ -68,7 +53,7 @@ void Store::computeFSClosure(const StorePathSet & startPaths,
                 getDependencies =
                     [&](std::future<ref<const ValidPathInfo>> fut) {
                         try {
-                            promise.set_value(queryDeps(path, fut));
+                            promise.set_value(queryDeps(path));
                         } catch (...) {
                             promise.set_exception(std::current_exception());
                         }
@@ -78,6 +63,56 @@ void Store::computeFSClosure(const StorePathSet & startPaths,
         });
 }
 
+void Store::computeFSClosureForward(const StorePathSet & startPaths,
+    StorePathSet & paths_, bool includeOutputs, bool includeDerivers)
+{
+    /* Walk the graph one level at a time, so that we can fetch the
+       info of all paths in a level with a single queryPathInfos()
+       call rather than doing a round trip per path. */
+    StorePathSet frontier;
+    for (auto & path : startPaths)
+        if (paths_.insert(path).second)
+            frontier.insert(path);
+
+    while (!frontier.empty()) {
+        checkInterrupt();
+
+        auto infos = queryPathInfos(frontier);
+
+        StorePathSet next, maybeValid;
+
+        for (auto & path : frontier) {
+            auto i = infos.find(path);
+            if (i == infos.end())
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+            auto & info = i->second;
+
+            for (auto & ref : info->references)
+                if (ref != path)
+                    next.insert(ref);
+
+            if (includeOutputs && path.isDerivation())
+                for (auto & [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
+                    if (maybeOutPath)
+                        maybeValid.insert(*maybeOutPath);
+
+            if (includeDerivers && info->deriver)
+                maybeValid.insert(*info->deriver);
+        }
+
+        /* Outputs and derivers are optional, so only follow the valid
+           ones. */
+        if (!maybeValid.empty())
+            for (auto & path : queryValidPaths(maybeValid))
+                next.insert(path);
+
+        frontier.clear();
+        for (auto & path : next)
+            if (paths_.insert(path).second)
+                frontier.insert(path);
+    }
+}
+
 void Store::computeFSClosure(const StorePath & startPath,
     StorePathSet & paths_, bool flipDirection, bool includeOutputs, bool includeDerivers)
 {
@@ -152,7 +187,7 @@ void Store::queryMissing(const std::vector<DerivedPath> & targets,
     };
 
     auto checkOutput = [&](
-        const StorePath & drvPath, ref<Derivation> drv, const StorePath & outPath, ref<Sync<DrvState>> drvState_)
+        const StorePath & drvPath, ref<const Derivation> drv, const StorePath & outPath, ref<Sync<DrvState>> drvState_)
     {
         if (drvState_->lock()->done) return;
 
@@ -221,7 +256,8 @@ void Store::queryMissing(const std::vector<DerivedPath> & targets,
             }
             if (knownOutputPaths && invalid.empty()) return;
 
-            auto drv = make_ref<Derivation>(derivationFromPath(drvPath));
+            ensurePath(drvPath);
+            auto drv = readDerivationShared(drvPath);
             auto parsedDrv = StructuredAttrs::tryParse(drv->env);
             DerivationOptions drvOptions;
             try {
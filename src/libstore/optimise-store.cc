@@ -3,15 +3,19 @@
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <cstdlib>
 #include <cstring>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
 #include <regex>
+#include <atomic>
+#include <map>
 
 #include "store-config-private.hh"
 
@@ -42,6 +46,191 @@ struct MakeReadOnly
 };
 
 
+OptimiseStats & OptimiseStats::operator += (const OptimiseStats & other)
+{
+    filesLinked += other.filesLinked;
+    bytesFreed += other.bytesFreed;
+    filesHashed += other.filesHashed;
+    bytesHashed += other.bytesHashed;
+    hashIndexHits += other.hashIndexHits;
+    elapsed += other.elapsed;
+    return *this;
+}
+
+
+static const char * hashIndexSchema = R"sql(
+
+create table if not exists Files (
+    device  integer not null,
+    inode   integer not null,
+    mode    integer not null,
+    size    integer not null,
+    mtime   integer not null,
+    btime   integer not null, -- in nanoseconds, see getBirthTime()
+    hash    text not null,
+    primary key (device, inode)
+);
+
+)sql";
+
+
+/**
+ * A persistent map from inodes to the NAR hash of their contents, so
+ * that `optimiseStore()` only has to hash files that it hasn't seen
+ * before.
+ *
+ * An entry is only used if the mode, size, mtime and birth time of the
+ * inode are unchanged. Since the store canonicalises mtimes, it's the
+ * birth time that protects against inode numbers being reused for
+ * another file after garbage collection.
+ *
+ * The index is read into memory at the start of a run. At the end, it
+ * is replaced by the entries of the files that were used or hashed
+ * during the run, taken from their state after linking, plus the
+ * entries of the inodes that were skipped because they were already
+ * in the links directory. This drops the entries of files that have
+ * since been deleted.
+ */
+struct OptimiseHashIndex
+{
+    struct Entry
+    {
+        mode_t mode;
+        off_t size;
+        time_t mtime;
+        int64_t btime;
+        Hash hash;
+    };
+
+    typedef std::map<std::pair<dev_t, ino_t>, Entry> Entries;
+
+    /**
+     * The files whose hash is known in this run. They are only
+     * stat()ed when the index is saved, since linking changes their
+     * inode number and ctime.
+     */
+    typedef std::map<Path, Hash> Known;
+
+    Path dbPath;
+
+    SQLite db;
+
+    /**
+     * The entries from the previous run. Read-only while optimising,
+     * so it can be accessed without locking.
+     */
+    Entries previous;
+
+    Sync<Known> known;
+
+    /**
+     * The birth time of the inode if the file system records it, and
+     * its ctime otherwise. The latter also changes whenever a hard
+     * link to the inode is created or removed, so it only keeps
+     * entries valid until the links directory changes.
+     */
+    static int64_t getBirthTime(const Path & path, const struct stat & st)
+    {
+#ifdef __APPLE__
+        return (int64_t) st.st_birthtimespec.tv_sec * 1000000000 + st.st_birthtimespec.tv_nsec;
+#else
+#  ifdef STATX_BTIME
+        struct statx stx;
+        if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BTIME, &stx) == 0
+            && (stx.stx_mask & STATX_BTIME) && stx.stx_btime.tv_sec)
+            return (int64_t) stx.stx_btime.tv_sec * 1000000000 + stx.stx_btime.tv_nsec;
+#  endif
+        return (int64_t) st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+    }
+
+    OptimiseHashIndex(Path dbPath)
+        : dbPath(std::move(dbPath))
+        , db(this->dbPath)
+    {
+        db.isCache();
+        db.exec(hashIndexSchema);
+
+        SQLiteStmt query(db, "select device, inode, mode, size, mtime, btime, hash from Files");
+        auto use(query.use());
+        while (use.next()) {
+            auto hash = Hash::parseAnyPrefixed(use.getStr(6));
+            previous.insert_or_assign(
+                {(dev_t) use.getInt(0), (ino_t) use.getInt(1)},
+                Entry {
+                    .mode = (mode_t) use.getInt(2),
+                    .size = (off_t) use.getInt(3),
+                    .mtime = (time_t) use.getInt(4),
+                    .btime = use.getInt(5),
+                    .hash = hash,
+                });
+        }
+        printMsg(lvlTalkative, "loaded %d entries from hash index '%s'", previous.size(), this->dbPath);
+    }
+
+    std::optional<Hash> lookup(const Path & path, const struct stat & st)
+    {
+        auto i = previous.find({st.st_dev, st.st_ino});
+        if (i == previous.end()
+            || i->second.mode != st.st_mode
+            || i->second.size != st.st_size
+            || i->second.mtime != st.st_mtime
+            || i->second.btime != getBirthTime(path, st))
+            return std::nullopt;
+        insert(path, i->second.hash);
+        return i->second.hash;
+    }
+
+    void insert(const Path & path, const Hash & hash)
+    {
+        known.lock()->insert_or_assign(path, hash);
+    }
+
+    /**
+     * Write the index. `linked` contains the inodes in the links
+     * directory, which are skipped without being looked up.
+     */
+    void save(const std::unordered_set<ino_t> & linked)
+    {
+        Entries entries;
+
+        for (auto & [path, hash] : *known.lock()) {
+            struct stat st;
+            if (::lstat(path.c_str(), &st)) continue;
+            entries.insert_or_assign(
+                {st.st_dev, st.st_ino},
+                Entry {
+                    .mode = st.st_mode,
+                    .size = st.st_size,
+                    .mtime = st.st_mtime,
+                    .btime = getBirthTime(path, st),
+                    .hash = hash,
+                });
+        }
+
+        for (auto & [key, entry] : previous)
+            if (linked.count(key.second))
+                entries.insert(std::pair{key, entry});
+
+        SQLiteStmt insert(db,
+            "insert or replace into Files(device, inode, mode, size, mtime, btime, hash) values (?, ?, ?, ?, ?, ?, ?)");
+        SQLiteTxn txn(db);
+        db.exec("delete from Files");
+        for (auto & [key, entry] : entries)
+            insert.use()
+                ((int64_t) key.first)
+                ((int64_t) key.second)
+                ((int64_t) entry.mode)
+                ((int64_t) entry.size)
+                ((int64_t) entry.mtime)
+                (entry.btime)
+                (entry.hash.to_string(HashFormat::SRI, true))
+                .exec();
+        txn.commit();
+    }
+};
+
+
 LocalStore::InodeHash LocalStore::loadInodeHash()
 {
     debug("loading hash inodes in memory");
@@ -64,7 +253,7 @@ LocalStore::InodeHash LocalStore::loadInodeHash()
 }
 
 
-Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash)
+Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, Sync<InodeHash> & inodeHash)
 {
     Strings names;
 
@@ -75,7 +264,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
     while (errno = 0, dirent = readdir(dir.get())) { /* sic */
         checkInterrupt();
 
-        if (inodeHash.count(dirent->d_ino)) {
+        if (inodeHash.lock()->count(dirent->d_ino)) {
             debug("'%1%' is already linked", dirent->d_name);
             continue;
         }
@@ -91,7 +280,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
 
 
 void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
-    const Path & path, InodeHash & inodeHash, RepairFlag repair)
+    const Path & path, Sync<InodeHash> & inodeHash, OptimiseHashIndex * hashIndex, RepairFlag repair)
 {
     checkInterrupt();
 
@@ -100,7 +289,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
     if (S_ISDIR(st.st_mode)) {
         Strings names = readDirectoryIgnoringInodes(path, inodeHash);
         for (auto & i : names)
-            optimisePath_(act, stats, path + "/" + i, inodeHash, repair);
+            optimisePath_(act, stats, path + "/" + i, inodeHash, hashIndex, repair);
         return;
     }
 
@@ -121,7 +310,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
     }
 
     /* This can still happen on top-level files. */
-    if (st.st_nlink > 1 && inodeHash.count(st.st_ino)) {
+    if (st.st_nlink > 1 && inodeHash.lock()->count(st.st_ino)) {
         debug("'%s' is already linked, with %d other file(s)", path, st.st_nlink - 2);
         return;
     }
@@ -135,11 +324,22 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
        Also note that if `path' is a symlink, then we're hashing the
        contents of the symlink (i.e. the result of readlink()), not
        the contents of the target (which may not even exist). */
-    Hash hash = ({
+    std::optional<Hash> indexedHash;
+    if (hashIndex) indexedHash = hashIndex->lookup(path, st);
+
+    Hash hash = indexedHash ? *indexedHash : ({
         hashPath(
             {make_ref<PosixSourceAccessor>(), CanonPath(path)},
             FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256).first;
     });
+
+    if (indexedHash)
+        stats.hashIndexHits++;
+    else {
+        stats.filesHashed++;
+        stats.bytesHashed += st.st_size;
+        if (hashIndex) hashIndex->insert(path, hash);
+    }
     debug("'%1%' has hash '%2%'", path, hash.to_string(HashFormat::Nix32, true));
 
     /* Check if this is a known hash. */
@@ -167,7 +367,7 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
         /* Nope, create a hard link in the links directory. */
         try {
             std::filesystem::create_hard_link(path, linkPath);
-            inodeHash.insert(st.st_ino);
+            inodeHash.lock()->insert(st.st_ino);
         } catch (std::filesystem::filesystem_error & e) {
             if (e.code() == std::errc::file_exists) {
                 /* Fall through if another process created ‘linkPath’ before
@@ -209,11 +409,13 @@ void LocalStore::optimisePath_(Activity * act, OptimiseStats & stats,
        its timestamp back to 0. */
     MakeReadOnly makeReadOnly(mustToggle ? dirOfPath : "");
 
-    std::filesystem::path tempLink = fmt("%1%/.tmp-link-%2%-%3%", config->realStoreDir, getpid(), rand());
+    /* The counter keeps the names unique between threads. */
+    static std::atomic<uint64_t> tempLinkCounter{0};
+    std::filesystem::path tempLink = fmt("%1%/.tmp-link-%2%-%3%-%4%", config->realStoreDir, getpid(), rand(), tempLinkCounter++);
 
     try {
         std::filesystem::create_hard_link(linkPath, tempLink);
-        inodeHash.insert(st.st_ino);
+        inodeHash.lock()->insert(st.st_ino);
     } catch (std::filesystem::filesystem_error & e) {
         if (e.code() == std::errc::too_many_links) {
             /* Too many links to the same file (>= 32000 on most file
@@ -257,23 +459,62 @@ void LocalStore::optimiseStore(OptimiseStats & stats)
 {
     Activity act(*logger, actOptimiseStore);
 
+    auto startTime = std::chrono::steady_clock::now();
+
     auto paths = queryAllValidPaths();
-    InodeHash inodeHash = loadInodeHash();
+    Sync<InodeHash> inodeHash(loadInodeHash());
+
+    std::unique_ptr<OptimiseHashIndex> hashIndex;
+    try {
+        hashIndex = std::make_unique<OptimiseHashIndex>(dbDir + "/optimise-index.sqlite");
+    } catch (Error & e) {
+        warn("cannot open the hash index, all files will be hashed: %s", e.msg());
+    }
 
     act.progress(0, paths.size());
 
-    uint64_t done = 0;
+    struct State
+    {
+        OptimiseStats stats;
+        uint64_t done = 0;
+    };
+
+    Sync<State> state_;
+
+    /* Every store path is optimised by a single worker, so that no two
+       workers toggle the permissions of the same directory. */
+    ThreadPool pool;
 
     for (auto & i : paths) {
-        addTempRoot(i);
-        if (!isValidPath(i)) continue; /* path was GC'ed, probably */
-        {
-            Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(i)));
-            optimisePath_(&act, stats, config->realStoreDir + "/" + std::string(i.to_string()), inodeHash, NoRepair);
+        pool.enqueue([&, i]() {
+            addTempRoot(i);
+            if (isValidPath(i)) { /* otherwise the path was GC'ed, probably */
+                OptimiseStats pathStats;
+                {
+                    Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(i)));
+                    optimisePath_(&act, pathStats, config->realStoreDir + "/" + std::string(i.to_string()), inodeHash, hashIndex.get(), NoRepair);
+                }
+                state_.lock()->stats += pathStats;
+            }
+            auto state(state_.lock());
+            state->done++;
+            act.progress(state->done, paths.size());
+        });
+    }
+
+    pool.process();
+
+    stats += state_.lock()->stats;
+
+    if (hashIndex) {
+        try {
+            hashIndex->save(*inodeHash.lock());
+        } catch (Error & e) {
+            warn("cannot write the hash index: %s", e.msg());
         }
-        done++;
-        act.progress(done, paths.size());
     }
+
+    stats.elapsed += std::chrono::steady_clock::now() - startTime;
 }
 
 void LocalStore::optimiseStore()
@@ -285,14 +526,21 @@ void LocalStore::optimiseStore()
     printInfo("%s freed by hard-linking %d files",
         showBytes(stats.bytesFreed),
         stats.filesLinked);
+
+    printInfo("hashed %d files (%s) in %.1f s (%s/s), reused the hashes of %d files",
+        stats.filesHashed,
+        showBytes(stats.bytesHashed),
+        stats.elapsed.count(),
+        showBytes(stats.elapsed.count() > 0 ? stats.bytesHashed / stats.elapsed.count() : 0),
+        stats.hashIndexHits);
 }
 
 void LocalStore::optimisePath(const Path & path, RepairFlag repair)
 {
     OptimiseStats stats;
-    InodeHash inodeHash;
+    Sync<InodeHash> inodeHash;
 
-    if (settings.autoOptimiseStore) optimisePath_(nullptr, stats, path, inodeHash, repair);
+    if (settings.autoOptimiseStore) optimisePath_(nullptr, stats, path, inodeHash, nullptr, repair);
 }
 
 
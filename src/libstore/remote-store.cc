@@ -287,6 +287,34 @@ void RemoteStore::queryPathInfoUncached(const StorePath & path,
 }
 
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+RemoteStore::queryPathInfosBatchUncached(const StorePathSet & paths)
+{
+    std::optional<std::map<StorePath, UnkeyedValidPathInfo>> infos;
+    {
+        auto conn(getConnection());
+        if (conn->features.count(WorkerProto::featureQueryPathInfos))
+            infos = conn->queryPathInfos(*this, &conn.daemonException, paths);
+    }
+
+    /* Older daemons need a round trip per path. Note that the default
+       implementation takes a connection per query, so we must not hold
+       on to ours. */
+    if (!infos)
+        return Store::queryPathInfosBatchUncached(paths);
+
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    for (auto & path : paths)
+        res.insert_or_assign(path, nullptr);
+    for (auto & [path, info] : *infos) {
+        if (!paths.count(path))
+            throw Error("daemon returned info for path '%s' that was not queried", printStorePath(path));
+        res.insert_or_assign(path, std::make_shared<ValidPathInfo>(StorePath{path}, std::move(info)));
+    }
+    return res;
+}
+
+
 void RemoteStore::queryReferrers(const StorePath & path,
     StorePathSet & referrers)
 {
@@ -40,3 +40,15 @@ create table if not exists DerivationOutputs (
 );
 
 create index if not exists IndexDerivationOutputs on DerivationOutputs(path);
+
+-- A cache of hashDerivationModulo() of derivations, one row per
+-- output, so that it doesn't have to be recomputed (by reading the
+-- whole closure of input derivations) in every process.
+create table if not exists DerivationHashesModulo (
+    drv      integer not null,
+    id       text not null, -- symbolic output id, usually "out"
+    hash     text not null, -- with the hash algorithm as prefix
+    deferred integer not null, -- whether the output paths are not known statically
+    primary key (drv, id),
+    foreign key (drv) references ValidPaths(id) on delete cascade
+);
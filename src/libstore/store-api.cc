@@ -22,6 +22,7 @@
 
 #include <filesystem>
 #include <nlohmann/json.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include "nix/util/strings.hh"
 
@@ -228,6 +229,17 @@ void Store::addMultipleToStore(
     Activity & act,
     RepairFlag repair,
     CheckSigsFlag checkSigs)
+{
+    addMultipleToStoreWith(std::move(pathsToCopy), act,
+        [&](ValidPathInfo & info, Source & source) {
+            addToStore(info, source, repair, checkSigs);
+        });
+}
+
+void Store::addMultipleToStoreWith(
+    PathsSource && pathsToCopy,
+    Activity & act,
+    std::function<void(ValidPathInfo & info, Source & source)> addPath)
 {
     std::atomic<size_t> nrDone{0};
     std::atomic<size_t> nrFailed{0};
@@ -285,7 +297,7 @@ void Store::addMultipleToStore(
                 MaintainCount<decltype(nrRunning)> mc(nrRunning);
                 showProgress();
                 try {
-                    addToStore(info, *source, repair, checkSigs);
+                    addPath(info, *source);
                 } catch (Error & e) {
                     nrFailed++;
                     if (!settings.keepGoing)
@@ -437,7 +449,7 @@ StringSet Store::Config::getDefaultSystemFeatures()
 Store::Store(const Store::Config & config)
     : MixStoreDirMethods{config}
     , config{config}
-    , state({(size_t) config.pathInfoCacheSize})
+    , state({(size_t) config.pathInfoCacheSize, (size_t) config.derivationCacheSize})
 {
     assertLibStoreInitialized();
 }
@@ -517,6 +529,12 @@ StorePathSet Store::queryDerivationOutputs(const StorePath & path)
 }
 
 
+std::optional<DrvHash> Store::queryDerivationHashModulo(const StorePath & drvPath)
+{
+    return std::nullopt;
+}
+
+
 void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, SubstitutablePathInfos & infos)
 {
     if (!settings.useSubstitutes) return;
@@ -715,6 +733,93 @@ void Store::queryPathInfo(const StorePath & storePath,
         }});
 }
 
+std::map<StorePath, ref<const ValidPathInfo>> Store::queryPathInfos(const StorePathSet & paths)
+{
+    std::map<StorePath, ref<const ValidPathInfo>> res;
+    StorePathSet missing;
+
+    for (auto & path : paths) {
+        if (auto info = queryPathInfoFromClientCache(path)) {
+            if (*info)
+                res.insert_or_assign(path, ref(*info));
+        } else
+            missing.insert(path);
+    }
+
+    if (missing.empty()) return res;
+
+    for (auto & [path, info] : queryPathInfosBatchUncached(missing)) {
+        if (diskCache)
+            diskCache->upsertNarInfo(getUri(), std::string(path.hashPart()), info);
+
+        {
+            auto state_(state.lock());
+            state_->pathInfoCache.upsert(path.to_string(), PathInfoCacheValue { .value = info });
+        }
+
+        if (!info || !goodStorePath(path, info->path)) {
+            stats.narInfoMissing++;
+            continue;
+        }
+
+        res.insert_or_assign(path, ref(info));
+    }
+
+    return res;
+}
+
+
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+Store::queryPathInfosBatchUncached(const StorePathSet & paths)
+{
+    struct State
+    {
+        size_t left;
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_(State{0});
+
+    std::condition_variable wakeup;
+
+    /* The callbacks refer to `state_` and `wakeup`, so if we're
+       interrupted, stop sending queries but wait for the outstanding
+       ones before unwinding. */
+    std::exception_ptr interrupted;
+
+    for (auto & path : paths) {
+        try {
+            checkInterrupt();
+        } catch (...) {
+            interrupted = std::current_exception();
+            break;
+        }
+        state_.lock()->left++;
+        queryPathInfoUncached(path, {[path, &state_, &wakeup](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+            auto state(state_.lock());
+            try {
+                state->infos.insert_or_assign(path, fut.get());
+            } catch (...) {
+                if (!state->exc) state->exc = std::current_exception();
+            }
+            assert(state->left);
+            if (!--state->left)
+                wakeup.notify_one();
+        }});
+    }
+
+    auto state(state_.lock());
+    while (state->left)
+        state.wait(wakeup);
+    if (interrupted)
+        std::rethrow_exception(interrupted);
+    if (state->exc)
+        std::rethrow_exception(state->exc);
+    return std::move(state->infos);
+}
+
+
 void Store::queryRealisation(const DrvOutput & id,
         Callback<std::shared_ptr<const Realisation>> callback) noexcept
 {
@@ -995,6 +1100,15 @@ void copyStorePath(
         info = info2;
     }
 
+    /* If the NAR is in a local file, let the destination read it
+       from there, which allows it to copy file contents in the
+       kernel. */
+    if (auto narFile = srcStore.openNarFile(storePath)) {
+        dstStore.addToStore(*info, *narFile, repair, checkSigs);
+        act.progress(info->narSize, info->narSize);
+        return;
+    }
+
     auto source = sinkToSource([&](Sink & sink) {
         LambdaSink progressSink([&](std::string_view data) {
             total += data.size();
@@ -1233,15 +1347,46 @@ Derivation Store::derivationFromPath(const StorePath & drvPath)
 static Derivation readDerivationCommon(Store & store, const StorePath & drvPath, bool requireValidPath)
 {
     auto accessor = store.getFSAccessor(requireValidPath);
+    CanonPath path(drvPath.to_string());
+    auto name = Derivation::nameFromPath(drvPath);
     try {
-        return parseDerivation(store,
-            accessor->readFile(CanonPath(drvPath.to_string())),
-            Derivation::nameFromPath(drvPath));
+        /* If the file is on the local file system, parse it straight
+           from a memory mapping rather than copying it first. */
+        if (auto physicalPath = accessor->getPhysicalPath(path)) {
+            if (requireValidPath && !store.isValidPath(drvPath))
+                throw InvalidPath("path '%1%' is not a valid store path", store.printStorePath(drvPath));
+            std::optional<boost::iostreams::mapped_file_source> mmap;
+            try {
+                mmap.emplace(physicalPath->string());
+            } catch (const boost::exception &) {
+            }
+            if (mmap && mmap->is_open())
+                return parseDerivation(store, std::string_view(mmap->data(), mmap->size()), name);
+        }
+        return parseDerivation(store, accessor->readFile(path), name);
     } catch (FormatError & e) {
         throw Error("error parsing derivation '%s': %s", store.printStorePath(drvPath), e.msg());
     }
 }
 
+ref<const Derivation> Store::readDerivationCached(const StorePath & drvPath, bool requireValidPath)
+{
+    if (auto drv = state.lock()->drvCache.get(drvPath)) {
+        /* The cache doesn't imply that the path is still valid. */
+        if (requireValidPath && !isValidPath(drvPath))
+            throw InvalidPath("path '%1%' is not a valid store path", printStorePath(drvPath));
+        stats.drvReadAverted++;
+        return *drv;
+    }
+
+    auto drv = make_ref<const Derivation>(readDerivationCommon(*this, drvPath, requireValidPath));
+    stats.drvRead++;
+
+    state.lock()->drvCache.upsert(drvPath, drv);
+
+    return drv;
+}
+
 std::optional<StorePath> Store::getBuildDerivationPath(const StorePath & path)
 {
 
@@ -1271,10 +1416,13 @@ std::optional<StorePath> Store::getBuildDerivationPath(const StorePath & path)
 }
 
 Derivation Store::readDerivation(const StorePath & drvPath)
-{ return readDerivationCommon(*this, drvPath, true); }
+{ return *readDerivationCached(drvPath, true); }
 
 Derivation Store::readInvalidDerivation(const StorePath & drvPath)
-{ return readDerivationCommon(*this, drvPath, false); }
+{ return *readDerivationCached(drvPath, false); }
+
+ref<const Derivation> Store::readDerivationShared(const StorePath & drvPath)
+{ return readDerivationCached(drvPath, true); }
 
 
 void Store::signPathInfo(ValidPathInfo & info)
@@ -5,7 +5,9 @@
 
 namespace nix {
 
-const WorkerProto::FeatureSet WorkerProto::allFeatures{};
+const WorkerProto::Feature WorkerProto::featureQueryPathInfos = "query-path-infos";
+
+const WorkerProto::FeatureSet WorkerProto::allFeatures{featureQueryPathInfos};
 
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
@@ -265,6 +267,16 @@ UnkeyedValidPathInfo WorkerProto::BasicClientConnection::queryPathInfo(
     return WorkerProto::Serialise<UnkeyedValidPathInfo>::read(store, *this);
 }
 
+std::map<StorePath, UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryPathInfos(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    assert(features.count(featureQueryPathInfos));
+    to << WorkerProto::Op::QueryPathInfos;
+    WorkerProto::write(store, *this, paths);
+    processStderr(daemonException);
+    return WorkerProto::Serialise<std::map<StorePath, UnkeyedValidPathInfo>>::read(store, *this);
+}
+
 StorePathSet WorkerProto::BasicClientConnection::queryValidPaths(
     const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
@@ -0,0 +1,114 @@
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/serialise.hh"
+
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+
+namespace nix {
+
+/* ----------------------------------------------------------------------------
+ * restorePath
+ * --------------------------------------------------------------------------*/
+
+class RestorePathTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path tmpDir;
+    std::unique_ptr<AutoDelete> delTmpDir;
+
+    void SetUp() override
+    {
+        tmpDir = createTempDir();
+        delTmpDir = std::make_unique<AutoDelete>(tmpDir, true);
+    }
+
+    /**
+     * Dump `src` to a file and restore it from that file to `dst`. The
+     * NAR is preceded by a string that is read first, so that part of
+     * the NAR is in the source's buffer when restoring starts.
+     */
+    void roundTrip(const std::filesystem::path & src, const std::filesystem::path & dst)
+    {
+        auto narPath = tmpDir / "test.nar";
+        {
+            AutoCloseFD fd = open(narPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+            ASSERT_TRUE(fd);
+            FdSink sink(fd.get());
+            sink << "prefix";
+            dumpPath(src.string(), sink);
+            sink.flush();
+        }
+
+        AutoCloseFD fd = open(narPath.c_str(), O_RDONLY | O_CLOEXEC);
+        ASSERT_TRUE(fd);
+        FdSource source(fd.get());
+        ASSERT_EQ(readString(source), "prefix");
+        restorePath(dst, source);
+    }
+};
+
+TEST_F(RestorePathTest, restoresLargeFilesFromFd)
+{
+    auto src = tmpDir / "src";
+    createDirs(src);
+
+    std::string big;
+    for (size_t i = 0; i < 1000000; ++i)
+        big.push_back('a' + i % 26);
+    writeFile(src / "big", big);
+    writeFile(src / "small", "hello");
+    writeFile(src / "empty", "");
+
+    auto dst = tmpDir / "dst";
+    roundTrip(src, dst);
+
+    ASSERT_EQ(readFile(dst / "big"), big);
+    ASSERT_EQ(readFile(dst / "small"), "hello");
+    ASSERT_EQ(readFile(dst / "empty"), "");
+}
+
+TEST_F(RestorePathTest, teeSourceSeesCopiedContents)
+{
+    auto src = tmpDir / "src";
+    std::string big;
+    for (size_t i = 0; i < 200000; ++i)
+        big.push_back('a' + i % 26);
+    writeFile(src, big);
+
+    auto narPath = tmpDir / "test.nar";
+    StringSink nar;
+    dumpPath(src.string(), nar);
+    writeFile(narPath, nar.s);
+
+    AutoCloseFD fd = open(narPath.c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_TRUE(fd);
+    FdSource source(fd.get());
+    StringSink seen;
+    TeeSource tee(source, seen);
+    restorePath(tmpDir / "dst", tee);
+
+    ASSERT_EQ(seen.s, nar.s);
+    ASSERT_EQ(readFile(tmpDir / "dst"), big);
+}
+
+TEST_F(RestorePathTest, truncatedNarFails)
+{
+    auto src = tmpDir / "src";
+    writeFile(src, std::string(100000, 'x'));
+
+    auto narPath = tmpDir / "test.nar";
+    {
+        StringSink sink;
+        dumpPath(src.string(), sink);
+        writeFile(narPath, sink.s.substr(0, 50000));
+    }
+
+    AutoCloseFD fd = open(narPath.c_str(), O_RDONLY | O_CLOEXEC);
+    ASSERT_TRUE(fd);
+    FdSource source(fd.get());
+    ASSERT_THROW(restorePath(tmpDir / "dst", source), EndOfFile);
+}
+
+}
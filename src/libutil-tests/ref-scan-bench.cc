@@ -0,0 +1,80 @@
+#include "nix/util/references.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace nix;
+
+/**
+ * Build a buffer resembling the contents of a large build output. In
+ * "binary" mode most bytes are random, so nix32 runs are short. In
+ * "text" mode most bytes are nix32 characters, which is the worst case
+ * for the scanner because nearly every position starts a candidate.
+ * In both cases, some of `hashes` are embedded at random offsets.
+ */
+static std::string makeOutput(size_t size, bool text, const std::vector<std::string> & hashes)
+{
+    std::mt19937_64 rng(42);
+    std::string s(size, 0);
+    for (auto & c : s) {
+        auto r = rng();
+        c = text && r % 8 != 0 ? nix32Chars[(r >> 8) % 32] : (char) (r >> 8);
+    }
+    for (size_t i = 0; i < hashes.size(); i += 2) {
+        auto pos = rng() % (size - hashes[i].size());
+        s.replace(pos, hashes[i].size(), hashes[i]);
+    }
+    return s;
+}
+
+static std::vector<std::string> makeHashes(size_t n)
+{
+    std::mt19937_64 rng(1);
+    std::vector<std::string> hashes;
+    for (size_t i = 0; i < n; ++i) {
+        std::string h;
+        for (size_t j = 0; j < RefScanSink::refLength; ++j)
+            h += nix32Chars[rng() % 32];
+        hashes.push_back(std::move(h));
+    }
+    return hashes;
+}
+
+/**
+ * Scan `state.range(0)` MiB of output for references to 100 store
+ * paths, feeding the sink in 64 KiB fragments like `dumpPath()` does.
+ * The output is produced by repeating a 64 MiB buffer so that
+ * multi-gigabyte runs don't need that much memory.
+ */
+static void scan(benchmark::State & state, bool text)
+{
+    auto hashes = makeHashes(100);
+    auto buf = makeOutput(64 << 20, text, hashes);
+    size_t total = (size_t) state.range(0) << 20;
+    constexpr size_t fragment = 64 << 10;
+
+    for (auto _ : state) {
+        /* Half of the hashes never occur, so the sink can't stop
+           early. */
+        RefScanSink sink(StringSet(hashes.begin(), hashes.end()));
+        for (size_t done = 0; done < total; done += fragment)
+            sink(std::string_view(buf).substr(done % buf.size(), fragment));
+        benchmark::DoNotOptimize(sink.getResult());
+    }
+
+    state.SetBytesProcessed(state.iterations() * total);
+}
+
+static void BM_RefScanBinary(benchmark::State & state)
+{
+    scan(state, false);
+}
+
+static void BM_RefScanText(benchmark::State & state)
+{
+    scan(state, true);
+}
+
+BENCHMARK(BM_RefScanBinary)->Arg(256)->Arg(4096)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RefScanText)->Arg(256)->Arg(4096)->Unit(benchmark::kMillisecond);
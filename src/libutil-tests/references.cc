@@ -1,6 +1,8 @@
 #include "nix/util/references.hh"
 #include <gtest/gtest.h>
 
+#include <random>
+
 namespace nix {
 
 using std::string;
@@ -42,5 +44,64 @@ INSTANTIATE_TEST_CASE_P(
     )
 );
 
+/**
+ * Check the scanner against a naive search on random inputs that mix
+ * arbitrary bytes with long runs of nix32 characters, fed to the sink
+ * in fragments of random size.
+ */
+TEST(RefScanSink, matchesNaiveSearch)
+{
+    std::mt19937 rng(1);
+
+    auto randomHash = [&]() {
+        std::string h;
+        for (size_t i = 0; i < RefScanSink::refLength; ++i)
+            h += nix32Chars[rng() % nix32Chars.size()];
+        return h;
+    };
+
+    for (int iter = 0; iter < 1000; ++iter) {
+        StringSet hashes;
+        for (int i = 0; i < 5; ++i)
+            hashes.insert(randomHash());
+
+        std::string s;
+        auto len = rng() % 400;
+        for (size_t i = 0; i < len; ++i)
+            s += rng() % 4 == 0 ? (char) rng() : nix32Chars[rng() % nix32Chars.size()];
+        for (auto & h : hashes)
+            if (rng() % 2)
+                s.insert(rng() % (s.size() + 1), h);
+
+        StringSet expected;
+        for (auto & h : hashes)
+            if (s.find(h) != s.npos)
+                expected.insert(h);
+
+        RefScanSink scanner(StringSet{hashes});
+        for (size_t pos = 0; pos < s.size(); ) {
+            auto n = rng() % 80;
+            scanner(((std::string_view) s).substr(pos, n));
+            pos += n;
+        }
+
+        ASSERT_EQ(scanner.getResult(), expected) << "iteration " << iter;
+    }
+}
+
+/**
+ * Hashes of the wrong length or with characters outside the nix32
+ * alphabet can never be found.
+ */
+TEST(RefScanSink, ignoresInvalidHashes)
+{
+    std::string hash = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    std::string shortHash = "dc04vv14dak1c1r48qa0m23vr9jy8sm";
+    std::string badHash = "dc04vv14dak1c1r48qa0m23vr9jy8seu";
+
+    RefScanSink scanner(StringSet{hash, shortHash, badHash});
+    scanner(hash + badHash);
+    ASSERT_EQ(scanner.getResult(), StringSet{hash});
 }
 
+}
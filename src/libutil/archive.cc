@@ -137,7 +137,9 @@ static void parseContents(CreateRegularFileSink & sink, Source & source)
 
     sink.preallocateContents(size);
 
-    uint64_t left = size;
+    /* Let the sink take the data directly from the source if they
+       are both files. */
+    uint64_t left = size - sink.copyContentsFrom(source, size);
     std::array<char, 65536> buf;
 
     while (left) {
@@ -99,6 +99,7 @@ struct RestoreRegularFile : CreateRegularFileSink {
     void operator () (std::string_view data) override;
     void isExecutable() override;
     void preallocateContents(uint64_t size) override;
+    uint64_t copyContentsFrom(Source & source, uint64_t len) override;
 };
 
 void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
@@ -108,7 +109,7 @@ void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(C
     RestoreRegularFile crf;
     crf.startFsync = startFsync;
     crf.fd =
-        open(p.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666)
+        open(p.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0666)
         ;
     if (!crf.fd) throw NativeSysError("creating file '%1%'", p);
     func(crf);
@@ -148,6 +149,11 @@ void RestoreRegularFile::operator () (std::string_view data)
     writeFull(fd.get(), data);
 }
 
+uint64_t RestoreRegularFile::copyContentsFrom(Source & source, uint64_t len)
+{
+    return source.copyIntoFile(fd.get(), len);
+}
+
 void RestoreSink::createSymlink(const CanonPath & path, const std::string & target)
 {
     auto p = append(dstPath, path);
@@ -20,6 +20,13 @@ struct CreateRegularFileSink : Sink
      * An optimization. By default, do nothing.
      */
     virtual void preallocateContents(uint64_t size) { };
+
+    /**
+     * An optimization: write up to ‘len’ bytes of ‘source’ to the file
+     * without copying them through userspace, and return how many
+     * bytes were written. By default, do nothing.
+     */
+    virtual uint64_t copyContentsFrom(Source & source, uint64_t len) { return 0; };
 };
 
 
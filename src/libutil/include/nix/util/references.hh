@@ -3,19 +3,57 @@
 
 #include "nix/util/hash.hh"
 
+#include <array>
+
 namespace nix {
 
+/**
+ * A sink that scans its input for occurrences of a given set of store
+ * path hash parts.
+ */
 class RefScanSink : public Sink
 {
-    StringSet hashes;
+public:
+
+    /**
+     * The length of a store path hash part in characters.
+     */
+    static constexpr size_t refLength = 32;
+
+private:
+
+    struct Slot
+    {
+        /**
+         * The hash part, or all zeroes if the slot is empty.
+         */
+        std::array<char, refLength> hash{};
+        bool found = false;
+    };
+
+    /**
+     * Open-addressing hash table of the hash parts we are looking
+     * for. Its size is a power of two and it's at most half full, so
+     * lookups never allocate and rarely probe more than one slot.
+     */
+    std::vector<Slot> table;
+
+    /**
+     * Number of hash parts in `table` that haven't been found yet.
+     */
+    size_t remaining = 0;
+
     StringSet seen;
 
     std::string tail;
 
+    void search(std::string_view s);
+
+    void check(const char * candidate, size_t offset);
+
 public:
 
-    RefScanSink(StringSet && hashes) : hashes(hashes)
-    { }
+    RefScanSink(StringSet && hashes);
 
     StringSet & getResult()
     { return seen; }
@@ -85,6 +85,15 @@ struct Source
 
     virtual bool good() { return true; }
 
+    /**
+     * Copy up to ‘len’ bytes into the regular file ‘fd’ at its
+     * current offset without passing them through a userspace
+     * buffer, and return the number of bytes copied.  Sources that
+     * can't do this return 0, so callers must be prepared to copy the
+     * remainder the normal way.
+     */
+    virtual uint64_t copyIntoFile(Descriptor fd, uint64_t len) { return 0; }
+
     void drainInto(Sink & sink);
 
     std::string drain();
@@ -173,10 +182,23 @@ struct FdSource : BufferedSource
      */
     bool hasData();
 
+    /**
+     * Uses `copy_file_range()` if ‘fd’ is a regular file, which lets
+     * the kernel share extents on file systems that support it.
+     */
+    uint64_t copyIntoFile(Descriptor fd, uint64_t len) override;
+
 protected:
     size_t readUnbuffered(char * data, size_t len) override;
 private:
     bool _good = true;
+
+    /**
+     * Whether `copyIntoFile()` should try `copy_file_range()`. Cleared
+     * on the first error that means it will never work for this
+     * source.
+     */
+    bool tryCopyFileRange = true;
 };
 
 
@@ -245,6 +267,14 @@ struct TeeSource : Source
         sink({data, n});
         return n;
     }
+
+    /**
+     * Copies with `orig.copyIntoFile()`, and then reads the copied
+     * bytes back from ‘fd’ to pass them to `sink`. That still
+     * saves writing them, and the kernel may share their extents
+     * with the source. ‘fd’ must be open for reading.
+     */
+    uint64_t copyIntoFile(Descriptor fd, uint64_t len) override;
 };
 
 /**
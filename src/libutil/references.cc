@@ -4,60 +4,268 @@
 
 #include <map>
 #include <cstdlib>
-#include <mutex>
+#include <cstring>
 #include <algorithm>
+#include <bit>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define NIX_REFSCAN_X86 1
+#  include <immintrin.h>
+#else
+#  define NIX_REFSCAN_X86 0
+#endif
 
 
 namespace nix {
 
 
-static size_t refLength = 32; /* characters */
-
-
-static void search(
-    std::string_view s,
-    StringSet & hashes,
-    StringSet & seen)
-{
-    static std::once_flag initialised;
-    static bool isBase32[256];
-    std::call_once(initialised, [](){
-        for (unsigned int i = 0; i < 256; ++i) isBase32[i] = false;
-        for (unsigned int i = 0; i < nix32Chars.size(); ++i)
-            isBase32[(unsigned char) nix32Chars[i]] = true;
-    });
-
-    for (size_t i = 0; i + refLength <= s.size(); ) {
-        int j;
-        bool match = true;
-        for (j = refLength - 1; j >= 0; --j)
-            if (!isBase32[(unsigned char) s[i + j]]) {
-                i += j + 1;
-                match = false;
-                break;
-            }
-        if (!match) continue;
-        std::string ref(s.substr(i, refLength));
-        if (hashes.erase(ref)) {
-            debug("found reference to '%1%' at offset '%2%'", ref, i);
-            seen.insert(ref);
+/* The scanner below finds every window of `refLength` consecutive
+   nix32 characters and looks it up in `RefScanSink::table`. The input
+   is classified 32 bytes at a time into a bitmask (bit `i` is set iff
+   byte `i` is a nix32 character), using SSE2 or AVX2 where available.
+   Two consecutive masks give a 64-bit window in which the starts of
+   all runs of at least 32 set bits are computed with a few shifts.
+   Blocks that can't contain the start of a run are skipped after
+   looking at a single byte. */
+
+static const std::array<bool, 256> & nix32Table()
+{
+    static const auto table = []() {
+        std::array<bool, 256> t{};
+        for (auto c : nix32Chars)
+            t[(unsigned char) c] = true;
+        return t;
+    }();
+    return table;
+}
+
+
+/**
+ * Classify the `n < 32` bytes at `p`. The missing bytes are treated
+ * as non-nix32 characters.
+ */
+static uint32_t classifyPartial(const unsigned char * p, size_t n)
+{
+    auto & isNix32 = nix32Table();
+    uint32_t mask = 0;
+    for (size_t i = 0; i < n; ++i)
+        mask |= (uint32_t) isNix32[p[i]] << i;
+    return mask;
+}
+
+
+struct ClassifyScalar
+{
+    static inline uint32_t classify(const unsigned char * p)
+    {
+        return classifyPartial(p, 32);
+    }
+};
+
+
+#if NIX_REFSCAN_X86
+
+/* nix32 characters are the digits and the lowercase letters other
+   than 'e', 'o', 't' and 'u'. Ranges are checked with the unsigned
+   `min(x - lo, hi - lo) == x - lo` idiom because SSE2 and AVX2 have no
+   unsigned byte comparisons. */
+
+struct ClassifySSE2
+{
+    static inline __m128i classify16(__m128i b)
+    {
+        auto d = _mm_sub_epi8(b, _mm_set1_epi8('0'));
+        auto isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+        auto l = _mm_sub_epi8(b, _mm_set1_epi8('a'));
+        auto isLower = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8('z' - 'a')), l);
+        auto excluded = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('e')), _mm_cmpeq_epi8(b, _mm_set1_epi8('o'))),
+            _mm_or_si128(_mm_cmpeq_epi8(b, _mm_set1_epi8('t')), _mm_cmpeq_epi8(b, _mm_set1_epi8('u'))));
+        return _mm_or_si128(isDigit, _mm_andnot_si128(excluded, isLower));
+    }
+
+    static inline uint32_t classify(const unsigned char * p)
+    {
+        auto lo = classify16(_mm_loadu_si128((const __m128i *) p));
+        auto hi = classify16(_mm_loadu_si128((const __m128i *) (p + 16)));
+        return (uint32_t) _mm_movemask_epi8(lo) | ((uint32_t) _mm_movemask_epi8(hi) << 16);
+    }
+};
+
+struct ClassifyAVX2
+{
+    [[gnu::target("avx2")]]
+    static inline uint32_t classify(const unsigned char * p)
+    {
+        auto b = _mm256_loadu_si256((const __m256i *) p);
+        auto d = _mm256_sub_epi8(b, _mm256_set1_epi8('0'));
+        auto isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+        auto l = _mm256_sub_epi8(b, _mm256_set1_epi8('a'));
+        auto isLower = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8('z' - 'a')), l);
+        auto excluded = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('e')), _mm256_cmpeq_epi8(b, _mm256_set1_epi8('o'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(b, _mm256_set1_epi8('t')), _mm256_cmpeq_epi8(b, _mm256_set1_epi8('u'))));
+        return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(isDigit, _mm256_andnot_si256(excluded, isLower)));
+    }
+};
+
+#endif
+
+
+/**
+ * Call `onCandidate(i)` for every `i` such that `s[i .. i + refLength)`
+ * consists of nix32 characters.
+ */
+template<typename Classifier, typename OnCandidate>
+[[gnu::always_inline]]
+static inline void scanRuns(std::string_view s, OnCandidate && onCandidate)
+{
+    static_assert(RefScanSink::refLength == 32);
+
+    auto p = (const unsigned char *) s.data();
+    auto n = s.size();
+
+    auto classifyAt = [&](size_t i) -> uint32_t {
+        if (i + 32 <= n) return Classifier::classify(p + i);
+        return i < n ? classifyPartial(p + i, n - i) : 0;
+    };
+
+    auto & isNix32 = nix32Table();
+
+    /* The mask of the current block, if the previous iteration
+       computed it. */
+    uint32_t next = 0;
+    bool haveNext = false;
+
+    for (size_t block = 0; block + 32 <= n; block += 32) {
+        /* Every run that starts in this block covers its last byte. In
+           binary data that byte usually isn't a nix32 character, so
+           this check lets us skip most blocks. */
+        if (!isNix32[p[block + 31]]) {
+            haveNext = false;
+            continue;
+        }
+
+        uint64_t lo = haveNext ? next : classifyAt(block);
+        uint64_t hi = classifyAt(block + 32);
+        uint64_t runs = lo | (hi << 32);
+        next = hi;
+        haveNext = true;
+
+        /* After this, bit `k` is set iff bits `k .. k + 31` were. Bits
+           beyond the end of the input are clear, so no run extends
+           past it. */
+        runs &= runs >> 1;
+        runs &= runs >> 2;
+        runs &= runs >> 4;
+        runs &= runs >> 8;
+        runs &= runs >> 16;
+
+        /* Runs starting at bit 32 are handled by the next block. */
+        runs &= 0xffffffff;
+
+        while (runs) {
+            onCandidate(block + std::countr_zero(runs));
+            runs &= runs - 1;
         }
-        ++i;
     }
 }
 
 
+#if NIX_REFSCAN_X86
+template<typename OnCandidate>
+[[gnu::target("avx2")]]
+static void scanRunsAVX2(std::string_view s, OnCandidate && onCandidate)
+{
+    scanRuns<ClassifyAVX2>(s, onCandidate);
+}
+
+static bool haveAVX2()
+{
+    static const bool res = []() {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }();
+    return res;
+}
+#endif
+
+
+static size_t slotFor(const char * hash, size_t mask)
+{
+    /* Hash parts are already uniformly distributed, so any 8 bytes of
+       one make a good hash. */
+    uint64_t h;
+    std::memcpy(&h, hash, sizeof(h));
+    return ((h * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+
+RefScanSink::RefScanSink(StringSet && hashes)
+{
+    size_t size = 2;
+    while (size < hashes.size() * 2) size *= 2;
+    table.resize(size);
+
+    for (auto & hash : hashes) {
+        /* Anything else can never match. */
+        if (hash.size() != refLength || hash.find_first_not_of(nix32Chars) != hash.npos)
+            continue;
+        auto i = slotFor(hash.data(), size - 1);
+        while (table[i].hash[0]) i = (i + 1) & (size - 1);
+        std::memcpy(table[i].hash.data(), hash.data(), refLength);
+        remaining++;
+    }
+}
+
+
+void RefScanSink::check(const char * candidate, size_t offset)
+{
+    auto mask = table.size() - 1;
+    for (auto i = slotFor(candidate, mask); table[i].hash[0]; i = (i + 1) & mask) {
+        auto & slot = table[i];
+        if (std::memcmp(slot.hash.data(), candidate, refLength) != 0) continue;
+        if (!slot.found) {
+            slot.found = true;
+            remaining--;
+            std::string ref(candidate, refLength);
+            debug("found reference to '%1%' at offset '%2%'", ref, offset);
+            seen.insert(std::move(ref));
+        }
+        return;
+    }
+}
+
+
+void RefScanSink::search(std::string_view s)
+{
+    auto onCandidate = [&](size_t i) { check(s.data() + i, i); };
+
+#if NIX_REFSCAN_X86
+    if (haveAVX2())
+        scanRunsAVX2(s, onCandidate);
+    else
+        scanRuns<ClassifySSE2>(s, onCandidate);
+#else
+    scanRuns<ClassifyScalar>(s, onCandidate);
+#endif
+}
+
+
 void RefScanSink::operator () (std::string_view data)
 {
+    /* Once everything has been found, there is nothing left to do. */
+    if (!remaining) return;
+
     /* It's possible that a reference spans the previous and current
        fragment, so search in the concatenation of the tail of the
        previous fragment and the start of the current fragment. */
     auto s = tail;
     auto tailLen = std::min(data.size(), refLength);
     s.append(data.data(), tailLen);
-    search(s, hashes, seen);
+    search(s);
 
-    search(data, hashes, seen);
+    search(data);
 
     auto rest = refLength - tailLen;
     if (rest < tail.size())
@@ -9,6 +9,12 @@
 #include <boost/coroutine2/coroutine.hpp>
 # include <poll.h>
 
+#include "util-config-private.hh"
+
+#if HAVE_COPY_FILE_RANGE
+# include <unistd.h>
+#endif
+
 
 namespace nix {
 
@@ -139,6 +145,82 @@ size_t FdSource::readUnbuffered(char * data, size_t len)
 }
 
 
+uint64_t FdSource::copyIntoFile(Descriptor dst, uint64_t len)
+{
+#if HAVE_COPY_FILE_RANGE
+    if (!tryCopyFileRange) return 0;
+
+    /* Whatever we've buffered precedes the current offset of ‘fd’. */
+    uint64_t copied = 0;
+    if (BufferedSource::hasData()) {
+        auto n = std::min<uint64_t>(len, bufPosIn - bufPosOut);
+        writeFull(dst, {buffer.get() + bufPosOut, n});
+        bufPosOut += n;
+        if (bufPosIn == bufPosOut) bufPosIn = bufPosOut = 0;
+        copied += n;
+        if (BufferedSource::hasData()) return copied;
+    }
+
+    while (copied < len) {
+        checkInterrupt();
+        auto n = copy_file_range(fd, nullptr, dst, nullptr, len - copied, 0);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            /* The source is not a regular file, the file systems
+               don't support it, etc. Fall back to reading. */
+            if (errno == EINVAL || errno == EXDEV || errno == ENOSYS
+                || errno == EOPNOTSUPP || errno == EBADF || errno == ESPIPE)
+            {
+                tryCopyFileRange = false;
+                break;
+            }
+            _good = false;
+            throw SysError("copying file contents");
+        }
+        /* End of file. Let the caller's read() report it. */
+        if (n == 0) break;
+        read += n;
+        copied += n;
+    }
+
+    return copied;
+#else
+    return 0;
+#endif
+}
+
+
+uint64_t TeeSource::copyIntoFile(Descriptor fd, uint64_t len)
+{
+#if HAVE_COPY_FILE_RANGE
+    auto n = orig.copyIntoFile(fd, len);
+    if (!n) return 0;
+
+    auto end = lseek(fd, 0, SEEK_CUR);
+    if (end == -1)
+        throw SysError("getting the offset of a file");
+
+    std::vector<char> buf(std::min<uint64_t>(n, 65536));
+    for (off_t offset = end - n; offset < end; ) {
+        checkInterrupt();
+        auto got = pread(fd, buf.data(), std::min<uint64_t>(buf.size(), end - offset), offset);
+        if (got == -1) {
+            if (errno == EINTR) continue;
+            throw SysError("reading back copied file contents");
+        }
+        if (got == 0)
+            throw EndOfFile("file was truncated while reading back copied contents");
+        sink({buf.data(), (size_t) got});
+        offset += got;
+    }
+
+    return n;
+#else
+    return 0;
+#endif
+}
+
+
 bool FdSource::good()
 {
     return _good;
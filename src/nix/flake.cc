@@ -12,6 +12,7 @@
 #include "nix/store/derivations.hh"
 #include "nix/store/outputs-spec.hh"
 #include "nix/expr/attr-path.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/fetchers/fetchers.hh"
 #include "nix/fetchers/registry.hh"
 #include "nix/expr/eval-cache.hh"
@@ -1175,8 +1176,12 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
         auto state = getEvalState();
         auto flake = std::make_shared<LockedFlake>(lockFlake());
         auto localSystem = std::string(settings.thisSystem.get());
+        auto parallel = evalSettings.evalCores != 1u;
+        if (parallel)
+            checkParallelEval(evalSettings);
 
         std::function<bool(
+            EvalState & state,
             eval_cache::AttrCursor & visitor,
             const std::vector<Symbol> &attrPath,
             const Symbol &attr)> hasContent;
@@ -1188,14 +1193,15 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
         // However, these attributes with empty values are not useful to the user
         // so we omit them.
         hasContent = [&](
+            EvalState & state,
             eval_cache::AttrCursor & visitor,
             const std::vector<Symbol> &attrPath,
             const Symbol &attr) -> bool
         {
             auto attrPath2(attrPath);
             attrPath2.push_back(attr);
-            auto attrPathS = state->symbols.resolve(attrPath2);
-            const auto & attrName = state->symbols[attr];
+            auto attrPathS = state.symbols.resolve(attrPath2);
+            const auto & attrName = state.symbols[attr];
 
             auto visitor2 = visitor.getAttr(attrName);
 
@@ -1207,7 +1213,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                         || attrPathS[0] == "packages")
                     && (attrPathS.size() == 1 || attrPathS.size() == 2)) {
                     for (const auto &subAttr : visitor2->getAttrs()) {
-                        if (hasContent(*visitor2, attrPath2, subAttr)) {
+                        if (hasContent(state, *visitor2, attrPath2, subAttr)) {
                             return true;
                         }
                     }
@@ -1221,7 +1227,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                         || attrPathS[0] == "overlays"
                         )) {
                     for (const auto &subAttr : visitor2->getAttrs()) {
-                        if (hasContent(*visitor2, attrPath2, subAttr)) {
+                        if (hasContent(state, *visitor2, attrPath2, subAttr)) {
                             return true;
                         }
                     }
@@ -1239,21 +1245,25 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
         };
 
         std::function<nlohmann::json(
+            EvalState & state,
             eval_cache::AttrCursor & visitor,
             const std::vector<Symbol> & attrPath,
             const std::string & headerPrefix,
-            const std::string & nextPrefix)> visit;
+            const std::string & nextPrefix,
+            const std::function<void(const std::string &)> & out)> visit;
 
         visit = [&](
+            EvalState & state,
             eval_cache::AttrCursor & visitor,
             const std::vector<Symbol> & attrPath,
             const std::string & headerPrefix,
-            const std::string & nextPrefix)
+            const std::string & nextPrefix,
+            const std::function<void(const std::string &)> & out)
             -> nlohmann::json
         {
             auto j = nlohmann::json::object();
 
-            auto attrPathS = state->symbols.resolve(attrPath);
+            auto attrPathS = state.symbols.resolve(attrPath);
 
             Activity act(*logger, lvlInfo, actUnknown,
                 fmt("evaluating '%s'", concatStringsSep(".", attrPathS)));
@@ -1262,48 +1272,118 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                 auto recurse = [&]()
                 {
                     if (!json)
-                        logger->cout("%s", headerPrefix);
+                        out(headerPrefix);
                     std::vector<Symbol> attrs;
                     for (const auto &attr : visitor.getAttrs()) {
-                        if (hasContent(visitor, attrPath, attr))
+                        if (hasContent(state, visitor, attrPath, attr))
                             attrs.push_back(attr);
                     }
 
-                    for (const auto & [i, attr] : enumerate(attrs)) {
-                        const auto & attrName = state->symbols[attr];
+                    auto childHeaderPrefix = [&](size_t i, std::string_view attrName) {
+                        bool last = i + 1 == attrs.size();
+                        return fmt(ANSI_GREEN "%s%s" ANSI_NORMAL ANSI_BOLD "%s" ANSI_NORMAL, nextPrefix, last ? treeLast : treeConn, attrName);
+                    };
+
+                    auto childNextPrefix = [&](size_t i) {
                         bool last = i + 1 == attrs.size();
+                        return nextPrefix + (last ? treeNull : treeLine);
+                    };
+
+                    /* The per-system package sets are the only big fan-out
+                       points, so that's where we evaluate the children in
+                       parallel. */
+                    if (parallel && attrPath.size() == 2) {
+                        /* Symbols are per-evaluator, so pass attribute
+                           names to the workers as strings. */
+                        std::vector<std::string> parentPath, attrNames;
+                        for (auto & attr : attrPath)
+                            parentPath.emplace_back(state.symbols[attr]);
+                        for (auto & attr : attrs)
+                            attrNames.emplace_back(state.symbols[attr]);
+
+                        struct Output
+                        {
+                            nlohmann::json json;
+                            std::vector<std::string> lines;
+                        };
+
+                        std::vector<Output> outputs(attrs.size());
+                        Sync<std::map<EvalState *, ref<eval_cache::AttrCursor>>> roots_;
+
+                        parallelEval(attrs.size(), evalSettings.evalCores, getEvalStateFactory(),
+                            [&](EvalState & state, size_t job)
+                            {
+                                auto root = [&]() {
+                                    if (auto cached = get(*roots_.lock(), &state))
+                                        return *cached;
+                                    auto root = openEvalCache(state, flake, false)->getRoot();
+                                    roots_.lock()->insert_or_assign(&state, root);
+                                    return root;
+                                }();
+
+                                std::vector<Symbol> attrPath2;
+                                for (auto & attr : parentPath)
+                                    attrPath2.push_back(state.symbols.create(attr));
+                                attrPath2.push_back(state.symbols.create(attrNames[job]));
+
+                                auto visitor2 = root->findAlongAttrPath(attrPath2);
+                                if (!visitor2)
+                                    throw Error("attribute '%s' disappeared", concatStringsSep(".", state.symbols.resolve(attrPath2)));
+
+                                auto & output = outputs[job];
+                                output.json = visit(state, **visitor2, attrPath2,
+                                    childHeaderPrefix(job, attrNames[job]),
+                                    childNextPrefix(job),
+                                    [&](const std::string & line) { output.lines.push_back(line); });
+                            },
+                            [&](EvalState & state)
+                            {
+                                roots_.lock()->erase(&state);
+                            });
+
+                        for (const auto & [i, output] : enumerate(outputs)) {
+                            for (auto & line : output.lines)
+                                out(line);
+                            if (json) j.emplace(attrNames[i], std::move(output.json));
+                        }
+                        return;
+                    }
+
+                    for (const auto & [i, attr] : enumerate(attrs)) {
+                        const auto & attrName = state.symbols[attr];
                         auto visitor2 = visitor.getAttr(attrName);
                         auto attrPath2(attrPath);
                         attrPath2.push_back(attr);
-                        auto j2 = visit(*visitor2, attrPath2,
-                            fmt(ANSI_GREEN "%s%s" ANSI_NORMAL ANSI_BOLD "%s" ANSI_NORMAL, nextPrefix, last ? treeLast : treeConn, attrName),
-                            nextPrefix + (last ? treeNull : treeLine));
+                        auto j2 = visit(state, *visitor2, attrPath2,
+                            childHeaderPrefix(i, attrName),
+                            childNextPrefix(i),
+                            out);
                         if (json) j.emplace(attrName, std::move(j2));
                     }
                 };
 
                 auto showDerivation = [&]()
                 {
-                    auto name = visitor.getAttr(state->sName)->getString();
+                    auto name = visitor.getAttr(state.sName)->getString();
 
                     if (json) {
                         std::optional<std::string> description;
-                        if (auto aMeta = visitor.maybeGetAttr(state->sMeta)) {
-                            if (auto aDescription = aMeta->maybeGetAttr(state->sDescription))
+                        if (auto aMeta = visitor.maybeGetAttr(state.sMeta)) {
+                            if (auto aDescription = aMeta->maybeGetAttr(state.sDescription))
                                 description = aDescription->getString();
                         }
                         j.emplace("type", "derivation");
                         j.emplace("name", name);
                         j.emplace("description", description ? *description : "");
                     } else {
-                        logger->cout("%s: %s '%s'",
+                        out(fmt("%s: %s '%s'",
                             headerPrefix,
                             attrPath.size() == 2 && attrPathS[0] == "devShell" ? "development environment" :
                             attrPath.size() >= 2 && attrPathS[0] == "devShells" ? "development environment" :
                             attrPath.size() == 3 && attrPathS[0] == "checks" ? "derivation" :
                             attrPath.size() >= 1 && attrPathS[0] == "hydraJobs" ? "derivation" :
                             "package",
-                            name);
+                            name));
                     }
                 };
 
@@ -1334,7 +1414,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                 {
                     if (!showAllSystems && std::string(attrPathS[1]) != localSystem) {
                         if (!json)
-                            logger->cout(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--all-systems' to show)", headerPrefix));
+                            out(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--all-systems' to show)", headerPrefix));
                         else {
                             logger->warn(fmt("%s omitted (use '--all-systems' to show)", concatStringsSep(".", attrPathS)));
                         }
@@ -1346,7 +1426,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                                 throw Error("expected a derivation");
                         } catch (IFDError & e) {
                             if (!json) {
-                                logger->cout(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
+                                out(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
                             } else {
                                 logger->warn(fmt("%s omitted due to use of import from derivation", concatStringsSep(".", attrPathS)));
                             }
@@ -1362,7 +1442,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                             recurse();
                     } catch (IFDError & e) {
                         if (!json) {
-                            logger->cout(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
+                            out(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
                         } else {
                             logger->warn(fmt("%s omitted due to use of import from derivation", concatStringsSep(".", attrPathS)));
                         }
@@ -1374,13 +1454,13 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                         recurse();
                     else if (!showLegacy){
                         if (!json)
-                            logger->cout(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--legacy' to show)", headerPrefix));
+                            out(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--legacy' to show)", headerPrefix));
                         else {
                             logger->warn(fmt("%s omitted (use '--legacy' to show)", concatStringsSep(".", attrPathS)));
                         }
                     } else if (!showAllSystems && std::string(attrPathS[1]) != localSystem) {
                         if (!json)
-                            logger->cout(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--all-systems' to show)", headerPrefix));
+                            out(fmt("%s " ANSI_WARNING "omitted" ANSI_NORMAL " (use '--all-systems' to show)", headerPrefix));
                         else {
                             logger->warn(fmt("%s omitted (use '--all-systems' to show)", concatStringsSep(".", attrPathS)));
                         }
@@ -1393,7 +1473,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                                 recurse();
                         } catch (IFDError & e) {
                             if (!json) {
-                                logger->cout(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
+                                out(fmt("%s " ANSI_WARNING "omitted due to use of import from derivation" ANSI_NORMAL, headerPrefix));
                             } else {
                                 logger->warn(fmt("%s omitted due to use of import from derivation", concatStringsSep(".", attrPathS)));
                             }
@@ -1407,18 +1487,18 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                 {
                     auto aType = visitor.maybeGetAttr("type");
                     std::optional<std::string> description;
-                    if (auto aMeta = visitor.maybeGetAttr(state->sMeta)) {
-                        if (auto aDescription = aMeta->maybeGetAttr(state->sDescription))
+                    if (auto aMeta = visitor.maybeGetAttr(state.sMeta)) {
+                        if (auto aDescription = aMeta->maybeGetAttr(state.sDescription))
                             description = aDescription->getString();
                     }
                     if (!aType || aType->getString() != "app")
-                        state->error<EvalError>("not an app definition").debugThrow();
+                        state.error<EvalError>("not an app definition").debugThrow();
                     if (json) {
                         j.emplace("type", "app");
                         if (description)
                             j.emplace("description", *description);
                     } else {
-                        logger->cout("%s: app: " ANSI_BOLD "%s" ANSI_NORMAL, headerPrefix, description ? *description : "no description");
+                        out(fmt("%s: app: " ANSI_BOLD "%s" ANSI_NORMAL, headerPrefix, description ? *description : "no description"));
                     }
                 }
 
@@ -1431,7 +1511,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                         j.emplace("type", "template");
                         j.emplace("description", description);
                     } else {
-                        logger->cout("%s: template: " ANSI_BOLD "%s" ANSI_NORMAL, headerPrefix, description);
+                        out(fmt("%s: template: " ANSI_BOLD "%s" ANSI_NORMAL, headerPrefix, description));
                     }
                 }
 
@@ -1446,7 +1526,7 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
                     if (json) {
                         j.emplace("type", type);
                     } else {
-                        logger->cout("%s: " ANSI_WARNING "%s" ANSI_NORMAL, headerPrefix, description);
+                        out(fmt("%s: " ANSI_WARNING "%s" ANSI_NORMAL, headerPrefix, description));
                     }
                 }
             } catch (EvalError & e) {
@@ -1459,7 +1539,8 @@ struct CmdFlakeShow : FlakeCommand, MixJSON
 
         auto cache = openEvalCache(*state, flake);
 
-        auto j = visit(*cache->getRoot(), {}, fmt(ANSI_BOLD "%s" ANSI_NORMAL, flake->flake.lockedRef), "");
+        auto j = visit(*state, *cache->getRoot(), {}, fmt(ANSI_BOLD "%s" ANSI_NORMAL, flake->flake.lockedRef), "",
+            [&](const std::string & line) { logger->cout(line); });
         if (json)
             printJSON(j);
     }
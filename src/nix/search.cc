@@ -1,4 +1,5 @@
 #include "nix/cmd/command-installable-value.hh"
+#include "nix/cmd/installable-flake.hh"
 #include "nix/store/globals.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-inline.hh"
@@ -9,7 +10,9 @@
 #include "nix/main/shared.hh"
 #include "nix/expr/eval-cache.hh"
 #include "nix/expr/attr-path.hh"
+#include "nix/expr/parallel-eval.hh"
 #include "nix/util/hilite.hh"
+#include "nix/util/sync.hh"
 #include "nix/util/strings-inline.hh"
 
 #include <regex>
@@ -92,11 +95,40 @@ struct CmdSearch : InstallableValueCommand, MixJSON
 
         uint64_t results = 0;
 
-        std::function<void(eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath, bool initialRecurse)> visit;
+        /* A matching package, ready to be printed. */
+        struct Result
+        {
+            std::string attrPath;
+            nlohmann::json json;
+            std::string text;
+        };
 
-        visit = [&](eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath, bool initialRecurse)
+        auto emit = [&](Result && result)
         {
-            auto attrPathS = state->symbols.resolve(attrPath);
+            results++;
+            if (json) {
+                (*jsonOut)[result.attrPath] = std::move(result.json);
+            } else {
+                if (results > 1) logger->cout("");
+                logger->cout("%s", result.text);
+            }
+        };
+
+        std::function<void(
+            EvalState & state,
+            eval_cache::AttrCursor & cursor,
+            const std::vector<Symbol> & attrPath,
+            bool initialRecurse,
+            const std::function<void(Result &&)> & emit)> visit;
+
+        visit = [&](
+            EvalState & state,
+            eval_cache::AttrCursor & cursor,
+            const std::vector<Symbol> & attrPath,
+            bool initialRecurse,
+            const std::function<void(Result &&)> & emit)
+        {
+            auto attrPathS = state.symbols.resolve(attrPath);
 
             Activity act(*logger, lvlInfo, actUnknown,
                 fmt("evaluating '%s'", concatStringsSep(".", attrPathS)));
@@ -104,18 +136,18 @@ struct CmdSearch : InstallableValueCommand, MixJSON
                 auto recurse = [&]()
                 {
                     for (const auto & attr : cursor.getAttrs()) {
-                        auto cursor2 = cursor.getAttr(state->symbols[attr]);
+                        auto cursor2 = cursor.getAttr(state.symbols[attr]);
                         auto attrPath2(attrPath);
                         attrPath2.push_back(attr);
-                        visit(*cursor2, attrPath2, false);
+                        visit(state, *cursor2, attrPath2, false, emit);
                     }
                 };
 
                 if (cursor.isDerivation()) {
-                    DrvName name(cursor.getAttr(state->sName)->getString());
+                    DrvName name(cursor.getAttr(state.sName)->getString());
 
-                    auto aMeta = cursor.maybeGetAttr(state->sMeta);
-                    auto aDescription = aMeta ? aMeta->maybeGetAttr(state->sDescription) : nullptr;
+                    auto aMeta = cursor.maybeGetAttr(state.sMeta);
+                    auto aDescription = aMeta ? aMeta->maybeGetAttr(state.sDescription) : nullptr;
                     auto description = aDescription ? aDescription->getString() : "";
                     std::replace(description.begin(), description.end(), '\n', ' ');
                     auto attrPath2 = concatStringsSep(".", attrPathS);
@@ -153,23 +185,23 @@ struct CmdSearch : InstallableValueCommand, MixJSON
 
                     if (found)
                     {
-                        results++;
+                        Result result{.attrPath = attrPath2};
                         if (json) {
-                            (*jsonOut)[attrPath2] = {
+                            result.json = {
                                 {"pname", name.name},
                                 {"version", name.version},
                                 {"description", description},
                             };
                         } else {
-                            if (results > 1) logger->cout("");
-                            logger->cout(
+                            result.text = fmt(
                                 "* %s%s",
                                 wrap("\e[0;1m", hiliteMatches(attrPath2, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
                                 name.version != "" ? " (" + name.version + ")" : "");
                             if (description != "")
-                                logger->cout(
-                                    "  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
+                                result.text += fmt(
+                                    "\n  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
                         }
+                        emit(std::move(result));
                     }
                 }
 
@@ -183,7 +215,7 @@ struct CmdSearch : InstallableValueCommand, MixJSON
                     recurse();
 
                 else if (attrPathS[0] == "legacyPackages" && attrPath.size() > 2) {
-                    auto attr = cursor.maybeGetAttr(state->sRecurseForDerivations);
+                    auto attr = cursor.maybeGetAttr(state.sRecurseForDerivations);
                     if (attr && attr->getBool())
                         recurse();
                 }
@@ -194,8 +226,66 @@ struct CmdSearch : InstallableValueCommand, MixJSON
             }
         };
 
-        for (auto & cursor : installable->getCursors(*state))
-            visit(*cursor, cursor->getAttrPath(), true);
+        /* Evaluate the attributes of a package set on several threads.
+           Each worker evaluates the flake again in its own evaluator,
+           so this is only possible for flakes. */
+        auto flake = installable.dynamic_pointer_cast<InstallableFlake>();
+        auto parallel = flake && evalSettings.evalCores != 1u;
+        if (parallel)
+            checkParallelEval(evalSettings);
+
+        auto visitParallel = [&](eval_cache::AttrCursor & cursor)
+        {
+            /* Symbols are per-evaluator, so pass attribute names to the
+               workers as strings. */
+            std::vector<std::string> attrPathS, attrs;
+            for (auto & attr : cursor.getAttrPath())
+                attrPathS.emplace_back(state->symbols[attr]);
+            for (auto & attr : cursor.getAttrs())
+                attrs.emplace_back(state->symbols[attr]);
+
+            Sync<std::map<EvalState *, ref<eval_cache::AttrCursor>>> roots_;
+            std::vector<std::vector<Result>> jobResults(attrs.size());
+
+            parallelEval(attrs.size(), evalSettings.evalCores, getEvalStateFactory(),
+                [&](EvalState & state, size_t job)
+                {
+                    auto root = [&]() {
+                        if (auto cached = get(*roots_.lock(), &state))
+                            return *cached;
+                        auto root = openEvalCache(state, flake->getLockedFlake(), false)->getRoot();
+                        roots_.lock()->insert_or_assign(&state, root);
+                        return root;
+                    }();
+
+                    std::vector<Symbol> attrPath;
+                    for (auto & attr : attrPathS)
+                        attrPath.push_back(state.symbols.create(attr));
+                    attrPath.push_back(state.symbols.create(attrs[job]));
+
+                    auto cursor2 = root->findAlongAttrPath(attrPath);
+                    if (!cursor2)
+                        throw Error("attribute '%s' disappeared", concatStringsSep(".", state.symbols.resolve(attrPath)));
+
+                    visit(state, **cursor2, attrPath, false,
+                        [&](Result && result) { jobResults[job].push_back(std::move(result)); });
+                },
+                [&](EvalState & state)
+                {
+                    roots_.lock()->erase(&state);
+                });
+
+            for (auto & results2 : jobResults)
+                for (auto & result : results2)
+                    emit(std::move(result));
+        };
+
+        for (auto & cursor : installable->getCursors(*state)) {
+            if (parallel && !cursor->isDerivation())
+                visitParallel(*cursor);
+            else
+                visit(*state, *cursor, cursor->getAttrPath(), true, emit);
+        }
 
         if (json)
             printJSON(*jsonOut);
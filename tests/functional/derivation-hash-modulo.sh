@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+needLocalStore "inspects the Nix database"
+
+TODO_NixOS
+
+clearStore
+
+drvPath=$(nix-instantiate dependencies.nix)
+
+if [ -z "$(type -p sqlite3)" ]; then
+    skipTest "sqlite3 is not available"
+fi
+
+countHashes() {
+    sqlite3 "$NIX_STATE_DIR/db/db.sqlite" \
+        "select count(*) from DerivationHashesModulo join ValidPaths on drv = ValidPaths.id where path = '$1'"
+}
+
+# Instantiating a derivation records its hash modulo.
+[[ $(countHashes "$drvPath") -ge 1 ]]
+
+# The recorded hashes are used when building, and must give the same
+# output paths.
+outPath=$(nix-store -r "$drvPath")
+[[ $outPath = $(nix-store -q --outputs "$drvPath") ]]
+
+# Deleting the derivation deletes its hashes.
+rm -f "$TEST_ROOT"/result*
+nix-store --delete "$drvPath"
+[[ $(sqlite3 "$NIX_STATE_DIR/db/db.sqlite" "select count(*) from DerivationHashesModulo where drv not in (select id from ValidPaths)") -eq 0 ]]
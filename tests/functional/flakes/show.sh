@@ -40,6 +40,18 @@ assert show_output.legacyPackages.${builtins.currentSystem}.hello.name == "simpl
 true
 '
 
+# Evaluating on several threads gives the same output
+nix flake show --legacy --all-systems > show-output.txt
+nix flake show --legacy --all-systems --option eval-cores 4 | diff - show-output.txt
+nix flake show --json --legacy --all-systems > show-output.json
+nix flake show --json --legacy --all-systems --option eval-cores 4 | diff - show-output.json
+nix search . ^ > search-output.txt
+nix search . ^ --option eval-cores 4 | diff - search-output.txt
+
+# Profiling needs a single evaluator
+expectStderr 1 nix flake show --legacy --all-systems --option eval-cores 4 --option eval-profiler heap \
+    --option eval-profile-file "$TEST_ROOT/profile" | grepQuiet "cannot be used with 'eval-cores'"
+
 # Test that attributes are only reported when they have actual content
 cat >flake.nix <<EOF
 {
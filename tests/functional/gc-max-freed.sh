@@ -0,0 +1,39 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+needLocalStore "the garbage collector settings are read by the daemon"
+
+TODO_NixOS
+
+# Stopping early because of `--max-freed` must not leave dead paths in
+# the store that are no longer registered as valid, whether they are
+# deleted in place or via the trash directory.
+for threads in 0 4; do
+    clearStore
+
+    paths=()
+    for i in $(seq 1 100); do
+        echo "garbage $i" > "$TEST_ROOT/garbage-$i"
+        paths+=("$(nix-store --add "$TEST_ROOT/garbage-$i")")
+    done
+
+    nix-store --gc --max-freed 1 --option gc-delete-threads "$threads"
+
+    deleted=0
+    for path in "${paths[@]}"; do
+        if [[ -e "$path" ]]; then
+            nix-store --check-validity "$path"
+        else
+            deleted=$((deleted + 1))
+        fi
+    done
+    (( deleted > 0 ))
+    (( deleted < 100 ))
+
+    # The remaining paths can still be collected.
+    nix-store --gc --option gc-delete-threads "$threads"
+    for path in "${paths[@]}"; do
+        [[ ! -e "$path" ]]
+    done
+done
@@ -0,0 +1,17 @@
+# Tests that slices of a list, which share its elements, are not printed
+# as `«repeated»`.
+let
+  xs = [
+    1
+    2
+    3
+    4
+    5
+  ];
+in
+[
+  xs
+  (builtins.filter (x: x < 5) xs)
+  (builtins.tail xs)
+  xs
+]
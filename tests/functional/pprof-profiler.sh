@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+profile="$TEST_ROOT/nix.pprof"
+
+# Spend enough CPU time in a named lambda that it is sampled.
+nix-instantiate \
+    --eval-profiler pprof \
+    --eval-profiler-frequency 1000 \
+    --eval-profile-file "$profile" \
+    --eval --expr 'let fib = n: if n < 2 then n else fib (n - 1) + fib (n - 2); in fib 22'
+
+# The profile is a gzipped protobuf whose string table has the sample
+# types, the function names and the files they are defined in.
+gzip -dc "$profile" > "$TEST_ROOT/nix.pprof.raw"
+grepQuiet -a nanoseconds "$TEST_ROOT/nix.pprof.raw"
+grepQuiet -a fib "$TEST_ROOT/nix.pprof.raw"
+grepQuiet -a «string» "$TEST_ROOT/nix.pprof.raw"
+
+# A frequency of 0 only makes sense for the tracing profiler.
+expectStderr 1 nix-instantiate --eval-profiler pprof --eval-profiler-frequency 0 --eval --expr 1 \
+    | grepQuiet "must not be 0"
+
+# The heap profiler attributes the memory of the attribute sets built by
+# `mkSet` to it.
+nix-instantiate \
+    --eval-profiler heap \
+    --eval-profile-file "$profile" \
+    --eval --strict --expr 'let mkSet = n: { inherit n; a = n; b = n; }; in map mkSet (builtins.genList (x: x) 1000)' \
+    > /dev/null
+
+gzip -dc "$profile" > "$TEST_ROOT/nix.pprof.raw"
+grepQuiet -a alloc_space "$TEST_ROOT/nix.pprof.raw"
+grepQuiet -a mkSet "$TEST_ROOT/nix.pprof.raw"